@@ -0,0 +1,871 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Convert.h"
+#include "Encoder.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <Windows.h>
+#else
+#    include <sys/resource.h>
+#endif
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+#include <libavutil/frame.h>
+#include <libavutil/pixfmt.h>
+}
+
+using namespace std;
+
+namespace Ak {
+static bool s_verbose = false;
+
+void logHandler(const std::string& message)
+{
+    if (s_verbose) {
+        fputs(message.c_str(), stderr);
+    }
+}
+
+/** A stream type that can be recorded along with the resolutions supported by the camera. */
+struct StreamType
+{
+    string m_name;
+    int32_t m_format;
+    float m_scale;
+    vector<array<uint32_t, 3>> m_modes; /**< Width, height and maximum FPS of each camera mode. */
+};
+
+/** Settings for a single benchmark run. */
+struct RunSettings
+{
+    const StreamType* m_stream;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_fps;
+    Rendition m_rendition;
+    uint32_t m_numThreads;
+};
+
+/** Measured results of a single stream. */
+struct RunResult
+{
+    bool m_success = false;
+    uint32_t m_frames = 0;
+    uint32_t m_dropped = 0;
+    uint32_t m_peakQueue = 0;
+    double m_fps = 0.0;
+    double m_latency50 = 0.0;
+    double m_latency95 = 0.0;
+    double m_latency99 = 0.0;
+    double m_latencyMax = 0.0;
+    double m_cpuTime = 0.0;
+    double m_cpuUsage = 0.0;
+    double m_bitrate = 0.0;
+};
+
+// Depth and IR range used to scale GRAY16 values (matches NFOV unbinned depth and typical IR)
+static const array<StreamType, 3> s_streams = {
+    StreamType{"depth", AV_PIX_FMT_GRAY16LE, 65536.0f / (3860.0f - 500.0f),
+        {{320, 288, 30}, {640, 576, 30}, {512, 512, 30}, {1024, 1024, 15}}},
+    StreamType{"colour", AV_PIX_FMT_BGRA, 1.0f,
+        {{1280, 720, 30}, {1920, 1080, 30}, {2560, 1440, 30}, {2048, 1536, 30}, {3840, 2160, 30},
+            {4096, 3072, 15}}},
+    StreamType{"ir", AV_PIX_FMT_GRAY16LE, 65536.0f / 1000.0f,
+        {{320, 288, 30}, {640, 576, 30}, {512, 512, 30}, {1024, 1024, 15}}}};
+
+/** Number of distinct synthetic frames that are cycled through. */
+static constexpr uint32_t s_numSynthetic = 8;
+
+/**
+ * Gets the CPU time used by all threads of the process.
+ * @returns The time in seconds.
+ */
+static double getCPUTime() noexcept
+{
+#if defined(_WIN32)
+    FILETIME create, exit, kernel, user;
+    GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+    const auto toSeconds = [](const FILETIME& time) {
+        return static_cast<double>((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7;
+    };
+    return toSeconds(kernel) + toSeconds(user);
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+/**
+ * Generates synthetic frames that change over time so that the encoder has realistic work to do.
+ * @param settings The run settings.
+ * @returns The frame data of each frame.
+ */
+static vector<vector<uint8_t>> makeFrames(const RunSettings& settings) noexcept
+{
+    const bool gray = settings.m_stream->m_format == AV_PIX_FMT_GRAY16LE;
+    const uint32_t pixSize = gray ? 2 : 4;
+    vector<vector<uint8_t>> frames(s_numSynthetic);
+    uint32_t seed = 1;
+    for (uint32_t f = 0; f < s_numSynthetic; ++f) {
+        auto& frame = frames[f];
+        frame.resize(static_cast<size_t>(settings.m_width) * settings.m_height * pixSize);
+        for (uint32_t y = 0; y < settings.m_height; ++y) {
+            for (uint32_t x = 0; x < settings.m_width; ++x) {
+                // A moving gradient with a small amount of noise
+                seed = seed * 1664525U + 1013904223U;
+                const uint32_t noise = seed >> 28;
+                const uint32_t value = (x + y + f * 8) & 255U;
+                uint8_t* pixel = &frame[(static_cast<size_t>(y) * settings.m_width + x) * pixSize];
+                if (gray) {
+                    const uint16_t gray16 = static_cast<uint16_t>(500 + value * 12 + noise);
+                    memcpy(pixel, &gray16, sizeof(gray16));
+                } else {
+                    pixel[0] = static_cast<uint8_t>(value + noise);
+                    pixel[1] = static_cast<uint8_t>((x >> 2) + f * 4 + noise);
+                    pixel[2] = static_cast<uint8_t>((y >> 2) + noise);
+                    pixel[3] = 255;
+                }
+            }
+        }
+    }
+    return frames;
+}
+
+/**
+ * Calculates a percentile from sorted values.
+ * @param values The sorted values.
+ * @param percentile The percentile (0-1).
+ * @returns The value.
+ */
+static double getPercentile(const vector<double>& values, const double percentile) noexcept
+{
+    if (values.empty()) {
+        return 0.0;
+    }
+    const auto index = static_cast<size_t>(percentile * static_cast<double>(values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+/**
+ * Encodes a set of streams at the same time and measures their performance.
+ * @param settings  The settings of each stream.
+ * @param numFrames Number of frames to encode per stream.
+ * @param realtime  True to add frames at the camera frame rate (dropping frames if the encoder is full), false to
+ *  add frames as fast as the encoder accepts them.
+ * @param directory Directory used for output files.
+ * @returns The result for each stream.
+ */
+static vector<RunResult> runBenchmark(const vector<RunSettings>& settings, const uint32_t numFrames,
+    const bool realtime, const filesystem::path& directory) noexcept
+{
+    using Clock = chrono::steady_clock;
+    const size_t numStreams = settings.size();
+    vector<RunResult> results(numStreams);
+    atomic_bool failed = false;
+    vector<unique_ptr<Encoder>> encoders;
+    vector<vector<vector<uint8_t>>> frames;
+    vector<string> files;
+    for (size_t i = 0; i < numStreams; ++i) {
+        const auto& set = settings[i];
+        auto encoder = make_unique<Encoder>();
+        if (!encoder->prepare(set.m_width, set.m_height, set.m_fps, set.m_stream->m_format, set.m_stream->m_scale,
+                set.m_numThreads, false, false, set.m_rendition, [&failed](const string& message) {
+                    fprintf(stderr, "Error: %s\n", message.c_str());
+                    failed = true;
+                })) {
+            return results;
+        }
+        files.emplace_back((directory / (set.m_stream->m_name + encoder->getFileExtension())).string());
+        frames.emplace_back(makeFrames(set));
+        encoders.emplace_back(move(encoder));
+    }
+
+    // Submission time of each frame is stored so that the monitor can determine when it has been encoded
+    vector<vector<Clock::time_point>> submitted(numStreams, vector<Clock::time_point>(numFrames));
+    vector<vector<double>> latencies(numStreams);
+    vector<atomic_uint32_t> added(numStreams);
+    atomic_bool running = true;
+    for (size_t i = 0; i < numStreams; ++i) {
+        latencies[i].reserve(numFrames);
+        if (!encoders[i]->start(files[i])) {
+            return results;
+        }
+    }
+
+    // Poll each encoder queue to find the time at which each frame leaves it
+    thread monitor([&] {
+        vector<uint32_t> completed(numStreams, 0);
+        while (true) {
+            const bool stop = !running;
+            const auto now = Clock::now();
+            for (size_t i = 0; i < numStreams; ++i) {
+                const uint32_t count = added[i].load(memory_order_acquire);
+                const uint32_t depth = encoders[i]->getQueueDepth();
+                results[i].m_peakQueue = std::max(results[i].m_peakQueue, depth);
+                for (; completed[i] + depth < count; ++completed[i]) {
+                    latencies[i].push_back(chrono::duration<double, milli>(now - submitted[i][completed[i]]).count());
+                }
+            }
+            if (stop) {
+                break;
+            }
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    });
+
+    // All streams are added from a single thread in the same way as the camera capture callback
+    const uint32_t fps = std::min_element(settings.cbegin(), settings.cend(), [](const auto& a, const auto& b) {
+        return a.m_fps < b.m_fps;
+    })->m_fps;
+    const auto period = chrono::duration_cast<Clock::duration>(chrono::duration<double>(1.0 / fps));
+    const double cpuStart = getCPUTime();
+    const auto start = Clock::now();
+    for (uint32_t f = 0; f < numFrames && !failed; ++f) {
+        if (realtime) {
+            this_thread::sleep_until(start + period * f);
+        }
+        const uint64_t timestamp = static_cast<uint64_t>(f) * 1000000 / fps;
+        for (size_t i = 0; i < numStreams; ++i) {
+            const auto& set = settings[i];
+            if (realtime) {
+                if (encoders[i]->getQueueDepth() >= Encoder::getQueueSize()) {
+                    ++results[i].m_dropped;
+                    continue;
+                }
+            } else {
+                while (encoders[i]->getQueueDepth() >= Encoder::getQueueSize()) {
+                    this_thread::sleep_for(chrono::microseconds(100));
+                }
+            }
+            const uint32_t index = added[i].load(memory_order_relaxed);
+            submitted[i][index] = Clock::now();
+            auto& data = frames[i][f % s_numSynthetic];
+            const uint32_t stride = set.m_width * (set.m_stream->m_format == AV_PIX_FMT_GRAY16LE ? 2 : 4);
+            if (!encoders[i]->addFrame(data.data(), set.m_width, set.m_height, stride, timestamp)) {
+                failed = true;
+                break;
+            }
+            added[i].store(index + 1, memory_order_release);
+        }
+    }
+
+    // Wait for all queued frames to be encoded
+    for (size_t i = 0; i < numStreams; ++i) {
+        while (encoders[i]->getQueueDepth() > 0 && !failed) {
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    }
+    running = false;
+    monitor.join();
+    // Flush frames buffered inside the codec and finalise the file
+    for (auto& i : encoders) {
+        i->shutdown();
+    }
+    const double elapsed = chrono::duration<double>(Clock::now() - start).count();
+    const double cpuTime = getCPUTime() - cpuStart;
+
+    for (size_t i = 0; i < numStreams; ++i) {
+        auto& result = results[i];
+        auto& latency = latencies[i];
+        sort(latency.begin(), latency.end());
+        result.m_success = !failed;
+        result.m_frames = added[i];
+        result.m_fps = static_cast<double>(result.m_frames) / elapsed;
+        result.m_latency50 = getPercentile(latency, 0.5);
+        result.m_latency95 = getPercentile(latency, 0.95);
+        result.m_latency99 = getPercentile(latency, 0.99);
+        result.m_latencyMax = latency.empty() ? 0.0 : latency.back();
+        // CPU time is shared by all streams that were run together
+        result.m_cpuTime = cpuTime * 1000.0 / static_cast<double>(std::max(result.m_frames, 1U));
+        result.m_cpuUsage = cpuTime / elapsed;
+        error_code ec;
+        const auto size = filesystem::file_size(files[i], ec);
+        if (!ec && result.m_frames > 0) {
+            const double duration = static_cast<double>(result.m_frames) / settings[i].m_fps;
+            result.m_bitrate = static_cast<double>(size) * 8.0 / duration / 1000000.0;
+        }
+        filesystem::remove(files[i], ec);
+    }
+    return results;
+}
+
+/**
+ * Creates the filter graph that was used to convert depth/IR to YUV420 before the fused conversion.
+ * @param       width  The image width.
+ * @param       height The image height.
+ * @param       scale  The scale that needs to be applied to input pixels.
+ * @param [out] source The input buffer of the graph.
+ * @param [out] sink   The output buffer of the graph.
+ * @returns The graph, nullptr if it could not be created.
+ */
+static AVFilterGraph* makeGray16Graph(const uint32_t width, const uint32_t height, const float scale,
+    AVFilterContext*& source, AVFilterContext*& sink) noexcept
+{
+    AVFilterGraph* graph = avfilter_graph_alloc();
+    if (graph == nullptr) {
+        return nullptr;
+    }
+    graph->nb_threads = 1;
+    const string bufferArgs = "video_size="s + to_string(width) + 'x' + to_string(height) +
+        ":pix_fmt=gray16le:time_base=1/1000000:pixel_aspect=1/1";
+    const string levelArgs = "rimax="s + to_string(1.0f / scale) + ":gimax=" + to_string(1.0f / scale) +
+        ":bimax=" + to_string(1.0f / scale);
+    const array<pair<const char*, string>, 5> filters = {make_pair("buffer", bufferArgs), make_pair("hflip", ""s),
+        make_pair("colorlevels", levelArgs), make_pair("format", "pix_fmts=yuv420p"s), make_pair("buffersink", ""s)};
+    AVFilterContext* previous = nullptr;
+    for (const auto& i : filters) {
+        AVFilterContext* context = nullptr;
+        if (avfilter_graph_create_filter(&context, avfilter_get_by_name(i.first), i.first,
+                i.second.empty() ? nullptr : i.second.c_str(), nullptr, graph) < 0 ||
+            (previous != nullptr && avfilter_link(previous, 0, context, 0) < 0)) {
+            avfilter_graph_free(&graph);
+            return nullptr;
+        }
+        if (previous == nullptr) {
+            source = context;
+        }
+        previous = context;
+    }
+    sink = previous;
+    if (avfilter_graph_config(graph, nullptr) < 0) {
+        avfilter_graph_free(&graph);
+        return nullptr;
+    }
+    return graph;
+}
+
+/**
+ * Measures the time taken to convert a depth frame to YUV420 using the filter graph, the scalar fused conversion and
+ * the AVX2 fused conversion. All conversions use a single thread.
+ * @param width     The image width.
+ * @param height    The image height.
+ * @param numFrames Number of frames to convert with each method.
+ * @returns The time per frame in ms of each method (negative if the method is not available).
+ */
+static array<double, 3> runConvertBenchmark(
+    const uint32_t width, const uint32_t height, const uint32_t numFrames) noexcept
+{
+    using Clock = chrono::steady_clock;
+    const StreamType& stream = s_streams[0];
+    const auto frames = makeFrames({&stream, width, height, 30, Rendition(), 1});
+    array<double, 3> times = {-1.0, -1.0, -1.0};
+
+    // Reference counted input frames so that the graph doesn't need to copy them
+    array<AVFrame*, s_numSynthetic> inFrames = {};
+    for (uint32_t i = 0; i < s_numSynthetic; ++i) {
+        inFrames[i] = av_frame_alloc();
+        inFrames[i]->format = AV_PIX_FMT_GRAY16LE;
+        inFrames[i]->width = static_cast<int>(width);
+        inFrames[i]->height = static_cast<int>(height);
+        if (av_frame_get_buffer(inFrames[i], 32) >= 0) {
+            for (uint32_t y = 0; y < height; ++y) {
+                memcpy(inFrames[i]->data[0] + static_cast<ptrdiff_t>(y) * inFrames[i]->linesize[0],
+                    &frames[i][static_cast<size_t>(y) * width * 2], static_cast<size_t>(width) * 2);
+            }
+        }
+    }
+    AVFilterContext* source = nullptr;
+    AVFilterContext* sink = nullptr;
+    AVFilterGraph* graph = makeGray16Graph(width, height, stream.m_scale, source, sink);
+    AVFrame* outFrame = av_frame_alloc();
+    if (graph != nullptr && outFrame != nullptr) {
+        const auto start = Clock::now();
+        uint32_t converted = 0;
+        for (uint32_t f = 0; f < numFrames; ++f) {
+            AVFrame* frame = inFrames[f % s_numSynthetic];
+            frame->pts = f;
+            if (av_buffersrc_add_frame_flags(source, frame, AV_BUFFERSRC_FLAG_KEEP_REF) < 0) {
+                break;
+            }
+            while (av_buffersink_get_frame(sink, outFrame) >= 0) {
+                av_frame_unref(outFrame);
+                ++converted;
+            }
+        }
+        if (converted == numFrames) {
+            times[0] = chrono::duration<double, milli>(Clock::now() - start).count() / numFrames;
+        }
+    }
+    av_frame_free(&outFrame);
+    avfilter_graph_free(&graph);
+
+    // The fused conversion writes into a single buffer with the same layout as Filter::convertFrame
+    const int32_t lumaStride = static_cast<int32_t>((width + 31) & ~31U);
+    const int32_t chromaStride = static_cast<int32_t>(((width + 1) / 2 + 31) & ~31U);
+    vector<uint8_t> output(static_cast<size_t>(lumaStride) * height + static_cast<size_t>(chromaStride) * (height + 1));
+    uint8_t* const data[3] = {output.data(), output.data() + static_cast<ptrdiff_t>(lumaStride) * height,
+        output.data() + static_cast<ptrdiff_t>(lumaStride) * height +
+            static_cast<ptrdiff_t>(chromaStride) * ((height + 1) / 2)};
+    const int32_t linesize[3] = {lumaStride, chromaStride, chromaStride};
+    for (uint32_t method = 1; method < 3; ++method) {
+        const bool useAVX2 = method == 2;
+        if (useAVX2 && !hasConvertAVX2()) {
+            continue;
+        }
+        const auto start = Clock::now();
+        for (uint32_t f = 0; f < numFrames; ++f) {
+            const AVFrame* frame = inFrames[f % s_numSynthetic];
+            convertGray16ToYUV420(
+                frame->data[0], frame->linesize[0], data, linesize, width, height, stream.m_scale, useAVX2);
+        }
+        times[method] = chrono::duration<double, milli>(Clock::now() - start).count() / numFrames;
+    }
+
+    for (auto& i : inFrames) {
+        av_frame_free(&i);
+    }
+    return times;
+}
+
+/**
+ * Checks which half of an image is brighter.
+ * @param [in] luma   The luma plane.
+ * @param      stride The luma plane stride (in bytes).
+ * @param      width  The image width.
+ * @param      height The image height.
+ * @returns True if the left half is brighter, false if the right half is.
+ */
+static bool isLeftBrighter(
+    const uint8_t* luma, const int32_t stride, const uint32_t width, const uint32_t height) noexcept
+{
+    uint64_t left = 0;
+    uint64_t right = 0;
+    for (uint32_t y = 0; y < height; ++y) {
+        const uint8_t* row = luma + static_cast<ptrdiff_t>(y) * stride;
+        for (uint32_t x = 0; x < width / 2; ++x) {
+            left += row[x];
+            right += row[width - 1 - x];
+        }
+    }
+    return left > right;
+}
+
+/**
+ * Decodes the first frame of a recording and checks which half of it is brighter.
+ * @param       file         The recorded file.
+ * @param [out] leftBrighter True if the left half is brighter, false if the right half is.
+ * @returns True if a frame was decoded, false if not.
+ */
+static bool decodeBrightSide(const string& file, bool& leftBrighter) noexcept
+{
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, file.c_str(), nullptr, nullptr) < 0) {
+        return false;
+    }
+    const int32_t stream = avformat_find_stream_info(formatContext, nullptr) >= 0 ?
+        av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0) :
+        AVERROR_STREAM_NOT_FOUND;
+    AVCodecContext* codecContext = nullptr;
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    if (stream >= 0 && packet != nullptr && frame != nullptr) {
+        const AVCodecParameters* parameters = formatContext->streams[stream]->codecpar;
+        const AVCodec* codec = avcodec_find_decoder(parameters->codec_id);
+        codecContext = codec != nullptr ? avcodec_alloc_context3(codec) : nullptr;
+        if (codecContext != nullptr &&
+            (avcodec_parameters_to_context(codecContext, parameters) < 0 ||
+                avcodec_open2(codecContext, codec, nullptr) < 0)) {
+            avcodec_free_context(&codecContext);
+        }
+    }
+
+    // The decoder is flushed at the end of the file in case it buffers the first frame
+    bool decoded = false;
+    bool flushed = false;
+    while (codecContext != nullptr && !decoded && !flushed) {
+        if (av_read_frame(formatContext, packet) >= 0) {
+            if (packet->stream_index == stream) {
+                (void)avcodec_send_packet(codecContext, packet);
+            }
+            av_packet_unref(packet);
+        } else {
+            (void)avcodec_send_packet(codecContext, nullptr);
+            flushed = true;
+        }
+        if (avcodec_receive_frame(codecContext, frame) >= 0) {
+            leftBrighter = isLeftBrighter(frame->data[0], frame->linesize[0], static_cast<uint32_t>(frame->width),
+                static_cast<uint32_t>(frame->height));
+            decoded = true;
+        }
+    }
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+    return decoded;
+}
+
+/**
+ * Checks that camera colour images are recorded mirrored and that composites are recorded as they were displayed.
+ * @note A frame with a bright left edge is converted with the scalar and AVX2 fused conversions and is then encoded
+ *  and decoded, with the bright side checked after each step.
+ * @param width     The image width.
+ * @param height    The image height.
+ * @param directory Directory used for output files.
+ * @returns True if every image has the expected orientation, false if not.
+ */
+static bool runOrientationCheck(const uint32_t width, const uint32_t height, const filesystem::path& directory) noexcept
+{
+    const uint32_t stride = width * 4;
+    vector<uint8_t> image(static_cast<size_t>(stride) * height, 0);
+    for (uint32_t y = 0; y < height; ++y) {
+        memset(&image[static_cast<size_t>(y) * stride], 255, static_cast<size_t>(width / 4) * 4);
+    }
+    bool success = true;
+    const auto report = [&success](const char* name, const bool mirror, const bool leftBrighter) {
+        // Mirrored images have the bright edge on the right
+        const bool correct = leftBrighter != mirror;
+        printf("%-14s %-9s %s\n", name, mirror ? "mirror" : "no mirror", correct ? "ok" : "FAILED");
+        success = success && correct;
+    };
+
+    // The fused conversion is checked while resizing so that the bins are also checked
+    const uint32_t outWidth = width / 2;
+    const uint32_t outHeight = height / 2;
+    const int32_t lumaStride = static_cast<int32_t>(outWidth);
+    const int32_t chromaStride = static_cast<int32_t>((outWidth + 1) / 2);
+    vector<uint8_t> output(static_cast<size_t>(lumaStride) * outHeight +
+        static_cast<size_t>(chromaStride) * ((outHeight + 1) / 2) * 2);
+    uint8_t* const data[3] = {output.data(), output.data() + static_cast<ptrdiff_t>(lumaStride) * outHeight,
+        output.data() + static_cast<ptrdiff_t>(lumaStride) * outHeight +
+            static_cast<ptrdiff_t>(chromaStride) * ((outHeight + 1) / 2)};
+    const int32_t linesize[3] = {lumaStride, chromaStride, chromaStride};
+    ResizeBins bins;
+    ResizeScratch scratch;
+    initResizeBins(bins, outWidth, width);
+    initResizeScratch(scratch, outWidth, width);
+    for (uint32_t method = 0; method < 2; ++method) {
+        const bool useAVX2 = method == 1;
+        if (useAVX2 && !hasConvertAVX2()) {
+            continue;
+        }
+        for (const bool mirror : {true, false}) {
+            convertBGRAToYUV420(image.data(), static_cast<int32_t>(stride), width, height, data, linesize, outWidth,
+                outHeight, 0, outHeight, bins, scratch, useAVX2, mirror);
+            report(useAVX2 ? "avx2 convert" : "scalar convert", mirror,
+                isLeftBrighter(data[0], lumaStride, outWidth, outHeight));
+        }
+    }
+
+    // Colour is recorded mirrored and the composite is recorded unmodified
+    for (const bool mirror : {true, false}) {
+        Encoder encoder;
+        encoder.setMirror(mirror);
+        if (!encoder.prepare(width, height, 30, AV_PIX_FMT_BGRA, 1.0f, std::min(ThreadPool::get().size(), 8U), false,
+                false, Rendition(), [](const string& message) { fprintf(stderr, "Error: %s\n", message.c_str()); })) {
+            return false;
+        }
+        const string file = (directory / ("orientation"s + encoder.getFileExtension())).string();
+        if (!encoder.start(file)) {
+            return false;
+        }
+        for (uint32_t f = 0; f < 5; ++f) {
+            if (!encoder.addFrame(image.data(), width, height, stride, static_cast<uint64_t>(f) * 1000000 / 30)) {
+                return false;
+            }
+        }
+        encoder.shutdown();
+        bool leftBrighter = false;
+        const bool decoded = decodeBrightSide(file, leftBrighter);
+        error_code ec;
+        filesystem::remove(file, ec);
+        if (!decoded) {
+            fprintf(stderr, "Failed to decode %s\n", file.c_str());
+            return false;
+        }
+        report("encode", mirror, leftBrighter);
+    }
+    return success;
+}
+
+/**
+ * Splits a comma separated list.
+ * @param list The list.
+ * @returns The list items.
+ */
+static vector<string> split(const string& list) noexcept
+{
+    vector<string> items;
+    size_t begin = 0;
+    while (begin <= list.size()) {
+        size_t end = list.find(',', begin);
+        if (end == string::npos) {
+            end = list.size();
+        }
+        if (end > begin) {
+            items.emplace_back(list.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return items;
+}
+
+static void printUsage() noexcept
+{
+    puts("Usage: EncoderBenchmark [options]\n"
+         "  --streams LIST      Streams to benchmark (depth,colour,ir)\n"
+         "  --resolutions LIST  Resolutions to use as WxH (default all camera modes of each stream)\n"
+         "  --codecs LIST       Encoders to use (default FFV1 for depth/IR and x264 for colour)\n"
+         "  --presets LIST      Encoder presets (default the codec default)\n"
+         "  --crf LIST          Constant quality levels (default 0 for the codec default)\n"
+         "  --threads LIST      Thread counts (default 0 for automatic)\n"
+         "  --frames N          Frames to encode per run (default 300)\n"
+         "  --realtime          Add frames at the camera rate and drop them if the encoder falls behind\n"
+         "  --combined          Also record depth, colour and IR together at the camera rate using the first\n"
+         "                      resolution, codec, preset, CRF and thread count of each stream\n"
+         "  --preview URL       Also stream encoded packets to a live preview (e.g. udp://127.0.0.1:5000)\n"
+         "  --convert           Only time the depth/IR GRAY16 to YUV420 conversion (filter graph, scalar and AVX2)\n"
+         "                      at 640x576 and 1024x1024, or the requested resolutions\n"
+         "  --orientation       Only check that colour is recorded mirrored and the composite is not, at 1280x720\n"
+         "                      or the first requested resolution\n"
+         "  --csv FILE          Also write results to a CSV file\n"
+         "  --verbose           Print FFmpeg log messages");
+}
+
+/**
+ * Prints the results of a run.
+ * @param settings The settings of each stream.
+ * @param results  The results of each stream.
+ * @param csv      The CSV file to also write to (if open).
+ */
+static void printResults(
+    const vector<RunSettings>& settings, const vector<RunResult>& results, ofstream& csv) noexcept
+{
+    for (size_t i = 0; i < settings.size(); ++i) {
+        const auto& set = settings[i];
+        const auto& res = results[i];
+        const string resolution = to_string(set.m_width) + 'x' + to_string(set.m_height);
+        const string codec = set.m_rendition.m_codec.empty() ? "default"s : set.m_rendition.m_codec;
+        const string preset = set.m_rendition.m_preset.empty() ? "default"s : set.m_rendition.m_preset;
+        printf("%-7s %-10s %-11s %-10s %4u %4u | %8.1f %6u %4u %8.2f %8.2f %8.2f %8.2f %8.2f %6.2f %9.2f %s\n",
+            set.m_stream->m_name.c_str(), resolution.c_str(), codec.c_str(), preset.c_str(),
+            set.m_rendition.m_quality, set.m_numThreads, res.m_fps, res.m_dropped, res.m_peakQueue, res.m_latency50,
+            res.m_latency95, res.m_latency99, res.m_latencyMax, res.m_cpuTime, res.m_cpuUsage, res.m_bitrate,
+            !res.m_success ? "FAILED" : (res.m_fps + 0.5 < set.m_fps || res.m_dropped > 0 ? "slow" : "ok"));
+        if (csv.is_open()) {
+            csv << set.m_stream->m_name << ',' << set.m_width << ',' << set.m_height << ',' << set.m_fps << ','
+                << codec << ',' << preset << ',' << set.m_rendition.m_quality << ','
+                << set.m_numThreads << ',' << res.m_success << ',' << res.m_frames << ',' << res.m_dropped << ','
+                << res.m_peakQueue << ',' << res.m_fps << ',' << res.m_latency50 << ',' << res.m_latency95 << ','
+                << res.m_latency99 << ',' << res.m_latencyMax << ',' << res.m_cpuTime << ',' << res.m_cpuUsage
+                << ',' << res.m_bitrate << '\n';
+        }
+    }
+    fflush(stdout);
+}
+} // namespace Ak
+
+using namespace Ak;
+
+int main(const int argc, char* argv[])
+{
+    vector<string> streams = {"depth", "colour", "ir"};
+    vector<string> resolutions;
+    vector<string> codecs = {""};
+    vector<string> presets = {""};
+    vector<string> crfs = {"0"};
+    vector<string> threads = {"0"};
+    uint32_t numFrames = 300;
+    bool realtime = false;
+    bool combined = false;
+    bool convert = false;
+    bool orientation = false;
+    string csvFile;
+    string preview;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--streams" && hasValue) {
+            streams = split(argv[++i]);
+        } else if (arg == "--resolutions" && hasValue) {
+            resolutions = split(argv[++i]);
+        } else if (arg == "--codecs" && hasValue) {
+            codecs = split(argv[++i]);
+        } else if (arg == "--presets" && hasValue) {
+            presets = split(argv[++i]);
+        } else if (arg == "--crf" && hasValue) {
+            crfs = split(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            threads = split(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            numFrames = std::max(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1U);
+        } else if (arg == "--realtime") {
+            realtime = true;
+        } else if (arg == "--combined") {
+            combined = true;
+        } else if (arg == "--convert") {
+            convert = true;
+        } else if (arg == "--orientation") {
+            orientation = true;
+        } else if (arg == "--preview" && hasValue) {
+            preview = argv[++i];
+        } else if (arg == "--csv" && hasValue) {
+            csvFile = argv[++i];
+        } else if (arg == "--verbose") {
+            s_verbose = true;
+        } else {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    if (convert) {
+        // Only 8/10 bit depth/IR renditions are converted, the default lossless FFV1 stores GRAY16 unconverted
+        if (resolutions.empty()) {
+            resolutions = {"640x576"s, "1024x1024"s};
+        }
+        printf("GRAY16 to YUV420 conversion, single thread, %u frames per run\n", numFrames);
+        printf("%-10s %10s %10s %10s\n", "size", "graph ms", "scalar ms", "avx2 ms");
+        for (const auto& i : resolutions) {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            if (sscanf(i.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                fprintf(stderr, "Invalid resolution %s\n", i.c_str());
+                return 1;
+            }
+            const auto times = runConvertBenchmark(width, height, numFrames);
+            printf("%-10s %10.3f %10.3f %10.3f\n", i.c_str(), times[0], times[1], times[2]);
+        }
+        return 0;
+    }
+
+    if (orientation) {
+        uint32_t width = 1280;
+        uint32_t height = 720;
+        if (!resolutions.empty() &&
+            (sscanf(resolutions.front().c_str(), "%ux%u", &width, &height) != 2 || width < 8 || height < 8)) {
+            fprintf(stderr, "Invalid resolution %s\n", resolutions.front().c_str());
+            return 1;
+        }
+        error_code ec;
+        const auto directory = filesystem::temp_directory_path(ec) / "AzureKinectBenchmark";
+        filesystem::create_directories(directory, ec);
+        const bool success = runOrientationCheck(width, height, directory);
+        filesystem::remove(directory, ec);
+        return success ? 0 : 1;
+    }
+
+    // Check which of the requested encoders are available in the linked FFmpeg
+    for (const auto& i : codecs) {
+        if (!i.empty() && findCodec(i) == nullptr) {
+            fprintf(stderr, "Encoder %s is not available\n", i.c_str());
+            return 1;
+        }
+    }
+
+    // Build the list of runs for each requested stream
+    vector<vector<RunSettings>> runs;
+    array<vector<RunSettings>, 3> firstRuns;
+    for (size_t s = 0; s < s_streams.size(); ++s) {
+        const auto& stream = s_streams[s];
+        if (find(streams.cbegin(), streams.cend(), stream.m_name) == streams.cend()) {
+            continue;
+        }
+        for (const auto& mode : stream.m_modes) {
+            const string resolution = to_string(mode[0]) + 'x' + to_string(mode[1]);
+            if (!resolutions.empty() &&
+                find(resolutions.cbegin(), resolutions.cend(), resolution) == resolutions.cend()) {
+                continue;
+            }
+            for (const auto& codec : codecs) {
+                for (const auto& preset : presets) {
+                    for (const auto& crf : crfs) {
+                        for (const auto& thread : threads) {
+                            Rendition rendition;
+                            rendition.m_codec = codec;
+                            rendition.m_preset = preset;
+                            rendition.m_quality = static_cast<uint32_t>(strtoul(crf.c_str(), nullptr, 10));
+                            rendition.m_preview = preview;
+                            uint32_t numThreads = static_cast<uint32_t>(strtoul(thread.c_str(), nullptr, 10));
+                            if (numThreads == 0) {
+                                numThreads = std::min(ThreadPool::get().size(), 8U);
+                            }
+                            runs.push_back({{&stream, mode[0], mode[1], mode[2], rendition, numThreads}});
+                            if (firstRuns[s].empty()) {
+                                firstRuns[s] = runs.back();
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (runs.empty()) {
+        fputs("No benchmark runs match the requested options\n", stderr);
+        return 1;
+    }
+
+    error_code ec;
+    const auto directory = filesystem::temp_directory_path(ec) / "AzureKinectBenchmark";
+    filesystem::create_directories(directory, ec);
+    ofstream csv;
+    if (!csvFile.empty()) {
+        csv.open(csvFile);
+        csv << "stream,width,height,cameraFPS,codec,preset,crf,threads,success,frames,dropped,peakQueue,fps,"
+               "latency50,latency95,latency99,latencyMax,cpuMsPerFrame,cpuCores,mbps\n";
+    }
+
+    printf("%u worker threads, %u frames per run, %s\n", ThreadPool::get().size(), numFrames,
+        realtime ? "real-time input" : "maximum throughput");
+    printf("%-7s %-10s %-11s %-10s %4s %4s | %8s %6s %4s %8s %8s %8s %8s %8s %6s %9s\n", "stream", "size", "codec",
+        "preset", "crf", "thr", "fps", "drops", "peak", "p50 ms", "p95 ms", "p99 ms", "max ms", "cpu ms", "cores",
+        "Mbps");
+    bool success = true;
+    for (const auto& i : runs) {
+        const auto results = runBenchmark(i, numFrames, realtime, directory);
+        printResults(i, results, csv);
+        success = success && results.front().m_success;
+    }
+
+    if (combined) {
+        // Record all streams at once in the same way as the recorder to check the machine keeps up
+        vector<RunSettings> settings;
+        for (const auto& i : firstRuns) {
+            settings.insert(settings.end(), i.cbegin(), i.cend());
+        }
+        puts("Combined real-time recording:");
+        const auto results = runBenchmark(settings, numFrames, true, directory);
+        printResults(settings, results, csv);
+        for (const auto& i : results) {
+            success = success && i.m_success;
+        }
+    }
+
+    filesystem::remove(directory, ec);
+    return success ? 0 : 1;
+}
@@ -0,0 +1,217 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+using namespace std;
+
+namespace Ak {
+using Clock = chrono::steady_clock;
+
+/** Measured results of reading the preview. */
+struct CheckResult
+{
+    bool m_opened = false;
+    uint32_t m_packets = 0;
+    uint32_t m_frames = 0;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    string m_codec;
+    double m_firstPacket = -1.0; /**< Time until the first packet was read (ms). */
+    double m_firstFrame = -1.0;  /**< Time until the first frame was decoded (ms). */
+};
+
+/** Deadline used to interrupt blocking reads of the preview. */
+struct Deadline
+{
+    Clock::time_point m_end;
+    atomic_bool m_cancel = false;
+};
+
+/**
+ * Gets the description of an FFmpeg error code.
+ * @param error The error code.
+ * @returns The description.
+ */
+static string getErrorString(const int32_t error) noexcept
+{
+    char buffer[AV_ERROR_MAX_STRING_SIZE];
+    av_strerror(error, buffer, sizeof(buffer));
+    return buffer;
+}
+
+/**
+ * Interrupt callback used by FFmpeg to check if a blocking operation should give up.
+ * @param [in] opaque The deadline.
+ * @returns Non-zero to interrupt.
+ */
+static int interruptCallback(void* opaque) noexcept
+{
+    const auto deadline = static_cast<Deadline*>(opaque);
+    return deadline->m_cancel || Clock::now() >= deadline->m_end ? 1 : 0;
+}
+
+/**
+ * Opens the preview in the same way as a consumer (e.g. ffplay) and decodes frames from it.
+ * @param          url       The preview URL.
+ * @param          numFrames The number of decoded frames required.
+ * @param [in,out] deadline  The time by which the frames must have been decoded.
+ * @returns The result.
+ */
+static CheckResult readPreview(const string& url, const uint32_t numFrames, Deadline& deadline) noexcept
+{
+    CheckResult result;
+    const auto start = Clock::now();
+    const auto elapsed = [&] { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+
+    AVFormatContext* formatContext = avformat_alloc_context();
+    if (formatContext == nullptr) {
+        return result;
+    }
+    formatContext->interrupt_callback = {interruptCallback, &deadline};
+    // Only a small amount of the stream is probed as it is sent with low latency
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "probesize", "500000", 0);
+    av_dict_set(&opts, "analyzeduration", "1000000", 0);
+    auto ret = avformat_open_input(&formatContext, url.c_str(), nullptr, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to open preview %s: %s\n", url.c_str(), getErrorString(ret).c_str());
+        return result;
+    }
+    result.m_opened = true;
+
+    AVCodecContext* codecContext = nullptr;
+    AVPacket* packet = av_packet_alloc();
+    AVFrame* frame = av_frame_alloc();
+    ret = avformat_find_stream_info(formatContext, nullptr);
+    const int32_t stream = ret >= 0 ? av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0) :
+                                      AVERROR_STREAM_NOT_FOUND;
+    if (stream >= 0 && packet != nullptr && frame != nullptr) {
+        const AVCodecParameters* parameters = formatContext->streams[stream]->codecpar;
+        const AVCodec* codec = avcodec_find_decoder(parameters->codec_id);
+        codecContext = codec != nullptr ? avcodec_alloc_context3(codec) : nullptr;
+        if (codecContext != nullptr && avcodec_parameters_to_context(codecContext, parameters) >= 0 &&
+            avcodec_open2(codecContext, codec, nullptr) >= 0) {
+            result.m_codec = codec->name;
+        } else {
+            fprintf(stderr, "Failed to open a decoder for the preview stream\n");
+            avcodec_free_context(&codecContext);
+        }
+    } else {
+        fprintf(stderr, "No video stream found in preview: %s\n", getErrorString(ret < 0 ? ret : stream).c_str());
+    }
+
+    // Frames that arrive before the decoder has seen a keyframe or a full intra refresh are dropped by the decoder
+    while (codecContext != nullptr && result.m_frames < numFrames && av_read_frame(formatContext, packet) >= 0) {
+        if (packet->stream_index == stream) {
+            if (result.m_packets++ == 0) {
+                result.m_firstPacket = elapsed();
+            }
+            if (avcodec_send_packet(codecContext, packet) >= 0) {
+                while (avcodec_receive_frame(codecContext, frame) >= 0) {
+                    if (result.m_frames++ == 0) {
+                        result.m_firstFrame = elapsed();
+                        result.m_width = static_cast<uint32_t>(frame->width);
+                        result.m_height = static_cast<uint32_t>(frame->height);
+                    }
+                    av_frame_unref(frame);
+                }
+            }
+        }
+        av_packet_unref(packet);
+    }
+
+    av_frame_free(&frame);
+    av_packet_free(&packet);
+    avcodec_free_context(&codecContext);
+    avformat_close_input(&formatContext);
+    return result;
+}
+} // namespace Ak
+
+using namespace Ak;
+
+int main(const int argc, char* argv[])
+{
+    string url = "udp://127.0.0.1:5000"s;
+    string command;
+    uint32_t numFrames = 30;
+    uint32_t timeout = 30;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--url" && hasValue) {
+            url = argv[++i];
+        } else if (arg == "--run" && hasValue) {
+            command = argv[++i];
+        } else if (arg == "--frames" && hasValue) {
+            numFrames = std::max(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1U);
+        } else if (arg == "--timeout" && hasValue) {
+            timeout = std::max(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1U);
+        } else {
+            puts("Usage: PreviewCheck [options]\n"
+                 "  --url URL      Live preview to read (default udp://127.0.0.1:5000)\n"
+                 "  --run COMMAND  Command that sends the preview, started once the preview is being read\n"
+                 "                 (e.g. \"EncoderBenchmark --streams colour --realtime --preview URL\")\n"
+                 "  --frames N     Decoded frames required (default 30)\n"
+                 "  --timeout S    Seconds to wait for the frames (default 30)");
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    Deadline deadline;
+    deadline.m_end = Clock::now() + chrono::seconds(timeout);
+    int32_t status = 0;
+    thread sender;
+    if (!command.empty()) {
+        sender = thread([&] {
+            // Give the reader time to start listening so that the sender's first keyframe is not missed
+            this_thread::sleep_for(chrono::milliseconds(500));
+            status = system(command.c_str());
+            if (status != 0) {
+                // There is nothing more to wait for if the sender failed
+                deadline.m_cancel = true;
+            }
+        });
+    }
+
+    const auto result = readPreview(url, numFrames, deadline);
+    if (sender.joinable()) {
+        sender.join();
+    }
+
+    const bool success = result.m_opened && result.m_frames >= numFrames && status == 0;
+    printf("preview %s: %s %ux%u, %u packets, %u frames decoded, first packet %.1f ms, first frame %.1f ms, %s\n",
+        url.c_str(), result.m_codec.empty() ? "none" : result.m_codec.c_str(), result.m_width, result.m_height,
+        result.m_packets, result.m_frames, result.m_firstPacket, result.m_firstFrame, success ? "ok" : "FAILED");
+    if (status != 0) {
+        fprintf(stderr, "Preview sender failed (%d): %s\n", status, command.c_str());
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,288 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OffscreenRenderer.h"
+
+#include <QGuiApplication>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <k4abt.h>
+#include <limits>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace Ak {
+static bool s_verbose = false;
+
+void logHandler(const std::string& message)
+{
+    if (s_verbose) {
+        fputs(message.c_str(), stderr);
+    }
+}
+
+/** A view that can be selected in the display. */
+struct View
+{
+    const char* m_name;
+    bool m_depthImage;
+    bool m_colourImage;
+    bool m_irImage;
+    bool m_pointCloud;
+};
+
+/** Synthetic frame data matching the layout produced by the camera. */
+struct FrameData
+{
+    vector<uint16_t> m_depth;
+    vector<uint8_t> m_colour;
+    vector<uint16_t> m_ir;
+    vector<uint8_t> m_shadow;
+    vector<Joint> m_joints;
+};
+
+/**
+ * Gets calibration data for the NFOV unbinned depth mode and 1080p colour.
+ * @returns The calibration.
+ */
+static KinectCalibration getCalibration() noexcept
+{
+    KinectCalibration calibration;
+    calibration.m_depthBC = {{320.0f, 288.0f}, {504.0f, 504.0f}, {0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f},
+        {0.0f, 0.0f}};
+    calibration.m_colourBC = {{960.0f, 540.0f}, {918.0f, 918.0f}, {0.0f, 0.0f}, {0.0f, 0.0f}, {0.0f, 0.0f},
+        {0.0f, 0.0f}};
+    calibration.m_irBC = calibration.m_depthBC;
+    calibration.m_jointToDepth = glm::mat4(1.0f);
+    calibration.m_jointToColour = glm::mat4(1.0f);
+    calibration.m_jointToIR = glm::mat4(1.0f);
+    calibration.m_depthFOV = {75.0f, 65.0f};
+    calibration.m_colourFOV = {90.0f, 59.0f};
+    calibration.m_irFOV = calibration.m_depthFOV;
+    calibration.m_depthDimensions = {640, 576};
+    calibration.m_colourDimensions = {1920, 1080};
+    calibration.m_irDimensions = calibration.m_depthDimensions;
+    calibration.m_fps = 30;
+    calibration.m_depthRange = {500, 4000};
+    calibration.m_irRange = {0, 1000};
+    return calibration;
+}
+
+/**
+ * Creates frame data containing gradients and a single body standing 2m in front of the camera.
+ * @param calibration The calibration data.
+ * @returns The frame data.
+ */
+static FrameData getFrameData(const KinectCalibration& calibration) noexcept
+{
+    FrameData data;
+    const auto depthWidth = static_cast<uint32_t>(calibration.m_depthDimensions.x);
+    const auto depthHeight = static_cast<uint32_t>(calibration.m_depthDimensions.y);
+    data.m_depth.resize(static_cast<size_t>(depthWidth) * depthHeight);
+    data.m_ir.resize(data.m_depth.size());
+    data.m_shadow.resize(data.m_depth.size());
+    for (uint32_t y = 0; y < depthHeight; ++y) {
+        for (uint32_t x = 0; x < depthWidth; ++x) {
+            const size_t i = static_cast<size_t>(y) * depthWidth + x;
+            const bool body = x > depthWidth * 2 / 5 && x < depthWidth * 3 / 5 && y > depthHeight / 5;
+            data.m_depth[i] = static_cast<uint16_t>(body ? 2000 : 1000 + 2500 * y / depthHeight);
+            data.m_ir[i] = static_cast<uint16_t>(1000 * (x + y) / (depthWidth + depthHeight));
+            data.m_shadow[i] = body ? numeric_limits<uint8_t>::max() : 0;
+        }
+    }
+    const auto colourWidth = static_cast<uint32_t>(calibration.m_colourDimensions.x);
+    const auto colourHeight = static_cast<uint32_t>(calibration.m_colourDimensions.y);
+    data.m_colour.resize(static_cast<size_t>(colourWidth) * colourHeight * 4);
+    for (uint32_t y = 0; y < colourHeight; ++y) {
+        uint8_t* pixel = &data.m_colour[static_cast<size_t>(y) * colourWidth * 4];
+        for (uint32_t x = 0; x < colourWidth; ++x, pixel += 4) {
+            pixel[0] = static_cast<uint8_t>(255 * x / colourWidth);
+            pixel[1] = static_cast<uint8_t>(255 * y / colourHeight);
+            pixel[2] = 128;
+            pixel[3] = 255;
+        }
+    }
+
+    // Joints are spread down the body in the order they are reported by the body tracker (millimetres)
+    for (uint32_t i = 0; i < K4ABT_JOINT_COUNT; ++i) {
+        const float x = static_cast<float>(i % 4) * 100.0f - 150.0f;
+        const float y = static_cast<float>(i) * 30.0f - 500.0f;
+        data.m_joints.emplace_back(Position{x, y, 2000.0f}, Quaternion{0.0f, 0.0f, 0.0f, 1.0f}, 1.0f);
+    }
+    return data;
+}
+
+/** Measured results of rendering a view. */
+struct RunResult
+{
+    int64_t m_uploadTime = 0;    /**< Average CPU time taken to upload each frame (microseconds). */
+    int64_t m_renderTime = 0;    /**< Average time taken to render and read back each frame (microseconds). */
+    uint32_t m_clientFrames = 0; /**< Frames that couldn't be written to a pixel buffer. */
+    bool m_valid = true;
+};
+
+/**
+ * Renders a single frame.
+ * @note When using pixel buffers the images are written in the same layout as AzureKinectWindow::dataCallback, the
+ *  displayed image (followed by the colour image for point clouds) and then the shadow image.
+ * @param renderer     The renderer.
+ * @param calibration  The calibration data.
+ * @param data         The frame data.
+ * @param view         The view to render.
+ * @param pixelBuffers True to write the images to a pixel buffer.
+ * @param [out] result The result to update.
+ */
+static void renderFrame(OffscreenRenderer& renderer, const KinectCalibration& calibration, FrameData& data,
+    const View& view, const bool pixelBuffers, RunResult& result) noexcept
+{
+    KinectImage depthImage(reinterpret_cast<uint8_t*>(data.m_depth.data()), calibration.m_depthDimensions.x,
+        calibration.m_depthDimensions.y, calibration.m_depthDimensions.x * 2);
+    KinectImage colourImage(data.m_colour.data(), calibration.m_colourDimensions.x,
+        calibration.m_colourDimensions.y, calibration.m_colourDimensions.x * 4);
+    KinectImage irImage(reinterpret_cast<uint8_t*>(data.m_ir.data()), calibration.m_irDimensions.x,
+        calibration.m_irDimensions.y, calibration.m_irDimensions.x * 2);
+    KinectImage shadowImage(data.m_shadow.data(), calibration.m_depthDimensions.x, calibration.m_depthDimensions.y,
+        calibration.m_depthDimensions.x);
+    const KinectJoints joints(data.m_joints.data(), static_cast<uint32_t>(data.m_joints.size()));
+
+    if (pixelBuffers) {
+        KinectImage* image = &irImage;
+        if (view.m_depthImage || view.m_pointCloud) {
+            image = &depthImage;
+        } else if (view.m_colourImage) {
+            image = &colourImage;
+        }
+        const size_t displaySize = static_cast<size_t>(image->m_height) * image->m_stride;
+        size_t imageSize = displaySize;
+        const size_t colourSize = static_cast<size_t>(colourImage.m_height) * colourImage.m_stride;
+        if (view.m_pointCloud) {
+            imageSize = KinectRenderer::getShadowOffset(displaySize) + colourSize;
+        }
+        const size_t shadowSize = static_cast<size_t>(shadowImage.m_height) * shadowImage.m_stride;
+        uint8_t* buffer = renderer.acquirePixelBuffer(KinectRenderer::getShadowOffset(imageSize) + shadowSize);
+        if (buffer != nullptr) {
+            memcpy(buffer, image->m_image, displaySize);
+            image->m_image = buffer;
+            if (view.m_pointCloud) {
+                uint8_t* colour = buffer + KinectRenderer::getShadowOffset(displaySize);
+                memcpy(colour, colourImage.m_image, colourSize);
+                colourImage.m_image = colour;
+            }
+            uint8_t* shadow = buffer + KinectRenderer::getShadowOffset(imageSize);
+            memcpy(shadow, shadowImage.m_image, shadowSize);
+            shadowImage.m_image = shadow;
+        } else {
+            ++result.m_clientFrames;
+        }
+    }
+    result.m_valid = result.m_valid && !renderer.render(depthImage, colourImage, irImage, shadowImage, joints).isNull();
+}
+
+/**
+ * Renders a view for a number of frames.
+ * @param renderer     The renderer.
+ * @param calibration  The calibration data.
+ * @param data         The frame data.
+ * @param view         The view to render.
+ * @param numFrames    Number of frames to render.
+ * @param pixelBuffers True to write the images to pixel buffers.
+ * @returns The result.
+ */
+static RunResult runBenchmark(OffscreenRenderer& renderer, const KinectCalibration& calibration, FrameData& data,
+    const View& view, const uint32_t numFrames, const bool pixelBuffers) noexcept
+{
+    renderer.setRenderOptions(view.m_depthImage, view.m_colourImage, view.m_irImage, view.m_pointCloud, true, true);
+
+    // The first frame includes texture allocation and shader warm up so isn't included in the timings
+    RunResult result;
+    renderFrame(renderer, calibration, data, view, pixelBuffers, result);
+    renderer.resetRenderTime();
+    result.m_clientFrames = 0;
+    for (uint32_t i = 0; i < numFrames && result.m_valid; ++i) {
+        renderFrame(renderer, calibration, data, view, pixelBuffers, result);
+    }
+    result.m_uploadTime = renderer.getUploadTime();
+    result.m_renderTime = renderer.getRenderTime();
+    return result;
+}
+} // namespace Ak
+
+using namespace Ak;
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = 1280;
+    uint32_t height = 720;
+    uint32_t numFrames = 300;
+    bool pixelBuffers = false;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--size" && hasValue) {
+            if (sscanf(argv[++i], "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+                fprintf(stderr, "Invalid size: %s\n", argv[i]);
+                return 1;
+            }
+        } else if (arg == "--frames" && hasValue) {
+            numFrames = std::max(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1U);
+        } else if (arg == "--pixel-buffers") {
+            pixelBuffers = true;
+        } else if (arg == "--verbose") {
+            s_verbose = true;
+        } else {
+            puts("Usage: RenderBenchmark [options]\n"
+                 "  --size WxH       Size of the rendered images (default 1280x720)\n"
+                 "  --frames N       Frames rendered for each view (default 300)\n"
+                 "  --pixel-buffers  Write images to the renderer's pixel buffers in the same way as the display\n"
+                 "                   (default passes them in client memory)\n"
+                 "  --verbose        Print log messages\n"
+                 "Run with QT_QPA_PLATFORM=offscreen when there is no display");
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    QGuiApplication application(argc, argv);
+    OffscreenRenderer renderer;
+    if (!renderer.init(width, height, [](const string& message) { fprintf(stderr, "%s\n", message.c_str()); })) {
+        return 1;
+    }
+    const KinectCalibration calibration = getCalibration();
+    renderer.updateCalibration(calibration);
+    FrameData data = getFrameData(calibration);
+
+    const View views[] = {{"depth", true, false, false, false}, {"colour", false, true, false, false},
+        {"ir", false, false, true, false}, {"pointcloud", false, false, false, true}};
+    printf("%ux%u target, %u frames per view with body shadow and skeleton, images in %s\n", width, height,
+        numFrames, pixelBuffers ? "pixel buffers" : "client memory");
+    printf("%-12s %10s %10s %14s\n", "view", "upload us", "frame us", "client frames");
+    bool success = true;
+    for (const auto& view : views) {
+        const RunResult result = runBenchmark(renderer, calibration, data, view, numFrames, pixelBuffers);
+        if (!result.m_valid) {
+            printf("%-12s %10s\n", view.m_name, "FAILED");
+            success = false;
+        } else {
+            printf("%-12s %10lld %10lld %14u\n", view.m_name, static_cast<long long>(result.m_uploadTime),
+                static_cast<long long>(result.m_renderTime), result.m_clientFrames);
+        }
+        fflush(stdout);
+    }
+    return success ? 0 : 1;
+}
@@ -0,0 +1,211 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace Ak {
+static constexpr uint32_t s_ringSize = 32;
+
+/**
+ * Ring buffer guarded by a mutex and condition variable (the queue scheme used by the encoder and recorder before
+ * RingBuffer).
+ */
+class MutexRing
+{
+public:
+    [[nodiscard]] uint64_t* beginPush() noexcept
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (m_remaining >= s_ringSize) {
+            return nullptr;
+        }
+        return &m_buffer[m_pushIndex % s_ringSize];
+    }
+
+    void endPush() noexcept
+    {
+        ++m_pushIndex;
+        {
+            lock_guard<mutex> lock(m_lock);
+            ++m_remaining;
+        }
+        m_condition.notify_one();
+    }
+
+    [[nodiscard]] uint64_t* front() noexcept
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (m_remaining == 0) {
+            return nullptr;
+        }
+        return &m_buffer[m_popIndex % s_ringSize];
+    }
+
+    void pop() noexcept
+    {
+        ++m_popIndex;
+        lock_guard<mutex> lock(m_lock);
+        --m_remaining;
+    }
+
+    template<typename Pred>
+    void wait(Pred cancel) noexcept
+    {
+        unique_lock<mutex> lock(m_lock);
+        m_condition.wait(lock, [&] { return m_remaining > 0 || cancel(); });
+    }
+
+    void wake() noexcept
+    {
+        { lock_guard<mutex> lock(m_lock); }
+        m_condition.notify_one();
+    }
+
+    [[nodiscard]] uint32_t count() noexcept
+    {
+        lock_guard<mutex> lock(m_lock);
+        return m_remaining;
+    }
+
+private:
+    mutex m_lock;
+    condition_variable m_condition;
+    uint32_t m_remaining = 0;
+    uint32_t m_pushIndex = 0;
+    uint32_t m_popIndex = 0;
+    uint64_t m_buffer[s_ringSize] = {};
+};
+
+/** Measured results of a single run. */
+struct RunResult
+{
+    double m_nsPerItem = 0.0;
+    uint32_t m_maxCount = 0;
+    bool m_valid = true;
+};
+
+/**
+ * Passes items from a producer to a consumer thread while a third thread polls the queue depth in the same way as
+ * Encoder::getQueueDepth.
+ * @tparam Ring Type of the ring buffer.
+ * @param numItems Number of items to pass through the ring.
+ * @returns The result.
+ */
+template<typename Ring>
+static RunResult runBenchmark(const uint64_t numItems) noexcept
+{
+    Ring ring;
+    atomic_bool done = false;
+    RunResult result;
+    thread consumer([&] {
+        uint64_t expected = 0;
+        while (expected < numItems) {
+            const uint64_t* item = ring.front();
+            if (item == nullptr) {
+                ring.wait([&] { return done.load(); });
+                continue;
+            }
+            result.m_valid = result.m_valid && *item == expected;
+            ++expected;
+            ring.pop();
+        }
+    });
+    thread observer([&] {
+        // The queue depth is polled by threads that are neither the producer nor the consumer
+        while (!done) {
+            result.m_maxCount = std::max(result.m_maxCount, ring.count());
+            this_thread::sleep_for(chrono::microseconds(100));
+        }
+    });
+
+    const auto start = chrono::steady_clock::now();
+    for (uint64_t i = 0; i < numItems; ++i) {
+        uint64_t* item;
+        while ((item = ring.beginPush()) == nullptr) {
+            this_thread::yield();
+        }
+        *item = i;
+        ring.endPush();
+    }
+    consumer.join();
+    const auto elapsed = chrono::steady_clock::now() - start;
+    done = true;
+    ring.wake();
+    observer.join();
+
+    result.m_nsPerItem = chrono::duration<double, nano>(elapsed).count() / static_cast<double>(numItems);
+    result.m_valid = result.m_valid && result.m_maxCount <= s_ringSize;
+    return result;
+}
+
+/**
+ * Prints the result of a run.
+ * @param name   The name of the ring buffer.
+ * @param result The result.
+ */
+static void printResult(const char* name, const RunResult& result) noexcept
+{
+    printf("%-10s %10.1f %10u %s\n", name, result.m_nsPerItem, result.m_maxCount, result.m_valid ? "ok" : "FAILED");
+    fflush(stdout);
+}
+} // namespace Ak
+
+using namespace Ak;
+
+int main(const int argc, char* argv[])
+{
+    uint64_t numItems = 5000000;
+    uint32_t numRuns = 3;
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--items" && hasValue) {
+            numItems = std::max(strtoull(argv[++i], nullptr, 10), 1ULL);
+        } else if (arg == "--runs" && hasValue) {
+            numRuns = std::max(static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10)), 1U);
+        } else {
+            puts("Usage: RingBufferBenchmark [options]\n"
+                 "  --items N  Items passed from the producer to the consumer per run (default 5000000)\n"
+                 "  --runs N   Runs of each ring buffer (default 3)");
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    printf("%u hardware threads, %llu 8-byte items through a %u slot ring\n", thread::hardware_concurrency(),
+        static_cast<unsigned long long>(numItems), s_ringSize);
+    printf("%-10s %10s %10s\n", "ring", "ns/item", "max count");
+    bool success = true;
+    for (uint32_t i = 0; i < numRuns; ++i) {
+        const auto mutexResult = runBenchmark<MutexRing>(numItems);
+        printResult("mutex+cv", mutexResult);
+        const auto ringResult = runBenchmark<RingBuffer<uint64_t, s_ringSize>>(numItems);
+        printResult("RingBuffer", ringResult);
+        success = success && mutexResult.m_valid && ringResult.m_valid;
+    }
+    return success ? 0 : 1;
+}
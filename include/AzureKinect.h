@@ -18,6 +18,7 @@
 #include "DataTypes.h"
 
 #include <atomic>
+#include <chrono>
 #include <functional>
 #include <k4abt.h>
 #include <mutex>
@@ -41,14 +42,15 @@ public:
 
     using errorCallback = std::function<void(const std::string&)>;
     using readyCallback = std::function<void(const KinectCalibration&)>;
-    using dataCallback = std::function<void(
-        uint64_t, const KinectImage&, const KinectImage&, const KinectImage&, const KinectImage&, const KinectJoints&)>;
+    using dataCallback = std::function<void(uint64_t, std::chrono::steady_clock::time_point, const KinectImage&,
+        const KinectImage&, const KinectImage&, const KinectImage&, const KinectJoints&)>;
 
     /**
      * Initializes the azure kinect camera.
      * @param error (Optional) The callback used to signal errors.
      * @param ready (Optional) The callback used to signal camera is ready for operations.
-     * @param data  (Optional) The callback used to signal updated image/position data.
+     * @param data  (Optional) The callback used to signal updated image/position data, this is passed the device
+     *  timestamp and the host time the capture was received.
      * @returns True if it succeeds, false if it fails.
      */
     bool init(errorCallback error = nullptr, readyCallback ready = nullptr, dataCallback data = nullptr) noexcept;
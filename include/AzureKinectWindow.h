@@ -16,6 +16,7 @@
  */
 
 #include "AzureKinect.h"
+#include "KinectPlayback.h"
 #include "KinectRecord.h"
 #include "ui_AzureKinect.h"
 
@@ -42,9 +43,18 @@ public slots:
     /** Slot used to receive request to exit the program */
     void exitSlot() noexcept;
 
-    /** Slot used to pass error messages between threads/objects (calls exitSlot when done) */
+    /** Slot used to receive request to play back a previously recorded session */
+    void openRecordingSlot() noexcept;
+
+    /** Slot used to notify program that playback of a recorded session has completed */
+    void playbackFinishedSlot() noexcept;
+
+    /** Slot used to pass error messages between threads/objects (calls exitSlot when done once a source is running) */
     void errorSlot(const QString& message) noexcept;
 
+    /** Slot used to pass playback error messages (stops playback without exiting) */
+    void playbackErrorSlot(const QString& message) noexcept;
+
     /** Slot used to notify program that camera is ready to start capture */
     void readySlot() noexcept;
 
@@ -57,12 +67,18 @@ public slots:
     /** Slot used to select display of IR image */
     void viewIRImageSlot() noexcept;
 
+    /** Slot used to select display of 3D point cloud */
+    void viewPointCloudSlot() noexcept;
+
     /** Slot used to select display of body shadow */
     void viewBodyShadowSlot() noexcept;
 
     /** Slot used to select display of body skeleton */
     void viewBodySkeletonSlot() noexcept;
 
+    /** Slot used to select display of the frame timing overlay */
+    void viewTimingOverlaySlot() noexcept;
+
     /** Slot used to update the record options for the record object */
     void updateRecordOptionsSlot() noexcept;
 
@@ -77,16 +93,22 @@ private:
         std::vector<Joint> m_joints;
     };
 
+    // Buffers are only used when no pixel buffer is free and are sized for the displayed image on first use
     std::array<DataBuffers, 15> m_dataBuffer;
     uint32_t m_bufferIndex = 0;
+    std::array<size_t, 4> m_displaySizes = {}; // Depth, colour, IR and shadow image sizes for the current camera mode
+    size_t m_bufferFootprint = 0;
     bool m_viewDepthImage = true;
     bool m_viewColourImage = false;
     bool m_viewIRImage = false;
+    bool m_viewPointCloud = false;
     bool m_viewBodyShadow = true;
     bool m_viewBodySkeleton = true;
     bool m_started = false;
     bool m_ready = false;
+    bool m_playing = false;
     AzureKinect m_kinect;
+    KinectPlayback m_playback;
     KinectRecord m_recorder;
 
     /**
@@ -109,17 +131,32 @@ private:
      */
     void readyCallback(const KinectCalibration& calibration) noexcept;
 
+    /**
+     * Callback used by the playback thread to notify of errors.
+     * @note This provide thread safe, asynchronous error handling.
+     * @param message The error message.
+     */
+    void playbackErrorCallback(const std::string& message) const noexcept;
+
+    /**
+     * Callback used by the playback thread to notify when the end of the recording has been reached.
+     * @note This provide thread safe, asynchronous handling.
+     */
+    void playbackFinishedCallback() const noexcept;
+
     /**
      * Callback used by the camera thread when new image/position information is available.
      * @param time        The timestamp of the capture.
+     * @param hostTime    The host time the capture was received.
      * @param depthImage  The depth image data.
      * @param colourImage The colour image data.
      * @param irImage     The IR image data.
      * @param shadowImage The body shadow image data.
      * @param joints      The joint data.
      */
-    void dataCallback(uint64_t time, const KinectImage& depthImage, const KinectImage& colourImage,
-        const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept;
+    void dataCallback(uint64_t time, std::chrono::steady_clock::time_point hostTime, const KinectImage& depthImage,
+        const KinectImage& colourImage, const KinectImage& irImage, const KinectImage& shadowImage,
+        const KinectJoints& joints) noexcept;
 
     /** Updates the render options for the render widget */
     void updateRenderOptions() const noexcept;
@@ -139,15 +176,16 @@ signals:
     void readySignal() const;
 
     /**
-     * Signal used to pass asynchronous thread safe image/position data.
-     * @note This is required by @dataCallback.
-     * @param depthImage  The depth image data.
-     * @param colourImage The colour image data.
-     * @param irImage     The IR image data.
-     * @param shadowImage The body shadow image data.
-     * @param joints      The joint data.
+     * Signal used to pass asynchronous thread safe playback completion.
+     * @note This is required by @playbackFinishedCallback.
+     */
+    void playbackFinishedSignal() const;
+
+    /**
+     * Signal used to pass asynchronous thread safe playback error messages.
+     * @note This is required by @playbackErrorCallback.
+     * @param message The message.
      */
-    void dataSignal(KinectImage depthImage, KinectImage colourImage, KinectImage irImage, KinectImage shadowImage,
-        KinectJoints joints) const;
+    void playbackErrorSignal(const QString& message) const;
 };
 } // namespace Ak
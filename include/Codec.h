@@ -0,0 +1,139 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+
+namespace Ak {
+/** Rate control modes used when encoding. */
+enum class RateControl : uint32_t
+{
+    ConstantQuality = 0, /**< Constant quality (CRF or CQ) using Rendition::m_quality. */
+    Bitrate = 1,         /**< Average bitrate using Rendition::m_bitrate. */
+    Lossless = 2,        /**< Mathematically lossless. */
+};
+
+/** Output settings for a single encoded rendition of a stream. */
+class Rendition
+{
+public:
+    uint32_t m_width = 0;    /**< The output width (0 to use the input width). */
+    uint32_t m_height = 0;   /**< The output height (0 to maintain the input aspect ratio). */
+    std::string m_codec;     /**< Name of the encoder (empty to use the default for the stream type). */
+    uint32_t m_quality = 0;  /**< The constant quality level (CRF or CQ, 0 to use the codec default). */
+    std::string m_preset;    /**< The encoder preset (empty to use the codec default). */
+    std::string m_name;      /**< Added to the output filename to identify the rendition (may be empty). */
+    uint32_t m_bitrate = 0;  /**< Target bitrate in kbit/s when using RateControl::Bitrate. */
+    uint32_t m_bitDepth = 0; /**< Output bits per sample (8, 10 or 16, 0 to use the codec default). */
+    std::string m_preview;   /**< URL that encoded packets are also streamed to as MPEG-TS (empty for none). */
+
+    RateControl m_rateControl = RateControl::ConstantQuality; /**< The rate control mode. */
+    bool m_adaptiveQuality = true;                            /**< Reduce quality if the encoder falls behind. */
+};
+
+/** Description of a video encoder that can be used for recording. */
+class Codec
+{
+public:
+    std::string m_name;          /**< The FFmpeg encoder name. */
+    std::string m_container;     /**< The FFmpeg muxer used for output files. */
+    std::string m_extension;     /**< The output file extension. */
+    std::string m_presetOption;  /**< The encoder option that sets the preset (empty if not supported). */
+    std::string m_defaultPreset; /**< The preset used when none is specified. */
+    std::string m_qualityOption; /**< The encoder option that sets constant quality. */
+    uint32_t m_defaultQuality;   /**< The quality level used when none is specified. */
+    bool m_losslessOnly;         /**< True if the encoder only supports lossless encoding. */
+    bool m_gpu;                  /**< True if the encoder requires GPU encoding. */
+    bool m_runtimeQuality;       /**< True if the quality level can be changed while encoding. */
+
+    /**
+     * Query if the encoder supports a pixel format.
+     * @param format The pixel format.
+     * @returns True if supported, false if not.
+     */
+    [[nodiscard]] bool supportsFormat(int32_t format) const noexcept;
+
+    /**
+     * Gets the output pixel format for a rendition.
+     * @param format    The input frame pixel format.
+     * @param rendition The rendition settings.
+     * @returns The pixel format, AV_PIX_FMT_NONE if the requested bit depth is not supported.
+     */
+    [[nodiscard]] int32_t getOutputFormat(int32_t format, const Rendition& rendition) const noexcept;
+
+    /**
+     * Sets the encoder options required for a rendition.
+     * @note Renditions with a preview are tuned for low latency and use intra refresh instead of keyframes where the
+     *  encoder supports it.
+     * @param          rendition The rendition settings.
+     * @param [in,out] context   The codec context to set options on before it is opened.
+     * @param [in,out] options   The options passed when opening the codec.
+     * @returns True if it succeeds, false if the rate control mode is not supported.
+     */
+    [[nodiscard]] bool setOptions(
+        const Rendition& rendition, AVCodecContext* context, AVDictionary** options) const noexcept;
+
+    /**
+     * Changes the constant quality level of an open encoder.
+     * @note The new level is applied from the next frame sent to the encoder.
+     * @param [in,out] context The open codec context.
+     * @param          quality The new quality level.
+     * @returns True if it succeeds, false if the encoder can't be reconfigured while encoding.
+     */
+    [[nodiscard]] bool setQuality(AVCodecContext* context, uint32_t quality) const noexcept;
+
+    /**
+     * Gets a faster preset than the one used by a rendition.
+     * @note Presets can't be changed while encoding so a new encoder must be opened to use it.
+     * @param rendition The rendition settings.
+     * @param steps     The number of presets faster than the rendition preset.
+     * @returns The preset, empty if the encoder has no preset that much faster.
+     */
+    [[nodiscard]] std::string getFasterPreset(const Rendition& rendition, uint32_t steps) const noexcept;
+};
+
+/**
+ * Gets the encoders that are provided by the linked FFmpeg.
+ * @note Encoders are probed the first time this is called. GPU encoders are only available if a CUDA device can be
+ *  created.
+ * @returns The available encoders.
+ */
+[[nodiscard]] const std::vector<Codec>& getAvailableCodecs() noexcept;
+
+/**
+ * Finds an available encoder.
+ * @param name The FFmpeg encoder name.
+ * @returns The encoder, nullptr if it is not available.
+ */
+[[nodiscard]] const Codec* findCodec(const std::string& name) noexcept;
+
+/**
+ * Gets the default encoder for a type of stream.
+ * @note Depth and IR default to lossless FFV1 and colour defaults to x264 (the only encoder whose quality can be
+ *  adapted while recording), falling back to x265 if they are not available.
+ * @param format The input frame pixel format.
+ * @param useGPU True to use GPU accelerated encoding.
+ * @returns The encoder, nullptr if no suitable encoder is available.
+ */
+[[nodiscard]] const Codec* getDefaultCodec(int32_t format, bool useGPU) noexcept;
+} // namespace Ak
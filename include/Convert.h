@@ -0,0 +1,126 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <vector>
+
+namespace Ak {
+/**
+ * Query if the current CPU supports the AVX2 conversion functions.
+ * @returns True if AVX2 is supported, false if not.
+ */
+[[nodiscard]] bool hasConvertAVX2() noexcept;
+
+/**
+ * Converts a 16bit grayscale image to YUV420 in a single pass.
+ * @note This scales the input range to the full limited range luma, mirrors the image horizontally and sets chroma to
+ *  a constant value. This produces the same result as a "hflip,colorlevels,format=yuv420p" filter graph (within
+ *  rounding). Depth and IR recorded with the default lossless FFV1 are stored as GRAY16 so skip this conversion, it is
+ *  only used for 8 and 10 bit depth/IR renditions.
+ * @param [in]  source       The source image data.
+ * @param       sourceStride The source image stride (in bytes).
+ * @param [out] dest         The destination Y, U and V planes.
+ * @param       destStride   The destination Y, U and V plane strides (in bytes).
+ * @param       width        The image width.
+ * @param       height       The image height.
+ * @param       scale        The scale that needs to be applied to input pixels.
+ * @param       useAVX2      True to use AVX2 instructions (must only be used if hasConvertAVX2() returns true).
+ */
+void convertGray16ToYUV420(const uint8_t* source, int32_t sourceStride, uint8_t* const dest[3],
+    const int32_t destStride[3], uint32_t width, uint32_t height, float scale, bool useAVX2) noexcept;
+
+/** Horizontal box filter bins used to resize an image, these are the same for every row. */
+struct ResizeBins
+{
+    std::vector<uint32_t> m_begin;      /**< The first source column of each output column. */
+    std::vector<uint32_t> m_end;        /**< One past the last source column of each output column. */
+    std::vector<float> m_scale;         /**< The reciprocal of the number of columns in each bin. */
+    std::vector<uint32_t> m_fixedScale; /**< The reciprocal of the number of columns in each bin (16.16 fixed point). */
+};
+
+/** Working storage used by a single band of a resizing conversion. */
+struct ResizeScratch
+{
+    std::vector<uint16_t> m_columnSums; /**< Per column sums of the current source rows. */
+    std::vector<float> m_colours;       /**< The colour of each output pixel for a pair of rows. */
+    std::vector<float> m_scale;         /**< The reciprocal of the number of pixels in each bin of the current row. */
+};
+
+/**
+ * Calculates the bins used to resize an image.
+ * @param [out] bins        The bins.
+ * @param       width       The output width.
+ * @param       sourceWidth The source width.
+ */
+void initResizeBins(ResizeBins& bins, uint32_t width, uint32_t sourceWidth) noexcept;
+
+/**
+ * Allocates the working storage used to resize an image.
+ * @note The storage is large enough to be used by both convertBGRAToYUV420 and scaleYUV420.
+ * @param [out] scratch     The working storage.
+ * @param       width       The output width.
+ * @param       sourceWidth The source width.
+ */
+void initResizeScratch(ResizeScratch& scratch, uint32_t width, uint32_t sourceWidth) noexcept;
+
+/**
+ * Converts a BGRA image to a resized YUV420 image in a single pass.
+ * @note Each output pixel is the box filtered average of the source pixels it covers so the source is only read once.
+ *  The image can also be mirrored horizontally. The output can be any size but is intended for downscaling. To allow
+ *  the conversion to be split across threads only a range of output rows is written.
+ * @param [in]  source       The source image data.
+ * @param       sourceStride The source image stride (in bytes).
+ * @param       sourceWidth  The source image width.
+ * @param       sourceHeight The source image height.
+ * @param [out] dest         The destination Y, U and V planes.
+ * @param       destStride   The destination Y, U and V plane strides (in bytes).
+ * @param       width        The output image width.
+ * @param       height       The output image height.
+ * @param       rowBegin     The first output row to write (must be even).
+ * @param       rowEnd       One past the last output row to write (must be even or equal to height).
+ * @param       bins         The bins from initResizeBins(width, sourceWidth).
+ * @param [out] scratch      Working storage from initResizeScratch (must not be shared with other threads).
+ * @param       useAVX2      True to use AVX2 instructions (must only be used if hasConvertAVX2() returns true).
+ * @param       mirror       True to mirror the image horizontally.
+ */
+void convertBGRAToYUV420(const uint8_t* source, int32_t sourceStride, uint32_t sourceWidth, uint32_t sourceHeight,
+    uint8_t* const dest[3], const int32_t destStride[3], uint32_t width, uint32_t height, uint32_t rowBegin,
+    uint32_t rowEnd, const ResizeBins& bins, ResizeScratch& scratch, bool useAVX2, bool mirror) noexcept;
+
+/**
+ * Resizes a YUV420 image.
+ * @note Each output pixel is the box filtered average of the source pixels it covers. This is used to derive smaller
+ *  renditions from an already converted image. To allow the conversion to be split across threads only a range of
+ *  output rows is written.
+ * @param [in]  source       The source Y, U and V planes.
+ * @param       sourceStride The source Y, U and V plane strides (in bytes).
+ * @param       sourceWidth  The source image width.
+ * @param       sourceHeight The source image height.
+ * @param [out] dest         The destination Y, U and V planes.
+ * @param       destStride   The destination Y, U and V plane strides (in bytes).
+ * @param       width        The output image width.
+ * @param       height       The output image height.
+ * @param       rowBegin     The first output row to write (must be even).
+ * @param       rowEnd       One past the last output row to write (must be even or equal to height).
+ * @param       bins         The luma and chroma bins from initResizeBins (of the luma and chroma plane widths).
+ * @param [out] scratch      Working storage from initResizeScratch (must not be shared with other threads).
+ * @param       useAVX2      True to use AVX2 instructions (must only be used if hasConvertAVX2() returns true).
+ */
+void scaleYUV420(const uint8_t* const source[3], const int32_t sourceStride[3], uint32_t sourceWidth,
+    uint32_t sourceHeight, uint8_t* const dest[3], const int32_t destStride[3], uint32_t width, uint32_t height,
+    uint32_t rowBegin, uint32_t rowEnd, const ResizeBins bins[2], ResizeScratch& scratch, bool useAVX2) noexcept;
+} // namespace Ak
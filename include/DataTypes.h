@@ -37,10 +37,29 @@ public:
 
     KinectImage(uint8_t* image, int32_t width, int32_t height, int32_t stride);
 
+    using referenceFunction = void (*)(void* owner);
+    using releaseFunction = void (*)(void* owner, uint8_t* image);
+
+    /**
+     * Constructor for an image whose storage is reference counted by its owner.
+     * @param [in] image     The image data.
+     * @param      width     The image width.
+     * @param      height    The image height.
+     * @param      stride    The image stride.
+     * @param [in] owner     The object that owns the image data.
+     * @param      reference The function used to add a reference to the owner.
+     * @param      release   The function used to release a reference to the owner.
+     */
+    KinectImage(uint8_t* image, int32_t width, int32_t height, int32_t stride, void* owner,
+        referenceFunction reference, releaseFunction release);
+
     uint8_t* m_image;
     int32_t m_width;
     int32_t m_height;
     int32_t m_stride;
+    void* m_owner = nullptr;
+    referenceFunction m_reference = nullptr;
+    releaseFunction m_release = nullptr;
 };
 
 class Position
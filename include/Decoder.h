@@ -0,0 +1,167 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Encoder.h"
+#include "Filter.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavformat/avformat.h>
+#include <libavutil/rational.h>
+}
+
+namespace Ak {
+class InputFormatContextPtr
+{
+    friend class Decoder;
+
+    InputFormatContextPtr() = default;
+
+    explicit InputFormatContextPtr(AVFormatContext* formatContext) noexcept;
+
+    [[nodiscard]] AVFormatContext* get() const noexcept;
+
+    AVFormatContext* operator->() const noexcept;
+
+    std::shared_ptr<AVFormatContext> m_formatContext = nullptr;
+};
+
+class Decoder
+{
+public:
+    using errorCallback = std::function<void(const std::string&)>;
+
+    Decoder() = default;
+
+    ~Decoder();
+
+    Decoder(const Decoder& other) = delete;
+
+    Decoder(Decoder&& other) noexcept = delete;
+
+    Decoder& operator=(const Decoder& other) = delete;
+
+    Decoder& operator=(Decoder&& other) noexcept = delete;
+
+    /**
+     * Opens a recorded video file and reads its stream parameters.
+     * @param filename Filename of the file.
+     * @param error    (Optional) The callback used to signal errors.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool init(const std::string& filename, errorCallback error = nullptr) noexcept;
+
+    /**
+     * Starts decoding frames in the background.
+     * @note init() must be called before this function can be used.
+     * @param format     The pixel format that output frames should be converted to.
+     * @param scale      The scale that was applied to input pixels when the file was recorded.
+     * @param numThreads Number of threads to use.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool start(int32_t format, float scale, uint32_t numThreads) noexcept;
+
+    /**
+     * Gets the next decoded frame.
+     * @note This function will block until a frame is available. The frames pts is in microseconds relative to the
+     *  start of the stream.
+     * @param [out] frame The frame.
+     * @returns True if it succeeds, false if there are no more frames available.
+     */
+    bool getFrame(FramePtr& frame) noexcept;
+
+    /** Notify to shutdown.
+     * @note This function is synchronous and will block until thread has completed.
+     */
+    void shutdown() noexcept;
+
+    /**
+     * Gets the width of decoded frames.
+     * @returns The width.
+     */
+    [[nodiscard]] uint32_t getWidth() const noexcept;
+
+    /**
+     * Gets the height of decoded frames.
+     * @returns The height.
+     */
+    [[nodiscard]] uint32_t getHeight() const noexcept;
+
+    /**
+     * Gets the frame rate (fps) of the decoded stream.
+     * @returns The frame rate in frames per second.
+     */
+    [[nodiscard]] AVRational getFrameRate() const noexcept;
+
+    /**
+     * Gets the device timestamp of the first frame in the stream.
+     * @returns The device timestamp (in microseconds), or AV_NOPTS_VALUE if the file does not contain one.
+     */
+    [[nodiscard]] int64_t getDeviceStartTime() const noexcept;
+
+private:
+    std::atomic_bool m_shutdown = false;
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    std::array<FramePtr, 8 /*must be power of 2*/> m_dataBuffer;
+    uint32_t m_bufferIndex = 0;
+    int32_t m_remainingBuffers = 0;
+    uint32_t m_nextBufferIndex = 0;
+    bool m_finished = false;
+    int64_t m_startTime = 0;
+
+    InputFormatContextPtr m_formatContext;
+    CodecContextPtr m_codecContext;
+    int32_t m_streamIndex = 0;
+    Filter m_filter;
+    std::thread m_thread;
+    errorCallback m_errorCallback = nullptr;
+
+    /** Cleanup input files opened during @init. */
+    void cleanupInput() noexcept;
+
+    /**
+     * Run video decoding and processing.
+     * @note start() must be called before this function can be used.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool run() noexcept;
+
+    /**
+     * Receive all available frames from the decoder and pass them to the output.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool decodeFrames() noexcept;
+
+    /**
+     * Places a processed frame on the pending output stack.
+     * @note This function will block until there is space available on the stack.
+     * @param [in,out] frame The frame.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool pushFrame(FramePtr& frame) noexcept;
+};
+} // namespace Ak
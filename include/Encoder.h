@@ -15,7 +15,11 @@
  * limitations under the License.
  */
 
+#include "Codec.h"
+#include "DataTypes.h"
 #include "Filter.h"
+#include "RingBuffer.h"
+#include "ThreadPool.h"
 
 #include <array>
 #include <atomic>
@@ -87,6 +91,104 @@ public:
     std::shared_ptr<AVBufferRef> m_device = nullptr;
 };
 
+class BitstreamFilterPtr
+{
+public:
+    BitstreamFilterPtr() noexcept = default;
+
+    explicit BitstreamFilterPtr(AVBSFContext* filter) noexcept;
+
+    [[nodiscard]] AVBSFContext* get() const noexcept;
+
+    AVBSFContext* operator->() const noexcept;
+
+    std::shared_ptr<AVBSFContext> m_filter = nullptr;
+};
+
+class BufferPoolPtr
+{
+public:
+    BufferPoolPtr() noexcept = default;
+
+    explicit BufferPoolPtr(AVBufferPool* pool) noexcept;
+
+    [[nodiscard]] AVBufferPool* get() const noexcept;
+
+    std::shared_ptr<AVBufferPool> m_pool = nullptr;
+};
+
+/** Histogram of durations that can be updated and read from any thread without locking. */
+class TimeHistogram
+{
+public:
+    static constexpr uint32_t s_numBuckets = 16; /**< Bucket i holds durations less than 64us << i. */
+
+    /**
+     * Adds a duration to the histogram.
+     * @param time The duration (in microseconds).
+     */
+    void add(int64_t time) noexcept;
+
+    /**
+     * Gets the number of durations that have been added.
+     * @returns The count.
+     */
+    [[nodiscard]] uint64_t getCount() const noexcept;
+
+    /**
+     * Gets the average duration.
+     * @returns The average (in microseconds).
+     */
+    [[nodiscard]] int64_t getAverage() const noexcept;
+
+    /**
+     * Gets the longest duration.
+     * @returns The maximum (in microseconds).
+     */
+    [[nodiscard]] int64_t getMax() const noexcept;
+
+    /**
+     * Gets an approximate percentile.
+     * @param percentile The percentile (0 to 1).
+     * @returns The upper bound of the bucket containing the percentile (in microseconds).
+     */
+    [[nodiscard]] int64_t getPercentile(float percentile) const noexcept;
+
+    /**
+     * Gets the number of durations in a bucket.
+     * @param bucket The bucket index.
+     * @returns The count.
+     */
+    [[nodiscard]] uint64_t getBucket(uint32_t bucket) const noexcept;
+
+    /** Clears the histogram. */
+    void reset() noexcept;
+
+private:
+    std::array<std::atomic_uint64_t, s_numBuckets> m_buckets = {};
+    std::atomic_uint64_t m_count = 0;
+    std::atomic_int64_t m_total = 0;
+    std::atomic_int64_t m_max = 0;
+};
+
+/** Live statistics of an encoder, all values may be read from any thread while encoding. */
+class EncoderStatistics
+{
+public:
+    std::atomic_uint64_t m_framesIn = 0;       /**< Frames added to the encoder. */
+    std::atomic_uint64_t m_framesOut = 0;      /**< Encoded frames written to the output. */
+    std::atomic_uint64_t m_droppedFrames = 0;  /**< Frames rejected because the queue was full. */
+    std::atomic_uint32_t m_queueHighWater = 0; /**< Largest number of frames that were waiting to be encoded. */
+    std::atomic_uint64_t m_bytesWritten = 0;   /**< Encoded bytes written to the output. */
+    std::atomic_uint32_t m_bitrate = 0;        /**< Bitrate of the most recent second of output (in kbit/s). */
+    TimeHistogram m_filterTime;                /**< Time taken to convert each frame. */
+    TimeHistogram m_encodeTime;                /**< Time taken to encode each frame (excluding muxing). */
+    TimeHistogram m_muxTime;                   /**< Time taken to write each encoded frame. */
+
+    /** Clears all statistics. */
+    void reset() noexcept;
+};
+
 class Encoder
 {
 public:
@@ -114,50 +216,205 @@ public:
      * @param scale      The scale that needs to be applied to input pixels.
      * @param numThreads Number of threads to use.
      * @param useGPU     True to use GPU accelerated encoding.
+     * @param fragmented True to write fragmented MP4 output (a fragment per GOP) so that the file is playable while
+     *  it is being written.
      * @param error      (Optional) The callback used to signal errors.
      * @returns True if it succeeds, false if it fails.
      */
     bool init(const std::string& filename, uint32_t width, uint32_t height, uint32_t fps, int32_t format, float scale,
-        uint32_t numThreads, bool useGPU, errorCallback error = nullptr) noexcept;
+        uint32_t numThreads, bool useGPU, bool fragmented, errorCallback error = nullptr) noexcept;
 
     /**
-     * Adds a frame to be processed.
-     * @param [in] data   The image data.
-     * @param      width  The image width.
-     * @param      height The image height.
-     * @param      stride The image stride.
+     * Prepares the encoder ahead of time by creating the filter graph and opening the codec.
+     * @note This performs all the expensive setup so that a later call to start() only needs to open the file. If the
+     *  rendition has a preview then encoded packets are also sent to it as MPEG-TS. Preview encoding uses intra refresh
+     *  so fragmented output is no longer split at regular keyframes.
+     * @param width      The input width.
+     * @param height     The input height.
+     * @param fps        The input FPS.
+     * @param format     The input frame pixel format.
+     * @param scale      The scale that needs to be applied to input pixels.
+     * @param numThreads Number of threads to use.
+     * @param useGPU     True to use GPU accelerated encoding.
+     * @param fragmented True to write fragmented MP4 output (a fragment per GOP).
+     * @param rendition  The output size and codec settings. If useGPU is set then the codec must be an NVEncoder. If
+     *  no codec is set then the default for the input format is used.
+     * @param error      (Optional) The callback used to signal errors.
      * @returns True if it succeeds, false if it fails.
      */
-    bool addFrame(uint8_t* data, uint32_t width, uint32_t height, uint32_t stride) noexcept;
+    bool prepare(uint32_t width, uint32_t height, uint32_t fps, int32_t format, float scale, uint32_t numThreads,
+        bool useGPU, bool fragmented, const Rendition& rendition, errorCallback error = nullptr) noexcept;
+
+    /**
+     * Opens the output file and starts encoding.
+     * @note prepare() must be called before this function can be used.
+     * @param filename Filename of the file.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool start(const std::string& filename) noexcept;
+
+    /**
+     * Query if the encoder has been prepared and is waiting to be started.
+     * @returns True if prepared, false if not.
+     */
+    [[nodiscard]] bool isPrepared() const noexcept;
+
+    /**
+     * Sets an encoder that receives every converted frame so that it can derive a smaller rendition from it.
+     * @note The downstream encoder must be prepared with input of the format and size returned by getPixelFormat(),
+     *  getWidth() and getHeight(). It must be started before and shutdown after this encoder.
+     * @param encoder The downstream encoder (nullptr to remove).
+     */
+    void setDownstream(Encoder* encoder) noexcept;
+
+    /**
+     * Sets the priority that frames are processed with on the thread pool.
+     * @note Must be called before start() for it to take effect.
+     * @param priority The priority.
+     */
+    void setPriority(TaskPriority priority) noexcept;
+
+    /**
+     * Sets whether GRAY16 and BGRA input is mirrored horizontally (as camera images are) before it is encoded.
+     * @note Must be called before prepare() for it to take effect. Input that is already oriented as it should be
+     *  stored (such as the composite) must not be mirrored.
+     * @param mirror True to mirror the input (the default).
+     */
+    void setMirror(bool mirror) noexcept;
+
+    /**
+     * Gets the width of encoded frames.
+     * @note prepare() must be called before this function can be used.
+     * @returns The width.
+     */
+    [[nodiscard]] uint32_t getWidth() const noexcept;
+
+    /**
+     * Gets the height of encoded frames.
+     * @note prepare() must be called before this function can be used.
+     * @returns The height.
+     */
+    [[nodiscard]] uint32_t getHeight() const noexcept;
+
+    /**
+     * Gets the pixel format of converted frames.
+     * @note prepare() must be called before this function can be used.
+     * @returns The pixel format.
+     */
+    [[nodiscard]] int32_t getPixelFormat() const noexcept;
+
+    /**
+     * Gets the file extension used by the output container.
+     * @note prepare() must be called before this function can be used.
+     * @returns The file extension (including the leading '.').
+     */
+    [[nodiscard]] const std::string& getFileExtension() const noexcept;
+
+    /**
+     * Gets the number of frame allocations made since the encoder was prepared.
+     * @note Frames and their storage are pooled so this should stop increasing once the pool has warmed up.
+     * @returns The allocation count.
+     */
+    [[nodiscard]] uint32_t getAllocationCount() const noexcept;
+
+    /**
+     * Gets the number of frames that have been added but not yet encoded.
+     * @note This may be called from any thread. Frames that have been converted and are waiting to be encoded are
+     *  included so this may exceed getQueueSize() by the size of the encode stage queue.
+     * @returns The number of frames.
+     */
+    [[nodiscard]] uint32_t getQueueDepth() const noexcept;
+
+    /**
+     * Gets the live statistics of the encoder.
+     * @note The statistics may be read from any thread. They are reset each time the encoder is started.
+     * @returns The statistics.
+     */
+    [[nodiscard]] const EncoderStatistics& getStatistics() const noexcept;
+
+    /**
+     * Gets the maximum number of frames that can be waiting to be encoded before new frames are rejected.
+     * @returns The number of frames.
+     */
+    [[nodiscard]] static constexpr uint32_t getQueueSize() noexcept
+    {
+        return decltype(m_dataBuffer)::size();
+    }
+
+    /**
+     * Adds a frame to be processed.
+     * @param [in] data      The image data.
+     * @param      width     The image width.
+     * @param      height    The image height.
+     * @param      stride    The image stride.
+     * @param      timestamp The device timestamp of the image (in microseconds).
+     * @returns True if it succeeds, false if it fails or the frame was dropped as the queue is full.
+     */
+    bool addFrame(uint8_t* data, uint32_t width, uint32_t height, uint32_t stride, uint64_t timestamp) noexcept;
+
+    /**
+     * Adds a frame to be processed.
+     * @note If the image has an owner then its data is used directly without copying and the owner is held until the
+     *  frame has been encoded. Otherwise the image data is copied. Images must have the dimensions the encoder was
+     *  prepared with.
+     * @param image     The image.
+     * @param timestamp The device timestamp of the image (in microseconds).
+     * @returns True if it succeeds, false if it fails or the frame was dropped as the queue is full.
+     */
+    bool addFrame(const KinectImage& image, uint64_t timestamp) noexcept;
 
     /** Notify to shutdown.
-     * @note This function is synchronous and will block until thread has completed.
+     * @note This function is synchronous and will block until thread has completed. Frames that were already added
+     *  are encoded before the output is finalised.
      */
     void shutdown() noexcept;
 
 private:
     std::atomic_bool m_shutdown = false;
-    std::mutex m_lock;
-    std::condition_variable m_condition;
 
-    std::array<FramePtr, 32 /*must be power of 2*/> m_dataBuffer;
-    std::atomic_uint32_t m_bufferIndex = 0;
-    std::atomic_int32_t m_remainingBuffers = 0;
-    uint32_t m_nextBufferIndex = 0;
+    RingBuffer<FramePtr, 32> m_dataBuffer;
+    RingBuffer<FramePtr, 4> m_encodeBuffer; /**< Converted frames waiting for the encode stage. */
     int32_t m_format = 0;
-    uint64_t m_frameNumber = 0;
+    uint32_t m_inputWidth = 0;  /**< The input width the filter was prepared with. */
+    uint32_t m_inputHeight = 0; /**< The input height the filter was prepared with. */
+    int64_t m_startTime = 0;
+    bool m_headerWritten = false;
+    bool m_opened = false;
     bool m_useGPU = false;
+    bool m_fragmented = false;
+    Rendition m_rendition;
+    const Codec* m_codec = nullptr;
+    bool m_adaptive = false;         /**< True if the rate controller can change the quality level or preset. */
+    uint32_t m_qualityStep = 0;      /**< Number of quality reductions currently applied by the rate controller. */
+    uint32_t m_maxQualitySteps = 0;  /**< Number of quality reductions the rate controller can make. */
+    uint32_t m_presetStep = 0;       /**< Number of faster presets currently applied by the rate controller. */
+    uint32_t m_maxPresetSteps = 0;   /**< Number of faster presets with the same stream headers. */
+    uint32_t m_framesSinceAdapt = 0; /**< Frames encoded since the rate controller last changed the quality. */
+    int64_t m_encodeTime = 0;        /**< Moving average of the time taken to encode a frame (in microseconds). */
+    int64_t m_muxTime = 0;           /**< Time spent muxing the most recently encoded frame (in microseconds). */
+    int64_t m_bitrateStart = 0;      /**< Timestamp of the start of the current bitrate window. */
+    uint64_t m_bitrateBytes = 0;     /**< Bytes written in the current bitrate window. */
+    EncoderStatistics m_statistics;
+    Encoder* m_downstream = nullptr;
+    TaskPriority m_priority = TaskPriority::Normal;
+    bool m_mirror = true; /**< True if input is mirrored horizontally before encoding. */
 
     OutputFormatContextPtr m_formatContext;
     CodecContextPtr m_codecContext;
+    BufferPoolPtr m_bufferPool;
+    OutputFormatContextPtr m_previewContext; /**< The live preview output (if enabled and open). */
+    BitstreamFilterPtr m_previewFilter;      /**< Repeats stream headers so consumers can join at any time. */
+    FramePtr m_deviceFrame;
+    std::atomic_uint32_t m_allocations = 0;
+    AVRational m_frameRate;
     AVRational m_timebase;
     Filter m_filter;
-    std::thread m_thread;
+    SerialTask m_filterTask;
+    SerialTask m_encodeTask;
     errorCallback m_errorCallback = nullptr;
 
     /**
-     * Initializes the output files and encoders/filters.
-     * @param filename   Filename of the file.
+     * Initializes the encoders/filters.
      * @param width      The input width.
      * @param height     The input height.
      * @param format     The input frame pixel format.
@@ -165,43 +422,146 @@ private:
      * @param numThreads Number of threads to use.
      * @returns True if it succeeds, false if it fails.
      */
-    [[nodiscard]] bool initOutput(const std::string& filename, uint32_t width, uint32_t height, int32_t format,
-        float scale, uint32_t numThreads) noexcept;
+    [[nodiscard]] bool initOutput(
+        uint32_t width, uint32_t height, int32_t format, float scale, uint32_t numThreads) noexcept;
+
+    /**
+     * Opens the output file for the prepared output.
+     * @param filename Filename of the file.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool openOutput(const std::string& filename) noexcept;
+
+    /**
+     * Opens the live preview output of the rendition.
+     * @note Failure to open the preview is logged but does not prevent recording.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool openPreview() noexcept;
+
+    /**
+     * Writes an encoded packet to the live preview output.
+     * @note The preview is closed if writing fails (e.g. if the consumer goes away).
+     * @param packet The packet with timestamps in the main output stream timebase.
+     */
+    void writePreview(const AVPacket& packet) noexcept;
+
+    /** Closes the live preview output. */
+    void closePreview() noexcept;
+
+    /**
+     * Gets the next free frame on the pending stack.
+     * @returns The frame, nullptr if the pending stack is full.
+     */
+    [[nodiscard]] FramePtr* getFreeFrame() noexcept;
+
+    /**
+     * Fills in the timestamp of a frame and places it on the pending stack.
+     * @param [in,out] frame     The frame returned from getFreeFrame().
+     * @param          timestamp The device timestamp of the frame (in microseconds).
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool queueFrame(FramePtr& frame, uint64_t timestamp) noexcept;
+
+    /**
+     * Adds a frame that has already been converted by an upstream encoder.
+     * @note The frame data is referenced and not copied.
+     * @param frame     The converted frame.
+     * @param timestamp The device timestamp of the frame (in microseconds).
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool addConvertedFrame(const FramePtr& frame, uint64_t timestamp) noexcept;
+
+    /**
+     * Allocates a new buffer for the frame buffer pool.
+     * @param opaque The encoder that owns the pool.
+     * @param size   The size of the buffer.
+     * @returns The new buffer, nullptr if it fails.
+     */
+    static AVBufferRef* allocBuffer(void* opaque, int size) noexcept;
+
+    /**
+     * Writes the file header to the output.
+     * @note This is delayed until the first frame is available so that its timestamp can be stored in the file.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool writeHeader() noexcept;
+
+    /** Logs a summary of the statistics of the current output. */
+    void logStatistics() const noexcept;
 
     /** Cleanup output files opened during @initOutput. */
     void cleanupOutput() noexcept;
 
     /**
-     * Run image recording and processing.
-     * @note init() must be called before this function can be used.
+     * Run the filter stage of the encode pipeline.
+     * @note This is run on the thread pool whenever new frames are queued. Once either stage fails no further frames
+     *  are processed until the encoder is restarted.
      * @returns True if it succeeds, false if it fails.
      */
-    [[nodiscard]] bool run() noexcept;
+    bool runFilter() noexcept;
 
     /**
-     * Process any pending frames.
+     * Run the encode stage of the encode pipeline.
+     * @note This is run on the thread pool whenever the filter stage queues converted frames.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool runEncode() noexcept;
+
+    /**
+     * Filter any pending frames and pass them on to the encode stage.
+     * @note Stops early if the encode stage queue is full, the encode stage resumes it once space is available.
      * @returns True if it succeeds, false if it fails.
      */
     bool process() noexcept;
 
     /**
-     * Process the input frame.
-     * @param [in,out] frame The frame.
+     * Encode any frames that are waiting in the encode stage queue.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool encodeFrames() noexcept;
+
+    /**
+     * Updates the rate controller after a frame has been encoded.
+     * @note The quality level is reduced in steps while the queue is filling up or frames take longer to encode than
+     *  the frame interval, then a faster preset is used if that isn't enough. Both are restored once the encoder has
+     *  caught up. Each change is logged. Only faster presets that produce the same stream headers are used (checked
+     *  when the encoder is prepared), for x264 this often leaves only the quality steps.
+     * @param encodeTime The time taken to encode the frame (in microseconds).
+     * @returns True if it succeeds, false if writing out frames while changing preset failed.
+     */
+    [[nodiscard]] bool adaptQuality(int64_t encodeTime) noexcept;
+
+    /**
+     * Opens a new encoder with the same settings as the current one but a different preset.
+     * @note This fails if the new encoder's stream headers differ from those already written to the output, as the
+     *  output can't store more than one set.
+     * @param          presetStep   The number of presets faster than the rendition preset.
+     * @param          quality      The quality level.
+     * @param [out]    codecContext The new encoder.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool openPresetCodec(
+        uint32_t presetStep, uint32_t quality, CodecContextPtr& codecContext) const noexcept;
+
+    /**
+     * Filter the input frame.
+     * @param [in,out] frame The frame, replaced by the converted frame.
      * @returns True if it succeeds, false if it fails.
      */
-    bool processFrame(FramePtr& frame) const noexcept;
+    bool filterFrame(FramePtr& frame) const noexcept;
 
     /**
      * Encode frame.
      * @param frame The frame.
      * @returns True if it succeeds, false if it fails.
      */
-    [[nodiscard]] bool encodeFrame(FramePtr& frame) const noexcept;
+    [[nodiscard]] bool encodeFrame(FramePtr& frame) noexcept;
 
     /**
      * Writes encoded frames to output.
      * @returns True if it succeeds, false if it fails.
      */
-    [[nodiscard]] bool muxFrames() const noexcept;
+    [[nodiscard]] bool muxFrames() noexcept;
 };
 } // namespace Ak
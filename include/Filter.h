@@ -15,9 +15,14 @@
  * limitations under the License.
  */
 
+#include "Convert.h"
+
+#include <array>
 #include <functional>
 #include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 extern "C" {
 #include <libavutil/pixfmt.h>
@@ -26,6 +31,7 @@ extern "C" {
 
 struct AVFilterGraph;
 struct AVFilterContext;
+struct AVBufferPool;
 
 namespace Ak {
 class FramePtr;
@@ -65,17 +71,44 @@ public:
 
     /**
      * Initializes the filter.
+     * @note When converting to YUV420P, GRAY16 input is converted directly using a fused conversion instead of a filter
+     *  graph if the CPU supports it and BGRA input is always converted using a fused conversion that is split into a
+     *  band per thread, with the bands run on the thread pool. Input other than GRAY16 and BGRA is assumed to be the
+     *  output of another filter (so is already mirrored if required) and is only resized. GRAY16 output is stored
+     *  unscaled.
+     * @param width        The input frame width.
+     * @param height       The input frame height.
+     * @param outputWidth  The output frame width (0 to use the input width).
+     * @param outputHeight The output frame height (0 to maintain the input aspect ratio).
+     * @param fps          The input frame FPS.
+     * @param timebase     The timebase of input frame timestamps.
+     * @param format       The input frame pixel format to use.
+     * @param outputFormat The output frame pixel format.
+     * @param scale        The scale that needs to be applied to input pixels.
+     * @param numThreads   Number of threads.
+     * @param mirror       True to mirror GRAY16 and BGRA input horizontally (as camera images are).
+     * @param error        (Optional) The callback used to signal errors.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool init(uint32_t width, uint32_t height, uint32_t outputWidth, uint32_t outputHeight, AVRational fps,
+        AVRational timebase, int32_t format, int32_t outputFormat, float scale, uint32_t numThreads, bool mirror,
+        errorCallback error = nullptr) noexcept;
+
+    /**
+     * Initializes the filter to reverse the conversions performed by @init.
      * @param width      The input frame width.
      * @param height     The input frame height.
      * @param fps        The input frame FPS.
-     * @param format     The input frame pixel format to use.
-     * @param scale      The scale that needs to be applied to input pixels.
+     * @param timebase   The timebase of input frame timestamps.
+     * @param inFormat   The input frame pixel format.
+     * @param outFormat  The output frame pixel format (the format originally passed to @init).
+     * @param scale      The scale that was applied to input pixels by @init.
      * @param numThreads Number of threads.
      * @param error      (Optional) The callback used to signal errors.
      * @returns True if it succeeds, false if it fails.
      */
-    bool init(uint32_t width, uint32_t height, AVRational fps, int32_t format, float scale, uint32_t numThreads,
-        errorCallback error = nullptr) noexcept;
+    bool initInverse(uint32_t width, uint32_t height, AVRational fps, AVRational timebase, int32_t inFormat,
+        int32_t outFormat, float scale, uint32_t numThreads, errorCallback error = nullptr) noexcept;
 
     /**
      * Sends a frame to be filtered
@@ -120,6 +153,83 @@ private:
     FilterGraphPtr m_filterGraph;        /**< The filter graph. */
     AVFilterContext* m_source = nullptr; /**< The input for the filter graph. */
     AVFilterContext* m_sink = nullptr;   /**< The output of the filter graph.*/
+    std::shared_ptr<AVBufferPool> m_convertPool = nullptr; /**< Output storage when using the fused conversion. */
+    uint32_t m_sourceWidth = 0;                            /**< The input width when using the fused conversion. */
+    uint32_t m_sourceHeight = 0;                           /**< The input height when using the fused conversion. */
+    int32_t m_sourceFormat = 0;                            /**< The input format when using the fused conversion. */
+    uint32_t m_width = 0;                                  /**< The frame width when using the fused conversion. */
+    uint32_t m_height = 0;                                 /**< The frame height when using the fused conversion. */
+    AVRational m_frameRate = {0, 1};                       /**< The frame rate when using the fused conversion. */
+    float m_scale = 1.0f;                                  /**< The pixel scale when using the fused conversion. */
+    uint32_t m_numThreads = 1;                             /**< Number of bands used by the fused conversion. */
+    bool m_useAVX2 = false;                                /**< True if the fused conversion uses AVX2. */
+    bool m_mirror = true;                                  /**< True if the fused conversion mirrors the image. */
+    std::array<ResizeBins, 2> m_bins;                      /**< Luma and chroma bins used by the fused conversion. */
+    mutable std::vector<ResizeScratch> m_scratch;          /**< Working storage for each band of the conversion. */
     errorCallback m_errorCallback = nullptr;
+
+    /**
+     * Initializes the fused GRAY16/BGRA to YUV420 conversion used in place of a filter graph.
+     * @param width        The input frame width.
+     * @param height       The input frame height.
+     * @param outputWidth  The output frame width (must equal width for GRAY16).
+     * @param outputHeight The output frame height (must equal height for GRAY16).
+     * @param fps          The input frame FPS.
+     * @param format       The input frame pixel format.
+     * @param scale        The scale that needs to be applied to input pixels.
+     * @param numThreads   Number of threads.
+     * @param mirror       True to mirror the image horizontally (must be true for GRAY16).
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool initConvert(uint32_t width, uint32_t height, uint32_t outputWidth, uint32_t outputHeight,
+        AVRational fps, int32_t format, float scale, uint32_t numThreads, bool mirror) noexcept;
+
+    /**
+     * Converts a frame using the fused conversion.
+     * @note The converted data replaces the data in the input frame.
+     * @param [in,out] frame The frame.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool convertFrame(FramePtr& frame) const noexcept;
+
+    /**
+     * Creates a new filter graph containing only the input and output buffers.
+     * @param [out] graph      The new filter graph.
+     * @param [out] source     The input buffer of the graph.
+     * @param [out] sink       The output buffer of the graph.
+     * @param       width      The input frame width.
+     * @param       height     The input frame height.
+     * @param       fps        The input frame FPS.
+     * @param       timebase   The timebase of input frame timestamps.
+     * @param       inFormat   The input frame pixel format.
+     * @param       outFormat  The output frame pixel format.
+     * @param       numThreads Number of threads.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool initGraph(FilterGraphPtr& graph, AVFilterContext*& source, AVFilterContext*& sink,
+        uint32_t width, uint32_t height, AVRational fps, AVRational timebase, int32_t inFormat, int32_t outFormat,
+        uint32_t numThreads) const noexcept;
+
+    /**
+     * Adds a filter to the end of a filter chain.
+     * @param          graph      The filter graph.
+     * @param [in,out] nextFilter The last filter in the chain, updated to the newly added filter.
+     * @param          name       The name of the filter to add.
+     * @param          options    (Optional) The filter options.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool addFilter(const FilterGraphPtr& graph, AVFilterContext*& nextFilter, const std::string& name,
+        const std::vector<std::pair<std::string, std::string>>& options = {}) const noexcept;
+
+    /**
+     * Links the filter chain to the output buffer and configures the completed graph.
+     * @param graph      The filter graph.
+     * @param source     The input buffer of the graph.
+     * @param lastFilter The last filter in the chain.
+     * @param sink       The output buffer of the graph.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool configureGraph(
+        FilterGraphPtr& graph, AVFilterContext* source, AVFilterContext* lastFilter, AVFilterContext* sink) noexcept;
 };
 } // namespace Ak
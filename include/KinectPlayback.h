@@ -0,0 +1,115 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DataTypes.h"
+#include "Decoder.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Ak {
+class KinectPlayback
+{
+public:
+    KinectPlayback() noexcept = default;
+
+    ~KinectPlayback();
+
+    KinectPlayback(const KinectPlayback& other) noexcept = delete;
+
+    KinectPlayback(KinectPlayback&& other) noexcept = delete;
+
+    KinectPlayback& operator=(const KinectPlayback& other) noexcept = delete;
+
+    KinectPlayback& operator=(KinectPlayback&& other) noexcept = delete;
+
+    using errorCallback = std::function<void(const std::string&)>;
+    using readyCallback = std::function<void(const KinectCalibration&)>;
+    using dataCallback = std::function<void(uint64_t, std::chrono::steady_clock::time_point, const KinectImage&,
+        const KinectImage&, const KinectImage&, const KinectImage&, const KinectJoints&)>;
+    using finishedCallback = std::function<void()>;
+
+    /**
+     * Initializes playback of a previously recorded session.
+     * @param baseName The base filename of the recording (i.e. without the "_depth.mp4", ".csv" etc. suffix).
+     * @param speed    The playback speed relative to real time. A value of 0 plays back as fast as possible.
+     * @param error    (Optional) The callback used to signal errors.
+     * @param ready    (Optional) The callback used to signal playback is ready for operations.
+     * @param data     (Optional) The callback used to signal updated image/position data, this is passed the
+     *  device timestamp and the host time the capture was due.
+     * @param finished (Optional) The callback used to signal that the end of the recording has been reached (or that
+     *  the recording could not be opened).
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool init(const std::string& baseName, float speed, errorCallback error = nullptr, readyCallback ready = nullptr,
+        dataCallback data = nullptr, finishedCallback finished = nullptr) noexcept;
+
+    /** Notify to shutdown.
+     * @note This function is synchronous and will block until thread has completed.
+     */
+    void shutdown() noexcept;
+
+private:
+    std::atomic_bool m_shutdown = false;
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+    std::string m_baseName;
+    float m_speed = 1.0f;
+    std::array<Decoder, 3> m_decoders;
+    std::array<bool, 3> m_hasVideo = {false, false, false};
+    std::ifstream m_skeletonFile;
+    std::thread m_playbackThread;
+    errorCallback m_errorCallback = nullptr;
+    dataCallback m_dataCallback = nullptr;
+    finishedCallback m_finishedCallback = nullptr;
+    KinectCalibration m_calibration;
+
+    /**
+     * Opens the recorded files and determines the calibration information for the recording.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool initPlayback() noexcept;
+
+    /**
+     * Run data playback and processing.
+     * @note init() must be called before this function can be used.
+     * @param ready (Optional) The callback used to signal playback is ready for operations.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool run(const readyCallback& ready = nullptr) noexcept;
+
+    /**
+     * Reads the next row of joint data from the skeleton file.
+     * @param [out] time   The timestamp of the row.
+     * @param [out] joints The joint data.
+     * @returns True if it succeeds, false if there are no more rows available.
+     */
+    [[nodiscard]] bool readSkeleton(uint64_t& time, std::vector<Joint>& joints) noexcept;
+
+    /** Cleanup any resources created during init(). */
+    void cleanup() noexcept;
+};
+} // namespace Ak
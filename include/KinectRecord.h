@@ -17,14 +17,20 @@
 
 #include "DataTypes.h"
 #include "Encoder.h"
+#include "RingBuffer.h"
+#include "ThreadPool.h"
 
 #include <array>
 #include <atomic>
 #include <cstdint>
 #include <fstream>
 #include <functional>
+#include <k4abttypes.h>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <thread>
+#include <vector>
 
 namespace Ak {
 class KinectRecord
@@ -80,6 +86,13 @@ public:
     void dataCallback(uint64_t time, const KinectImage& depthImage, const KinectImage& colourImage,
         const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept;
 
+    /**
+     * Callback used by the display when a new composite image (image with shadow and skeleton overlays) is available.
+     * @param time  The timestamp of the capture the composite was rendered from.
+     * @param image The BGRA composite image.
+     */
+    void compositeCallback(uint64_t time, const KinectImage& image) noexcept;
+
     /**
      * Sets what types of data should be recorded.
      * @param depthImage   True to render depth image.
@@ -87,9 +100,29 @@ public:
      * @param irImage      True to render IR image.
      * @param bodySkeleton True to render body skeleton.
      * @param useGPUEncode True to use GPU encoding of video.
+     * @param fragmented   True to write video as fragmented MP4.
+     */
+    void setRecordOptions(bool depthImage, bool colourImage, bool irImage, bool bodySkeleton, bool useGPUEncode,
+        bool fragmented) noexcept;
+
+    /**
+     * Sets whether the displayed composite should also be recorded.
+     * @note The composite images must be passed to compositeCallback.
+     * @param compositeImage True to record the composite.
+     * @param width          The width of composite images.
+     * @param height         The height of composite images.
+     */
+    void setCompositeOptions(bool compositeImage, uint32_t width, uint32_t height) noexcept;
+
+    /**
+     * Sets the renditions that a stream is recorded to.
+     * @note Renditions must be ordered from largest to smallest as each is derived from the one before it. Renditions
+     *  larger than the stream image are skipped. By default depth and IR are recorded losslessly and colour is recorded
+     *  to a 640 wide proxy.
+     * @param stream     The stream index (0 for depth, 1 for colour, 2 for IR, 3 for composite).
+     * @param renditions The renditions.
      */
-    void setRecordOptions(
-        bool depthImage, bool colourImage, bool irImage, bool bodySkeleton, bool useGPUEncode) noexcept;
+    void setRenditions(uint32_t stream, const std::vector<Rendition>& renditions) noexcept;
 
     /**
      * Updates the calibration information for the camera
@@ -101,30 +134,81 @@ private:
     std::atomic_bool m_shutdown = false;
     std::atomic_bool m_run = false;
     std::atomic_bool m_run2 = false;
+    bool m_rearm = false;
+    bool m_calibrated = false;
     std::mutex m_lock;
     std::condition_variable m_condition;
+    std::shared_mutex m_encoderLock; // Held shared while adding frames, encoders only change once m_run2 is cleared
+
+    struct RecordOptions
+    {
+        bool m_depthImage = true;
+        bool m_colourImage = false;
+        bool m_irImage = false;
+        bool m_bodySkeleton = true;
+        bool m_useGPUEncode = false;
+        bool m_fragmented = true;
+        bool m_compositeImage = false;
+        uint32_t m_compositeWidth = 0;
+        uint32_t m_compositeHeight = 0;
+    };
 
     struct DataBuffers
     {
         uint64_t m_timeStamp;
-        std::vector<Joint> m_joints;
+        std::array<Joint, K4ABT_JOINT_COUNT> m_joints;
     };
 
-    std::array<DataBuffers, 32 /*must be power of 2*/> m_dataBuffer;
-    std::atomic_uint32_t m_bufferIndex = 0;
-    std::atomic_int32_t m_remainingBuffers = 0;
-    uint32_t m_nextBufferIndex = 0;
-    bool m_depthImage = true;
-    bool m_colourImage = false;
-    bool m_irImage = false;
-    bool m_bodySkeleton = true;
-    bool m_useGPUEncode = false;
+    RingBuffer<DataBuffers, 32> m_dataBuffer;
+    RecordOptions m_requestedOptions; // Set by the GUI thread (protected by m_lock)
+    RecordOptions m_options;          // Copy used by the prepared encoders
     std::ofstream m_skeletonFile;
     std::atomic_uint32_t m_pid = 0;
-    std::array<Encoder, 3> m_encoders;
+    std::array<std::vector<Rendition>, 4> m_requestedRenditions = {std::vector<Rendition>{Rendition()},
+        std::vector<Rendition>{Rendition{640}}, std::vector<Rendition>{Rendition()},
+        std::vector<Rendition>{Rendition()}};
+    std::array<std::vector<Rendition>, 4> m_renditions;
+    std::array<std::vector<std::unique_ptr<Encoder>>, 4> m_encoders;
     std::thread m_recordThread;
+    SerialTask m_skeletonTask;
     errorCallback m_errorCallback = nullptr;
-    KinectCalibration m_calibration;
+    KinectCalibration m_calibration; // Protected by m_lock
+
+    /**
+     * Prepares the encoders for the current record options so that recording can start without delay.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool prepareOutput() noexcept;
+
+    /**
+     * Prepares an encoder for each rendition of a stream.
+     * @param stream     The stream index (0 for depth, 1 for colour, 2 for IR, 3 for composite).
+     * @param width      The input width.
+     * @param height     The input height.
+     * @param format     The input frame pixel format.
+     * @param fps        The frame rate.
+     * @param scale      The scale that needs to be applied to input pixels.
+     * @param numThreads Number of threads to use.
+     * @param renditions The renditions ordered from largest to smallest.
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool prepareStream(uint32_t stream, uint32_t width, uint32_t height, int32_t format, uint32_t fps,
+        float scale, uint32_t numThreads, const std::vector<Rendition>& renditions) noexcept;
+
+    /**
+     * Query if all encoders of a stream have been prepared.
+     * @param stream The stream index.
+     * @returns True if prepared, false if not.
+     */
+    [[nodiscard]] bool isStreamPrepared(uint32_t stream) const noexcept;
+
+    /**
+     * Starts all encoders of a stream.
+     * @param stream   The stream index.
+     * @param filename Base filename of the output files (the rendition name and extension are appended).
+     * @returns True if it succeeds, false if it fails.
+     */
+    [[nodiscard]] bool startStream(uint32_t stream, const std::string& filename) noexcept;
 
     /**
      * Initializes the output files for recording.
@@ -135,6 +219,9 @@ private:
     /** Cleanup output files opened during @initOutput. */
     void cleanupOutput() noexcept;
 
+    /** Writes all pending joint data to the skeleton file (run on the thread pool). */
+    void writeSkeleton() noexcept;
+
     /**
      * Run data recording and processing.
      * @note init() must be called before this function can be used.
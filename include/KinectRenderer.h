@@ -0,0 +1,466 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "DataTypes.h"
+
+#include <QOpenGLExtraFunctions>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Ak {
+/**
+ * Renders images and skeletons using OpenGL.
+ * @note All functions other than those noted must be called with the same OpenGL (4.3 or newer) context current.
+ *  The render target (window or framebuffer object) must be bound before calling render.
+ */
+class KinectRenderer final : protected QOpenGLExtraFunctions
+{
+public:
+    using errorCallback = std::function<void(const std::string&)>;
+    using captureCallback = std::function<void(uint64_t, const KinectImage&)>;
+
+    /**
+     * Creates all OpenGL resources.
+     * @param error (Optional) The error callback.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool init(errorCallback error = nullptr) noexcept;
+
+    /** Cleanup any OpenGL resources */
+    void cleanup() noexcept;
+
+    /**
+     * Sets what types of data should be rendered.
+     * @note This may be called from any thread, refreshRender must then be called before rendering.
+     * @param depthImage   True to render depth image.
+     * @param colourImage  True to render colour image.
+     * @param irImage      True to render IR image.
+     * @param pointCloud   True to render the depth image as a 3D point cloud.
+     * @param bodyShadow   True to render body shadow.
+     * @param bodySkeleton True to render body skeleton.
+     */
+    void setRenderOptions(bool depthImage, bool colourImage, bool irImage, bool pointCloud, bool bodyShadow,
+        bool bodySkeleton) noexcept;
+
+    /**
+     * Sets the calibration information for the camera.
+     * @note This may be called from any thread, refreshCalibration and refreshRender must then be called before
+     *  rendering.
+     * @param calibration The calibration data.
+     */
+    void setCalibration(const KinectCalibration& calibration) noexcept;
+
+    /** Updates render settings after the render options or calibration have changed. */
+    void refreshRender() noexcept;
+
+    /** Resizes image textures and pixel buffers after the calibration has changed. */
+    void refreshCalibration() noexcept;
+
+    /**
+     * Sets the camera used to view the point cloud.
+     * @note The camera orbits a point 2m in front of the depth camera, the default orbit views from the depth camera.
+     * @param yaw      The horizontal rotation around the orbit point (radians).
+     * @param pitch    The vertical rotation around the orbit point (radians).
+     * @param distance The distance from the orbit point (metres).
+     */
+    void setOrbitCamera(float yaw, float pitch, float distance) noexcept;
+
+    /** The distance in front of the depth camera that the point cloud camera orbits around (metres). */
+    static constexpr float s_orbitTarget = 2.0f;
+
+    /**
+     * Updates the render viewport, this is kept centred in the target with the aspect ratio of the displayed image.
+     * @param width  The width of the render target.
+     * @param height The height of the render target.
+     */
+    void resize(int width, int height) noexcept;
+
+    /**
+     * Uploads new image/position information to be rendered.
+     * @param depthImage  The depth image data.
+     * @param colourImage The colour image data.
+     * @param irImage     The IR image data.
+     * @param shadowImage The body shadow image data.
+     * @param joints      The joint data.
+     */
+    void uploadData(const KinectImage& depthImage, const KinectImage& colourImage, const KinectImage& irImage,
+        const KinectImage& shadowImage, const KinectJoints& joints) noexcept;
+
+    /** Renders the most recently uploaded data to the currently bound framebuffer. */
+    void render() noexcept;
+
+    /**
+     * Sets whether the frame timing overlay is rendered.
+     * @note The overlay shows a bar for the GPU time of each pass (upload, image, shadow, skeleton compute and skeleton
+     *  draw) followed by the CPU timings. Bars span 0-33ms with a marker at the 16.7ms frame budget.
+     * @param show True to render the overlay.
+     */
+    void setTimingOverlay(bool show) noexcept;
+
+    /**
+     * Sets the CPU timings shown in the frame timing overlay.
+     * @param updateTime The time taken to upload the latest data (ms).
+     * @param paintTime  The CPU time taken to render the previous frame (ms).
+     * @param latency    The time from data being captured until it was presented (ms).
+     */
+    void setCPUTimings(float updateTime, float paintTime, float latency) noexcept;
+
+    /**
+     * Starts capturing the rendered composite at a fixed resolution.
+     * @note Captures are read back asynchronously so that the render thread never waits on the GPU.
+     * @param width    The width of captured images.
+     * @param height   The height of captured images.
+     * @param callback The callback that is passed each captured BGRA image along with its timestamp (the image data is
+     *  only valid during the call).
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool initCapture(uint32_t width, uint32_t height, captureCallback callback) noexcept;
+
+    /** Stops capturing, any captures that are still being read back are passed on first. */
+    void cleanupCapture() noexcept;
+
+    /**
+     * Renders the most recently uploaded data into the capture framebuffer and starts reading it back.
+     * @note Earlier captures that have finished reading back are passed to the capture callback. If every read back
+     *  buffer is still in use then the frame is dropped.
+     * @param time The timestamp of the uploaded data.
+     */
+    void capture(uint64_t time) noexcept;
+
+    /**
+     * Query if rendered frames are being captured.
+     * @returns True if capturing, false if not.
+     */
+    [[nodiscard]] bool isCapturing() const noexcept;
+
+    /**
+     * Gets the number of frames that couldn't be captured as the previous read backs hadn't completed.
+     * @returns The dropped frames.
+     */
+    [[nodiscard]] uint64_t getDroppedCaptures() const noexcept;
+
+    /**
+     * Gets pixel buffer storage that image data can be written to directly so that it is uploaded without blocking.
+     * @note This may be called from any thread. Images (and the shadow image) written to the storage must then be
+     *  passed to uploadData (or releasePixelBuffer) which releases the storage once the GPU has finished reading
+     *  from it.
+     * @param size The required storage size in bytes.
+     * @returns The storage, nullptr if none is free (the data must then be passed in client memory).
+     */
+    [[nodiscard]] uint8_t* acquirePixelBuffer(size_t size) noexcept;
+
+    /**
+     * Releases the pixel buffer that data was written to without uploading it.
+     * @note This may be called from any thread.
+     * @param data The image data.
+     */
+    void releasePixelBuffer(const uint8_t* data) noexcept;
+
+    /**
+     * Gets the offset in pixel buffer storage that the shadow image is written to.
+     * @param imageSize The size of the image written at the start of the storage.
+     * @returns The offset.
+     */
+    [[nodiscard]] static constexpr size_t getShadowOffset(const size_t imageSize) noexcept
+    {
+        return (imageSize + 63) & ~static_cast<size_t>(63);
+    }
+
+private:
+    // View port setting
+    int m_targetWidth = 0;
+    int m_targetHeight = 0;
+    GLint m_viewportX = 0;
+    GLint m_viewportY = 0;
+    GLsizei m_viewportW = 0;
+    GLsizei m_viewportH = 0;
+
+    bool m_depthImage = true;
+    bool m_colourImage = false;
+    bool m_irImage = false;
+    bool m_pointCloud = false;
+    bool m_bodyShadowImage = true;
+    bool m_bodySkeletonImage = true;
+
+    // Render shaders
+    GLuint m_depthProgram = 0;
+    GLuint m_colourProgram = 0;
+    GLuint m_irProgram = 0;
+    GLuint m_shadowProgram = 0;
+    GLuint m_skeletonProgram = 0;
+    GLuint m_skeletonComputeProgram = 0;
+    GLuint m_timingProgram = 0;
+    GLuint m_pointCloudProgram = 0;
+
+    // Screen quad
+    GLuint m_quadVAO = 0;
+    GLuint m_quadVBO = 0;
+    GLuint m_quadIBO = 0;
+
+    // Image textures
+    GLuint m_depthTexture = 0;
+    GLuint m_colourTexture = 0;
+    GLuint m_irTexture = 0;
+    GLuint m_shadowTexture = 0;
+
+    // Point cloud, each depth pixel is unprojected using a table of its normalised xy position (z = 1)
+    GLuint m_pointVAO = 0;
+    GLuint m_xyTableTexture = 0;
+    bool m_pointColour = false; /**< True if the current colour texture matches the depth texture. */
+    float m_pointScale = 1.0f;  /**< Scales point size by depth so that each point covers a depth pixel. */
+    float m_orbitYaw = 0.0f;
+    float m_orbitPitch = 0.0f;
+    float m_orbitDistance = s_orbitTarget;
+
+    // Skeleton data, the instance transforms are built by a compute shader from the joint positions
+    struct SkeletonData
+    {
+        glm::mat4 m_mat1;
+        glm::mat4 m_mat2;
+        glm::vec4 m_confidence; /**< Only x is used, padded to match the shader storage layout. */
+    };
+
+    struct DrawCommand
+    {
+        GLuint m_count;
+        GLuint m_instanceCount;
+        GLuint m_firstIndex;
+        GLint m_baseVertex;
+        GLuint m_baseInstance;
+    };
+
+    using MultiDrawElementsIndirectFunction =
+        void(QOPENGLF_APIENTRY*)(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+    MultiDrawElementsIndirectFunction m_multiDrawElementsIndirect = nullptr;
+    GLuint m_skeletonVAO = 0;
+    GLuint m_skeletonVBO = 0;
+    GLuint m_skeletonIBO = 0;
+    GLuint m_skeletonInstanceBO = 0;
+    GLuint m_skeletonCommandBO = 0;
+    GLuint m_jointSSBO = 0;
+    GLuint m_boneSSBO = 0;
+    size_t m_skeletonInstances = 0;                 /**< Number of instances the instance buffer can hold. */
+    std::array<DrawCommand, 2> m_skeletonCommands{}; /**< Sphere (joint) and cylinder (bone) draws. */
+    std::vector<glm::vec4> m_jointData;              /**< Joint positions (mm) and confidences. */
+
+    // Camera data
+    GLuint m_inverseResUBO = 0;
+    GLuint m_cameraUBO = 0;
+    GLuint m_transformUBO = 0;
+    GLuint m_imageUBO = 0;
+
+    // Pixel upload buffers
+    using BufferStorageFunction =
+        void(QOPENGLF_APIENTRY*)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+
+    enum class PixelBufferState : uint32_t
+    {
+        Free,      /**< Available to be written to. */
+        Writing,   /**< Being written to by the data thread until it is uploaded (or released). */
+        Uploading, /**< Owned by the render thread until the GPU has finished reading from it. */
+    };
+
+    struct PixelBuffer
+    {
+        GLuint m_buffer = 0;
+        uint8_t* m_data = nullptr; /**< Persistently mapped storage. */
+        size_t m_size = 0;
+        GLsync m_fence = nullptr;
+        std::atomic<PixelBufferState> m_state = PixelBufferState::Free;
+    };
+
+    BufferStorageFunction m_bufferStorage = nullptr;
+    std::array<PixelBuffer, 3> m_pixelBuffers;
+    std::atomic_uint32_t m_nextPixelBuffer = 0;
+    size_t m_pixelBufferSize = 0;
+
+    // Composite capture, rendered at its own resolution and read back through a ring of pixel pack buffers
+    struct ReadBuffer
+    {
+        GLuint m_buffer = 0;
+        GLsync m_fence = nullptr; /**< Signalled once the read back has completed. */
+        uint64_t m_time = 0;
+    };
+
+    GLuint m_captureFramebuffer = 0;
+    GLuint m_captureFlipFramebuffer = 0;
+    std::array<GLuint, 3> m_captureRenderbuffers{}; /**< Capture colour and depth followed by the flipped colour. */
+    std::array<ReadBuffer, 3> m_readBuffers;
+    uint32_t m_nextReadBuffer = 0;
+    GLsizei m_captureWidth = 0;
+    GLsizei m_captureHeight = 0;
+    uint64_t m_droppedCaptures = 0;
+    captureCallback m_captureCallback = nullptr;
+
+    // Frame timing, each frame uses its own set of queries so results are only read once the GPU has finished
+    enum class TimerPass : uint32_t
+    {
+        Upload,
+        Image,
+        Shadow,
+        SkeletonCompute,
+        SkeletonDraw,
+        Count,
+    };
+
+    static constexpr size_t s_timerPasses = static_cast<size_t>(TimerPass::Count);
+
+    struct TimerFrame
+    {
+        std::array<GLuint, s_timerPasses> m_queries{};
+        std::array<bool, s_timerPasses> m_issued{};
+    };
+
+    bool m_timingOverlay = false;
+    bool m_timerReady = false;  /**< True if the current timer frame has been read back and can be reused. */
+    bool m_timerActive = false; /**< True if a timer query has been started and not yet ended. */
+    std::array<TimerFrame, 4> m_timerFrames;
+    uint32_t m_timerFrame = 0;
+    std::array<float, s_timerPasses + 3> m_timings{}; /**< Smoothed GPU pass then CPU timings (ms). */
+
+    // Calibration data
+    KinectCalibration m_calibration;
+
+    errorCallback m_errorCallback = nullptr;
+
+    /** Creates the image textures (storage is allocated once calibration is known) */
+    void createTextures() noexcept;
+
+    /** Creates the table used to unproject depth pixels from the depth camera calibration. */
+    void createXYTable() noexcept;
+
+    /** Updates the view/projection used to render the skeleton (and point cloud). */
+    void updateCamera() noexcept;
+
+    /**
+     * (Re)creates the storage of a pixel buffer with the current required size.
+     * @param [in,out] buffer The pixel buffer (must be owned by the render thread).
+     */
+    void allocatePixelBuffer(PixelBuffer& buffer) noexcept;
+
+    /** Frees pixel buffers that the GPU has finished reading from so they can be written to again. */
+    void reclaimPixelBuffers() noexcept;
+
+    /**
+     * Sizes the pixel buffers for the images written by the data thread for the current view.
+     * @note Buffers are resized once they are no longer in use.
+     */
+    void updatePixelBufferSize() noexcept;
+
+    /**
+     * Passes captures that have finished reading back to the capture callback (oldest first).
+     * @param wait True to wait for all outstanding read backs to complete.
+     */
+    void processCaptures(bool wait) noexcept;
+
+    /**
+     * Starts timing a render pass on the GPU.
+     * @note Passes are only timed while the overlay is shown and each pass is timed once per frame.
+     * @param pass The render pass.
+     */
+    void beginTimer(TimerPass pass) noexcept;
+
+    /** Ends timing the pass started by beginTimer. */
+    void endTimer() noexcept;
+
+    /** Reads back the results of the current timer frame if they are available so it can be reused. */
+    void readTimers() noexcept;
+
+    /** Renders the frame timing overlay in the top left of the render target. */
+    void renderTimingOverlay() noexcept;
+
+    /**
+     * Finds the pixel buffer that contains image data.
+     * @param data The image data.
+     * @returns The pixel buffer, nullptr if the data is in client memory.
+     */
+    [[nodiscard]] PixelBuffer* findPixelBuffer(const uint8_t* data) noexcept;
+
+    /**
+     * Uploads an image to a texture.
+     * @note Images in a pixel buffer are uploaded asynchronously. Images that are missing (frames only carry the images
+     *  that were needed when they were copied), don't match the texture or don't fit in their storage are skipped.
+     * @param texture    The texture.
+     * @param dimensions The texture dimensions.
+     * @param image      The image.
+     * @param format     The pixel format of the image data.
+     * @param type       The data type of the image data.
+     * @param pixelSize  The size of each pixel in bytes.
+     * @returns True if the image was uploaded, false if it was skipped.
+     */
+    bool uploadImage(GLuint texture, const glm::ivec2& dimensions, const KinectImage& image, GLenum format, GLenum type,
+        int32_t pixelSize) noexcept;
+
+    /**
+     * Loads a shader
+     * @param [out] shader     The returned shader.
+     * @param       shaderType Type of the shader (vertex, fragment and compute supported).
+     * @param       shaderCode The shader code.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool loadShader(GLuint& shader, GLenum shaderType, const GLchar* shaderCode) noexcept;
+
+    /**
+     * Links shaders into final program.
+     * @param [out] shader         The shader program.
+     * @param       vertexShader   The vertex shader.
+     * @param       fragmentShader The fragment shader.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool loadShaders(GLuint& shader, GLuint vertexShader, GLuint fragmentShader) noexcept;
+
+    /**
+     * Links a compute shader into final program.
+     * @param [out] shader        The shader program.
+     * @param       computeShader The compute shader.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool loadShaders(GLuint& shader, GLuint computeShader) noexcept;
+
+    /**
+     * Checks that a shader program linked successfully.
+     * @param shader The shader program (deleted if it failed).
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool checkProgram(GLuint shader) noexcept;
+
+    /**
+     * Generates a sphere mesh.
+     * @param          tessU    The horizontal tessellation.
+     * @param          tessV    The vertical tessellation.
+     * @param [in,out] vertices The vertex data to append to.
+     * @param [in,out] indices  The index data to append to (indices are relative to the first appended vertex).
+     * @returns The number of indices in the sphere.
+     */
+    GLsizei generateSphere(
+        uint32_t tessU, uint32_t tessV, std::vector<CustomVertex>& vertices, std::vector<GLuint>& indices) noexcept;
+
+    /**
+     * Generates a cylinder mesh.
+     * @param          tessU    The horizontal tessellation.
+     * @param [in,out] vertices The vertex data to append to.
+     * @param [in,out] indices  The index data to append to (indices are relative to the first appended vertex).
+     * @returns The number of indices in the cylinder.
+     */
+    GLsizei generateCylinder(
+        uint32_t tessU, std::vector<CustomVertex>& vertices, std::vector<GLuint>& indices) noexcept;
+};
+} // namespace Ak
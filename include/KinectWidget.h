@@ -1,4 +1,4 @@
-#pragma once
+﻿#pragma once
 /**
  * Copyright Matthew Oliver
  *
@@ -15,15 +15,15 @@
  * limitations under the License.
  */
 
-#include "DataTypes.h"
+#include "KinectRenderer.h"
 
-#include <QOpenGLExtraFunctions>
 #include <QOpenGLWidget>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
 namespace Ak {
-class KinectWidget final
-    : public QOpenGLWidget
-    , protected QOpenGLExtraFunctions
+class KinectWidget final : public QOpenGLWidget
 {
     Q_OBJECT
 
@@ -37,10 +37,12 @@ public:
      * @param depthImage   True to render depth image.
      * @param colourImage  True to render colour image.
      * @param irImage      True to render IR image.
+     * @param pointCloud   True to render the depth image as a 3D point cloud.
      * @param bodyShadow   True to render body shadow.
      * @param bodySkeleton True to render body skeleton.
      */
-    void setRenderOptions(bool depthImage, bool colourImage, bool irImage, bool bodyShadow, bool bodySkeleton) noexcept;
+    void setRenderOptions(bool depthImage, bool colourImage, bool irImage, bool pointCloud, bool bodyShadow,
+        bool bodySkeleton) noexcept;
 
     /**
      * Updates the calibration information for the camera
@@ -48,18 +50,67 @@ public:
      */
     void updateCalibration(const KinectCalibration& calibration) noexcept;
 
-public slots:
+    /**
+     * Gets pixel buffer storage that image data can be written to directly so that it is uploaded without blocking.
+     * @note This may be called from any thread. Images (and the shadow image) written to the storage must then be
+     *  passed to postData which releases the storage once the GPU has finished reading from it.
+     * @param size The required storage size in bytes.
+     * @returns The storage, nullptr if none is free (the data must then be passed in client memory).
+     */
+    [[nodiscard]] uint8_t* acquirePixelBuffer(size_t size) noexcept;
 
     /**
-     * Slot used to receive thread safe, asynchronous image/position information.
+     * Gets the offset in pixel buffer storage that the shadow image is written to.
+     * @param imageSize The size of the image written at the start of the storage.
+     * @returns The offset.
+     */
+    [[nodiscard]] static constexpr size_t getShadowOffset(const size_t imageSize) noexcept
+    {
+        return KinectRenderer::getShadowOffset(imageSize);
+    }
+
+    /**
+     * Passes new image/position information to be rendered.
+     * @note This may be called from any thread. Only the newest data is rendered, data that hasn't been rendered yet
+     *  is replaced without ever being uploaded. The data must remain valid until the next call.
+     * @param time        The timestamp of the capture.
+     * @param hostTime    The host time the capture was received, the overlay latency is measured from this.
      * @param depthImage  The depth image data.
      * @param colourImage The colour image data.
      * @param irImage     The IR image data.
      * @param shadowImage The body shadow image data.
      * @param joints      The joint data.
      */
-    void dataSlot(KinectImage depthImage, KinectImage colourImage, KinectImage irImage, KinectImage shadowImage,
-        KinectJoints joints) noexcept;
+    void postData(uint64_t time, std::chrono::steady_clock::time_point hostTime, const KinectImage& depthImage,
+        const KinectImage& colourImage, const KinectImage& irImage, const KinectImage& shadowImage,
+        const KinectJoints& joints) noexcept;
+
+    /**
+     * Starts or stops capturing the displayed composite (image with shadow and skeleton overlays).
+     * @note Each new frame is also rendered at the capture resolution and passed to the callback once it has been read
+     *  back from the GPU. The callback is called from the gui thread.
+     * @param width    The width of captured images (0 to stop capturing).
+     * @param height   The height of captured images.
+     * @param callback The callback that is passed each captured BGRA image and its timestamp.
+     */
+    void setCapture(uint32_t width, uint32_t height, KinectRenderer::captureCallback callback = nullptr) noexcept;
+
+    /**
+     * Sets whether the frame timing overlay is shown.
+     * @param show True to show the overlay.
+     */
+    void setTimingOverlay(bool show) noexcept;
+
+    /**
+     * Gets the number of frames that were replaced by newer data before they could be rendered.
+     * @returns The skipped frames.
+     */
+    [[nodiscard]] uint64_t getSkippedFrames() const noexcept;
+
+public slots:
+
+    /** Slot used to receive thread safe, asynchronous notification that new data has been posted. */
+    void dataSlot() noexcept;
 
     /** Slot used to receive thread safe, asynchronous render update notifications. */
     void refreshRenderSlot() noexcept;
@@ -67,6 +118,9 @@ public slots:
     /** Slot used to receive thread safe, asynchronous calibration update notifications. */
     void refreshCalibrationSlot() noexcept;
 
+    /** Slot used to receive notification that a rendered frame has been presented. */
+    void frameSwappedSlot() noexcept;
+
 signals:
     /**
      * Signal used to pass asynchronous thread safe error messages.
@@ -74,6 +128,9 @@ signals:
      */
     void errorSignal(const QString& message);
 
+    /** Signal used to pass asynchronous thread safe new data notifications. */
+    void dataSignal();
+
     /** Signal used to pass asynchronous thread safe render update notifications. */
     void refreshRenderSignal();
 
@@ -87,107 +144,56 @@ protected:
 
     void paintGL() noexcept override;
 
+    /** The point cloud camera is orbited by dragging with the left mouse button. */
+    void mousePressEvent(QMouseEvent* event) noexcept override;
+
+    void mouseMoveEvent(QMouseEvent* event) noexcept override;
+
+    /** Double clicking resets the point cloud camera to the depth camera view. */
+    void mouseDoubleClickEvent(QMouseEvent* event) noexcept override;
+
+    /** The mouse wheel zooms the point cloud camera. */
+    void wheelEvent(QWheelEvent* event) noexcept override;
+
 private:
-    // View port setting
-    GLint m_viewportX = 0;
-    GLint m_viewportY = 0;
-    GLsizei m_viewportW = 0;
-    GLsizei m_viewportH = 0;
-
-    bool m_depthImage = true;
-    bool m_colourImage = false;
-    bool m_irImage = false;
-    bool m_bodyShadowImage = true;
-    bool m_bodySkeletonImage = true;
-
-    // Render shaders
-    GLuint m_depthProgram = 0;
-    GLuint m_colourProgram = 0;
-    GLuint m_irProgram = 0;
-    GLuint m_shadowProgram = 0;
-    GLuint m_skeletonProgram = 0;
-
-    // Screen quad
-    GLuint m_quadVAO = 0;
-    GLuint m_quadVBO = 0;
-    GLuint m_quadIBO = 0;
-
-    // Image textures
-    GLuint m_depthTexture = 0;
-    GLuint m_colourTexture = 0;
-    GLuint m_irTexture = 0;
-    GLuint m_shadowTexture = 0;
-
-    struct SkeletonData
+    KinectRenderer m_renderer;
+
+    // Point cloud camera
+    QPoint m_mousePosition;
+    float m_orbitYaw = 0.0f;
+    float m_orbitPitch = 0.0f;
+    float m_orbitDistance = KinectRenderer::s_orbitTarget;
+    int64_t m_dataTime = 0;
+    uint32_t m_dataFrames = 0;
+
+    // Timings shown in the overlay (ms), latency is measured from when data was captured until it has been presented
+    float m_updateTime = 0.0f;
+    float m_paintTime = 0.0f;
+    float m_latency = 0.0f;
+    std::chrono::steady_clock::time_point m_uploadedTime;
+    std::chrono::steady_clock::time_point m_paintedTime;
+
+    // Latest posted data, a data signal is only sent when the mailbox was empty so that events can't pile up
+    struct FrameData
     {
-        glm::mat4 m_mat1;
-        glm::mat4 m_mat2;
-        float m_confidence;
+        uint64_t m_time;
+        std::chrono::steady_clock::time_point m_hostTime;
+        KinectImage m_depthImage;
+        KinectImage m_colourImage;
+        KinectImage m_irImage;
+        KinectImage m_shadowImage;
+        KinectJoints m_joints;
     };
 
-    // Sphere data
-    GLuint m_sphereVAO = 0;
-    GLuint m_sphereVBO = 0;
-    GLuint m_sphereIBO = 0;
-    GLsizei m_sphereElements = 0;
-    GLuint m_sphereInstanceBO = 0;
-    std::vector<SkeletonData> m_sphereTransforms;
-
-    // Cylinder data
-    GLuint m_cylinderVAO = 0;
-    GLuint m_cylinderVBO = 0;
-    GLuint m_cylinderIBO = 0;
-    GLsizei m_cylinderElements = 0;
-    GLuint m_cylinderInstanceBO = 0;
-    std::vector<SkeletonData> m_cylinderTransforms;
-
-    // Camera data
-    GLuint m_inverseResUBO = 0;
-    GLuint m_cameraUBO = 0;
-    GLuint m_transformUBO = 0;
-    GLuint m_imageUBO = 0;
-
-    // Calibration data
-    KinectCalibration m_calibration;
+    std::mutex m_frameLock;
+    FrameData m_pendingFrame;
+    bool m_framePending = false;
+    std::atomic_uint64_t m_skippedFrames = 0;
 
     /** Cleanup any OpenGL resources */
     void cleanup() noexcept;
 
-    /**
-     * Loads a shader
-     * @param [out] shader     The returned shader.
-     * @param       shaderType Type of the shader (vertex, fragment supported).
-     * @param       shaderCode The shader code.
-     * @returns True if it succeeds, false if it fails.
-     */
-    bool loadShader(GLuint& shader, GLenum shaderType, const GLchar* shaderCode) noexcept;
-
-    /**
-     * Links shaders into final program.
-     * @param [out] shader         The shader program.
-     * @param       vertexShader   The vertex shader.
-     * @param       fragmentShader The fragment shader.
-     * @returns True if it succeeds, false if it fails.
-     */
-    bool loadShaders(GLuint& shader, GLuint vertexShader, GLuint fragmentShader) noexcept;
-
-    /**
-     * Generates a sphere mesh.
-     * @param tessU    The horizontal tessellation.
-     * @param tessV    The vertical tessellation.
-     * @param vertexBO The vertex buffer to write to.
-     * @param indexBO  The index buffer to write to.
-     * @returns The number of indices in the sphere.
-     */
-    GLsizei generateSphere(uint32_t tessU, uint32_t tessV, GLuint vertexBO, GLuint indexBO) noexcept;
-
-    /**
-     * Generates a cylinder mesh.
-     * @param tessU    The horizontal tessellation.
-     * @param vertexBO The vertex buffer to write to.
-     * @param indexBO  The index buffer to write to.
-     * @returns The number of indices in the sphere.
-     */
-    GLsizei generateCylinder(uint32_t tessU, GLuint vertexBO, GLuint indexBO) noexcept;
+    /** Passes the current orbit to the renderer and redraws. */
+    void updateOrbit() noexcept;
 };
 } // namespace Ak
@@ -0,0 +1,126 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KinectRenderer.h"
+
+#include <QImage>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <memory>
+
+namespace Ak {
+/**
+ * Renders images and skeletons into a framebuffer object without needing a window or display.
+ * @note A QGuiApplication must exist. On a machine without a display run with QT_QPA_PLATFORM=offscreen (or
+ *  minimalegl) in which case the surface is an EGL pbuffer, this allows using software rendering such as Mesa
+ *  llvmpipe. All functions must be called from the thread that created the object.
+ */
+class OffscreenRenderer
+{
+public:
+    using errorCallback = std::function<void(const std::string&)>;
+
+    OffscreenRenderer() noexcept = default;
+
+    ~OffscreenRenderer() noexcept;
+
+    OffscreenRenderer(const OffscreenRenderer& other) = delete;
+
+    OffscreenRenderer(OffscreenRenderer&& other) noexcept = delete;
+
+    OffscreenRenderer& operator=(const OffscreenRenderer& other) = delete;
+
+    OffscreenRenderer& operator=(OffscreenRenderer&& other) noexcept = delete;
+
+    /**
+     * Initialises the renderer.
+     * @param width  The width of the rendered images.
+     * @param height The height of the rendered images.
+     * @param error  (Optional) The error callback.
+     * @returns True if it succeeds, false if it fails.
+     */
+    bool init(uint32_t width, uint32_t height, errorCallback error = nullptr) noexcept;
+
+    /**
+     * Sets what types of data should be rendered.
+     * @param depthImage   True to render depth image.
+     * @param colourImage  True to render colour image.
+     * @param irImage      True to render IR image.
+     * @param pointCloud   True to render the depth image as a 3D point cloud.
+     * @param bodyShadow   True to render body shadow.
+     * @param bodySkeleton True to render body skeleton.
+     */
+    void setRenderOptions(bool depthImage, bool colourImage, bool irImage, bool pointCloud, bool bodyShadow,
+        bool bodySkeleton) noexcept;
+
+    /**
+     * Updates the calibration information for the camera
+     * @param calibration The calibration data.
+     */
+    void updateCalibration(const KinectCalibration& calibration) noexcept;
+
+    /**
+     * Renders a frame.
+     * @param depthImage  The depth image data.
+     * @param colourImage The colour image data.
+     * @param irImage     The IR image data.
+     * @param shadowImage The body shadow image data.
+     * @param joints      The joint data.
+     * @returns The rendered image, a null image if it fails.
+     */
+    [[nodiscard]] QImage render(const KinectImage& depthImage, const KinectImage& colourImage,
+        const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept;
+
+    /**
+     * Gets the average time taken to render (including reading back) each frame.
+     * @returns The time in microseconds.
+     */
+    [[nodiscard]] int64_t getRenderTime() const noexcept;
+
+    /**
+     * Gets the average CPU time taken to upload each frame, in the display this is spent on the GUI thread.
+     * @returns The time in microseconds.
+     */
+    [[nodiscard]] int64_t getUploadTime() const noexcept;
+
+    /** Resets the average render and upload times, for example to exclude the first frames after changing the view. */
+    void resetRenderTime() noexcept;
+
+    /**
+     * Gets pixel buffer storage that image data can be written to directly in the same way as the display.
+     * @note See KinectRenderer::acquirePixelBuffer, the storage must then be passed to render.
+     * @param size The required storage size in bytes.
+     * @returns The storage, nullptr if none is free.
+     */
+    [[nodiscard]] uint8_t* acquirePixelBuffer(size_t size) noexcept;
+
+private:
+    std::unique_ptr<QOpenGLContext> m_context = nullptr;
+    std::unique_ptr<QOffscreenSurface> m_surface = nullptr;
+    std::unique_ptr<QOpenGLFramebufferObject> m_framebuffer = nullptr;
+    KinectRenderer m_renderer;
+    bool m_rendererInit = false;
+    errorCallback m_errorCallback = nullptr;
+    int64_t m_renderTime = 0;
+    int64_t m_uploadTime = 0;
+    uint32_t m_renderFrames = 0;
+
+    /** Cleanup any OpenGL resources */
+    void cleanup() noexcept;
+};
+} // namespace Ak
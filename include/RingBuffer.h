@@ -0,0 +1,172 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace Ak {
+/**
+ * Lock-free single producer, single consumer ring buffer.
+ * @note Slots are never constructed or destroyed by push/pop so they can be pre-allocated and reused. Only a single
+ *  thread may call the producer functions (beginPush/endPush) and only a single thread may call the consumer functions
+ *  (front/pop/wait).
+ * @tparam T    Slot type.
+ * @tparam Size Number of slots (must be power of 2).
+ */
+template<typename T, uint32_t Size>
+class RingBuffer
+{
+    static_assert(Size > 0 && (Size & (Size - 1)) == 0, "Ring buffer size must be power of 2");
+
+public:
+    RingBuffer() noexcept = default;
+
+    ~RingBuffer() noexcept = default;
+
+    RingBuffer(const RingBuffer& other) = delete;
+
+    RingBuffer(RingBuffer&& other) noexcept = delete;
+
+    RingBuffer& operator=(const RingBuffer& other) = delete;
+
+    RingBuffer& operator=(RingBuffer&& other) noexcept = delete;
+
+    /**
+     * Gets the next free slot so that it can be filled by the producer.
+     * @note The slot is not visible to the consumer until endPush() is called.
+     * @returns The slot, nullptr if the ring buffer is full.
+     */
+    [[nodiscard]] T* beginPush() noexcept
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) >= Size) {
+            return nullptr;
+        }
+        return &m_buffer[head & (Size - 1)];
+    }
+
+    /**
+     * Publishes the slot returned from beginPush() to the consumer.
+     * @note The consumer is only woken if the ring buffer was previously empty.
+     */
+    void endPush() noexcept
+    {
+        const auto head = m_head.load(std::memory_order_relaxed);
+        m_head.store(head + 1, std::memory_order_seq_cst);
+        if (m_tail.load(std::memory_order_seq_cst) == head) {
+            wake();
+        }
+    }
+
+    /**
+     * Gets the oldest pending slot.
+     * @returns The slot, nullptr if the ring buffer is empty.
+     */
+    [[nodiscard]] T* front() noexcept
+    {
+        const auto tail = m_tail.load(std::memory_order_relaxed);
+        if (m_head.load(std::memory_order_acquire) == tail) {
+            return nullptr;
+        }
+        return &m_buffer[tail & (Size - 1)];
+    }
+
+    /** Releases the slot returned from front() back to the producer. */
+    void pop() noexcept
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * Waits until the ring buffer is not empty.
+     * @note This may also return early if wake() is called.
+     * @tparam Pred Type of the predicate.
+     * @param cancel Predicate that returns true if waiting should be cancelled. Any state it checks must be updated
+     *  before calling wake().
+     */
+    template<typename Pred>
+    void wait(Pred cancel) noexcept
+    {
+        const auto signal = m_signal.load(std::memory_order_seq_cst);
+        if (m_head.load(std::memory_order_seq_cst) == m_tail.load(std::memory_order_relaxed) && !cancel()) {
+            m_signal.wait(signal, std::memory_order_acquire);
+        }
+    }
+
+    /** Wakes the consumer if it is currently waiting. */
+    void wake() noexcept
+    {
+        m_signal.fetch_add(1, std::memory_order_seq_cst);
+        m_signal.notify_one();
+    }
+
+    /** Discards all pending slots. Must only be called when neither the producer nor consumer are active. */
+    void clear() noexcept
+    {
+        m_tail.store(m_head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the number of pending slots.
+     * @note This may be called from any thread. The tail is loaded first so that a pop between the two loads can't
+     *  make the count wrap, and the count is limited to Size as pushes between the loads can make it overshoot.
+     * @returns The number of slots.
+     */
+    [[nodiscard]] uint32_t count() const noexcept
+    {
+        const auto tail = m_tail.load(std::memory_order_acquire);
+        const auto head = m_head.load(std::memory_order_acquire);
+        const uint32_t count = head - tail;
+        return count < Size ? count : Size;
+    }
+
+    /**
+     * Gets the total number of slots.
+     * @returns The number of slots.
+     */
+    [[nodiscard]] static constexpr uint32_t size() noexcept
+    {
+        return Size;
+    }
+
+    /**
+     * Gets an iterator to the beginning of the slot storage (used to pre-allocate slot contents).
+     * @returns The iterator.
+     */
+    [[nodiscard]] auto begin() noexcept
+    {
+        return m_buffer.begin();
+    }
+
+    /**
+     * Gets an iterator to the end of the slot storage.
+     * @returns The iterator.
+     */
+    [[nodiscard]] auto end() noexcept
+    {
+        return m_buffer.end();
+    }
+
+private:
+    // Each index is on its own cache line to prevent false sharing between producer and consumer
+    alignas(64) std::atomic_uint32_t m_head = 0;
+    alignas(64) std::atomic_uint32_t m_tail = 0;
+    alignas(64) std::atomic_uint32_t m_signal = 0;
+    alignas(64) std::array<T, Size> m_buffer;
+};
+} // namespace Ak
@@ -0,0 +1,177 @@
+﻿#pragma once
+/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Ak {
+/** Priority of work scheduled on the thread pool. Pending work of a higher priority is always run first. */
+enum class TaskPriority : uint32_t
+{
+    High = 0,
+    Normal = 1,
+    Low = 2,
+};
+
+/**
+ * Process wide work-stealing thread pool.
+ * @note Each worker has its own task queues. Tasks submitted from a worker are placed on its own queue and are run
+ *  newest first, while idle workers steal the oldest tasks from the other queues. Tasks must not block waiting on
+ *  other tasks except through parallelFor().
+ */
+class ThreadPool
+{
+public:
+    using Task = std::function<void()>;
+
+    /**
+     * Constructor.
+     * @param numThreads Number of worker threads (0 to use one per hardware thread).
+     */
+    explicit ThreadPool(uint32_t numThreads = 0) noexcept;
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool& other) = delete;
+
+    ThreadPool(ThreadPool&& other) noexcept = delete;
+
+    ThreadPool& operator=(const ThreadPool& other) = delete;
+
+    ThreadPool& operator=(ThreadPool&& other) noexcept = delete;
+
+    /**
+     * Gets the process wide thread pool.
+     * @returns The thread pool.
+     */
+    [[nodiscard]] static ThreadPool& get() noexcept;
+
+    /**
+     * Gets the priority of the task running on the calling thread.
+     * @returns The priority, Normal if the calling thread is not running a pool task.
+     */
+    [[nodiscard]] static TaskPriority getCurrentPriority() noexcept;
+
+    /**
+     * Gets the number of worker threads.
+     * @returns The number of threads.
+     */
+    [[nodiscard]] uint32_t size() const noexcept;
+
+    /**
+     * Schedules a task to be run.
+     * @param task     The task.
+     * @param priority The priority of the task.
+     */
+    void submit(Task task, TaskPriority priority) noexcept;
+
+    /**
+     * Runs a function for each index in a range in parallel and waits for them all to complete.
+     * @note The calling thread also runs indexes so this may safely be called from within a pool task. The work is
+     *  scheduled with the priority of the calling task.
+     * @param count    The number of indexes.
+     * @param function The function to run for each index.
+     */
+    void parallelFor(uint32_t count, const std::function<void(uint32_t)>& function) noexcept;
+
+private:
+    struct Queue
+    {
+        std::mutex m_lock;
+        std::array<std::deque<Task>, 3> m_tasks; /**< Pending tasks for each priority. */
+    };
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_threads;
+    std::atomic_uint32_t m_next = 0;
+    std::atomic_uint32_t m_pending = 0;
+    bool m_shutdown = false;
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    /**
+     * Gets the next task to run, stealing from other workers if needed.
+     * @param       index    The index of the worker.
+     * @param [out] task     The task.
+     * @param [out] priority The priority of the task.
+     * @returns True if a task was found, false if there are no pending tasks.
+     */
+    [[nodiscard]] bool popTask(uint32_t index, Task& task, TaskPriority& priority) noexcept;
+
+    /**
+     * Run pending tasks until shutdown.
+     * @param index The index of the worker.
+     */
+    void run(uint32_t index) noexcept;
+};
+
+/**
+ * A function that is run on the thread pool whenever it is notified, with only a single run active at a time.
+ * @note Notifications made while the function is running cause it to run again once complete. This allows a single
+ *  consumer (such as the reader of a RingBuffer) to be driven by the thread pool without a dedicated thread.
+ */
+class SerialTask
+{
+public:
+    SerialTask() noexcept = default;
+
+    ~SerialTask();
+
+    SerialTask(const SerialTask& other) = delete;
+
+    SerialTask(SerialTask&& other) noexcept = delete;
+
+    SerialTask& operator=(const SerialTask& other) = delete;
+
+    SerialTask& operator=(SerialTask&& other) noexcept = delete;
+
+    /**
+     * Sets the function to run.
+     * @note Must only be called while the task is not running.
+     * @param function The function.
+     * @param priority The priority the function is run with.
+     */
+    void init(std::function<void()> function, TaskPriority priority) noexcept;
+
+    /** Schedules the function to run if it is not already scheduled. */
+    void notify() noexcept;
+
+    /**
+     * Waits until the function is no longer scheduled or running.
+     * @note This function is synchronous and will block until the function has completed.
+     */
+    void wait() noexcept;
+
+private:
+    std::function<void()> m_function = nullptr;
+    TaskPriority m_priority = TaskPriority::Normal;
+    std::atomic_uint32_t m_pending = 0;
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+
+    /** Runs the function until there are no remaining notifications. */
+    void run() noexcept;
+};
+} // namespace Ak
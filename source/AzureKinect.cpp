@@ -17,6 +17,7 @@
 #include "AzureKinect.h"
 
 #include <array>
+#include <chrono>
 #include <k4a/k4a.h>
 #include <vector>
 using namespace std;
@@ -29,6 +30,16 @@ static void azureCallback(void*, k4a_log_level_t, const char*, const int, const
     logHandler(message);
 }
 
+static void referenceImage(void* image)
+{
+    k4a_image_reference(static_cast<k4a_image_t>(image));
+}
+
+static void releaseImage(void* image, uint8_t*)
+{
+    k4a_image_release(static_cast<k4a_image_t>(image));
+}
+
 AzureKinect::~AzureKinect()
 {
     shutdown();
@@ -360,19 +371,27 @@ bool AzureKinect::run(const readyCallback& ready) noexcept
 
             if (m_dataCallback) {
                 const auto time = k4abt_frame_get_device_timestamp_usec(bodyFrame);
+                // The system timestamp uses the same monotonic clock as steady_clock (QueryPerformanceCounter on
+                //  Windows, CLOCK_MONOTONIC on Linux) so latency includes body tracking
+                const chrono::steady_clock::time_point hostTime(chrono::duration_cast<chrono::steady_clock::duration>(
+                    chrono::nanoseconds(static_cast<int64_t>(k4a_image_get_system_timestamp_nsec(depthImage)))));
                 const auto colourImage = k4a_capture_get_color_image(originalCapture);
                 const auto irImage = k4a_capture_get_ir_image(originalCapture);
+                // Images are passed with their owning handle so that consumers can hold on to them without copying
                 KinectImage depthPass = {k4a_image_get_buffer(depthImage), k4a_image_get_width_pixels(depthImage),
-                    k4a_image_get_height_pixels(depthImage), k4a_image_get_stride_bytes(depthImage)};
+                    k4a_image_get_height_pixels(depthImage), k4a_image_get_stride_bytes(depthImage), depthImage,
+                    referenceImage, releaseImage};
                 KinectImage colourPass = {k4a_image_get_buffer(colourImage), k4a_image_get_width_pixels(colourImage),
-                    k4a_image_get_height_pixels(colourImage), k4a_image_get_stride_bytes(colourImage)};
+                    k4a_image_get_height_pixels(colourImage), k4a_image_get_stride_bytes(colourImage), colourImage,
+                    referenceImage, releaseImage};
                 KinectImage irPass = {k4a_image_get_buffer(irImage), k4a_image_get_width_pixels(irImage),
-                    k4a_image_get_height_pixels(irImage), k4a_image_get_stride_bytes(irImage)};
+                    k4a_image_get_height_pixels(irImage), k4a_image_get_stride_bytes(irImage), irImage,
+                    referenceImage, releaseImage};
 
                 KinectImage shadow = {bodyPixel.data(), depthPass.m_width, depthPass.m_height, depthPass.m_width};
                 KinectJoints joints(bodyJoint.data(), static_cast<uint32_t>(bodyJoint.size()));
                 if (m_dataCallback) {
-                    m_dataCallback(time, depthPass, colourPass, irPass, shadow, joints);
+                    m_dataCallback(time, hostTime, depthPass, colourPass, irPass, shadow, joints);
                 }
 
                 k4a_image_release(colourImage);
@@ -1,4 +1,4 @@
-/**
+﻿/**
  * Copyright Matthew Oliver
  *
  * Licensed under the Apache License, Version 2.0 (the "License");
@@ -16,17 +16,55 @@
 
 #include "AzureKinectWindow.h"
 
+#include <QFileDialog>
+#include <QInputDialog>
 #include <QMessageBox>
 #include <QTextStream>
 #include <QThread>
 #include <QTimer>
 #include <QtEvents>
+#include <algorithm>
 
 using namespace std;
 
 namespace Ak {
 extern void logHandler(const std::string& message);
 
+// Resolution the displayed composite is recorded at
+static constexpr uint32_t s_compositeWidth = 1280;
+static constexpr uint32_t s_compositeHeight = 720;
+
+/**
+ * Resizes a display buffer, reallocating it when its storage is larger than currently needed so that memory held for
+ * a previous view or camera mode is released.
+ * @param [in,out] buffer   The buffer.
+ * @param          size     The required size in bytes.
+ * @param          capacity The expected size of the displayed image (may be 0 if not known).
+ */
+static void resizeBuffer(vector<uint8_t>& buffer, const size_t size, const size_t capacity) noexcept
+{
+    const size_t required = max(size, capacity);
+    if (buffer.capacity() > required) {
+        vector<uint8_t> resized;
+        resized.swap(buffer);
+    }
+    buffer.reserve(required);
+    buffer.resize(size);
+}
+
+/**
+ * Releases the storage of a display buffer if it is larger than currently needed, otherwise it is kept for reuse.
+ * @param [in,out] buffer   The buffer.
+ * @param          capacity The expected size of the displayed image (0 if not displayed).
+ */
+static void trimBuffer(vector<uint8_t>& buffer, const size_t capacity) noexcept
+{
+    if (buffer.capacity() > capacity) {
+        vector<uint8_t> trimmed;
+        trimmed.swap(buffer);
+    }
+}
+
 static void customMessageHandler(const QtMsgType type, const QMessageLogContext& context, const QString& msg)
 {
     Q_UNUSED(context);
@@ -51,10 +89,6 @@ static void customMessageHandler(const QtMsgType type, const QMessageLogContext&
     logHandler(txt.toStdString());
 }
 
-// Allow data types to be passed by qt connect function
-Q_DECLARE_METATYPE(KinectImage);
-Q_DECLARE_METATYPE(KinectJoints);
-
 AzureKinectWindow::AzureKinectWindow(QWidget* parent) noexcept
     : QMainWindow(parent)
 {
@@ -68,20 +102,15 @@ AzureKinectWindow::AzureKinectWindow(QWidget* parent) noexcept
     m_validatorPID = new QIntValidator(1L, 999L, m_ui.centralWidget);
     m_ui.lineEditPID->setValidator(m_validatorPID);
 
-    // Reserve initial memory
-    for (auto& i : m_dataBuffer) {
-        i.m_image.reserve(3840 * 2160 * 4);
-        i.m_joints.reserve(40);
-    }
-
     // Connect required signals/slots
     connect(m_ui.buttonStart, &QPushButton::clicked, this, &AzureKinectWindow::startSlot);
     connect(m_ui.actionExit, &QAction::triggered, this, &AzureKinectWindow::exitSlot);
+    connect(m_ui.actionOpen_Recording, &QAction::triggered, this, &AzureKinectWindow::openRecordingSlot);
     connect(this, &AzureKinectWindow::errorSignal, this, &AzureKinectWindow::errorSlot);
     connect(this, &AzureKinectWindow::readySignal, this, &AzureKinectWindow::readySlot);
-    qRegisterMetaType<KinectImage>();
-    qRegisterMetaType<KinectJoints>();
-    connect(this, &AzureKinectWindow::dataSignal, m_ui.openGLWidget, &KinectWidget::dataSlot);
+    connect(this, &AzureKinectWindow::playbackFinishedSignal, this, &AzureKinectWindow::playbackFinishedSlot);
+    connect(this, &AzureKinectWindow::playbackErrorSignal, this, &AzureKinectWindow::playbackErrorSlot);
+    connect(m_ui.openGLWidget, &KinectWidget::dataSignal, m_ui.openGLWidget, &KinectWidget::dataSlot);
     connect(m_ui.openGLWidget, &KinectWidget::errorSignal, this, &AzureKinectWindow::errorSlot);
     connect(m_ui.openGLWidget, &KinectWidget::refreshRenderSignal, m_ui.openGLWidget, &KinectWidget::refreshRenderSlot);
     connect(m_ui.openGLWidget, &KinectWidget::refreshCalibrationSignal, m_ui.openGLWidget,
@@ -89,13 +118,20 @@ AzureKinectWindow::AzureKinectWindow(QWidget* parent) noexcept
     connect(m_ui.actionDepth_Image, &QAction::triggered, this, &AzureKinectWindow::viewDepthImageSlot);
     connect(m_ui.actionColour_Image, &QAction::triggered, this, &AzureKinectWindow::viewColourImageSlot);
     connect(m_ui.actionIR_Image, &QAction::triggered, this, &AzureKinectWindow::viewIRImageSlot);
+    connect(m_ui.actionPoint_Cloud, &QAction::triggered, this, &AzureKinectWindow::viewPointCloudSlot);
     connect(m_ui.actionBody_Shadow, &QAction::triggered, this, &AzureKinectWindow::viewBodyShadowSlot);
     connect(m_ui.actionBody_Skeleton, &QAction::triggered, this, &AzureKinectWindow::viewBodySkeletonSlot);
+    connect(m_ui.actionTiming_Overlay, &QAction::triggered, this, &AzureKinectWindow::viewTimingOverlaySlot);
     connect(m_ui.actionDepth_Image_2, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
     connect(m_ui.actionColour_Image_2, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
     connect(m_ui.actionIR_Image_2, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
     connect(m_ui.actionBody_Skeleton_2, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
     connect(m_ui.actionGPU_Encoding, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
+    connect(m_ui.actionFragmented_MP4, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
+    connect(m_ui.actionColour_Master, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
+    connect(m_ui.actionColour_1080p, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
+    connect(m_ui.actionLive_Preview, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
+    connect(m_ui.actionComposite_View, &QAction::triggered, this, &AzureKinectWindow::updateRecordOptionsSlot);
 
     m_ui.statusBar->showMessage(tr("Waiting for camera to start..."));
 
@@ -105,7 +141,7 @@ AzureKinectWindow::AzureKinectWindow(QWidget* parent) noexcept
         m_kinect.init(bind(&AzureKinectWindow::errorCallback, this, placeholders::_1),
             bind(&AzureKinectWindow::readyCallback, this, placeholders::_1),
             bind(&AzureKinectWindow::dataCallback, this, placeholders::_1, placeholders::_2, placeholders::_3,
-                placeholders::_4, placeholders::_5, placeholders::_6));
+                placeholders::_4, placeholders::_5, placeholders::_6, placeholders::_7));
     });
 }
 
@@ -121,6 +157,11 @@ void AzureKinectWindow::startSlot() noexcept
 
         // Start recorder thread
         m_recorder.start(pid);
+        if (m_ui.actionComposite_View->isChecked()) {
+            // The displayed composite is only rendered at the recording resolution while it is being recorded
+            m_ui.openGLWidget->setCapture(s_compositeWidth, s_compositeHeight,
+                bind(&KinectRecord::compositeCallback, &m_recorder, placeholders::_1, placeholders::_2));
+        }
 
         // Change button to stop
         m_started = true;
@@ -131,9 +172,16 @@ void AzureKinectWindow::startSlot() noexcept
         m_ui.actionIR_Image_2->setEnabled(false);
         m_ui.actionBody_Skeleton_2->setEnabled(false);
         m_ui.actionGPU_Encoding->setEnabled(false);
+        m_ui.actionFragmented_MP4->setEnabled(false);
+        m_ui.actionColour_Master->setEnabled(false);
+        m_ui.actionColour_1080p->setEnabled(false);
+        m_ui.actionLive_Preview->setEnabled(false);
+        m_ui.actionComposite_View->setEnabled(false);
 
         m_ui.statusBar->showMessage(tr("Recording started..."));
     } else {
+        // Stopping the capture passes on any outstanding read backs, so this must be done while the recorder is running
+        m_ui.openGLWidget->setCapture(0, 0);
         m_recorder.stop();
         m_started = false;
         m_ui.buttonStart->setText(tr("Start"));
@@ -142,6 +190,11 @@ void AzureKinectWindow::startSlot() noexcept
         m_ui.actionIR_Image_2->setEnabled(true);
         m_ui.actionBody_Skeleton_2->setEnabled(true);
         m_ui.actionGPU_Encoding->setEnabled(true);
+        m_ui.actionFragmented_MP4->setEnabled(true);
+        m_ui.actionColour_Master->setEnabled(true);
+        m_ui.actionColour_1080p->setEnabled(true);
+        m_ui.actionLive_Preview->setEnabled(true);
+        m_ui.actionComposite_View->setEnabled(true);
 
         m_ui.statusBar->showMessage(tr("Recording stopped"));
     }
@@ -151,22 +204,114 @@ void AzureKinectWindow::exitSlot() noexcept
 {
     // Shutdown kinect threads
     m_kinect.shutdown();
+    m_playback.shutdown();
     m_recorder.shutdown();
 
     QCoreApplication::quit();
 }
 
+void AzureKinectWindow::openRecordingSlot() noexcept
+{
+    if (m_started) {
+        QMessageBox::warning(this, tr("AzureKinect"), tr("Please stop recording before opening a recording"));
+        return;
+    }
+
+    // Any of the files from a recording can be selected
+    const auto fileName =
+        QFileDialog::getOpenFileName(this, tr("Open Recording"), QString(), tr("Recordings (*.csv *.mp4 *.mkv)"));
+    if (fileName.isEmpty()) {
+        return;
+    }
+    bool ok = false;
+    const auto speed = QInputDialog::getDouble(this, tr("AzureKinect"),
+        tr("Playback speed (1 = real time, 0 = as fast as possible):"), 1.0, 0.0, 100.0, 2, &ok);
+    if (!ok) {
+        return;
+    }
+
+    // Determine the base name of the recording by removing the stream suffix
+    auto baseName = fileName.toStdString();
+    for (const auto& i :
+        {"_depth.mp4"s, "_colour.mp4"s, "_ir.mp4"s, "_depth.mkv"s, "_colour.mkv"s, "_ir.mkv"s, ".csv"s}) {
+        if (baseName.length() > i.length() && baseName.compare(baseName.length() - i.length(), i.length(), i) == 0) {
+            baseName.erase(baseName.length() - i.length());
+            break;
+        }
+    }
+
+    // Only a single source can feed the pipeline so stop the camera and any existing playback
+    m_kinect.shutdown();
+    m_playback.shutdown();
+    m_ready = false;
+    m_playing = true;
+    m_ui.buttonStart->setEnabled(false);
+    m_ui.statusBar->showMessage(tr("Loading recording..."));
+
+    m_playback.init(baseName, static_cast<float>(speed),
+        bind(&AzureKinectWindow::playbackErrorCallback, this, placeholders::_1),
+        bind(&AzureKinectWindow::readyCallback, this, placeholders::_1),
+        bind(&AzureKinectWindow::dataCallback, this, placeholders::_1, placeholders::_2, placeholders::_3,
+            placeholders::_4, placeholders::_5, placeholders::_6, placeholders::_7),
+        bind(&AzureKinectWindow::playbackFinishedCallback, this));
+}
+
+void AzureKinectWindow::playbackFinishedSlot() noexcept
+{
+    if (!m_playing) {
+        // Playback was stopped by an error
+        return;
+    }
+    // Finalise any recording made from the played back data
+    if (m_started) {
+        startSlot();
+    }
+    m_ready = false;
+    m_ui.buttonStart->setEnabled(false);
+    m_ui.statusBar->showMessage(tr("Playback finished"));
+}
+
 void AzureKinectWindow::errorSlot(const QString& message) noexcept
 {
     logHandler(message.toStdString());
     m_ui.statusBar->showMessage(tr("Error: ") + message);
     QMessageBox::critical(this, tr("AzureKinect"), message);
+    if (!m_ready && !m_playing) {
+        // Camera failed to start, but recordings can still be played back
+        m_kinect.shutdown();
+        m_ui.statusBar->showMessage(tr("Camera unavailable, recordings can be opened from the File menu"));
+        return;
+    }
     exitSlot();
 }
 
+void AzureKinectWindow::playbackErrorSlot(const QString& message) noexcept
+{
+    logHandler(message.toStdString());
+    QMessageBox::critical(this, tr("AzureKinect"), message);
+    if (!m_playing) {
+        // Playback has already been stopped
+        return;
+    }
+
+    // A bad recording only stops playback, another recording can still be opened
+    if (m_started) {
+        startSlot();
+    }
+    m_playback.shutdown();
+    m_playing = false;
+    m_ready = false;
+    updateRecordOptionsSlot();
+    m_ui.statusBar->showMessage(tr("Playback stopped: ") + message);
+}
+
 void AzureKinectWindow::readySlot() noexcept
 {
-    m_ui.statusBar->showMessage(tr("Camera is now ready for capture"));
+    if (m_playing) {
+        m_ui.statusBar->showMessage(tr("Recording playback is now ready for capture"));
+    } else {
+        m_ui.statusBar->showMessage(tr("Camera is now ready for capture"));
+    }
     m_ready = true;
     updateRecordOptionsSlot(); // This will enable the start button if possible
 }
@@ -177,6 +322,7 @@ void AzureKinectWindow::viewDepthImageSlot() noexcept
     // Only 1 of depth/colour image can be selected at a time so disable the current one and enable the others
     m_viewColourImage = false;
     m_viewIRImage = false;
+    m_viewPointCloud = false;
     updateRenderOptions();
 }
 
@@ -185,6 +331,7 @@ void AzureKinectWindow::viewColourImageSlot() noexcept
     m_viewColourImage = true;
     m_viewDepthImage = false;
     m_viewIRImage = false;
+    m_viewPointCloud = false;
     updateRenderOptions();
 }
 
@@ -193,6 +340,16 @@ void AzureKinectWindow::viewIRImageSlot() noexcept
     m_viewIRImage = true;
     m_viewDepthImage = false;
     m_viewColourImage = false;
+    m_viewPointCloud = false;
+    updateRenderOptions();
+}
+
+void AzureKinectWindow::viewPointCloudSlot() noexcept
+{
+    m_viewPointCloud = true;
+    m_viewDepthImage = false;
+    m_viewColourImage = false;
+    m_viewIRImage = false;
     updateRenderOptions();
 }
 
@@ -207,6 +364,11 @@ void AzureKinectWindow::viewBodySkeletonSlot() noexcept
     m_viewBodySkeleton = m_ui.actionBody_Skeleton->isChecked();
 }
 
+void AzureKinectWindow::viewTimingOverlaySlot() noexcept
+{
+    m_ui.openGLWidget->setTimingOverlay(m_ui.actionTiming_Overlay->isChecked());
+}
+
 void AzureKinectWindow::updateRecordOptionsSlot() noexcept
 {
     const bool recordDepthImage = m_ui.actionDepth_Image_2->isChecked();
@@ -214,14 +376,41 @@ void AzureKinectWindow::updateRecordOptionsSlot() noexcept
     const bool recordIRImage = m_ui.actionIR_Image_2->isChecked();
     const bool recordBodySkeleton = m_ui.actionBody_Skeleton_2->isChecked();
     const bool recordGPUEncode = m_ui.actionGPU_Encoding->isChecked();
-    if (!recordDepthImage && !recordColourImage && !recordIRImage && !recordBodySkeleton) {
+    const bool recordFragmented = m_ui.actionFragmented_MP4->isChecked();
+    const bool recordComposite = m_ui.actionComposite_View->isChecked();
+    if (!recordDepthImage && !recordColourImage && !recordIRImage && !recordBodySkeleton && !recordComposite) {
         // If no recording options have been specified then disable the start button
         m_ui.buttonStart->setEnabled(false);
     } else if (m_ready && !m_ui.buttonStart->isEnabled()) {
         m_ui.buttonStart->setEnabled(true);
     }
-    m_recorder.setRecordOptions(
-        recordDepthImage, recordColourImage, recordIRImage, recordBodySkeleton, recordGPUEncode);
+    m_recorder.setRecordOptions(recordDepthImage, recordColourImage, recordIRImage, recordBodySkeleton,
+        recordGPUEncode, recordFragmented);
+    m_recorder.setCompositeOptions(recordComposite, s_compositeWidth, s_compositeHeight);
+
+    // Colour is always recorded to a 640 wide proxy, larger renditions are optional (ordered largest first)
+    vector<Rendition> colourRenditions;
+    if (m_ui.actionColour_Master->isChecked()) {
+        Rendition master;
+        master.m_quality = 18;
+        master.m_name = "master";
+        colourRenditions.emplace_back(master);
+    }
+    if (m_ui.actionColour_1080p->isChecked()) {
+        Rendition hd;
+        hd.m_width = 1920;
+        hd.m_quality = 20;
+        hd.m_name = "1080p";
+        colourRenditions.emplace_back(hd);
+    }
+    Rendition proxy;
+    proxy.m_width = 640;
+    if (m_ui.actionLive_Preview->isChecked()) {
+        // The proxy is also streamed so that it can be watched live by another process (e.g. ffplay)
+        proxy.m_preview = "udp://127.0.0.1:5000?pkt_size=1316"s;
+    }
+    colourRenditions.emplace_back(proxy);
+    m_recorder.setRenditions(1, colourRenditions);
 }
 
 void AzureKinectWindow::closeEvent(QCloseEvent* event) noexcept
@@ -242,64 +431,127 @@ void AzureKinectWindow::readyCallback(const KinectCalibration& calibration) noex
     m_ui.openGLWidget->updateCalibration(calibration);
     m_recorder.updateCalibration(calibration);
 
+    // Size display buffers for the current camera mode
+    m_displaySizes[0] = static_cast<size_t>(calibration.m_depthDimensions.x) * calibration.m_depthDimensions.y * 2;
+    m_displaySizes[1] = static_cast<size_t>(calibration.m_colourDimensions.x) * calibration.m_colourDimensions.y * 4;
+    m_displaySizes[2] = static_cast<size_t>(calibration.m_irDimensions.x) * calibration.m_irDimensions.y * 2;
+    m_displaySizes[3] = static_cast<size_t>(calibration.m_depthDimensions.x) * calibration.m_depthDimensions.y;
+
     // Note: Currently assumes that the recorder thread has already initialised at this point
     // TODO: Correctly wait for both threads to have started
     emit readySignal();
 }
 
-void AzureKinectWindow::dataCallback(const uint64_t time, const KinectImage& depthImage, const KinectImage& colourImage,
-    const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept
+void AzureKinectWindow::playbackErrorCallback(const std::string& message) const noexcept
+{
+    emit playbackErrorSignal(QString::fromStdString(message));
+}
+
+void AzureKinectWindow::playbackFinishedCallback() const noexcept
+{
+    emit playbackFinishedSignal();
+}
+
+void AzureKinectWindow::dataCallback(const uint64_t time, const chrono::steady_clock::time_point hostTime,
+    const KinectImage& depthImage, const KinectImage& colourImage, const KinectImage& irImage,
+    const KinectImage& shadowImage, const KinectJoints& joints) noexcept
 {
     // Call recorder callback
     m_recorder.dataCallback(time, depthImage, colourImage, irImage, shadowImage, joints);
 
-    // Need to copy data into local storage
+    // Need to copy data into local storage, the view is read once as it may be changed by the UI at any time
     ++m_bufferIndex;
     m_bufferIndex = m_bufferIndex < m_dataBuffer.size() ? m_bufferIndex : 0;
-    if (m_viewDepthImage) {
-        if (depthImage.m_image == nullptr) {
-            return;
-        }
-        m_dataBuffer[m_bufferIndex].m_image.resize(0);
-        m_dataBuffer[m_bufferIndex].m_image.insert(m_dataBuffer[m_bufferIndex].m_image.begin(), depthImage.m_image,
-            depthImage.m_image + (static_cast<size_t>(depthImage.m_height) * depthImage.m_stride));
+    const bool viewPointCloud = m_viewPointCloud;
+    const bool viewBodyShadow = m_viewBodyShadow;
+    const bool viewBodySkeleton = m_viewBodySkeleton;
+    const KinectImage* image = nullptr;
+    size_t imageCapacity = 0;
+    if (m_viewDepthImage || viewPointCloud) {
+        image = &depthImage;
+        imageCapacity = m_displaySizes[0];
     } else if (m_viewColourImage) {
-        if (colourImage.m_image == nullptr) {
-            return;
-        }
-        m_dataBuffer[m_bufferIndex].m_image.resize(0);
-        m_dataBuffer[m_bufferIndex].m_image.insert(m_dataBuffer[m_bufferIndex].m_image.begin(), colourImage.m_image,
-            colourImage.m_image + (static_cast<size_t>(colourImage.m_height) * colourImage.m_stride));
+        image = &colourImage;
+        imageCapacity = m_displaySizes[1];
     } else if (m_viewIRImage) {
-        if (irImage.m_image == nullptr) {
-            return;
-        }
-        m_dataBuffer[m_bufferIndex].m_image.resize(0);
-        m_dataBuffer[m_bufferIndex].m_image.insert(m_dataBuffer[m_bufferIndex].m_image.begin(), irImage.m_image,
-            irImage.m_image + (static_cast<size_t>(irImage.m_height) * irImage.m_stride));
+        image = &irImage;
+        imageCapacity = m_displaySizes[2];
+    }
+    if (image != nullptr && image->m_image == nullptr) {
+        return;
+    }
+    size_t imageSize = image != nullptr ? static_cast<size_t>(image->m_height) * image->m_stride : 0;
+    const size_t displaySize = imageSize;
+
+    // Point clouds are also coloured from the colour image when there is one, this is stored after the depth image
+    size_t colourSize = 0;
+    if (viewPointCloud && colourImage.m_image != nullptr) {
+        colourSize = static_cast<size_t>(colourImage.m_height) * colourImage.m_stride;
+        imageSize = KinectWidget::getShadowOffset(displaySize) + colourSize;
+        imageCapacity = KinectWidget::getShadowOffset(m_displaySizes[0]) + m_displaySizes[1];
+    }
+    size_t shadowSize = 0;
+    if (viewBodyShadow && shadowImage.m_image != nullptr) {
+        shadowSize = static_cast<size_t>(shadowImage.m_height) * shadowImage.m_stride;
     }
 
-    if (m_viewBodyShadow) {
-        m_dataBuffer[m_bufferIndex].m_shadow.resize(0);
-        m_dataBuffer[m_bufferIndex].m_shadow.insert(m_dataBuffer[m_bufferIndex].m_shadow.begin(), shadowImage.m_image,
-            shadowImage.m_image + (static_cast<size_t>(shadowImage.m_height) * shadowImage.m_stride));
+    // Write directly into a pixel buffer if one is free so that the render thread doesn't have to copy the data
+    // Note: A buffer is only resized once it has been cycled back to, by which point the render thread has finished
+    //  with it. Client memory is kept while pixel buffers are in use as they often alternate under load, it is only
+    //  released as the buffers are reused once the view or camera mode no longer needs as much.
+    auto& buffers = m_dataBuffer[m_bufferIndex];
+    const size_t oldCapacity = buffers.m_image.capacity() + buffers.m_shadow.capacity();
+    uint8_t* imageData;
+    uint8_t* shadowData;
+    uint8_t* pixelBuffer =
+        m_ui.openGLWidget->acquirePixelBuffer(KinectWidget::getShadowOffset(imageSize) + shadowSize);
+    if (pixelBuffer != nullptr) {
+        trimBuffer(buffers.m_image, imageSize > 0 ? imageCapacity : 0);
+        trimBuffer(buffers.m_shadow, shadowSize > 0 ? m_displaySizes[3] : 0);
+        imageData = pixelBuffer;
+        shadowData = pixelBuffer + KinectWidget::getShadowOffset(imageSize);
+    } else {
+        resizeBuffer(buffers.m_image, imageSize, imageSize > 0 ? imageCapacity : 0);
+        resizeBuffer(buffers.m_shadow, shadowSize, shadowSize > 0 ? m_displaySizes[3] : 0);
+        imageData = buffers.m_image.data();
+        shadowData = buffers.m_shadow.data();
+    }
+    const size_t newCapacity = buffers.m_image.capacity() + buffers.m_shadow.capacity();
+    if (newCapacity != oldCapacity) {
+        m_bufferFootprint = m_bufferFootprint + newCapacity - oldCapacity;
+        logHandler("Display buffer pool: "s += to_string((m_bufferFootprint + 1048575) / 1048576) += " MB"s);
     }
-    if (m_viewBodySkeleton) {
-        m_dataBuffer[m_bufferIndex].m_joints.resize(0);
-        m_dataBuffer[m_bufferIndex].m_joints.insert(m_dataBuffer[m_bufferIndex].m_joints.begin(), joints.m_joints,
-            joints.m_joints + static_cast<size_t>(joints.m_length));
+    if (displaySize > 0) {
+        memcpy(imageData, image->m_image, displaySize);
     }
+    if (colourSize > 0) {
+        memcpy(imageData + KinectWidget::getShadowOffset(displaySize), colourImage.m_image, colourSize);
+    }
+    if (shadowSize > 0) {
+        memcpy(shadowData, shadowImage.m_image, shadowSize);
+    }
+    if (viewBodySkeleton) {
+        buffers.m_joints.resize(0);
+        buffers.m_joints.insert(
+            buffers.m_joints.begin(), joints.m_joints, joints.m_joints + static_cast<size_t>(joints.m_length));
+    }
+
+    // Only the data that was copied is passed on, the renderer skips anything that is missing
     auto depthCopy = depthImage;
-    depthCopy.m_image = m_dataBuffer[m_bufferIndex].m_image.data();
+    depthCopy.m_image = image == &depthImage && displaySize > 0 ? imageData : nullptr;
     auto colourCopy = colourImage;
-    colourCopy.m_image = m_dataBuffer[m_bufferIndex].m_image.data();
+    colourCopy.m_image = image == &colourImage && displaySize > 0 ? imageData : nullptr;
+    if (colourSize > 0) {
+        colourCopy.m_image = imageData + KinectWidget::getShadowOffset(displaySize);
+    }
     auto irCopy = irImage;
-    irCopy.m_image = m_dataBuffer[m_bufferIndex].m_image.data();
+    irCopy.m_image = image == &irImage && displaySize > 0 ? imageData : nullptr;
     auto shadowCopy = shadowImage;
-    shadowCopy.m_image = m_dataBuffer[m_bufferIndex].m_shadow.data();
+    shadowCopy.m_image = shadowSize > 0 ? shadowData : nullptr;
     auto jointCopy = joints;
-    jointCopy.m_joints = m_dataBuffer[m_bufferIndex].m_joints.data();
-    emit dataSignal(depthCopy, colourCopy, irCopy, shadowCopy, jointCopy);
+    jointCopy.m_joints = buffers.m_joints.data();
+    jointCopy.m_length = viewBodySkeleton ? joints.m_length : 0;
+    m_ui.openGLWidget->postData(time, hostTime, depthCopy, colourCopy, irCopy, shadowCopy, jointCopy);
 }
 
 void AzureKinectWindow::updateRenderOptions() const noexcept
@@ -310,7 +562,9 @@ void AzureKinectWindow::updateRenderOptions() const noexcept
     m_ui.actionColour_Image->setEnabled(!m_viewColourImage);
     m_ui.actionIR_Image->setChecked(m_viewIRImage);
     m_ui.actionIR_Image->setEnabled(!m_viewIRImage);
+    m_ui.actionPoint_Cloud->setChecked(m_viewPointCloud);
+    m_ui.actionPoint_Cloud->setEnabled(!m_viewPointCloud);
     m_ui.openGLWidget->setRenderOptions(
-        m_viewDepthImage, m_viewColourImage, m_viewIRImage, m_viewBodyShadow, m_viewBodySkeleton);
+        m_viewDepthImage, m_viewColourImage, m_viewIRImage, m_viewPointCloud, m_viewBodyShadow, m_viewBodySkeleton);
 }
 } // namespace Ak
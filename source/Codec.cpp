@@ -0,0 +1,228 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Codec.h"
+
+#include <algorithm>
+#include <array>
+
+extern "C" {
+#include <libavutil/hwcontext.h>
+#include <libavutil/opt.h>
+}
+
+using namespace std;
+
+namespace Ak {
+extern void logHandler(const std::string& message);
+
+// All encoders that may be used for recording. FFV1 and VP9 can't be stored in MP4 so use Matroska instead. Only
+// x264 re-reads its CRF while encoding (the preset can't be changed once the encoder is open for any of them)
+static const array<Codec, 7> s_codecs = {
+    Codec{"libx264", "mp4", ".mp4", "preset", "veryfast", "crf", 23, false, false, true},
+    Codec{"libx265", "mp4", ".mp4", "preset", "superfast", "crf", 28, false, false, false},
+    Codec{"libsvtav1", "mp4", ".mp4", "preset", "10", "crf", 35, false, false, false},
+    Codec{"libvpx-vp9", "matroska", ".mkv", "cpu-used", "8", "crf", 31, false, false, false},
+    Codec{"ffv1", "matroska", ".mkv", "", "", "", 0, true, false, false},
+    Codec{"h264_nvenc", "mp4", ".mp4", "preset", "llhp", "cq", 23, false, true, false},
+    Codec{"hevc_nvenc", "mp4", ".mp4", "preset", "llhp", "cq", 28, false, true, false}};
+
+bool Codec::supportsFormat(const int32_t format) const noexcept
+{
+    const AVCodec* codec = avcodec_find_encoder_by_name(m_name.c_str());
+    if (codec == nullptr) {
+        return false;
+    }
+    if (codec->pix_fmts == nullptr) {
+        // Encoders that don't list their formats accept anything
+        return true;
+    }
+    for (auto i = codec->pix_fmts; *i != AV_PIX_FMT_NONE; ++i) {
+        if (*i == format) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int32_t Codec::getOutputFormat(const int32_t format, const Rendition& rendition) const noexcept
+{
+    // Frames from an upstream encoder have already been converted
+    if (format != AV_PIX_FMT_GRAY16LE && format != AV_PIX_FMT_BGRA) {
+        return supportsFormat(format) ? format : AV_PIX_FMT_NONE;
+    }
+    uint32_t bitDepth = rendition.m_bitDepth;
+    if (bitDepth == 0) {
+        // Lossless encoders store depth/IR unmodified
+        bitDepth = (m_losslessOnly && format == AV_PIX_FMT_GRAY16LE) ? 16 : 8;
+    }
+    int32_t outFormat;
+    if (bitDepth == 8) {
+        outFormat = AV_PIX_FMT_YUV420P;
+    } else if (bitDepth == 10) {
+        outFormat = AV_PIX_FMT_YUV420P10LE;
+    } else if (bitDepth == 16 && format == AV_PIX_FMT_GRAY16LE) {
+        outFormat = AV_PIX_FMT_GRAY16LE;
+    } else {
+        return AV_PIX_FMT_NONE;
+    }
+    return supportsFormat(outFormat) ? outFormat : AV_PIX_FMT_NONE;
+}
+
+bool Codec::setOptions(const Rendition& rendition, AVCodecContext* context, AVDictionary** options) const noexcept
+{
+    if (!m_presetOption.empty()) {
+        av_dict_set(options, m_presetOption.c_str(),
+            !rendition.m_preset.empty() ? rendition.m_preset.c_str() : m_defaultPreset.c_str(), 0);
+    }
+    if (m_name == "libvpx-vp9") {
+        // Presets only apply to realtime encoding
+        av_dict_set(options, "deadline", "realtime", 0);
+        av_dict_set(options, "row-mt", "1", 0);
+    }
+
+    // Previews are decoded live so can't wait on lookahead/reordering or for a keyframe to be able to start decoding
+    string x265Params;
+    if (!rendition.m_preview.empty()) {
+        if (m_name == "libx264") {
+            av_dict_set(options, "tune", "zerolatency", 0);
+            av_dict_set(options, "intra-refresh", "1", 0);
+        } else if (m_name == "libx265") {
+            av_dict_set(options, "tune", "zerolatency", 0);
+            x265Params = "intra-refresh=1"s;
+        } else if (m_name == "libvpx-vp9") {
+            av_dict_set(options, "lag-in-frames", "0", 0);
+        } else if (m_gpu) {
+            av_dict_set(options, "zerolatency", "1", 0);
+            av_dict_set(options, "delay", "0", 0);
+        }
+    }
+
+    if (m_losslessOnly) {
+        // Every frame is a keyframe so that a partially written file is fully decodable
+        context->gop_size = 1;
+        av_dict_set(options, "level", "3", 0);
+        av_dict_set(options, "slicecrc", "1", 0);
+        return rendition.m_rateControl != RateControl::Bitrate;
+    }
+
+    if (rendition.m_rateControl == RateControl::ConstantQuality) {
+        const uint32_t quality = rendition.m_quality != 0 ? rendition.m_quality : m_defaultQuality;
+        if (m_gpu) {
+            av_dict_set(options, "rc", "vbr", 0);
+        } else {
+            // A bitrate would otherwise be used as a limit
+            context->bit_rate = 0;
+        }
+        av_dict_set(options, m_qualityOption.c_str(), to_string(quality).c_str(), 0);
+    } else if (rendition.m_rateControl == RateControl::Bitrate) {
+        if (rendition.m_bitrate == 0) {
+            return false;
+        }
+        if (m_gpu) {
+            av_dict_set(options, "rc", "vbr", 0);
+        }
+        context->bit_rate = static_cast<int64_t>(rendition.m_bitrate) * 1000;
+    } else {
+        if (m_name == "libx264") {
+            av_dict_set(options, "qp", "0", 0);
+        } else if (m_name == "libx265") {
+            x265Params = !x265Params.empty() ? "lossless=1:"s += x265Params : "lossless=1"s;
+        } else if (m_name == "libvpx-vp9") {
+            av_dict_set(options, "lossless", "1", 0);
+        } else if (m_gpu) {
+            av_dict_set(options, "preset", "lossless", 0);
+        } else {
+            return false;
+        }
+    }
+    if (!x265Params.empty()) {
+        av_dict_set(options, "x265-params", x265Params.c_str(), 0);
+    }
+    return true;
+}
+
+bool Codec::setQuality(AVCodecContext* context, const uint32_t quality) const noexcept
+{
+    if (!m_runtimeQuality) {
+        return false;
+    }
+    return av_opt_set(context->priv_data, m_qualityOption.c_str(), to_string(quality).c_str(), 0) >= 0;
+}
+
+string Codec::getFasterPreset(const Rendition& rendition, const uint32_t steps) const noexcept
+{
+    // Only x264 and x265 have named presets, these are ordered from slowest to fastest
+    static const array<string, 10> presets = {"placebo"s, "veryslow"s, "slower"s, "slow"s, "medium"s, "fast"s,
+        "faster"s, "veryfast"s, "superfast"s, "ultrafast"s};
+    if (m_name != "libx264" && m_name != "libx265") {
+        return ""s;
+    }
+    const string& preset = !rendition.m_preset.empty() ? rendition.m_preset : m_defaultPreset;
+    const auto found = find(presets.cbegin(), presets.cend(), preset);
+    if (found == presets.cend() || static_cast<size_t>(presets.cend() - found) <= steps) {
+        return ""s;
+    }
+    return *(found + steps);
+}
+
+const vector<Codec>& getAvailableCodecs() noexcept
+{
+    static const vector<Codec> codecs = [] {
+        // GPU encoders also need a usable device
+        AVBufferRef* device = nullptr;
+        const bool hasGPU = av_hwdevice_ctx_create(&device, AV_HWDEVICE_TYPE_CUDA, nullptr, nullptr, 0) >= 0;
+        av_buffer_unref(&device);
+
+        vector<Codec> available;
+        string names;
+        for (const auto& i : s_codecs) {
+            if ((!i.m_gpu || hasGPU) && avcodec_find_encoder_by_name(i.m_name.c_str()) != nullptr) {
+                available.emplace_back(i);
+                (names += ' ') += i.m_name;
+            }
+        }
+        logHandler("Available encoders:"s += names);
+        return available;
+    }();
+    return codecs;
+}
+
+const Codec* findCodec(const string& name) noexcept
+{
+    for (const auto& i : getAvailableCodecs()) {
+        if (i.m_name == name) {
+            return &i;
+        }
+    }
+    return nullptr;
+}
+
+const Codec* getDefaultCodec(const int32_t format, const bool useGPU) noexcept
+{
+    if (useGPU) {
+        return findCodec("h264_nvenc"s);
+    }
+    // Depth/IR compresses well losslessly. Colour uses x264 as it is the only encoder that can reduce its quality while
+    // recording if it falls behind (x265 is more efficient but can only switch to a faster preset, which isn't always
+    // possible)
+    const Codec* codec = findCodec(format == AV_PIX_FMT_GRAY16LE ? "ffv1"s : "libx264"s);
+    if (codec == nullptr) {
+        codec = findCodec("libx265"s);
+    }
+    return codec;
+}
+} // namespace Ak
@@ -0,0 +1,542 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Convert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <immintrin.h>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <libavutil/cpu.h>
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#    define AK_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#    define AK_TARGET_AVX2
+#endif
+
+using namespace std;
+
+namespace Ak {
+// Output luma uses the limited range [16, 235]
+static constexpr uint32_t s_lumaMin = 16;
+static constexpr uint32_t s_lumaRange = 219;
+static constexpr uint8_t s_chromaZero = 128;
+
+// BT.601 limited range RGB to YUV coefficients (the same as used by swscale for yuv420p)
+static constexpr float s_yFromR = 0.256788f;
+static constexpr float s_yFromG = 0.504129f;
+static constexpr float s_yFromB = 0.097906f;
+static constexpr float s_uFromR = -0.148223f;
+static constexpr float s_uFromG = -0.290993f;
+static constexpr float s_uFromB = 0.439216f;
+static constexpr float s_vFromR = 0.439216f;
+static constexpr float s_vFromG = -0.367788f;
+static constexpr float s_vFromB = -0.071427f;
+
+// Column sums are stored in 16bit which cannot overflow for up to 257 rows
+static constexpr uint32_t s_maxBinSize = 257;
+
+bool hasConvertAVX2() noexcept
+{
+    return (av_get_cpu_flags() & AV_CPU_FLAG_AVX2) != 0;
+}
+
+/**
+ * Converts a range of pixels within a row using standard instructions.
+ * @param [in]  source     The source row.
+ * @param [out] dest       The destination luma row.
+ * @param       begin      The first destination pixel to convert.
+ * @param       end        One past the last destination pixel to convert.
+ * @param       width      The image width.
+ * @param       maxValue   The largest input value before the output saturates.
+ * @param       multiplier The 16.16 fixed point multiplier from input value to luma.
+ */
+static void convertRow(const uint16_t* source, uint8_t* dest, const uint32_t begin, const uint32_t end,
+    const uint32_t width, const uint16_t maxValue, const uint16_t multiplier) noexcept
+{
+    for (uint32_t x = begin; x < end; ++x) {
+        const uint32_t value = std::min(source[width - 1 - x], maxValue);
+        const uint32_t luma = s_lumaMin + ((value * multiplier + 0x8000) >> 16);
+        dest[x] = static_cast<uint8_t>(std::min(luma, s_lumaMin + s_lumaRange));
+    }
+}
+
+/**
+ * Reverses the order of the 16bit values in a vector.
+ * @param value The vector.
+ * @returns The reversed vector.
+ */
+AK_TARGET_AVX2 static __m256i reverse16(const __m256i value) noexcept
+{
+    const __m256i mask = _mm256_setr_epi8(14, 15, 12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13, 10, 11,
+        8, 9, 6, 7, 4, 5, 2, 3, 0, 1);
+    return _mm256_permute4x64_epi64(_mm256_shuffle_epi8(value, mask), 0x4E);
+}
+
+/**
+ * Converts 16 input pixels to luma.
+ * @param value      The input pixels.
+ * @param maxValue   The largest input value before the output saturates.
+ * @param multiplier The 16.16 fixed point multiplier from input value to luma.
+ * @param lumaMin    The minimum luma value.
+ * @param lumaMax    The maximum luma value.
+ * @returns The luma values (stored in 16bit).
+ */
+AK_TARGET_AVX2 static __m256i convertLuma(__m256i value, const __m256i maxValue, const __m256i multiplier,
+    const __m256i lumaMin, const __m256i lumaMax) noexcept
+{
+    value = _mm256_min_epu16(value, maxValue);
+    // Rounded (value * multiplier) >> 16 using the high half and the top bit of the low half
+    const __m256i high = _mm256_mulhi_epu16(value, multiplier);
+    const __m256i round = _mm256_srli_epi16(_mm256_mullo_epi16(value, multiplier), 15);
+    const __m256i luma = _mm256_add_epi16(_mm256_add_epi16(high, round), lumaMin);
+    return _mm256_min_epu16(luma, lumaMax);
+}
+
+/**
+ * Converts a row using AVX2 instructions.
+ * @param [in]  source     The source row.
+ * @param [out] dest       The destination luma row.
+ * @param       width      The image width.
+ * @param       maxValue   The largest input value before the output saturates.
+ * @param       multiplier The 16.16 fixed point multiplier from input value to luma.
+ */
+AK_TARGET_AVX2 static void convertRowAVX2(const uint16_t* source, uint8_t* dest, const uint32_t width,
+    const uint16_t maxValue, const uint16_t multiplier) noexcept
+{
+    const __m256i maxValue2 = _mm256_set1_epi16(static_cast<int16_t>(maxValue));
+    const __m256i multiplier2 = _mm256_set1_epi16(static_cast<int16_t>(multiplier));
+    const __m256i lumaMin = _mm256_set1_epi16(static_cast<int16_t>(s_lumaMin));
+    const __m256i lumaMax = _mm256_set1_epi16(static_cast<int16_t>(s_lumaMin + s_lumaRange));
+    uint32_t x = 0;
+    for (; x + 32 <= width; x += 32) {
+        // Output pixels [x, x + 32) come from the mirrored input pixels [width - x - 32, width - x)
+        const uint16_t* input = source + (width - x - 32);
+        const __m256i low = reverse16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + 16)));
+        const __m256i high = reverse16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(input)));
+        const __m256i lumaLow = convertLuma(low, maxValue2, multiplier2, lumaMin, lumaMax);
+        const __m256i lumaHigh = convertLuma(high, maxValue2, multiplier2, lumaMin, lumaMax);
+        // Pack interleaves the 128bit lanes so they need to be reordered
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(lumaLow, lumaHigh), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + x), packed);
+    }
+    convertRow(source, dest, x, width, width, maxValue, multiplier);
+}
+
+void convertGray16ToYUV420(const uint8_t* const source, const int32_t sourceStride, uint8_t* const dest[3],
+    const int32_t destStride[3], const uint32_t width, const uint32_t height, const float scale,
+    const bool useAVX2) noexcept
+{
+    // Values are first scaled to the full 16bit range and then converted to limited range luma
+    const auto maxValue = static_cast<uint16_t>(std::min(65535.0f / scale, 65535.0f));
+    const auto multiplier = static_cast<uint16_t>(
+        std::min(static_cast<float>(s_lumaRange) * scale * 65536.0f / 65535.0f + 0.5f, 65535.0f));
+
+    for (uint32_t y = 0; y < height; ++y) {
+        const auto* sourceRow = reinterpret_cast<const uint16_t*>(source + static_cast<ptrdiff_t>(y) * sourceStride);
+        uint8_t* destRow = dest[0] + static_cast<ptrdiff_t>(y) * destStride[0];
+        if (useAVX2) {
+            convertRowAVX2(sourceRow, destRow, width, maxValue, multiplier);
+        } else {
+            convertRow(sourceRow, destRow, 0, width, width, maxValue, multiplier);
+        }
+    }
+
+    // Grayscale has no colour information
+    const uint32_t chromaWidth = (width + 1) / 2;
+    const uint32_t chromaHeight = (height + 1) / 2;
+    for (uint32_t y = 0; y < chromaHeight; ++y) {
+        memset(dest[1] + static_cast<ptrdiff_t>(y) * destStride[1], s_chromaZero, chromaWidth);
+        memset(dest[2] + static_cast<ptrdiff_t>(y) * destStride[2], s_chromaZero, chromaWidth);
+    }
+}
+
+/**
+ * Gets the range of source pixels that are averaged to produce an output pixel.
+ * @note When upscaling each output pixel uses at least 1 source pixel. Bins are limited to s_maxBinSize pixels.
+ * @param      index       The output pixel index.
+ * @param      size        The output size.
+ * @param      sourceSize  The source size.
+ * @param[out] begin       The first source pixel.
+ * @param[out] end         One past the last source pixel.
+ */
+static void getBin(const uint32_t index, const uint32_t size, const uint32_t sourceSize, uint32_t& begin,
+    uint32_t& end) noexcept
+{
+    begin = static_cast<uint32_t>(static_cast<uint64_t>(index) * sourceSize / size);
+    end = static_cast<uint32_t>(static_cast<uint64_t>(index + 1) * sourceSize / size);
+    begin = std::min(begin, sourceSize - 1);
+    end = std::min(std::max(end, begin + 1), begin + s_maxBinSize);
+}
+
+/**
+ * Sums the BGRA channels of each column over a range of rows using standard instructions.
+ * @param [in]  source       The first source row.
+ * @param       sourceStride The source image stride (in bytes).
+ * @param       rows         The number of rows to sum.
+ * @param       count        The number of values in each row (4 per pixel).
+ * @param [out] sums         The per value sums.
+ */
+static void sumRows(const uint8_t* source, const int32_t sourceStride, const uint32_t rows, const uint32_t count,
+    uint16_t* sums) noexcept
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t x = 0;
+    for (; x + 16 <= count; x += 16) {
+        __m128i low = zero;
+        __m128i high = zero;
+        const uint8_t* row = source + x;
+        for (uint32_t y = 0; y < rows; ++y, row += sourceStride) {
+            const __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+            low = _mm_add_epi16(low, _mm_unpacklo_epi8(values, zero));
+            high = _mm_add_epi16(high, _mm_unpackhi_epi8(values, zero));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x), low);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sums + x + 8), high);
+    }
+    for (; x < count; ++x) {
+        uint32_t sum = 0;
+        for (uint32_t y = 0; y < rows; ++y) {
+            sum += source[static_cast<ptrdiff_t>(y) * sourceStride + x];
+        }
+        sums[x] = static_cast<uint16_t>(sum);
+    }
+}
+
+/**
+ * Sums the BGRA channels of each column over a range of rows using AVX2 instructions.
+ * @param [in]  source       The first source row.
+ * @param       sourceStride The source image stride (in bytes).
+ * @param       rows         The number of rows to sum.
+ * @param       count        The number of values in each row (4 per pixel).
+ * @param [out] sums         The per value sums.
+ */
+AK_TARGET_AVX2 static void sumRowsAVX2(const uint8_t* source, const int32_t sourceStride, const uint32_t rows,
+    const uint32_t count, uint16_t* sums) noexcept
+{
+    uint32_t x = 0;
+    for (; x + 32 <= count; x += 32) {
+        __m256i low = _mm256_setzero_si256();
+        __m256i high = _mm256_setzero_si256();
+        const uint8_t* row = source + x;
+        for (uint32_t y = 0; y < rows; ++y, row += sourceStride) {
+            low = _mm256_add_epi16(low, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row))));
+            high = _mm256_add_epi16(
+                high, _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 16))));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + x), low);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sums + x + 16), high);
+    }
+    sumRows(source + x, sourceStride, rows, count - x, sums + x);
+}
+
+/**
+ * Sums the column sums within a horizontal bin.
+ * @param [in] sums  The per column BGRA sums.
+ * @param      begin The first column of the bin.
+ * @param      end   One past the last column of the bin.
+ * @returns The BGRA totals.
+ */
+static __m128 sumBin(const uint16_t* sums, const uint32_t begin, const uint32_t end) noexcept
+{
+    // All 4 channels are summed at once (in 32bit as the total can overflow 16bit)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = zero;
+    for (uint32_t j = begin; j < end; ++j) {
+        const __m128i column = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(sums + j * 4));
+        total = _mm_add_epi32(total, _mm_unpacklo_epi16(column, zero));
+    }
+    return _mm_cvtepi32_ps(total);
+}
+
+/**
+ * Averages the column sums within each horizontal bin to get the colour of each output pixel.
+ * @param [in]  sums   The per column BGRA sums.
+ * @param [in]  begin  The first column of each bin.
+ * @param [in]  end    One past the last column of each bin.
+ * @param [in]  scale  The reciprocal of the number of pixels summed in each bin.
+ * @param       width  The output width.
+ * @param       mirror True to mirror the output horizontally.
+ * @param [out] colour The output blue, green and red planes.
+ */
+static void averageBins(const uint16_t* sums, const uint32_t* begin, const uint32_t* end, const float* scale,
+    const uint32_t width, const bool mirror, float* const colour[3]) noexcept
+{
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        // Transpose 4 pixels into separate channels, reversing their order mirrors the output horizontally
+        __m128 pixel0 = sumBin(sums, begin[x], end[x]);
+        __m128 pixel1 = sumBin(sums, begin[x + 1], end[x + 1]);
+        __m128 pixel2 = sumBin(sums, begin[x + 2], end[x + 2]);
+        __m128 pixel3 = sumBin(sums, begin[x + 3], end[x + 3]);
+        __m128 scale4 = _mm_loadu_ps(scale + x);
+        if (mirror) {
+            std::swap(pixel0, pixel3);
+            std::swap(pixel1, pixel2);
+            scale4 = _mm_shuffle_ps(scale4, scale4, _MM_SHUFFLE(0, 1, 2, 3));
+        }
+        _MM_TRANSPOSE4_PS(pixel0, pixel1, pixel2, pixel3);
+        const uint32_t out = mirror ? width - 4 - x : x;
+        _mm_storeu_ps(colour[0] + out, _mm_mul_ps(pixel0, scale4));
+        _mm_storeu_ps(colour[1] + out, _mm_mul_ps(pixel1, scale4));
+        _mm_storeu_ps(colour[2] + out, _mm_mul_ps(pixel2, scale4));
+    }
+    for (; x < width; ++x) {
+        alignas(16) float pixel[4];
+        _mm_store_ps(pixel, _mm_mul_ps(sumBin(sums, begin[x], end[x]), _mm_set1_ps(scale[x])));
+        const uint32_t out = mirror ? width - 1 - x : x;
+        colour[0][out] = pixel[0];
+        colour[1][out] = pixel[1];
+        colour[2][out] = pixel[2];
+    }
+}
+
+/**
+ * Rounds and stores 4 values as bytes.
+ * @param [out] dest  The destination.
+ * @param       value The values (must be within the range of a byte).
+ */
+static void storeBytes(uint8_t* dest, const __m128 value) noexcept
+{
+    __m128i bytes = _mm_cvttps_epi32(_mm_add_ps(value, _mm_set1_ps(0.5f)));
+    bytes = _mm_packs_epi32(bytes, bytes);
+    bytes = _mm_packus_epi16(bytes, bytes);
+    const int32_t packed = _mm_cvtsi128_si32(bytes);
+    memcpy(dest, &packed, sizeof(packed));
+}
+
+/**
+ * Converts a row of colours to luma.
+ * @param [in]  colour The blue, green and red planes.
+ * @param       width  The output width.
+ * @param [out] dest   The destination luma row.
+ */
+static void convertLumaRow(const float* const colour[3], const uint32_t width, uint8_t* dest) noexcept
+{
+    const __m128 fromB = _mm_set1_ps(s_yFromB);
+    const __m128 fromG = _mm_set1_ps(s_yFromG);
+    const __m128 fromR = _mm_set1_ps(s_yFromR);
+    const __m128 offset = _mm_set1_ps(static_cast<float>(s_lumaMin));
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128 luma = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(colour[0] + x), fromB),
+                                           _mm_mul_ps(_mm_loadu_ps(colour[1] + x), fromG)),
+            _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(colour[2] + x), fromR), offset));
+        storeBytes(dest + x, luma);
+    }
+    for (; x < width; ++x) {
+        const float luma = s_yFromB * colour[0][x] + s_yFromG * colour[1][x] + s_yFromR * colour[2][x];
+        dest[x] = static_cast<uint8_t>(luma + static_cast<float>(s_lumaMin) + 0.5f);
+    }
+}
+
+/**
+ * Sums each 2x2 block within 8 columns of a pair of rows.
+ * @param [in] row0 The first row.
+ * @param [in] row1 The second row.
+ * @returns The 4 block totals.
+ */
+static __m128 sumBlocks(const float* row0, const float* row1) noexcept
+{
+    const __m128 low = _mm_add_ps(_mm_loadu_ps(row0), _mm_loadu_ps(row1));
+    const __m128 high = _mm_add_ps(_mm_loadu_ps(row0 + 4), _mm_loadu_ps(row1 + 4));
+    return _mm_add_ps(
+        _mm_shuffle_ps(low, high, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(low, high, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+/**
+ * Converts a pair of rows of colours to chroma by averaging each 2x2 block.
+ * @param [in]  colour0 The blue, green and red planes of the first row.
+ * @param [in]  colour1 The blue, green and red planes of the second row.
+ * @param       width   The chroma width (each plane must contain twice as many values).
+ * @param [out] destU   The destination U row.
+ * @param [out] destV   The destination V row.
+ */
+static void convertChromaRow(const float* const colour0[3], const float* const colour1[3], const uint32_t width,
+    uint8_t* destU, uint8_t* destV) noexcept
+{
+    const __m128 uFromB = _mm_set1_ps(s_uFromB * 0.25f);
+    const __m128 uFromG = _mm_set1_ps(s_uFromG * 0.25f);
+    const __m128 uFromR = _mm_set1_ps(s_uFromR * 0.25f);
+    const __m128 vFromB = _mm_set1_ps(s_vFromB * 0.25f);
+    const __m128 vFromG = _mm_set1_ps(s_vFromG * 0.25f);
+    const __m128 vFromR = _mm_set1_ps(s_vFromR * 0.25f);
+    const __m128 offset = _mm_set1_ps(static_cast<float>(s_chromaZero));
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        const __m128 b = sumBlocks(colour0[0] + x * 2, colour1[0] + x * 2);
+        const __m128 g = sumBlocks(colour0[1] + x * 2, colour1[1] + x * 2);
+        const __m128 r = sumBlocks(colour0[2] + x * 2, colour1[2] + x * 2);
+        const __m128 u = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(b, uFromB), _mm_mul_ps(g, uFromG)), _mm_add_ps(_mm_mul_ps(r, uFromR), offset));
+        const __m128 v = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(b, vFromB), _mm_mul_ps(g, vFromG)), _mm_add_ps(_mm_mul_ps(r, vFromR), offset));
+        storeBytes(destU + x, u);
+        storeBytes(destV + x, v);
+    }
+    for (; x < width; ++x) {
+        float sums[3];
+        for (uint32_t i = 0; i < 3; ++i) {
+            sums[i] = colour0[i][x * 2] + colour0[i][x * 2 + 1] + colour1[i][x * 2] + colour1[i][x * 2 + 1];
+        }
+        const float u = (s_uFromB * sums[0] + s_uFromG * sums[1] + s_uFromR * sums[2]) * 0.25f;
+        const float v = (s_vFromB * sums[0] + s_vFromG * sums[1] + s_vFromR * sums[2]) * 0.25f;
+        destU[x] = static_cast<uint8_t>(u + static_cast<float>(s_chromaZero) + 0.5f);
+        destV[x] = static_cast<uint8_t>(v + static_cast<float>(s_chromaZero) + 0.5f);
+    }
+}
+
+void initResizeBins(ResizeBins& bins, const uint32_t width, const uint32_t sourceWidth) noexcept
+{
+    bins.m_begin.resize(width);
+    bins.m_end.resize(width);
+    bins.m_scale.resize(width);
+    bins.m_fixedScale.resize(width);
+    for (uint32_t x = 0; x < width; ++x) {
+        getBin(x, width, sourceWidth, bins.m_begin[x], bins.m_end[x]);
+        bins.m_scale[x] = 1.0f / static_cast<float>(bins.m_end[x] - bins.m_begin[x]);
+        bins.m_fixedScale[x] = 65536 / (bins.m_end[x] - bins.m_begin[x]);
+    }
+}
+
+void initResizeScratch(ResizeScratch& scratch, const uint32_t width, const uint32_t sourceWidth) noexcept
+{
+    // The colour rows are padded to an even width so that chroma always covers a full 2x2 block
+    const uint32_t paddedWidth = (width + 1) & ~1U;
+    scratch.m_columnSums.resize(static_cast<size_t>(sourceWidth) * 4);
+    scratch.m_colours.resize(static_cast<size_t>(paddedWidth) * 3 * 2);
+    scratch.m_scale.resize(width);
+}
+
+void convertBGRAToYUV420(const uint8_t* const source, const int32_t sourceStride, const uint32_t sourceWidth,
+    const uint32_t sourceHeight, uint8_t* const dest[3], const int32_t destStride[3], const uint32_t width,
+    const uint32_t height, const uint32_t rowBegin, const uint32_t rowEnd, const ResizeBins& bins,
+    ResizeScratch& scratch, const bool useAVX2, const bool mirror) noexcept
+{
+    // Per column sums of the current source rows and the colour of each output pixel for a pair of rows
+    const uint32_t paddedWidth = (width + 1) & ~1U;
+    uint16_t* columnSums = scratch.m_columnSums.data();
+    float* scale = scratch.m_scale.data();
+    float* colour[2][3];
+    for (uint32_t i = 0; i < 6; ++i) {
+        colour[i / 3][i % 3] = scratch.m_colours.data() + static_cast<size_t>(paddedWidth) * i;
+    }
+
+    for (uint32_t y = rowBegin & ~1U; y < rowEnd; y += 2) {
+        const uint32_t rows = std::min(height - y, 2U);
+        for (uint32_t i = 0; i < rows; ++i) {
+            uint32_t sourceBegin;
+            uint32_t sourceEnd;
+            getBin(y + i, height, sourceHeight, sourceBegin, sourceEnd);
+            const uint8_t* sourceRow = source + static_cast<ptrdiff_t>(sourceBegin) * sourceStride;
+            if (useAVX2) {
+                sumRowsAVX2(sourceRow, sourceStride, sourceEnd - sourceBegin, sourceWidth * 4, columnSums);
+            } else {
+                sumRows(sourceRow, sourceStride, sourceEnd - sourceBegin, sourceWidth * 4, columnSums);
+            }
+            const float rowScale = 1.0f / static_cast<float>(sourceEnd - sourceBegin);
+            for (uint32_t x = 0; x < width; ++x) {
+                scale[x] = bins.m_scale[x] * rowScale;
+            }
+            averageBins(columnSums, bins.m_begin.data(), bins.m_end.data(), scale, width, mirror, colour[i]);
+            convertLumaRow(colour[i], width, dest[0] + static_cast<ptrdiff_t>(y + i) * destStride[0]);
+            if (paddedWidth != width) {
+                for (auto& j : colour[i]) {
+                    j[width] = j[width - 1];
+                }
+            }
+        }
+        if (rows == 1) {
+            // Duplicate the last row so that it is used for the final chroma row
+            memcpy(colour[1][0], colour[0][0], static_cast<size_t>(paddedWidth) * 3 * sizeof(float));
+        }
+
+        // Chroma is the average over each 2x2 block of output pixels
+        const ptrdiff_t chromaY = y / 2;
+        convertChromaRow(colour[0], colour[1], paddedWidth / 2, dest[1] + chromaY * destStride[1],
+            dest[2] + chromaY * destStride[2]);
+    }
+}
+
+/**
+ * Resizes a range of rows of an 8bit image plane.
+ * @param [in]  source       The source plane.
+ * @param       sourceStride The source plane stride (in bytes).
+ * @param       sourceWidth  The source plane width.
+ * @param       sourceHeight The source plane height.
+ * @param [out] dest         The destination plane.
+ * @param       destStride   The destination plane stride (in bytes).
+ * @param       width        The destination plane width.
+ * @param       height       The destination plane height.
+ * @param       rowBegin     The first destination row to write.
+ * @param       rowEnd       One past the last destination row to write.
+ * @param       bins         The horizontal bins of the plane.
+ * @param [out] columnSums   Working storage for the per column sums (at least sourceWidth values).
+ * @param       useAVX2      True to use AVX2 instructions.
+ */
+static void scalePlane(const uint8_t* source, const int32_t sourceStride, const uint32_t sourceWidth,
+    const uint32_t sourceHeight, uint8_t* dest, const int32_t destStride, const uint32_t width, const uint32_t height,
+    const uint32_t rowBegin, const uint32_t rowEnd, const ResizeBins& bins, uint16_t* columnSums,
+    const bool useAVX2) noexcept
+{
+    for (uint32_t y = rowBegin; y < rowEnd; ++y) {
+        uint32_t sourceBegin;
+        uint32_t sourceEnd;
+        getBin(y, height, sourceHeight, sourceBegin, sourceEnd);
+        const uint8_t* sourceRow = source + static_cast<ptrdiff_t>(sourceBegin) * sourceStride;
+        if (useAVX2) {
+            sumRowsAVX2(sourceRow, sourceStride, sourceEnd - sourceBegin, sourceWidth, columnSums);
+        } else {
+            sumRows(sourceRow, sourceStride, sourceEnd - sourceBegin, sourceWidth, columnSums);
+        }
+        // The average is calculated in 16.16 fixed point
+        const uint32_t rowScale = 65536 / (sourceEnd - sourceBegin);
+
+        uint8_t* destRow = dest + static_cast<ptrdiff_t>(y) * destStride;
+        for (uint32_t x = 0; x < width; ++x) {
+            uint32_t total = 0;
+            for (uint32_t j = bins.m_begin[x]; j < bins.m_end[x]; ++j) {
+                total += columnSums[j];
+            }
+            const uint64_t average =
+                (static_cast<uint64_t>(total) * bins.m_fixedScale[x] * rowScale + 0x80000000) >> 32;
+            destRow[x] = static_cast<uint8_t>(average);
+        }
+    }
+}
+
+void scaleYUV420(const uint8_t* const source[3], const int32_t sourceStride[3], const uint32_t sourceWidth,
+    const uint32_t sourceHeight, uint8_t* const dest[3], const int32_t destStride[3], const uint32_t width,
+    const uint32_t height, const uint32_t rowBegin, const uint32_t rowEnd, const ResizeBins bins[2],
+    ResizeScratch& scratch, const bool useAVX2) noexcept
+{
+    scalePlane(source[0], sourceStride[0], sourceWidth, sourceHeight, dest[0], destStride[0], width, height, rowBegin,
+        rowEnd, bins[0], scratch.m_columnSums.data(), useAVX2);
+
+    // Chroma planes are half the size so only cover half the rows
+    const uint32_t chromaBegin = rowBegin / 2;
+    const uint32_t chromaEnd = (rowEnd + 1) / 2;
+    for (uint32_t i = 1; i < 3; ++i) {
+        scalePlane(source[i], sourceStride[i], (sourceWidth + 1) / 2, (sourceHeight + 1) / 2, dest[i], destStride[i],
+            (width + 1) / 2, (height + 1) / 2, chromaBegin, chromaEnd, bins[1], scratch.m_columnSums.data(), useAVX2);
+    }
+}
+} // namespace Ak
@@ -26,6 +26,17 @@ KinectImage::KinectImage(uint8_t* const image, const int32_t width, const int32_
     , m_stride(stride)
 {}
 
+KinectImage::KinectImage(uint8_t* const image, const int32_t width, const int32_t height, const int32_t stride,
+    void* const owner, const referenceFunction reference, const releaseFunction release)
+    : m_image(image)
+    , m_width(width)
+    , m_height(height)
+    , m_stride(stride)
+    , m_owner(owner)
+    , m_reference(reference)
+    , m_release(release)
+{}
+
 Position::Position(const float x, const float y, const float z)
     : m_position(x, y, z)
 {}
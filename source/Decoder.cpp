@@ -0,0 +1,341 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Decoder.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/opt.h>
+}
+
+using namespace std;
+
+namespace Ak {
+extern std::string getFfmpegErrorString(int errorCode) noexcept;
+
+InputFormatContextPtr::InputFormatContextPtr(AVFormatContext* formatContext) noexcept
+    : m_formatContext(formatContext, [](AVFormatContext* p) { avformat_close_input(&p); })
+{}
+
+AVFormatContext* InputFormatContextPtr::get() const noexcept
+{
+    return m_formatContext.get();
+}
+
+AVFormatContext* InputFormatContextPtr::operator->() const noexcept
+{
+    return m_formatContext.get();
+}
+
+Decoder::~Decoder()
+{
+    shutdown();
+    cleanupInput();
+}
+
+bool Decoder::init(const string& filename, errorCallback error) noexcept
+{
+    // Close any existing input
+    shutdown();
+    cleanupInput();
+
+    m_errorCallback = move(error);
+    m_shutdown = false;
+
+    // Open the input file
+    AVFormatContext* formatPtr = nullptr;
+    auto ret = avformat_open_input(&formatPtr, filename.c_str(), nullptr, nullptr);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback(("Failed to open input file: "s += filename) += ", "s += getFfmpegErrorString(ret));
+        }
+        return false;
+    }
+    InputFormatContextPtr tempFormat(formatPtr);
+    ret = avformat_find_stream_info(tempFormat.get(), nullptr);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed finding stream information: "s += getFfmpegErrorString(ret));
+        }
+        return false;
+    }
+
+    // Find the video stream and its decoder
+    AVCodec* decoder = nullptr;
+    ret = av_find_best_stream(tempFormat.get(), AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to find a video stream in input file: "s += filename);
+        }
+        return false;
+    }
+    const auto streamIndex = ret;
+    CodecContextPtr tempCodec(avcodec_alloc_context3(decoder));
+    if (tempCodec.get() == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed allocating decoder context");
+        }
+        return false;
+    }
+    ret = avcodec_parameters_to_context(tempCodec.get(), tempFormat->streams[streamIndex]->codecpar);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed copying parameters to decoder context: "s += getFfmpegErrorString(ret));
+        }
+        return false;
+    }
+    tempCodec->framerate = tempFormat->streams[streamIndex]->avg_frame_rate;
+    tempCodec->pkt_timebase = tempFormat->streams[streamIndex]->time_base;
+
+    // Make the new input
+    m_formatContext = move(tempFormat);
+    m_codecContext = move(tempCodec);
+    m_streamIndex = streamIndex;
+
+    return true;
+}
+
+bool Decoder::start(const int32_t format, const float scale, const uint32_t numThreads) noexcept
+{
+    // Open the decoder
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "refcounted_frames", "1", 0);
+    if (numThreads != 0) {
+        av_dict_set(&opts, "threads", to_string(numThreads).c_str(), 0);
+    }
+    auto ret = avcodec_open2(m_codecContext.get(), m_codecContext->codec, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed opening video decoder: "s += getFfmpegErrorString(ret));
+        }
+        return false;
+    }
+
+    // Initialise the filter to convert back to the original pixel format
+    if (!m_filter.initInverse(getWidth(), getHeight(), getFrameRate(), {1, 1000000}, m_codecContext->pix_fmt, format,
+            scale, numThreads, m_errorCallback)) {
+        return false;
+    }
+
+    m_bufferIndex = 0;
+    m_remainingBuffers = 0;
+    m_nextBufferIndex = 0;
+    m_finished = false;
+    m_startTime = AV_NOPTS_VALUE;
+
+    // Start decode thread running
+    m_thread = thread(&Decoder::run, this);
+
+    return true;
+}
+
+bool Decoder::getFrame(FramePtr& frame) noexcept
+{
+    {
+        unique_lock<mutex> lock(m_lock);
+        m_condition.wait(lock, [this] { return (m_remainingBuffers > 0) || m_finished || m_shutdown; });
+        if (m_remainingBuffers == 0) {
+            return false;
+        }
+        frame = move(m_dataBuffer[m_nextBufferIndex]);
+        ++m_nextBufferIndex;
+        m_nextBufferIndex = m_nextBufferIndex < m_dataBuffer.size() ? m_nextBufferIndex : 0;
+        --m_remainingBuffers;
+    }
+    // Notify wakeup
+    m_condition.notify_all();
+    return true;
+}
+
+void Decoder::shutdown() noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_shutdown = true;
+    }
+    // Notify wakeup
+    m_condition.notify_all();
+    // Wait for thread to complete
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+uint32_t Decoder::getWidth() const noexcept
+{
+    return m_codecContext->width;
+}
+
+uint32_t Decoder::getHeight() const noexcept
+{
+    return m_codecContext->height;
+}
+
+AVRational Decoder::getFrameRate() const noexcept
+{
+    return m_codecContext->framerate;
+}
+
+int64_t Decoder::getDeviceStartTime() const noexcept
+{
+    // Recordings store the device time of the first frame in the file metadata (see Encoder)
+    const auto entry = av_dict_get(m_formatContext->metadata, "device_start_time", nullptr, 0);
+    if (entry == nullptr) {
+        return AV_NOPTS_VALUE;
+    }
+    return strtoll(entry->value, nullptr, 10);
+}
+
+void Decoder::cleanupInput() noexcept
+{
+    for (auto& i : m_dataBuffer) {
+        i = FramePtr(nullptr);
+    }
+    m_filter = Filter();
+    m_codecContext = CodecContextPtr(nullptr);
+    m_formatContext = InputFormatContextPtr(nullptr);
+}
+
+bool Decoder::run() noexcept
+{
+    AVPacket packet;
+    bool ret = true;
+    while (!m_shutdown) {
+        packet.data = nullptr;
+        packet.size = 0;
+        av_init_packet(&packet);
+        auto ret2 = av_read_frame(m_formatContext.get(), &packet);
+        if (ret2 < 0) {
+            if (ret2 != AVERROR_EOF) {
+                if (m_errorCallback != nullptr) {
+                    m_errorCallback("Failed to read input packet: "s += getFfmpegErrorString(ret2));
+                }
+                ret = false;
+                break;
+            }
+
+            // Send a flush packet to retrieve any remaining frames
+            ret2 = avcodec_send_packet(m_codecContext.get(), nullptr);
+            if (ret2 < 0) {
+                if (m_errorCallback != nullptr) {
+                    m_errorCallback("Failed to send flush packet to decoder: "s += getFfmpegErrorString(ret2));
+                }
+                ret = false;
+                break;
+            }
+            ret = decodeFrames();
+            break;
+        }
+        if (packet.stream_index != m_streamIndex) {
+            av_packet_unref(&packet);
+            continue;
+        }
+
+        // Send packet to decoder
+        ret2 = avcodec_send_packet(m_codecContext.get(), &packet);
+        av_packet_unref(&packet);
+        if (ret2 < 0) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to send packet to decoder: "s += getFfmpegErrorString(ret2));
+            }
+            ret = false;
+            break;
+        }
+        if (!decodeFrames()) {
+            ret = false;
+            break;
+        }
+    }
+
+    // Signal that no more frames will be produced
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_finished = true;
+    }
+    m_condition.notify_all();
+
+    return ret;
+}
+
+bool Decoder::decodeFrames() noexcept
+{
+    // Get all decoded frames
+    while (!m_shutdown) {
+        FramePtr frame(av_frame_alloc());
+        if (frame.get() == nullptr) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to allocate new host frame"s);
+            }
+            return false;
+        }
+        const auto ret = avcodec_receive_frame(m_codecContext.get(), frame.get());
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            break;
+        } else if (ret < 0) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to receive decoded frame: "s += getFfmpegErrorString(ret));
+            }
+            return false;
+        }
+
+        // Convert timestamp to microseconds from start of stream
+        if (m_startTime == AV_NOPTS_VALUE) {
+            m_startTime = frame->best_effort_timestamp;
+        }
+        frame.m_frame->pts = av_rescale_q(frame->best_effort_timestamp - m_startTime,
+            m_formatContext->streams[m_streamIndex]->time_base, {1, 1000000});
+
+        // Pass through filter chain
+        if (!m_filter.sendFrame(frame)) {
+            return false;
+        }
+        while (m_filter.receiveFrame(frame)) {
+            if (!pushFrame(frame)) {
+                return false;
+            }
+            frame = FramePtr(av_frame_alloc());
+            if (frame.get() == nullptr) {
+                if (m_errorCallback != nullptr) {
+                    m_errorCallback("Failed to allocate new host frame"s);
+                }
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Decoder::pushFrame(FramePtr& frame) noexcept
+{
+    {
+        unique_lock<mutex> lock(m_lock);
+        m_condition.wait(
+            lock, [this] { return (m_remainingBuffers < static_cast<int32_t>(m_dataBuffer.size())) || m_shutdown; });
+        if (m_shutdown) {
+            return false;
+        }
+        m_dataBuffer[m_bufferIndex] = move(frame);
+        ++m_bufferIndex;
+        m_bufferIndex = m_bufferIndex < m_dataBuffer.size() ? m_bufferIndex : 0;
+        ++m_remainingBuffers;
+    }
+    // Notify wakeup
+    m_condition.notify_all();
+    return true;
+}
+} // namespace Ak
@@ -18,11 +18,14 @@
 
 #include "Filter.h"
 
+#include <cstring>
+
 extern "C" {
 #include <libavfilter/avfilter.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
 #include <libavutil/opt.h>
+#include <libavutil/time.h>
 }
 
 using namespace std;
@@ -39,7 +42,12 @@ std::string getFfmpegErrorString(const int errorCode) noexcept
 
 static int s_prefix = 1;
 
-void logCallback(void* avclass, const int level, const char* format, const va_list vl)
+static constexpr uint32_t s_qualityStepSize = 3; /**< Quality level change made by each rate controller step. */
+static constexpr uint32_t s_maxQualitySteps = 3; /**< Maximum number of rate controller steps. */
+static constexpr uint32_t s_maxPresetSteps = 2;  /**< Maximum number of faster presets used by the rate controller. */
+static constexpr uint64_t s_dropLogInterval = 30; /**< Number of dropped frames between each log message. */
+
+void logCallback(void* avclass, const int level, const char* format, va_list vl)
 {
     char buffer[1024];
     av_log_format_line(avclass, level, format, vl, buffer, 1024, &s_prefix);
@@ -47,7 +55,12 @@ void logCallback(void* avclass, const int level, const char* format, const va_li
 }
 
 OutputFormatContextPtr::OutputFormatContextPtr(AVFormatContext* formatContext) noexcept
-    : m_formatContext(formatContext, [](AVFormatContext* p) { avformat_free_context(p); })
+    : m_formatContext(formatContext, [](AVFormatContext* p) {
+        if (p != nullptr && p->pb != nullptr && !(p->oformat->flags & AVFMT_NOFILE)) {
+            avio_closep(&p->pb);
+        }
+        avformat_free_context(p);
+    })
 {}
 
 AVFormatContext* OutputFormatContextPtr::get() const noexcept
@@ -102,6 +115,107 @@ const AVBufferRef* DevicePtr::operator->() const noexcept
     return m_device.get();
 }
 
+BitstreamFilterPtr::BitstreamFilterPtr(AVBSFContext* filter) noexcept
+    : m_filter(filter, [](AVBSFContext* p) { av_bsf_free(&p); })
+{}
+
+AVBSFContext* BitstreamFilterPtr::get() const noexcept
+{
+    return m_filter.get();
+}
+
+AVBSFContext* BitstreamFilterPtr::operator->() const noexcept
+{
+    return m_filter.get();
+}
+
+BufferPoolPtr::BufferPoolPtr(AVBufferPool* pool) noexcept
+    : m_pool(pool, [](AVBufferPool* p) { av_buffer_pool_uninit(&p); })
+{}
+
+AVBufferPool* BufferPoolPtr::get() const noexcept
+{
+    return m_pool.get();
+}
+
+void TimeHistogram::add(const int64_t time) noexcept
+{
+    uint32_t bucket = 0;
+    while (bucket < s_numBuckets - 1 && time >= (64LL << bucket)) {
+        ++bucket;
+    }
+    m_buckets[bucket].fetch_add(1, memory_order_relaxed);
+    m_total.fetch_add(time, memory_order_relaxed);
+    m_count.fetch_add(1, memory_order_relaxed);
+    int64_t max = m_max.load(memory_order_relaxed);
+    while (time > max && !m_max.compare_exchange_weak(max, time, memory_order_relaxed)) {
+    }
+}
+
+uint64_t TimeHistogram::getCount() const noexcept
+{
+    return m_count.load(memory_order_relaxed);
+}
+
+int64_t TimeHistogram::getAverage() const noexcept
+{
+    const uint64_t count = getCount();
+    return count > 0 ? m_total.load(memory_order_relaxed) / static_cast<int64_t>(count) : 0;
+}
+
+int64_t TimeHistogram::getMax() const noexcept
+{
+    return m_max.load(memory_order_relaxed);
+}
+
+int64_t TimeHistogram::getPercentile(const float percentile) const noexcept
+{
+    // Buckets may be updated while they are read so use their sum instead of the separate count
+    array<uint64_t, s_numBuckets> buckets;
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < s_numBuckets; ++i) {
+        buckets[i] = getBucket(i);
+        count += buckets[i];
+    }
+    const auto target = static_cast<uint64_t>(static_cast<double>(count) * static_cast<double>(percentile));
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < s_numBuckets - 1; ++i) {
+        total += buckets[i];
+        if (total > target) {
+            return 64LL << i;
+        }
+    }
+    return getMax();
+}
+
+uint64_t TimeHistogram::getBucket(const uint32_t bucket) const noexcept
+{
+    return m_buckets[bucket].load(memory_order_relaxed);
+}
+
+void TimeHistogram::reset() noexcept
+{
+    for (auto& i : m_buckets) {
+        i = 0;
+    }
+    m_count = 0;
+    m_total = 0;
+    m_max = 0;
+}
+
+void EncoderStatistics::reset() noexcept
+{
+    m_framesIn = 0;
+    m_framesOut = 0;
+    m_droppedFrames = 0;
+    m_queueHighWater = 0;
+    m_bytesWritten = 0;
+    m_bitrate = 0;
+    m_filterTime.reset();
+    m_encodeTime.reset();
+    m_muxTime.reset();
+}
+
 Encoder::~Encoder()
 {
     shutdown();
@@ -109,13 +223,31 @@ Encoder::~Encoder()
 }
 
 bool Encoder::init(const string& filename, const uint32_t width, const uint32_t height, const uint32_t fps,
-    const int32_t format, const float scale, const uint32_t numThreads, const bool useGPU, errorCallback error) noexcept
+    const int32_t format, const float scale, const uint32_t numThreads, const bool useGPU, const bool fragmented,
+    errorCallback error) noexcept
 {
+    if (!prepare(width, height, fps, format, scale, numThreads, useGPU, fragmented, Rendition(), move(error))) {
+        return false;
+    }
+    return start(filename);
+}
+
+bool Encoder::prepare(const uint32_t width, const uint32_t height, const uint32_t fps, const int32_t format,
+    const float scale, const uint32_t numThreads, const bool useGPU, const bool fragmented, const Rendition& rendition,
+    errorCallback error) noexcept
+{
+    // Close any existing output
+    shutdown();
+
     m_errorCallback = move(error);
     m_format = format;
-    m_timebase = {1, static_cast<int32_t>(fps)};
-    m_shutdown = false;
+    m_inputWidth = width;
+    m_inputHeight = height;
+    m_frameRate = {static_cast<int32_t>(fps), 1};
+    m_timebase = {1, 1000000};
     m_useGPU = useGPU;
+    m_fragmented = fragmented;
+    m_rendition = rendition;
 
     // Set the ffmpeg callback for receiving log messages
 #ifdef _DEBUG
@@ -126,36 +258,117 @@ bool Encoder::init(const string& filename, const uint32_t width, const uint32_t
     av_log_set_callback(logCallback);
 
     // Initialise the output
-    if (!initOutput(filename, width, height, format, scale, numThreads)) {
+    if (!initOutput(width, height, format, scale, numThreads)) {
+        cleanupOutput();
+        return false;
+    }
+
+    return true;
+}
+
+bool Encoder::start(const string& filename) noexcept
+{
+    if (!isPrepared()) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Encoder must be prepared before it can be started"s);
+        }
         return false;
     }
+    if (!openOutput(filename)) {
+        cleanupOutput();
+        return false;
+    }
+    m_shutdown = false;
 
-    // Start encode thread running
-    m_thread = thread(&Encoder::run, this);
+    // Frames are converted and encoded on the thread pool by separate stages so that conversion of the next frame
+    // can overlap encoding of the previous one
+    m_filterTask.init([this] { runFilter(); }, m_priority);
+    m_encodeTask.init([this] { runEncode(); }, m_priority);
 
     return true;
 }
 
-bool Encoder::addFrame(uint8_t* data, const uint32_t width, const uint32_t height, const uint32_t stride) noexcept
+bool Encoder::isPrepared() const noexcept
 {
-    // Copy data into local
-    const uint32_t bufferMod = m_bufferIndex % m_dataBuffer.size();
+    return (m_codecContext.m_codecContext != nullptr) && !m_opened;
+}
+
+void Encoder::setDownstream(Encoder* encoder) noexcept
+{
+    m_downstream = encoder;
+}
 
-    // Create ffmpeg frame
-    FramePtr frame2(av_frame_alloc());
-    if (frame2.get() == nullptr) {
+void Encoder::setPriority(const TaskPriority priority) noexcept
+{
+    m_priority = priority;
+}
+
+void Encoder::setMirror(const bool mirror) noexcept
+{
+    m_mirror = mirror;
+}
+
+uint32_t Encoder::getWidth() const noexcept
+{
+    return m_filter.getWidth();
+}
+
+uint32_t Encoder::getHeight() const noexcept
+{
+    return m_filter.getHeight();
+}
+
+int32_t Encoder::getPixelFormat() const noexcept
+{
+    return m_filter.getPixelFormat();
+}
+
+const string& Encoder::getFileExtension() const noexcept
+{
+    return m_codec->m_extension;
+}
+
+uint32_t Encoder::getAllocationCount() const noexcept
+{
+    return m_allocations;
+}
+
+uint32_t Encoder::getQueueDepth() const noexcept
+{
+    return m_dataBuffer.count() + m_encodeBuffer.count();
+}
+
+const EncoderStatistics& Encoder::getStatistics() const noexcept
+{
+    return m_statistics;
+}
+
+bool Encoder::addFrame(uint8_t* data, const uint32_t width, const uint32_t height, const uint32_t stride,
+    const uint64_t timestamp) noexcept
+{
+    FramePtr* frame = getFreeFrame();
+    if (frame == nullptr) {
+        return false;
+    }
+
+    // Get frame storage from the pool
+    FramePtr& frame2 = *frame;
+    frame2.m_frame->buf[0] = av_buffer_pool_get(m_bufferPool.get());
+    if (frame2->buf[0] == nullptr) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Failed to allocate new host frame"s);
+            m_errorCallback("Failed allocating new frame storage"s);
         }
         return false;
     }
     frame2.m_frame->format = m_format;
     frame2.m_frame->height = height;
     frame2.m_frame->width = width;
-    auto ret = av_frame_get_buffer(frame2.get(), 0);
-    if (ret < 0) {
+    auto ret = av_image_fill_arrays(frame2.m_frame->data, frame2.m_frame->linesize, frame2->buf[0]->data,
+        static_cast<AVPixelFormat>(m_format), width, height, 32);
+    if (ret < 0 || ret > frame2->buf[0]->size) {
+        av_frame_unref(frame2.get());
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Failed allocating new frame storage, "s += getFfmpegErrorString(ret));
+            m_errorCallback("Frame dimensions do not match the prepared encoder"s);
         }
         return false;
     }
@@ -174,6 +387,7 @@ bool Encoder::addFrame(uint8_t* data, const uint32_t width, const uint32_t heigh
     ret = av_image_fill_arrays(srcData, srcLine, data, static_cast<AVPixelFormat>(frame2.m_frame->format),
         frame2.m_frame->width, frame2.m_frame->height, align);
     if (ret < 0) {
+        av_frame_unref(frame2.get());
         if (m_errorCallback != nullptr) {
             m_errorCallback("Failed to copy new frame, "s += getFfmpegErrorString(ret));
         }
@@ -185,55 +399,146 @@ bool Encoder::addFrame(uint8_t* data, const uint32_t width, const uint32_t heigh
     av_image_copy(frame2.m_frame->data, frame2.m_frame->linesize, srcData2, srcLine,
         static_cast<AVPixelFormat>(frame2.m_frame->format), frame2.m_frame->width, frame2.m_frame->height);
 
-    // Fill in frame number
-    frame2.m_frame->best_effort_timestamp = m_frameNumber++;
-    frame2.m_frame->display_picture_number = static_cast<int32_t>(frame2.m_frame->best_effort_timestamp);
-    frame2.m_frame->pkt_dts = frame2.m_frame->best_effort_timestamp;
-    frame2.m_frame->pts = frame2.m_frame->best_effort_timestamp;
-    frame2.m_frame->sample_aspect_ratio = {1, 1};
-
-    // Place frame on pending stack
-    m_dataBuffer[bufferMod] = move(frame2);
-    ++m_bufferIndex;
-    {
-        lock_guard<mutex> lock(m_lock);
-        ++m_remainingBuffers;
-        if (m_remainingBuffers == static_cast<int32_t>(m_dataBuffer.size())) {
-            // Error buffer overflow
-            m_errorCallback("Encode buffer has overflowed"s);
-            return false;
+    return queueFrame(frame2, timestamp);
+}
+
+bool Encoder::addFrame(const KinectImage& image, const uint64_t timestamp) noexcept
+{
+    // The filter graph reads each image using the dimensions it was prepared with
+    const uint32_t pixSize = m_format == AV_PIX_FMT_BGRA ? 4 : 2;
+    if (image.m_image == nullptr || image.m_width != static_cast<int32_t>(m_inputWidth) ||
+        image.m_height != static_cast<int32_t>(m_inputHeight) ||
+        image.m_stride < static_cast<int32_t>(m_inputWidth * pixSize)) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Frame dimensions do not match the prepared encoder"s);
         }
+        return false;
+    }
+
+    // Images without an owner may be reused once this function returns so must be copied
+    if (image.m_owner == nullptr || image.m_reference == nullptr || image.m_release == nullptr) {
+        return addFrame(image.m_image, image.m_width, image.m_height, image.m_stride, timestamp);
+    }
+
+    FramePtr* frame = getFreeFrame();
+    if (frame == nullptr) {
+        return false;
     }
-    // Notify wakeup
-    m_condition.notify_one();
+
+    // Wrap the image data so that the owner is released once the filter graph no longer needs it
+    image.m_reference(image.m_owner);
+    frame->m_frame->buf[0] = av_buffer_create(
+        image.m_image, image.m_stride * image.m_height, image.m_release, image.m_owner, AV_BUFFER_FLAG_READONLY);
+    if ((*frame)->buf[0] == nullptr) {
+        image.m_release(image.m_owner, image.m_image);
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to wrap image data"s);
+        }
+        return false;
+    }
+
+    // Kinect images only ever contain a single plane
+    frame->m_frame->format = m_format;
+    frame->m_frame->height = image.m_height;
+    frame->m_frame->width = image.m_width;
+    frame->m_frame->data[0] = image.m_image;
+    frame->m_frame->linesize[0] = image.m_stride;
+
+    return queueFrame(*frame, timestamp);
+}
+
+FramePtr* Encoder::getFreeFrame() noexcept
+{
+    // Check there is a free frame available (the frame currently being encoded is still counted as pending)
+    FramePtr* frame = m_dataBuffer.beginPush();
+    if (frame == nullptr) {
+        // Dropping frames is expected when the system is overloaded (lower priority streams give way first) so this is
+        //  only logged, the total is also logged with the statistics during shutdown
+        const uint64_t dropped = ++m_statistics.m_droppedFrames;
+        if (dropped % s_dropLogInterval == 1) {
+            logHandler("Encoder "s += (m_codec != nullptr ? m_codec->m_name : ""s) += ": "s += to_string(dropped) +=
+                " frames dropped as the queue was full"s);
+        }
+    }
+    return frame;
+}
+
+bool Encoder::queueFrame(FramePtr& frame, const uint64_t timestamp) noexcept
+{
+    // Fill in timestamp relative to the first frame so that any dropped frames don't affect the remaining frames
+    if (m_startTime == AV_NOPTS_VALUE) {
+        m_startTime = static_cast<int64_t>(timestamp);
+    }
+    frame.m_frame->best_effort_timestamp = static_cast<int64_t>(timestamp) - m_startTime;
+    frame.m_frame->pkt_dts = frame.m_frame->best_effort_timestamp;
+    frame.m_frame->pts = frame.m_frame->best_effort_timestamp;
+    frame.m_frame->sample_aspect_ratio = {1, 1};
+
+    // Place frame on pending stack and schedule it to be encoded
+    m_dataBuffer.endPush();
+    ++m_statistics.m_framesIn;
+    const uint32_t depth = getQueueDepth();
+    uint32_t highWater = m_statistics.m_queueHighWater.load(memory_order_relaxed);
+    while (depth > highWater && !m_statistics.m_queueHighWater.compare_exchange_weak(highWater, depth)) {
+    }
+    m_filterTask.notify();
 
     return true;
 }
 
-void Encoder::shutdown() noexcept
+bool Encoder::addConvertedFrame(const FramePtr& frame, const uint64_t timestamp) noexcept
 {
-    {
-        lock_guard<mutex> lock(m_lock);
-        m_shutdown = true;
+    FramePtr* next = getFreeFrame();
+    if (next == nullptr) {
+        return false;
     }
-    // Notify wakeup
-    m_condition.notify_one();
-    // Wait for thread to complete
-    if (m_thread.joinable()) {
-        m_thread.join();
+    const auto ret = av_frame_ref(next->get(), frame.get());
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to reference converted frame, "s += getFfmpegErrorString(ret));
+        }
+        return false;
     }
+    return queueFrame(*next, timestamp);
+}
+
+void Encoder::shutdown() noexcept
+{
+    m_shutdown = true;
+    // Wait for any frames currently being processed to complete
+    m_filterTask.wait();
+    m_encodeTask.wait();
+    // Finalise the output (or release it if it was prepared but never started)
+    cleanupOutput();
 }
 
-bool Encoder::initOutput(const string& filename, const uint32_t width, const uint32_t height, const int32_t format,
-    const float scale, const uint32_t numThreads) noexcept
+bool Encoder::initOutput(const uint32_t width, const uint32_t height, const int32_t format, const float scale,
+    const uint32_t numThreads) noexcept
 {
+    // Find the required encoder
+    m_codec = !m_rendition.m_codec.empty() ? findCodec(m_rendition.m_codec) : getDefaultCodec(format, m_useGPU);
+    if (m_codec == nullptr || m_codec->m_gpu != m_useGPU) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Requested encoder is not supported: "s += m_rendition.m_codec);
+        }
+        return false;
+    }
+    const int32_t outputFormat = m_codec->getOutputFormat(format, m_rendition);
+    if (outputFormat == AV_PIX_FMT_NONE) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Requested bit depth is not supported by encoder: "s += m_codec->m_name);
+        }
+        return false;
+    }
+
     // Initialise the filter for pixel conversion
-    if (!m_filter.init(width, height, av_inv_q(m_timebase), format, scale, numThreads, m_errorCallback)) {
+    if (!m_filter.init(width, height, m_rendition.m_width, m_rendition.m_height, m_frameRate, m_timebase, format,
+            outputFormat, scale, numThreads, m_mirror, m_errorCallback)) {
         return false;
     }
 
     AVFormatContext* formatPtr = nullptr;
-    auto ret = avformat_alloc_output_context2(&formatPtr, nullptr, nullptr, filename.c_str());
+    auto ret = avformat_alloc_output_context2(&formatPtr, nullptr, m_codec->m_container.c_str(), nullptr);
     OutputFormatContextPtr tempFormat(formatPtr);
     if (ret < 0) {
         if (m_errorCallback != nullptr) {
@@ -249,8 +554,6 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
         return false;
     }
 
-    // Find the required encoder
-    AVCodec* encoder;
     DevicePtr tempDevice;
     if (m_useGPU) {
         AVBufferRef* devicePtr = nullptr;
@@ -262,11 +565,8 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
             }
             return false;
         }
-
-        encoder = avcodec_find_encoder_by_name("h264_nvenc");
-    } else {
-        encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
     }
+    AVCodec* encoder = avcodec_find_encoder_by_name(m_codec->m_name.c_str());
     if (!encoder) {
         if (m_errorCallback != nullptr) {
             m_errorCallback("Requested encoder is not supported");
@@ -287,13 +587,36 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
     tempCodec->sample_aspect_ratio = {1, 1};
     tempCodec->pix_fmt = m_useGPU ? AV_PIX_FMT_CUDA : m_filter.getPixelFormat();
     tempCodec->framerate = m_filter.getFrameRate();
-    tempCodec->time_base = av_inv_q(tempCodec->framerate);
+    tempCodec->time_base = m_timebase;
+    if (!m_rendition.m_preview.empty()) {
+        // Intra refresh is spread over a GOP so keep it short so that a preview consumer can start decoding quickly
+        tempCodec->gop_size = static_cast<int>(av_q2d(tempCodec->framerate));
+    } else if (m_fragmented) {
+        // Each GOP becomes a fragment so keep them short to limit what is lost on a crash
+        tempCodec->gop_size = static_cast<int>(av_q2d(tempCodec->framerate) * 2.0);
+    }
     av_opt_set_int(tempCodec.get(), "refcounted_frames", 1, 0);
 
     if (tempFormat->oformat->flags & AVFMT_GLOBALHEADER) {
         tempCodec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
+    // Quality can only be adapted while encoding if the encoder supports reconfiguration, once it can't be reduced any
+    // further (or straight away for other encoders) the encoder is reopened with a faster preset if one is usable
+    const bool adaptive = m_rendition.m_adaptiveQuality && m_rendition.m_rateControl == RateControl::ConstantQuality &&
+        !m_codec->m_losslessOnly && !m_useGPU;
+    m_maxQualitySteps = adaptive && m_codec->m_runtimeQuality ? s_maxQualitySteps : 0;
+    m_maxPresetSteps = 0;
+    while (adaptive && m_maxPresetSteps < s_maxPresetSteps &&
+        !m_codec->getFasterPreset(m_rendition, m_maxPresetSteps + 1).empty()) {
+        ++m_maxPresetSteps;
+    }
+    m_adaptive = m_maxQualitySteps > 0 || m_maxPresetSteps > 0;
+    m_qualityStep = 0;
+    m_presetStep = 0;
+    m_framesSinceAdapt = 0;
+    m_encodeTime = 0;
+
     // Setup the desired encoding options
     AVDictionary* opts = nullptr;
     if (m_useGPU) {
@@ -308,8 +631,8 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
         auto* frames = reinterpret_cast<AVHWFramesContext*>(framesRef->data);
         frames->format = AV_PIX_FMT_CUDA;
         frames->sw_format = m_filter.getPixelFormat();
-        frames->width = width;
-        frames->height = height;
+        frames->width = tempCodec->width;
+        frames->height = tempCodec->height;
         frames->initial_pool_size = static_cast<int>(m_dataBuffer.size());
 
         ret = av_hwframe_ctx_init(framesRef);
@@ -328,17 +651,15 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
             }
             return false;
         }
-
-        av_dict_set(&opts, "rc", "vbr", 0);
-        av_dict_set(&opts, "cq", to_string(23).c_str(), 0);
-        av_dict_set(&opts, "preset", "llhp", 0);
-    } else {
-        av_dict_set(&opts, "crf", to_string(23).c_str(), 0);
-        av_dict_set(&opts, "preset", "veryfast", 0);
-
-        if (numThreads != 0) {
-            av_dict_set(&opts, "threads", to_string(numThreads).c_str(), 0);
+    } else if (numThreads != 0) {
+        av_dict_set(&opts, "threads", to_string(numThreads).c_str(), 0);
+    }
+    if (!m_codec->setOptions(m_rendition, tempCodec.get(), &opts)) {
+        av_dict_free(&opts);
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Requested rate control is not supported by encoder: "s += m_codec->m_name);
         }
+        return false;
     }
 
     // Open the encoder
@@ -362,9 +683,89 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
     outStream->r_frame_rate = tempCodec->framerate;
     outStream->avg_frame_rate = tempCodec->framerate;
 
+    // Pre-allocate input frames and a pool for their storage so that no allocations are needed while recording
+    m_allocations = 0;
+    ret = av_image_get_buffer_size(static_cast<AVPixelFormat>(format), width, height, 32);
+    if (ret < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed determining frame storage size, "s += getFfmpegErrorString(ret));
+        }
+        return false;
+    }
+    BufferPoolPtr tempPool(av_buffer_pool_init2(ret, this, allocBuffer, nullptr));
+    if (tempPool.get() == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed allocating frame storage pool"s);
+        }
+        return false;
+    }
+    for (auto& i : m_dataBuffer) {
+        i = FramePtr(av_frame_alloc());
+        if (i.get() == nullptr) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to allocate new host frame"s);
+            }
+            return false;
+        }
+        ++m_allocations;
+    }
+    for (auto& i : m_encodeBuffer) {
+        i = FramePtr(av_frame_alloc());
+        if (i.get() == nullptr) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to allocate new converted frame"s);
+            }
+            return false;
+        }
+        ++m_allocations;
+    }
+    if (m_useGPU) {
+        m_deviceFrame = FramePtr(av_frame_alloc());
+        if (m_deviceFrame.get() == nullptr) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to allocate new device frame"s);
+            }
+            return false;
+        }
+        ++m_allocations;
+    }
+
+    // Make the new encoder
+    m_formatContext = move(tempFormat);
+    m_codecContext = move(tempCodec);
+    m_bufferPool = move(tempPool);
+    m_opened = false;
+
+    // The output only stores the stream headers once, so only faster presets that produce the same headers can be
+    //  switched to while recording (e.g. x264 presets that use fewer reference frames or no CABAC can't be). These
+    //  are checked now so that the rate controller only ever falls back to presets that can actually be used.
+    if (m_maxPresetSteps > 0) {
+        const uint32_t baseQuality = m_rendition.m_quality != 0 ? m_rendition.m_quality : m_codec->m_defaultQuality;
+        uint32_t presetSteps = 0;
+        for (CodecContextPtr probe; presetSteps < m_maxPresetSteps; ++presetSteps) {
+            if (!openPresetCodec(presetSteps + 1, baseQuality + m_maxQualitySteps * s_qualityStepSize, probe)) {
+                break;
+            }
+        }
+        if (presetSteps < m_maxPresetSteps) {
+            logHandler("Encoder "s + m_codec->m_name + ": falling back to "s + to_string(presetSteps) + " of "s +
+                to_string(m_maxPresetSteps) + " faster presets"s);
+            m_maxPresetSteps = presetSteps;
+            m_adaptive = m_maxQualitySteps > 0 || m_maxPresetSteps > 0;
+        }
+    }
+
+    return true;
+}
+
+bool Encoder::openOutput(const string& filename) noexcept
+{
+    av_freep(&m_formatContext->url);
+    m_formatContext->url = av_strdup(filename.c_str());
+
     // Open output file if required
-    if (!(tempFormat->oformat->flags & AVFMT_NOFILE)) {
-        ret = avio_open(&tempFormat->pb, filename.c_str(), AVIO_FLAG_WRITE);
+    if (!(m_formatContext->oformat->flags & AVFMT_NOFILE)) {
+        const auto ret = avio_open(&m_formatContext->pb, filename.c_str(), AVIO_FLAG_WRITE);
         if (ret < 0) {
             if (m_errorCallback != nullptr) {
                 m_errorCallback(("Failed to open output file: "s += filename) += ", "s += getFfmpegErrorString(ret));
@@ -373,33 +774,205 @@ bool Encoder::initOutput(const string& filename, const uint32_t width, const uin
         }
     }
 
+    m_dataBuffer.clear();
+    m_encodeBuffer.clear();
+    m_startTime = AV_NOPTS_VALUE;
+    m_headerWritten = false;
+    m_opened = true;
+    m_bitrateStart = AV_NOPTS_VALUE;
+    m_bitrateBytes = 0;
+    m_statistics.reset();
+
+    // The preview is optional so recording continues without it
+    if (!m_rendition.m_preview.empty()) {
+        (void)openPreview();
+    }
+
+    return true;
+}
+
+bool Encoder::openPreview() noexcept
+{
+    AVFormatContext* formatPtr = nullptr;
+    auto ret = avformat_alloc_output_context2(&formatPtr, nullptr, "mpegts", m_rendition.m_preview.c_str());
+    OutputFormatContextPtr tempFormat(formatPtr);
+    if (ret < 0) {
+        logHandler("Failed to create preview output "s += getFfmpegErrorString(ret));
+        return false;
+    }
+    if (avformat_query_codec(tempFormat->oformat, m_codecContext->codec_id, FF_COMPLIANCE_NORMAL) != 1) {
+        logHandler("Preview output is not supported by encoder: "s += m_codec->m_name);
+        return false;
+    }
+    const auto outStream = avformat_new_stream(tempFormat.get(), nullptr);
+    if (outStream == nullptr) {
+        logHandler("Failed to create a preview output stream"s);
+        return false;
+    }
+    ret = avcodec_parameters_from_context(outStream->codecpar, m_codecContext.get());
+    if (ret < 0) {
+        logHandler("Failed copying parameters to preview stream: "s += getFfmpegErrorString(ret));
+        return false;
+    }
+    outStream->time_base = m_codecContext->time_base;
+
+    // Stream headers are normally only stored once so they must be repeated for consumers that join part way through
+    const AVBitStreamFilter* dumpExtra = av_bsf_get_by_name("dump_extra");
+    AVBSFContext* filterPtr = nullptr;
+    ret = dumpExtra != nullptr ? av_bsf_alloc(dumpExtra, &filterPtr) : AVERROR_BSF_NOT_FOUND;
+    BitstreamFilterPtr tempFilter(filterPtr);
+    if (ret < 0) {
+        logHandler("Failed to create preview bitstream filter "s += getFfmpegErrorString(ret));
+        return false;
+    }
+    ret = avcodec_parameters_copy(tempFilter->par_in, outStream->codecpar);
+    if (ret >= 0) {
+        tempFilter->time_base_in = m_codecContext->time_base;
+        av_opt_set(tempFilter->priv_data, "freq", "all", 0);
+        ret = av_bsf_init(tempFilter.get());
+    }
+    if (ret < 0) {
+        logHandler("Failed to initialise preview bitstream filter "s += getFfmpegErrorString(ret));
+        return false;
+    }
+
+    ret = avio_open(&tempFormat->pb, m_rendition.m_preview.c_str(), AVIO_FLAG_WRITE);
+    if (ret < 0) {
+        logHandler(("Failed to open preview output: "s += m_rendition.m_preview) += ", "s +=
+            getFfmpegErrorString(ret));
+        return false;
+    }
+
+    // Packets are sent as soon as they are written instead of being buffered
+    AVDictionary* opts = nullptr;
+    av_dict_set(&opts, "flush_packets", "1", 0);
+    av_dict_set(&opts, "max_delay", "0", 0);
+    ret = avformat_write_header(tempFormat.get(), &opts);
+    av_dict_free(&opts);
+    if (ret < 0) {
+        logHandler("Failed writing preview header: "s += getFfmpegErrorString(ret));
+        return false;
+    }
+
+    m_previewContext = move(tempFormat);
+    m_previewFilter = move(tempFilter);
+    return true;
+}
+
+void Encoder::writePreview(const AVPacket& packet) noexcept
+{
+    AVPacket previewPacket;
+    previewPacket.data = nullptr;
+    previewPacket.size = 0;
+    av_init_packet(&previewPacket);
+    auto ret = av_packet_ref(&previewPacket, &packet);
+    if (ret >= 0) {
+        ret = av_bsf_send_packet(m_previewFilter.get(), &previewPacket);
+    }
+    while (ret >= 0) {
+        ret = av_bsf_receive_packet(m_previewFilter.get(), &previewPacket);
+        if (ret == AVERROR(EAGAIN)) {
+            return;
+        }
+        if (ret < 0) {
+            break;
+        }
+        previewPacket.stream_index = 0;
+        av_packet_rescale_ts(&previewPacket, m_previewFilter->time_base_out, m_previewContext->streams[0]->time_base);
+        ret = av_write_frame(m_previewContext.get(), &previewPacket);
+        av_packet_unref(&previewPacket);
+    }
+    av_packet_unref(&previewPacket);
+
+    // Consumers may come and go so this is not an error for the recording
+    logHandler("Failed writing to preview output, closing preview: "s += getFfmpegErrorString(ret));
+    closePreview();
+}
+
+void Encoder::closePreview() noexcept
+{
+    if (m_previewContext.m_formatContext != nullptr) {
+        av_write_trailer(m_previewContext.get());
+    }
+    m_previewFilter = BitstreamFilterPtr(nullptr);
+    m_previewContext = OutputFormatContextPtr(nullptr);
+}
+
+AVBufferRef* Encoder::allocBuffer(void* opaque, const int size) noexcept
+{
+    ++static_cast<Encoder*>(opaque)->m_allocations;
+    return av_buffer_alloc(size);
+}
+
+bool Encoder::writeHeader() noexcept
+{
+    // Store the device time of the first frame so that the stream can be synced with other recorded data
+    AVDictionary* opts = nullptr;
+    av_dict_set(&m_formatContext->metadata, "device_start_time",
+        to_string(m_startTime != AV_NOPTS_VALUE ? m_startTime : 0).c_str(), 0);
+    // Matroska always writes arbitrary metadata and is playable while it is being written
+    if (m_codec->m_container == "mp4") {
+        av_dict_set(&opts, "movflags", "+use_metadata_tags", 0);
+        if (m_fragmented) {
+            // Start a new fragment at each keyframe so that data is playable as soon as it is written
+            av_dict_set(&opts, "movflags", "+frag_keyframe+empty_moov+default_base_moof", AV_DICT_APPEND);
+        }
+    }
+
     // Init the muxer and write out file header
-    ret = avformat_write_header(tempFormat.get(), nullptr);
+    const auto ret = avformat_write_header(m_formatContext.get(), &opts);
+    av_dict_free(&opts);
     if (ret < 0) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback(
-                ("Failed writing header to output file: "s += filename) += ", "s += getFfmpegErrorString(ret));
+            m_errorCallback(("Failed writing header to output file: "s += m_formatContext->url) += ", "s +=
+                getFfmpegErrorString(ret));
         }
         return false;
     }
-
-    // Make the new encoder
-    m_formatContext = move(tempFormat);
-    m_codecContext = move(tempCodec);
-    m_bufferIndex = 0;
-    m_remainingBuffers = 0;
-    m_nextBufferIndex = 0;
-    m_frameNumber = 0;
-
+    m_headerWritten = true;
     return true;
 }
 
 void Encoder::cleanupOutput() noexcept
 {
+    // Outputs that were never opened have nothing to write
+    if (!m_opened) {
+        for (auto& i : m_dataBuffer) {
+            i = FramePtr(nullptr);
+        }
+        for (auto& i : m_encodeBuffer) {
+            i = FramePtr(nullptr);
+        }
+        m_deviceFrame = FramePtr(nullptr);
+        m_bufferPool = BufferPoolPtr(nullptr);
+        m_filter = Filter();
+        m_codecContext = CodecContextPtr(nullptr);
+        m_formatContext = OutputFormatContextPtr(nullptr);
+        return;
+    }
+    m_opened = false;
+    logHandler("Encoder frame allocations: "s += to_string(m_allocations));
+
+    // Make sure the file header has been written before anything else is written to the file
+    if (m_formatContext.m_formatContext != nullptr && !m_headerWritten && !writeHeader()) {
+        m_codecContext = CodecContextPtr(nullptr);
+        m_formatContext = OutputFormatContextPtr(nullptr);
+        return;
+    }
+
+    // Convert and encode frames that were accepted before shutdown, frames that were already converted are encoded
+    //  first so that frame order is maintained. If that fails the remaining frames are released back to the pool.
+    bool valid = encodeFrames();
+    for (FramePtr* next = m_dataBuffer.front(); next != nullptr; next = m_dataBuffer.front()) {
+        valid = valid && filterFrame(*next) && encodeFrame(*next);
+        av_frame_unref(next->get());
+        m_dataBuffer.pop();
+    }
+
     // Flush any remaining frames
     if (m_filter.m_filterGraph.m_filterGraph != nullptr) {
         FramePtr temp(nullptr);
-        while (processFrame(temp)) {
+        while (filterFrame(temp) && encodeFrame(temp)) {
         }
     }
 
@@ -407,59 +980,249 @@ void Encoder::cleanupOutput() noexcept
     if (m_formatContext.m_formatContext != nullptr) {
         FramePtr temp2(nullptr);
         (void)encodeFrame(temp2);
+        closePreview();
+        logStatistics();
         m_codecContext = CodecContextPtr(nullptr);
         m_formatContext = OutputFormatContextPtr(nullptr);
     }
 }
 
-bool Encoder::run() noexcept
+void Encoder::logStatistics() const noexcept
 {
+    string message = "Encoder "s += m_formatContext->url;
+    message += ": frames in "s + to_string(m_statistics.m_framesIn) + ", out "s + to_string(m_statistics.m_framesOut);
+    message += ", dropped "s + to_string(m_statistics.m_droppedFrames) + ", peak queue "s +
+        to_string(m_statistics.m_queueHighWater);
+    message += ", filter/encode/mux "s + to_string(m_statistics.m_filterTime.getAverage()) + '/' +
+        to_string(m_statistics.m_encodeTime.getAverage()) + '/' + to_string(m_statistics.m_muxTime.getAverage());
+    message += "us (p99 "s + to_string(m_statistics.m_filterTime.getPercentile(0.99f)) + '/' +
+        to_string(m_statistics.m_encodeTime.getPercentile(0.99f)) + '/' +
+        to_string(m_statistics.m_muxTime.getPercentile(0.99f));
+    message += "us), bytes "s + to_string(m_statistics.m_bytesWritten);
+    logHandler(message);
+}
+
+bool Encoder::runFilter() noexcept
+{
+    if (m_shutdown) {
+        return false;
+    }
+    // Process pending frames
+    if (!process()) {
+        // Stop processing any further frames, the output is finalised during shutdown
+        m_shutdown = true;
+        return false;
+    }
+    return true;
+}
+
+bool Encoder::runEncode() noexcept
+{
+    if (m_shutdown) {
+        return false;
+    }
+    // Encode converted frames
+    if (!encodeFrames()) {
+        m_shutdown = true;
+        return false;
+    }
+    return true;
+}
+
+bool Encoder::process() noexcept
+{
+    // Get frame to be processed
     while (true) {
-        // Wait until we have received valid data
-        {
-            unique_lock<mutex> lock(m_lock);
-            if (!m_shutdown) {
-                m_condition.wait(lock, [this] { return (m_remainingBuffers > 0) || m_shutdown; });
-            }
-            if (m_shutdown) {
-                break;
-            }
+        FramePtr* next = m_dataBuffer.front();
+        if (next == nullptr) {
+            break;
         }
-        // Process pending frames
-        if (!process()) {
+        FramePtr& frame = *next;
+
+        // Leave the frame queued until the encode stage has space for it
+        FramePtr* converted = m_encodeBuffer.beginPush();
+        if (converted == nullptr) {
             break;
         }
-    }
-    // Cleanup
-    cleanupOutput();
 
+        // The header must be written before the encode stage starts writing to the file
+        if (!m_headerWritten && !writeHeader()) {
+            return false;
+        }
+
+        // Process new frame and pass it to the encode stage, the input frame is then released back to the pool
+        const int64_t startTime = av_gettime_relative();
+        const bool ret = filterFrame(frame);
+        m_statistics.m_filterTime.add(av_gettime_relative() - startTime);
+        if (ret) {
+            av_frame_move_ref(converted->get(), frame.get());
+            m_encodeBuffer.endPush();
+            m_encodeTask.notify();
+        }
+        av_frame_unref(frame.get());
+        m_dataBuffer.pop();
+        if (!ret) {
+            return false;
+        }
+    }
     return true;
 }
 
-bool Encoder::process() noexcept
+bool Encoder::encodeFrames() noexcept
 {
-    // Get frame to be processed
     while (true) {
-        {
-            unique_lock<mutex> lock(m_lock);
-            if (m_remainingBuffers == 0) {
-                break;
+        FramePtr* next = m_encodeBuffer.front();
+        if (next == nullptr) {
+            break;
+        }
+        const int64_t startTime = av_gettime_relative();
+        m_muxTime = 0;
+        const bool ret = encodeFrame(*next);
+        av_frame_unref(next->get());
+        m_encodeBuffer.pop();
+        if (!ret) {
+            return false;
+        }
+        const int64_t encodeTime = av_gettime_relative() - startTime - m_muxTime;
+        m_statistics.m_encodeTime.add(encodeTime);
+        if (!adaptQuality(encodeTime)) {
+            return false;
+        }
+        // Resume the filter stage in case it stopped because this queue was full
+        if (!m_shutdown && m_dataBuffer.count() > 0) {
+            m_filterTask.notify();
+        }
+    }
+    return true;
+}
+
+bool Encoder::adaptQuality(const int64_t encodeTime) noexcept
+{
+    // Average over a number of frames so that occasional slow frames (e.g. keyframes) are ignored
+    m_encodeTime = m_encodeTime == 0 ? encodeTime : (m_encodeTime * 7 + encodeTime) / 8;
+    ++m_framesSinceAdapt;
+    if (!m_adaptive) {
+        return true;
+    }
+
+    // Back off quickly when falling behind but wait longer before recovering to prevent oscillation. Quality is
+    // changed first as it is cheap, the preset is only changed once that isn't enough and is restored first
+    const int64_t frameTime = av_rescale_q(1, av_inv_q(m_frameRate), m_timebase);
+    const uint32_t fps = static_cast<uint32_t>(m_frameRate.num / std::max(m_frameRate.den, 1));
+    const uint32_t depth = getQueueDepth();
+    uint32_t step = m_qualityStep;
+    uint32_t presetStep = m_presetStep;
+    if ((depth > getQueueSize() / 2 || m_encodeTime > frameTime) && m_framesSinceAdapt >= fps / 2) {
+        if (step < m_maxQualitySteps) {
+            ++step;
+        } else if (presetStep < m_maxPresetSteps) {
+            ++presetStep;
+        } else {
+            return true;
+        }
+    } else if (depth <= getQueueSize() / 8 && m_encodeTime < frameTime * 2 / 3 && m_framesSinceAdapt >= fps * 2) {
+        if (presetStep > 0) {
+            --presetStep;
+        } else if (step > 0) {
+            --step;
+        } else {
+            return true;
+        }
+    } else {
+        return true;
+    }
+
+    const uint32_t baseQuality = m_rendition.m_quality != 0 ? m_rendition.m_quality : m_codec->m_defaultQuality;
+    const uint32_t quality = baseQuality + step * s_qualityStepSize;
+    string message = "Encoder "s += m_formatContext->url;
+    message += step > m_qualityStep || presetStep > m_presetStep ? " falling behind (queue "s : " recovered (queue "s;
+    message += to_string(depth) + ", encode "s + to_string(m_encodeTime) + "us/frame), "s;
+    if (presetStep != m_presetStep) {
+        message += "preset "s + m_codec->getFasterPreset(m_rendition, m_presetStep) + " -> "s +
+            m_codec->getFasterPreset(m_rendition, presetStep);
+        CodecContextPtr codecContext;
+        if (!openPresetCodec(presetStep, quality, codecContext)) {
+            // Faster presets that can't be used are not tried again
+            logHandler("Failed to change encoder preset: "s += message);
+            if (presetStep > m_presetStep) {
+                m_maxPresetSteps = m_presetStep;
             }
-            --m_remainingBuffers;
+            m_framesSinceAdapt = 0;
+            return true;
         }
-        FramePtr frame(move(m_dataBuffer[m_nextBufferIndex]));
-        ++m_nextBufferIndex;
-        m_nextBufferIndex = m_nextBufferIndex < m_dataBuffer.size() ? m_nextBufferIndex : 0;
 
-        // Process new frame
-        if (!processFrame(frame)) {
+        // Frames still held by the current encoder (e.g. for lookahead) are written out before switching
+        const auto ret = avcodec_send_frame(m_codecContext.get(), nullptr);
+        if (ret < 0) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to send flush packet to encoder: "s += getFfmpegErrorString(ret));
+            }
+            return false;
+        }
+        if (!muxFrames()) {
             return false;
         }
+        m_codecContext = move(codecContext);
+    } else {
+        message += "quality "s + to_string(baseQuality + m_qualityStep * s_qualityStepSize) + " -> "s +
+            to_string(quality);
+        if (!m_codec->setQuality(m_codecContext.get(), quality)) {
+            logHandler("Failed to change encoder quality, disabling rate control: "s += message);
+            m_adaptive = false;
+            return true;
+        }
     }
+    logHandler(message);
+    m_qualityStep = step;
+    m_presetStep = presetStep;
+    m_framesSinceAdapt = 0;
     return true;
 }
 
-bool Encoder::processFrame(FramePtr& frame) const noexcept
+bool Encoder::openPresetCodec(
+    const uint32_t presetStep, const uint32_t quality, CodecContextPtr& codecContext) const noexcept
+{
+    // The new encoder uses the same settings as the current one apart from the preset and quality
+    const AVCodec* encoder = m_codecContext->codec;
+    CodecContextPtr tempCodec(avcodec_alloc_context3(encoder));
+    if (tempCodec.get() == nullptr) {
+        return false;
+    }
+    tempCodec->height = m_codecContext->height;
+    tempCodec->width = m_codecContext->width;
+    tempCodec->sample_aspect_ratio = m_codecContext->sample_aspect_ratio;
+    tempCodec->pix_fmt = m_codecContext->pix_fmt;
+    tempCodec->framerate = m_codecContext->framerate;
+    tempCodec->time_base = m_codecContext->time_base;
+    tempCodec->gop_size = m_codecContext->gop_size;
+    tempCodec->flags = m_codecContext->flags;
+    tempCodec->thread_count = m_codecContext->thread_count;
+    av_opt_set_int(tempCodec.get(), "refcounted_frames", 1, 0);
+    Rendition rendition = m_rendition;
+    rendition.m_preset = m_codec->getFasterPreset(m_rendition, presetStep);
+    rendition.m_quality = quality;
+    AVDictionary* opts = nullptr;
+    const bool opened = !rendition.m_preset.empty() && m_codec->setOptions(rendition, tempCodec.get(), &opts) &&
+        avcodec_open2(tempCodec.get(), encoder, &opts) >= 0;
+    av_dict_free(&opts);
+    if (!opened) {
+        return false;
+    }
+
+    // The output only stores the stream headers once so the new encoder must produce identical ones
+    const AVCodecParameters* parameters = m_formatContext->streams[0]->codecpar;
+    if (tempCodec->extradata_size != parameters->extradata_size ||
+        (parameters->extradata_size > 0 &&
+            memcmp(tempCodec->extradata, parameters->extradata, static_cast<size_t>(parameters->extradata_size)) !=
+                0)) {
+        logHandler("Encoder preset "s + rendition.m_preset + " can't be used as it changes the stream headers"s);
+        return false;
+    }
+    codecContext = move(tempCodec);
+    return true;
+}
+
+bool Encoder::filterFrame(FramePtr& frame) const noexcept
 {
     // Pass into filter chain
     if (!m_filter.sendFrame(frame)) {
@@ -473,28 +1236,20 @@ bool Encoder::processFrame(FramePtr& frame) const noexcept
         return false;
     }
 
-    // Pass to encoder
-    if (!encodeFrame(frame)) {
-        return false;
+    // Pass a reference to the converted frame on so that a smaller rendition can be derived from it
+    if (m_downstream != nullptr) {
+        (void)m_downstream->addConvertedFrame(frame, static_cast<uint64_t>(frame->pts + m_startTime));
     }
 
     return true;
 }
 
-bool Encoder::encodeFrame(FramePtr& frame) const noexcept
+bool Encoder::encodeFrame(FramePtr& frame) noexcept
 {
     if (frame.m_frame != nullptr) {
         if (m_useGPU) {
-            // Create a new frame to hold device memory
-            FramePtr frame2(av_frame_alloc());
-            if (frame2.get() == nullptr) {
-                if (m_errorCallback != nullptr) {
-                    m_errorCallback("Failed to allocate new device frame"s);
-                }
-                return false;
-            }
-
             // Create a new buffer for the hardware frame
+            const FramePtr& frame2 = m_deviceFrame;
             auto ret = av_hwframe_get_buffer(m_codecContext->hw_frames_ctx, frame2.get(), 0);
             if (ret < 0) {
                 if (m_errorCallback != nullptr) {
@@ -503,6 +1258,7 @@ bool Encoder::encodeFrame(FramePtr& frame) const noexcept
                 return false;
             }
             if (!frame2->hw_frames_ctx) {
+                av_frame_unref(frame2.get());
                 if (m_errorCallback != nullptr) {
                     m_errorCallback("Failed to init device frame storage");
                 }
@@ -512,13 +1268,15 @@ bool Encoder::encodeFrame(FramePtr& frame) const noexcept
             // Transfer data from host to device
             ret = av_hwframe_transfer_data(frame2.get(), frame.get(), 0);
             if (ret < 0) {
+                av_frame_unref(frame2.get());
                 if (m_errorCallback != nullptr) {
                     m_errorCallback("Failed to transfer device frame, "s += getFfmpegErrorString(ret));
                 }
                 return false;
             }
             frame2.get()->best_effort_timestamp = frame.get()->best_effort_timestamp;
-            frame = move(frame2);
+            av_frame_unref(frame.get());
+            av_frame_move_ref(frame.get(), frame2.get());
         }
 
         // Send frame to encoder
@@ -559,7 +1317,7 @@ bool Encoder::encodeFrame(FramePtr& frame) const noexcept
     return true;
 }
 
-bool Encoder::muxFrames() const noexcept
+bool Encoder::muxFrames() noexcept
 {
     // Get all encoder packets
     AVPacket packet;
@@ -582,11 +1340,33 @@ bool Encoder::muxFrames() const noexcept
         // Setup packet for muxing
         packet.stream_index = 0;
         packet.duration = av_rescale_q(1, av_inv_q(m_codecContext->framerate), m_codecContext->time_base);
+        if (m_previewContext.m_formatContext != nullptr) {
+            writePreview(packet);
+        }
         av_packet_rescale_ts(&packet, m_codecContext->time_base, m_formatContext->streams[0]->time_base);
         packet.pos = -1;
 
+        // Bitrate is measured over a second of output
+        const int64_t packetTime = packet.pts;
+        const int32_t packetSize = packet.size;
+        if (m_bitrateStart == AV_NOPTS_VALUE) {
+            m_bitrateStart = packetTime;
+        }
+        m_bitrateBytes += static_cast<uint64_t>(packetSize);
+        const int64_t window =
+            av_rescale_q(packetTime - m_bitrateStart, m_formatContext->streams[0]->time_base, {1, 1000});
+        if (window >= 1000) {
+            m_statistics.m_bitrate = static_cast<uint32_t>(m_bitrateBytes * 8 / static_cast<uint64_t>(window));
+            m_bitrateStart = packetTime;
+            m_bitrateBytes = 0;
+        }
+
         // Mux encoded frame
+        const int64_t startTime = av_gettime_relative();
         ret = av_interleaved_write_frame(m_formatContext.get(), &packet);
+        const int64_t muxTime = av_gettime_relative() - startTime;
+        m_muxTime += muxTime;
+        m_statistics.m_muxTime.add(muxTime);
         if (ret < 0) {
             av_packet_unref(&packet);
             if (m_errorCallback != nullptr) {
@@ -594,6 +1374,8 @@ bool Encoder::muxFrames() const noexcept
             }
             return false;
         }
+        ++m_statistics.m_framesOut;
+        m_statistics.m_bytesWritten += static_cast<uint64_t>(packetSize);
 
         av_packet_unref(&packet);
     }
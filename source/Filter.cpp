@@ -16,9 +16,12 @@
 
 #include "Filter.h"
 
+#include "Convert.h"
 #include "Encoder.h"
+#include "ThreadPool.h"
 
 #include <string>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -48,12 +51,294 @@ AVFilterGraph* Filter::FilterGraphPtr::operator->() const noexcept
     return m_filterGraph.get();
 }
 
-bool Filter::init(const uint32_t width, const uint32_t height, const AVRational fps, const int32_t format,
-    const float scale, const uint32_t numThreads, errorCallback error) noexcept
+bool Filter::init(const uint32_t width, const uint32_t height, uint32_t outputWidth, uint32_t outputHeight,
+    const AVRational fps, const AVRational timebase, const int32_t format, const int32_t outputFormat,
+    const float scale, const uint32_t numThreads, const bool mirror, errorCallback error) noexcept
 {
     m_errorCallback = move(error);
 
+    // Unspecified output dimensions are taken from the input
+    if (outputWidth == 0) {
+        outputWidth = width;
+    }
+    if (outputHeight == 0) {
+        const float aspect = static_cast<float>(height) / static_cast<float>(width);
+        outputHeight = static_cast<uint32_t>(static_cast<float>(outputWidth) * aspect);
+    }
+    const bool resize = (outputWidth != width) || (outputHeight != height);
+    const bool converted = (format != AV_PIX_FMT_GRAY16LE) && (format != AV_PIX_FMT_BGRA);
+
+    if (outputFormat == AV_PIX_FMT_YUV420P) {
+        // Depth/IR images can be converted in a single pass which is much faster than the equivalent filter graph
+        if (format == AV_PIX_FMT_GRAY16LE && !resize && mirror && hasConvertAVX2()) {
+            return initConvert(width, height, width, height, fps, format, scale, 1, mirror);
+        }
+
+        // Colour images are resized and converted in a single pass that only reads each input pixel once
+        if (format == AV_PIX_FMT_BGRA || (format == AV_PIX_FMT_YUV420P && resize)) {
+            return initConvert(width, height, outputWidth, outputHeight, fps, format, scale, numThreads, mirror);
+        }
+    }
+
     // Make a filter graph to perform any required conversions
+    FilterGraphPtr tempGraph;
+    AVFilterContext* bufferInContext = nullptr;
+    AVFilterContext* bufferOutContext = nullptr;
+    if (!initGraph(tempGraph, bufferInContext, bufferOutContext, width, height, fps, timebase, format, outputFormat,
+            numThreads)) {
+        return false;
+    }
+    AVFilterContext* nextFilter = bufferInContext;
+
+    if (format == AV_PIX_FMT_GRAY16LE) {
+        // Do hflip first as gray16 requires fewer operations than the format colorlevels uses
+        if (mirror && !addFilter(tempGraph, nextFilter, "hflip"s)) {
+            return false;
+        }
+
+        // Values are only expanded to the full range when they are going to be stored with reduced precision
+        const auto scaleString = to_string(1.0f / scale);
+        if (outputFormat != AV_PIX_FMT_GRAY16LE &&
+            !addFilter(tempGraph, nextFilter, "colorlevels"s,
+                {{"rimax"s, scaleString}, {"gimax"s, scaleString}, {"bimax"s, scaleString}})) {
+            return false;
+        }
+
+        if (resize &&
+            !addFilter(tempGraph, nextFilter, "scale"s,
+                {{"w"s, to_string(outputWidth)}, {"h"s, to_string(outputHeight)}, {"flags"s, "area"s}})) {
+            return false;
+        }
+    } else if (converted) {
+        if (resize &&
+            !addFilter(tempGraph, nextFilter, "scale"s,
+                {{"w"s, to_string(outputWidth)}, {"h"s, to_string(outputHeight)}, {"flags"s, "area"s}})) {
+            return false;
+        }
+    } else {
+        if (!addFilter(tempGraph, nextFilter, "scale"s,
+                {{"w"s, to_string(outputWidth)}, {"h"s, to_string(outputHeight)}, {"flags"s, "point"s}})) {
+            return false;
+        }
+
+        // Do hflip after resizing to reduce number of pixels worked on
+        if (mirror && !addFilter(tempGraph, nextFilter, "hflip"s)) {
+            return false;
+        }
+    }
+
+    return configureGraph(tempGraph, bufferInContext, nextFilter, bufferOutContext);
+}
+
+bool Filter::initInverse(const uint32_t width, const uint32_t height, const AVRational fps, const AVRational timebase,
+    const int32_t inFormat, const int32_t outFormat, const float scale, const uint32_t numThreads,
+    errorCallback error) noexcept
+{
+    m_errorCallback = move(error);
+
+    // Make a filter graph to undo the conversions performed during recording
+    FilterGraphPtr tempGraph;
+    AVFilterContext* bufferInContext = nullptr;
+    AVFilterContext* bufferOutContext = nullptr;
+    if (!initGraph(tempGraph, bufferInContext, bufferOutContext, width, height, fps, timebase, inFormat, outFormat,
+            numThreads)) {
+        return false;
+    }
+    AVFilterContext* nextFilter = bufferInContext;
+
+    // Recorded images are mirrored so flip them back to match camera output
+    if (!addFilter(tempGraph, nextFilter, "hflip"s)) {
+        return false;
+    }
+
+    if (outFormat == AV_PIX_FMT_GRAY16LE && inFormat != AV_PIX_FMT_GRAY16LE) {
+        // Compress the full range back down to the range of the original sensor values (unless stored unscaled)
+        const auto scaleString = to_string(1.0f / scale);
+        if (!addFilter(tempGraph, nextFilter, "colorlevels"s,
+                {{"romax"s, scaleString}, {"gomax"s, scaleString}, {"bomax"s, scaleString}})) {
+            return false;
+        }
+    }
+
+    return configureGraph(tempGraph, bufferInContext, nextFilter, bufferOutContext);
+}
+
+bool Filter::sendFrame(FramePtr& frame) const noexcept
+{
+    if (m_convertPool != nullptr) {
+        return convertFrame(frame);
+    }
+    const auto err = av_buffersrc_add_frame(m_source, frame.get());
+    if (err < 0) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to submit frame to filter graph: "s += getFfmpegErrorString(err));
+        }
+        return false;
+    }
+    return true;
+}
+
+bool Filter::receiveFrame(FramePtr& frame) const noexcept
+{
+    if (m_convertPool != nullptr) {
+        // Frames are converted in place so there is nothing buffered
+        return (frame.get() != nullptr) && (frame->buf[0] != nullptr);
+    }
+    // Get the next available frame
+    const auto err = av_buffersink_get_frame(m_sink, frame.get());
+    if (err < 0) {
+        if ((err == AVERROR(EAGAIN)) || (err == AVERROR_EOF)) {
+            return false;
+        }
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to receive frame from filter graph: "s += getFfmpegErrorString(err));
+        }
+        return false;
+    }
+    return true;
+}
+
+uint32_t Filter::getWidth() const noexcept
+{
+    if (m_convertPool != nullptr) {
+        return m_width;
+    }
+    return av_buffersink_get_w(m_sink);
+}
+
+uint32_t Filter::getHeight() const noexcept
+{
+    if (m_convertPool != nullptr) {
+        return m_height;
+    }
+    return av_buffersink_get_h(m_sink);
+}
+
+AVPixelFormat Filter::getPixelFormat() const noexcept
+{
+    if (m_convertPool != nullptr) {
+        return AV_PIX_FMT_YUV420P;
+    }
+    return static_cast<AVPixelFormat>(av_buffersink_get_format(m_sink));
+}
+
+AVRational Filter::getFrameRate() const noexcept
+{
+    if (m_convertPool != nullptr) {
+        return m_frameRate;
+    }
+    return av_buffersink_get_frame_rate(m_sink);
+}
+
+bool Filter::initConvert(const uint32_t width, const uint32_t height, const uint32_t outputWidth,
+    const uint32_t outputHeight, const AVRational fps, const int32_t format, const float scale,
+    const uint32_t numThreads, const bool mirror) noexcept
+{
+    // Converted frames are stored in a single buffer containing all 3 planes
+    const uint32_t lumaStride = (outputWidth + 31) & ~31U;
+    const uint32_t chromaStride = ((outputWidth + 1) / 2 + 31) & ~31U;
+    const uint32_t size = lumaStride * outputHeight + chromaStride * ((outputHeight + 1) / 2) * 2;
+    shared_ptr<AVBufferPool> tempPool(
+        av_buffer_pool_init(static_cast<int>(size), nullptr), [](AVBufferPool* p) { av_buffer_pool_uninit(&p); });
+    if (tempPool == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed allocating conversion storage pool"s);
+        }
+        return false;
+    }
+
+    m_filterGraph = FilterGraphPtr();
+    m_source = nullptr;
+    m_sink = nullptr;
+    m_convertPool = move(tempPool);
+    m_sourceWidth = width;
+    m_sourceHeight = height;
+    m_sourceFormat = format;
+    m_width = outputWidth;
+    m_height = outputHeight;
+    m_frameRate = fps;
+    m_scale = scale;
+    m_numThreads = std::max(numThreads, 1U);
+    m_useAVX2 = hasConvertAVX2();
+    m_mirror = mirror;
+
+    // Everything the resize needs is allocated up front so that converting a frame does not allocate
+    m_bins = {};
+    m_scratch.clear();
+    if (format == AV_PIX_FMT_BGRA || format == AV_PIX_FMT_YUV420P) {
+        initResizeBins(m_bins[0], outputWidth, width);
+        if (format == AV_PIX_FMT_YUV420P) {
+            initResizeBins(m_bins[1], (outputWidth + 1) / 2, (width + 1) / 2);
+        }
+        m_scratch.resize(m_numThreads);
+        for (auto& i : m_scratch) {
+            initResizeScratch(i, outputWidth, width);
+        }
+    }
+    return true;
+}
+
+bool Filter::convertFrame(FramePtr& frame) const noexcept
+{
+    if (frame.get() == nullptr) {
+        // Nothing to flush
+        return true;
+    }
+    AVBufferRef* buffer = av_buffer_pool_get(m_convertPool.get());
+    if (buffer == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed allocating converted frame storage"s);
+        }
+        return false;
+    }
+    const int32_t lumaStride = static_cast<int32_t>((m_width + 31) & ~31U);
+    const int32_t chromaStride = static_cast<int32_t>(((m_width + 1) / 2 + 31) & ~31U);
+    uint8_t* data[3];
+    data[0] = buffer->data;
+    data[1] = data[0] + static_cast<ptrdiff_t>(lumaStride) * m_height;
+    data[2] = data[1] + static_cast<ptrdiff_t>(chromaStride) * ((m_height + 1) / 2);
+    const int32_t linesize[3] = {lumaStride, chromaStride, chromaStride};
+    if (m_sourceFormat == AV_PIX_FMT_BGRA || m_sourceFormat == AV_PIX_FMT_YUV420P) {
+        // Split the output rows into bands (of an even number of rows) that are converted in parallel
+        const uint8_t* const source[3] = {frame->data[0], frame->data[1], frame->data[2]};
+        const int32_t sourceStride[3] = {frame->linesize[0], frame->linesize[1], frame->linesize[2]};
+        const auto convertBand = [&](const uint32_t band) {
+            const uint32_t rows = ((m_height + m_numThreads * 2 - 1) / (m_numThreads * 2)) * 2;
+            const uint32_t begin = std::min(band * rows, m_height);
+            const uint32_t end = std::min(begin + rows, m_height);
+            if (m_sourceFormat == AV_PIX_FMT_BGRA) {
+                convertBGRAToYUV420(source[0], sourceStride[0], m_sourceWidth, m_sourceHeight, data, linesize,
+                    m_width, m_height, begin, end, m_bins[0], m_scratch[band], m_useAVX2, m_mirror);
+            } else {
+                scaleYUV420(source, sourceStride, m_sourceWidth, m_sourceHeight, data, linesize, m_width, m_height,
+                    begin, end, m_bins.data(), m_scratch[band], m_useAVX2);
+            }
+        };
+        ThreadPool::get().parallelFor(m_numThreads, convertBand);
+    } else {
+        convertGray16ToYUV420(
+            frame->data[0], frame->linesize[0], data, linesize, m_width, m_height, m_scale, m_useAVX2);
+    }
+
+    // Replace the input data with the converted data, this releases the input buffer
+    for (auto& i : frame.m_frame->buf) {
+        av_buffer_unref(&i);
+    }
+    frame.m_frame->buf[0] = buffer;
+    for (uint32_t i = 0; i < 3; ++i) {
+        frame.m_frame->data[i] = data[i];
+        frame.m_frame->linesize[i] = linesize[i];
+    }
+    frame.m_frame->format = AV_PIX_FMT_YUV420P;
+    frame.m_frame->width = m_width;
+    frame.m_frame->height = m_height;
+    return true;
+}
+
+bool Filter::initGraph(FilterGraphPtr& graph, AVFilterContext*& source, AVFilterContext*& sink, const uint32_t width,
+    const uint32_t height, const AVRational fps, const AVRational timebase, const int32_t inFormat,
+    const int32_t outFormat, const uint32_t numThreads) const noexcept
+{
     FilterGraphPtr tempGraph(avfilter_graph_alloc());
     const auto bufferIn = avfilter_get_by_name("buffer");
     const auto bufferOut = avfilter_get_by_name("buffersink");
@@ -78,12 +363,12 @@ bool Filter::init(const uint32_t width, const uint32_t height, const AVRational
 
     // Set the input buffer parameters
     auto inParams = av_buffersrc_parameters_alloc();
-    inParams->format = format;
+    inParams->format = inFormat;
     inParams->frame_rate = fps;
     inParams->height = height;
     inParams->width = width;
     inParams->sample_aspect_ratio = {1, 1};
-    inParams->time_base = av_inv_q(inParams->frame_rate);
+    inParams->time_base = timebase;
     auto ret = av_buffersrc_parameters_set(bufferInContext, inParams);
     if (ret < 0) {
         av_free(inParams);
@@ -102,7 +387,7 @@ bool Filter::init(const uint32_t width, const uint32_t height, const AVRational
     }
 
     // Set the output buffer parameters
-    enum AVPixelFormat pixelFormats[] = {AV_PIX_FMT_YUV420P};
+    enum AVPixelFormat pixelFormats[] = {static_cast<AVPixelFormat>(outFormat)};
     ret = av_opt_set_bin(bufferOutContext, "pix_fmts", reinterpret_cast<const uint8_t*>(pixelFormats),
         sizeof(pixelFormats), AV_OPT_SEARCH_CHILDREN);
     ret = (ret < 0) ? ret : avfilter_init_str(bufferOutContext, nullptr);
@@ -112,179 +397,79 @@ bool Filter::init(const uint32_t width, const uint32_t height, const AVRational
         }
         return false;
     }
-    AVFilterContext* nextFilter = bufferInContext;
-    auto hflip = [&]() {
-        const auto mirrorFilter = avfilter_get_by_name("hflip");
-        if (mirrorFilter == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create hflip filter"s);
-            }
-            return false;
-        }
-        const auto mirrorContext = avfilter_graph_alloc_filter(tempGraph.get(), mirrorFilter, "hflip");
-        if (mirrorContext == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create hflip filter context"s);
-            }
-            return false;
-        }
-
-        // Link the filter into chain
-        ret = avfilter_link(nextFilter, 0, mirrorContext, 0);
-        if (ret < 0) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to link hflip filter"s);
-            }
-            return false;
-        }
-        nextFilter = mirrorContext;
-        return true;
-    };
 
-    if (format == AV_PIX_FMT_GRAY16LE) {
-        // Do hflip first as gray16 requires fewer operations than the format colorlevels uses
-        if (!hflip()) {
-            return false;
-        }
-
-        const auto brightFilter = avfilter_get_by_name("colorlevels");
-        if (brightFilter == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create colorlevels filter"s);
-            }
-            return false;
-        }
-        const auto brightContext = avfilter_graph_alloc_filter(tempGraph.get(), brightFilter, "colorlevels");
-        if (brightContext == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create colorlevels filter context"s);
-            }
-            return false;
-        }
-        const auto scaleString = to_string(1.0f / scale);
-        av_opt_set(brightContext, "rimax", scaleString.c_str(), AV_OPT_SEARCH_CHILDREN);
-        av_opt_set(brightContext, "gimax", scaleString.c_str(), AV_OPT_SEARCH_CHILDREN);
-        av_opt_set(brightContext, "bimax", scaleString.c_str(), AV_OPT_SEARCH_CHILDREN);
-
-        // Link the filter into chain
-        ret = avfilter_link(nextFilter, 0, brightContext, 0);
-        if (ret < 0) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to link colorlevels filter"s);
-            }
-            return false;
-        }
-        nextFilter = brightContext;
-    } else {
-        const auto scaleFilter = avfilter_get_by_name("scale");
-        if (scaleFilter == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create scale filter"s);
-            }
-            return false;
-        }
-        const auto scaleContext = avfilter_graph_alloc_filter(tempGraph.get(), scaleFilter, "scale");
-        if (scaleContext == nullptr) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to create scale filter context"s);
-            }
-            return false;
-        }
-
-        const float aspect = static_cast<float>(height) / static_cast<float>(width);
-        const auto heightScale = static_cast<uint32_t>(640.0f * aspect);
-        av_opt_set(scaleContext, "w", "640", AV_OPT_SEARCH_CHILDREN);
-        av_opt_set(scaleContext, "h", to_string(heightScale).c_str(), AV_OPT_SEARCH_CHILDREN);
-
-        av_opt_set(scaleContext, "flags", "point", AV_OPT_SEARCH_CHILDREN);
+    graph = move(tempGraph);
+    source = bufferInContext;
+    sink = bufferOutContext;
+    return true;
+}
 
-        // Link the filter into chain
-        ret = avfilter_link(nextFilter, 0, scaleContext, 0);
-        if (ret < 0) {
-            if (m_errorCallback != nullptr) {
-                m_errorCallback("Unable to link scale filter"s);
-            }
-            return false;
+bool Filter::addFilter(const FilterGraphPtr& graph, AVFilterContext*& nextFilter, const string& name,
+    const vector<pair<string, string>>& options) const noexcept
+{
+    const auto filter = avfilter_get_by_name(name.c_str());
+    if (filter == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback(("Unable to create "s += name) += " filter"s);
         }
-        nextFilter = scaleContext;
-
-        // Do hflip after resizing to reduce number of pixels worked on
-        if (!hflip()) {
-            return false;
+        return false;
+    }
+    const auto filterContext = avfilter_graph_alloc_filter(graph.get(), filter, name.c_str());
+    if (filterContext == nullptr) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback(("Unable to create "s += name) += " filter context"s);
         }
+        return false;
     }
-
-    // Link final filter sequence
-    ret = avfilter_link(nextFilter, 0, bufferOutContext, 0);
+    for (const auto& i : options) {
+        av_opt_set(filterContext, i.first.c_str(), i.second.c_str(), AV_OPT_SEARCH_CHILDREN);
+    }
+    auto ret = avfilter_init_str(filterContext, nullptr);
     if (ret < 0) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Could not set the filter links: "s += getFfmpegErrorString(ret));
+            m_errorCallback((("Could not initialize the "s += name) += " filter: "s) += getFfmpegErrorString(ret));
         }
         return false;
     }
 
-    // Configure the completed graph
-    ret = avfilter_graph_config(tempGraph.get(), nullptr);
+    // Link the filter into chain
+    ret = avfilter_link(nextFilter, 0, filterContext, 0);
     if (ret < 0) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Failed configuring filter graph: "s += getFfmpegErrorString(ret));
+            m_errorCallback(("Unable to link "s += name) += " filter"s);
         }
         return false;
     }
-
-    // Make a new filter
-    m_filterGraph = move(tempGraph);
-    m_source = bufferInContext;
-    m_sink = bufferOutContext;
-
+    nextFilter = filterContext;
     return true;
 }
 
-bool Filter::sendFrame(FramePtr& frame) const noexcept
+bool Filter::configureGraph(FilterGraphPtr& graph, AVFilterContext* source, AVFilterContext* lastFilter,
+    AVFilterContext* sink) noexcept
 {
-    const auto err = av_buffersrc_add_frame(m_source, frame.get());
-    if (err < 0) {
+    // Link final filter sequence
+    auto ret = avfilter_link(lastFilter, 0, sink, 0);
+    if (ret < 0) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Failed to submit frame to filter graph: "s += getFfmpegErrorString(err));
+            m_errorCallback("Could not set the filter links: "s += getFfmpegErrorString(ret));
         }
         return false;
     }
-    return true;
-}
 
-bool Filter::receiveFrame(FramePtr& frame) const noexcept
-{
-    // Get the next available frame
-    const auto err = av_buffersink_get_frame(m_sink, frame.get());
-    if (err < 0) {
-        if ((err == AVERROR(EAGAIN)) || (err == AVERROR_EOF)) {
-            return false;
-        }
+    // Configure the completed graph
+    ret = avfilter_graph_config(graph.get(), nullptr);
+    if (ret < 0) {
         if (m_errorCallback != nullptr) {
-            m_errorCallback("Failed to receive frame from filter graph: "s += getFfmpegErrorString(err));
+            m_errorCallback("Failed configuring filter graph: "s += getFfmpegErrorString(ret));
         }
         return false;
     }
-    return true;
-}
-
-uint32_t Filter::getWidth() const noexcept
-{
-    return av_buffersink_get_w(m_sink);
-}
 
-uint32_t Filter::getHeight() const noexcept
-{
-    return av_buffersink_get_h(m_sink);
-}
-
-AVPixelFormat Filter::getPixelFormat() const noexcept
-{
-    return static_cast<AVPixelFormat>(av_buffersink_get_format(m_sink));
-}
+    // Make a new filter
+    m_filterGraph = move(graph);
+    m_source = source;
+    m_sink = sink;
 
-AVRational Filter::getFrameRate() const noexcept
-{
-    return av_buffersink_get_frame_rate(m_sink);
+    return true;
 }
 } // namespace Ak
@@ -0,0 +1,403 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KinectPlayback.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <k4abttypes.h>
+#include <limits>
+#include <system_error>
+using namespace std;
+
+namespace Ak {
+extern void logHandler(const std::string& message);
+
+// Define the file suffixes used for each recorded video stream (depth, colour, IR)
+static array<std::string, 3> s_videoSuffixes = {"_depth", "_colour", "_ir"};
+static array<std::string, 2> s_videoExtensions = {".mp4", ".mkv"};
+
+/**
+ * Approximates a camera transform using a distortion free pinhole camera model.
+ * @param dimensions The image dimensions.
+ * @param fov        The field of view in degrees.
+ * @returns The camera transform.
+ */
+static BrownConradyTransform getPinholeTransform(const glm::ivec2& dimensions, const glm::vec2& fov) noexcept
+{
+    const glm::vec2 centre = glm::vec2(dimensions) * 0.5f;
+    return {glm::vec2(centre),
+        {centre.x / tanf(glm::radians(fov.x * 0.5f)), centre.y / tanf(glm::radians(fov.y * 0.5f))}, glm::vec2(0.0f),
+        glm::vec2(0.0f), glm::vec2(0.0f), glm::vec2(0.0f)};
+}
+
+KinectPlayback::~KinectPlayback()
+{
+    shutdown();
+    cleanup();
+}
+
+bool KinectPlayback::init(const std::string& baseName, const float speed, errorCallback error, readyCallback ready,
+    dataCallback data, finishedCallback finished) noexcept
+{
+    // Stop any existing playback
+    shutdown();
+
+    // Store callbacks
+    m_errorCallback = move(error);
+    m_dataCallback = move(data);
+    m_finishedCallback = move(finished);
+    m_baseName = baseName;
+    m_speed = std::max(speed, 0.0f);
+    m_shutdown = false;
+
+    // Start playback thread running
+    m_playbackThread = thread(&KinectPlayback::run, this, move(ready));
+
+    return true;
+}
+
+void KinectPlayback::shutdown() noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_shutdown = true;
+    }
+    // Notify wakeup
+    m_condition.notify_one();
+    // Wait for thread to complete
+    if (m_playbackThread.joinable()) {
+        m_playbackThread.join();
+    }
+}
+
+bool KinectPlayback::initPlayback() noexcept
+{
+    // Open each of the recorded video streams
+    error_code ec;
+    for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+        // The container depends on the codec the stream was recorded with
+        string videoFile;
+        m_hasVideo[i] = false;
+        for (const auto& j : s_videoExtensions) {
+            videoFile = m_baseName + s_videoSuffixes[i] + j;
+            m_hasVideo[i] = filesystem::exists(videoFile, ec);
+            if (m_hasVideo[i]) {
+                break;
+            }
+        }
+        if (m_hasVideo[i] && !m_decoders[i].init(videoFile, m_errorCallback)) {
+            return false;
+        }
+    }
+
+    // Open pose file
+    const string poseFile = m_baseName + ".csv";
+    if (filesystem::exists(poseFile, ec)) {
+        m_skeletonFile.open(poseFile, ios::binary);
+        if (!m_skeletonFile.is_open()) {
+            if (m_errorCallback != nullptr) {
+                m_errorCallback("Failed to open skeleton file: "s += poseFile);
+            }
+            return false;
+        }
+
+        // Skip column names
+        string line;
+        getline(m_skeletonFile, line);
+    }
+
+    if (!m_hasVideo[0] && !m_hasVideo[1] && !m_hasVideo[2] && !m_skeletonFile.is_open()) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("No recorded data found for: "s += m_baseName);
+        }
+        return false;
+    }
+
+    // Recordings don't store calibration information so it must be approximated from the recorded data. Recordings
+    // are made in K4A_DEPTH_MODE_NFOV_UNBINNED unless the depth/IR dimensions indicate otherwise.
+    if (m_hasVideo[0]) {
+        m_calibration.m_depthDimensions = {m_decoders[0].getWidth(), m_decoders[0].getHeight()};
+    } else if (m_hasVideo[2]) {
+        m_calibration.m_depthDimensions = {m_decoders[2].getWidth(), m_decoders[2].getHeight()};
+    } else {
+        m_calibration.m_depthDimensions = {640, 576};
+    }
+    m_calibration.m_irDimensions = m_calibration.m_depthDimensions;
+
+    // See AzureKinect::initCamera for the list of depth ranges/FOVs for each depth mode
+    if (m_calibration.m_depthDimensions.x == 320) {
+        m_calibration.m_depthRange = {500, 5800};
+        m_calibration.m_depthFOV = {75.0f, 65.0f};
+    } else if (m_calibration.m_depthDimensions.x == 640) {
+        m_calibration.m_depthRange = {500, 4000};
+        m_calibration.m_depthFOV = {75.0f, 65.0f};
+    } else if (m_calibration.m_depthDimensions.x == 512) {
+        m_calibration.m_depthRange = {250, 3000};
+        m_calibration.m_depthFOV = {120.0f, 120.0f};
+    } else {
+        m_calibration.m_depthRange = {250, 2500};
+        m_calibration.m_depthFOV = {120.0f, 120.0f};
+    }
+    m_calibration.m_irFOV = m_calibration.m_depthFOV;
+    m_calibration.m_irRange = {0, 1000};
+
+    // Colour images are downscaled during recording so use the recorded size
+    if (m_hasVideo[1]) {
+        m_calibration.m_colourDimensions = {m_decoders[1].getWidth(), m_decoders[1].getHeight()};
+    } else {
+        m_calibration.m_colourDimensions = {640, 360};
+    }
+    if (m_calibration.m_colourDimensions.x * 3 == m_calibration.m_colourDimensions.y * 4) {
+        m_calibration.m_colourFOV = {90.0f, 74.3f};
+    } else {
+        m_calibration.m_colourFOV = {90.0f, 59.0f};
+    }
+
+    m_calibration.m_depthBC = getPinholeTransform(m_calibration.m_depthDimensions, m_calibration.m_depthFOV);
+    m_calibration.m_colourBC = getPinholeTransform(m_calibration.m_colourDimensions, m_calibration.m_colourFOV);
+    m_calibration.m_irBC = m_calibration.m_depthBC;
+    m_calibration.m_jointToDepth = glm::mat4(1.0f);
+    m_calibration.m_jointToColour = glm::mat4(1.0f);
+    m_calibration.m_jointToIR = glm::mat4(1.0f);
+
+    m_calibration.m_fps = 30;
+    for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+        if (m_hasVideo[i]) {
+            const auto frameRate = m_decoders[i].getFrameRate();
+            if (frameRate.num > 0 && frameRate.den > 0) {
+                m_calibration.m_fps = static_cast<uint32_t>(lround(av_q2d(frameRate)));
+                break;
+            }
+        }
+    }
+
+    // Start decoding
+    uint32_t numThreads =
+        std::max(static_cast<uint32_t>((std::thread::hardware_concurrency() - 4) /
+                     std::max(m_hasVideo[0] + m_hasVideo[1] + m_hasVideo[2], 1)),
+            1U);
+    numThreads = std::min(numThreads, 8U);
+    if (m_hasVideo[0]) {
+        const float scale = 65536.0f / static_cast<float>(m_calibration.m_depthRange.y - m_calibration.m_depthRange.x);
+        if (!m_decoders[0].start(AV_PIX_FMT_GRAY16LE, scale, numThreads)) {
+            return false;
+        }
+    }
+    if (m_hasVideo[1]) {
+        if (!m_decoders[1].start(AV_PIX_FMT_BGRA, 1.0f, numThreads)) {
+            return false;
+        }
+    }
+    if (m_hasVideo[2]) {
+        const float scale = 65536.0f / static_cast<float>(m_calibration.m_irRange.y - m_calibration.m_irRange.x);
+        if (!m_decoders[2].start(AV_PIX_FMT_GRAY16LE, scale, numThreads)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool KinectPlayback::run(const readyCallback& ready) noexcept
+{
+    if (!initPlayback()) {
+        // The error has already been reported, playback is finished as nothing can be played
+        cleanup();
+        if (!m_shutdown && m_finishedCallback) {
+            m_finishedCallback();
+        }
+        return false;
+    }
+
+    // Pre-allocate storage
+    vector<uint8_t> bodyPixel(
+        static_cast<size_t>(m_calibration.m_depthDimensions.x) * m_calibration.m_depthDimensions.y, 0);
+    vector<Joint> bodyJoint;
+    bodyJoint.reserve(K4ABT_JOINT_COUNT);
+    vector<Joint> nextJoint;
+    nextJoint.reserve(K4ABT_JOINT_COUNT);
+    array<FramePtr, 3> currentFrames;
+    array<FramePtr, 3> nextFrames;
+
+    // Get the first frame from each stream
+    auto activeVideo = m_hasVideo;
+    for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+        if (activeVideo[i]) {
+            activeVideo[i] = m_decoders[i].getFrame(nextFrames[i]);
+        }
+    }
+    uint64_t nextSkeletonTime = 0;
+    bool activeSkeleton = false;
+    if (m_skeletonFile.is_open()) {
+        activeSkeleton = readSkeleton(nextSkeletonTime, nextJoint);
+    }
+
+    // Convert video timestamps to device time so that all streams are aligned. Older recordings don't store the
+    //  device start time so these are assumed to start with the skeleton data.
+    array<int64_t, 3> videoStart = {0, 0, 0};
+    int64_t startDeviceTime = activeSkeleton ? static_cast<int64_t>(nextSkeletonTime) : numeric_limits<int64_t>::max();
+    for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+        if (m_hasVideo[i]) {
+            videoStart[i] = m_decoders[i].getDeviceStartTime();
+            if (videoStart[i] == AV_NOPTS_VALUE) {
+                videoStart[i] = activeSkeleton ? static_cast<int64_t>(nextSkeletonTime) : 0;
+            }
+        }
+        if (activeVideo[i]) {
+            startDeviceTime = std::min(startDeviceTime, videoStart[i] + nextFrames[i]->pts);
+        }
+    }
+
+    // Trigger callback
+    if (ready) {
+        ready(m_calibration);
+    }
+
+    // Data from each stream is grouped into a single capture if it falls within half a frame period
+    const int64_t tolerance = 500000 / static_cast<int64_t>(m_calibration.m_fps);
+    const auto startTime = chrono::steady_clock::now();
+    while (!m_shutdown) {
+        // Determine the time of the next capture
+        int64_t time = numeric_limits<int64_t>::max();
+        for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+            if (activeVideo[i]) {
+                time = std::min(time, videoStart[i] + nextFrames[i]->pts);
+            }
+        }
+        if (activeSkeleton) {
+            time = std::min(time, static_cast<int64_t>(nextSkeletonTime));
+        }
+        if (time == numeric_limits<int64_t>::max()) {
+            // Reached end of recording
+            break;
+        }
+
+        // Wait until the capture is due, this is used as the host time the capture was received (without pacing it is
+        //  received once the previous capture has been passed on)
+        auto hostTime = chrono::steady_clock::now();
+        if (m_speed > 0.0f) {
+            const auto dueTime = startTime +
+                chrono::duration_cast<chrono::steady_clock::duration>(
+                    chrono::duration<double, micro>(static_cast<double>(time - startDeviceTime) / m_speed));
+            hostTime = dueTime;
+            unique_lock<mutex> lock(m_lock);
+            if (m_condition.wait_until(lock, dueTime, [this] { return m_shutdown.load(); })) {
+                break;
+            }
+        }
+
+        // Update each stream that has data due
+        for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+            if (activeVideo[i] && videoStart[i] + nextFrames[i]->pts <= time + tolerance) {
+                currentFrames[i] = move(nextFrames[i]);
+                activeVideo[i] = m_decoders[i].getFrame(nextFrames[i]);
+            }
+        }
+        // Skeleton rows are only recorded when a body is detected
+        bool validJoints = false;
+        while (activeSkeleton && static_cast<int64_t>(nextSkeletonTime) <= time + tolerance) {
+            swap(bodyJoint, nextJoint);
+            validJoints = true;
+            activeSkeleton = readSkeleton(nextSkeletonTime, nextJoint);
+        }
+
+        if (m_dataCallback) {
+            KinectImage passImages[3];
+            for (uint32_t i = 0; i < m_decoders.size(); ++i) {
+                if (currentFrames[i].m_frame != nullptr) {
+                    passImages[i] = {currentFrames[i]->data[0], currentFrames[i]->width, currentFrames[i]->height,
+                        currentFrames[i]->linesize[0]};
+                } else {
+                    passImages[i] = {nullptr, 0, 0, 0};
+                }
+            }
+
+            // Body index maps are not recorded so there is never a valid shadow
+            KinectImage shadow = {bodyPixel.data(), m_calibration.m_depthDimensions.x,
+                m_calibration.m_depthDimensions.y, m_calibration.m_depthDimensions.x};
+            KinectJoints joints(bodyJoint.data(), validJoints ? static_cast<uint32_t>(bodyJoint.size()) : 0);
+            m_dataCallback(static_cast<uint64_t>(time), hostTime, passImages[0], passImages[1], passImages[2], shadow,
+                joints);
+        }
+    }
+
+    // Cleanup all data
+    cleanup();
+
+    if (!m_shutdown && m_finishedCallback) {
+        m_finishedCallback();
+    }
+
+    return true;
+}
+
+bool KinectPlayback::readSkeleton(uint64_t& time, vector<Joint>& joints) noexcept
+{
+    string line;
+    while (getline(m_skeletonFile, line)) {
+        // Rows are separated by "\r\n"
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        // Each row contains the timestamp followed by position and rotation for each joint (see KinectRecord)
+        const char* position = line.c_str();
+        char* end;
+        time = strtoull(position, &end, 10);
+        bool validRow = (end != position) && (*end == ',');
+        joints.resize(K4ABT_JOINT_COUNT);
+        for (auto& joint : joints) {
+            array<float, 7> values;
+            for (auto& value : values) {
+                if (!validRow) {
+                    break;
+                }
+                position = end + 1;
+                value = strtof(position, &end);
+                validRow = (end != position) && (*end == ',');
+            }
+            if (!validRow) {
+                break;
+            }
+            // Joints that were not tracked are recorded with an invalid position
+            joint = Joint(Position(values[0], values[1], values[2]),
+                Quaternion(values[3], values[4], values[5], values[6]), values[0] <= -10000.0f ? 0.0f : 1.0f);
+        }
+        if (!validRow) {
+            // Partially written rows can occur if recording was interrupted
+            logHandler("Skipping invalid row in skeleton file: "s += line);
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
+
+void KinectPlayback::cleanup() noexcept
+{
+    for (auto& i : m_decoders) {
+        i.shutdown();
+    }
+    if (m_skeletonFile.is_open()) {
+        m_skeletonFile.close();
+    }
+}
+} // namespace Ak
@@ -16,6 +16,7 @@
 
 #include "KinectRecord.h"
 
+#include <algorithm>
 #include <array>
 #include <filesystem>
 #include <k4abttypes.h>
@@ -25,6 +26,8 @@
 using namespace std;
 
 namespace Ak {
+extern void logHandler(const std::string& message);
+
 // Define the joint string names
 static array<pair<k4abt_joint_id_t, std::string>, 32> s_jointNames = {std::make_pair(K4ABT_JOINT_PELVIS, "PELVIS"),
     std::make_pair(K4ABT_JOINT_SPINE_NAVEL, "SPINE_NAVAL"), std::make_pair(K4ABT_JOINT_SPINE_CHEST, "SPINE_CHEST"),
@@ -45,6 +48,11 @@ static array<pair<k4abt_joint_id_t, std::string>, 32> s_jointNames = {std::make_
     std::make_pair(K4ABT_JOINT_EAR_LEFT, "EAR_LEFT"), std::make_pair(K4ABT_JOINT_EYE_RIGHT, "EYE_RIGHT"),
     std::make_pair(K4ABT_JOINT_EAR_RIGHT, "EAR_RIGHT")};
 
+// Thread pool priority of each stream (depth, colour, IR, composite) so that the cheaper streams are never starved by
+// colour. The composite is only an archive of what was displayed so it is the first to give way
+static constexpr array<TaskPriority, 4> s_streamPriorities = {
+    TaskPriority::High, TaskPriority::Low, TaskPriority::Normal, TaskPriority::Low};
+
 string toString(const int number, const unsigned length) noexcept
 {
     string num = to_string(number);
@@ -65,10 +73,8 @@ bool KinectRecord::init(errorCallback error)
     // Store callbacks
     m_errorCallback = move(error);
 
-    // Reserve initial memory
-    for (auto& i : m_dataBuffer) {
-        i.m_joints.reserve(40);
-    }
+    // Joint data is written on the thread pool ahead of all video work
+    m_skeletonTask.init([this] { writeSkeleton(); }, TaskPriority::High);
 
     // Start capture thread running
     m_recordThread = thread(&KinectRecord::run, this);
@@ -115,89 +121,262 @@ void KinectRecord::shutdown() noexcept
 void KinectRecord::dataCallback(const uint64_t time, const KinectImage& depthImage, const KinectImage& colourImage,
     const KinectImage& irImage, const KinectImage&, const KinectJoints& joints) noexcept
 {
+    // The record thread can't replace the encoders while frames are being added
+    shared_lock<shared_mutex> lock(m_encoderLock);
     if (m_run && m_run2) {
-        bool validData = false;
-        // Only write out data when running and setup has completed
-
-        // Copy data into local
-        const uint32_t bufferMod = m_bufferIndex % m_dataBuffer.size();
-
-        m_dataBuffer[bufferMod].m_timeStamp = time;
-        if (m_depthImage) {
+        // Only write out data when running and setup has completed. A frame dropped by one encoder doesn't affect the
+        //  other streams, failures are reported through the error callback.
+        if (m_options.m_depthImage) {
             if (depthImage.m_image != nullptr) {
-                if (!m_encoders[0].addFrame(
-                        depthImage.m_image, depthImage.m_width, depthImage.m_height, depthImage.m_stride)) {
-                    return;
-                }
+                (void)m_encoders[0].front()->addFrame(depthImage, time);
             }
         }
-        if (m_colourImage) {
+        if (m_options.m_colourImage) {
             if (colourImage.m_image != nullptr) {
-                if (!m_encoders[1].addFrame(
-                        colourImage.m_image, colourImage.m_width, colourImage.m_height, colourImage.m_stride)) {
-                    return;
-                }
+                (void)m_encoders[1].front()->addFrame(colourImage, time);
             }
         }
-        if (m_irImage) {
+        if (m_options.m_irImage) {
             if (irImage.m_image != nullptr) {
-                if (!m_encoders[2].addFrame(irImage.m_image, irImage.m_width, irImage.m_height, irImage.m_stride)) {
+                (void)m_encoders[2].front()->addFrame(irImage, time);
+            }
+        }
+
+        if (m_options.m_bodySkeleton) {
+            if (joints.m_length > 0) {
+                // Copy data into local
+                DataBuffers* buffer = m_dataBuffer.beginPush();
+                if (buffer == nullptr) {
+                    // Error buffer overflow
+                    stop();
+                    m_errorCallback("Write buffer has overflowed"s);
                     return;
                 }
+                buffer->m_timeStamp = time;
+                copy_n(joints.m_joints, std::min<size_t>(joints.m_length, buffer->m_joints.size()),
+                    buffer->m_joints.begin());
+
+                // Schedule the writer on the thread pool
+                m_dataBuffer.endPush();
+                m_skeletonTask.notify();
             }
         }
+    }
+}
 
-        if (m_bodySkeleton) {
-            if (joints.m_length > 0) {
-                m_dataBuffer[bufferMod].m_joints.resize(0);
-                m_dataBuffer[bufferMod].m_joints.insert(m_dataBuffer[bufferMod].m_joints.begin(), joints.m_joints,
-                    joints.m_joints + static_cast<size_t>(joints.m_length));
-                validData = true;
+void KinectRecord::compositeCallback(const uint64_t time, const KinectImage& image) noexcept
+{
+    // Composites are rendered asynchronously so may still arrive briefly after recording has stopped
+    shared_lock<shared_mutex> lock(m_encoderLock);
+    if (m_run && m_run2 && m_options.m_compositeImage) {
+        m_encoders[3].front()->addFrame(image, time);
+    }
+}
+
+void KinectRecord::setRecordOptions(const bool depthImage, const bool colourImage, const bool irImage,
+    const bool bodySkeleton, const bool useGPUEncode, const bool fragmented) noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_requestedOptions.m_depthImage = depthImage;
+        m_requestedOptions.m_colourImage = colourImage;
+        m_requestedOptions.m_irImage = irImage;
+        m_requestedOptions.m_bodySkeleton = bodySkeleton;
+        m_requestedOptions.m_useGPUEncode = useGPUEncode;
+        m_requestedOptions.m_fragmented = fragmented;
+        m_rearm = true;
+    }
+    // Notify wakeup so the encoders can be prepared with the new options
+    m_condition.notify_one();
+}
+
+void KinectRecord::setCompositeOptions(
+    const bool compositeImage, const uint32_t width, const uint32_t height) noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_requestedOptions.m_compositeImage = compositeImage;
+        m_requestedOptions.m_compositeWidth = width;
+        m_requestedOptions.m_compositeHeight = height;
+        m_rearm = true;
+    }
+    // Notify wakeup so the encoders can be prepared with the new options
+    m_condition.notify_one();
+}
+
+void KinectRecord::setRenditions(const uint32_t stream, const vector<Rendition>& renditions) noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_requestedRenditions[stream] = renditions;
+        m_rearm = true;
+    }
+    // Notify wakeup so the encoders can be prepared with the new renditions
+    m_condition.notify_one();
+}
+
+void KinectRecord::updateCalibration(const KinectCalibration& calibration) noexcept
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_calibration = calibration;
+        m_calibrated = true;
+        m_rearm = true;
+    }
+    // Notify wakeup so the encoders can be prepared with the new calibration
+    m_condition.notify_one();
+}
+
+bool KinectRecord::prepareOutput() noexcept
+{
+    // Release any existing encoders as they may have been prepared with different settings
+    cleanupOutput();
+
+    // Settings are changed from other threads so take a copy of the current values
+    array<vector<Rendition>, 4> renditions;
+    KinectCalibration calibration;
+    {
+        lock_guard<mutex> lock(m_lock);
+        if (!m_calibrated) {
+            return true;
+        }
+        m_options = m_requestedOptions;
+        renditions = m_requestedRenditions;
+        calibration = m_calibration;
+    }
+
+    if (m_options.m_depthImage || m_options.m_colourImage || m_options.m_irImage || m_options.m_compositeImage) {
+        // Conversion work shares the thread pool, the count is only used to split it up and for the codec threads
+        uint32_t numThreads = std::max(ThreadPool::get().size() /
+                static_cast<uint32_t>(m_options.m_depthImage + m_options.m_colourImage + m_options.m_irImage +
+                    m_options.m_compositeImage),
+            1U);
+        numThreads = std::min(numThreads, 8U);
+
+        if (m_options.m_depthImage) {
+            const float scale = 65536.0f / static_cast<float>(calibration.m_depthRange.y - calibration.m_depthRange.x);
+            if (!prepareStream(0, calibration.m_depthDimensions.x, calibration.m_depthDimensions.y,
+                    AV_PIX_FMT_GRAY16LE, calibration.m_fps, scale, numThreads, renditions[0])) {
+                cleanupOutput();
+                return false;
             }
         }
-        if (validData) {
-            ++m_bufferIndex;
-            if (m_remainingBuffers == static_cast<int32_t>(m_dataBuffer.size()) - 2) {
-                // Error buffer overflow
-                {
-                    unique_lock<mutex> lock(m_lock);
-                    m_run = false;
-                }
-                m_errorCallback("Write buffer has overflowed"s);
-                return;
+        if (m_options.m_colourImage) {
+            if (!prepareStream(1, calibration.m_colourDimensions.x, calibration.m_colourDimensions.y, AV_PIX_FMT_BGRA,
+                    calibration.m_fps, 1.0f, numThreads, renditions[1])) {
+                cleanupOutput();
+                return false;
+            }
+        }
+        if (m_options.m_irImage) {
+            const float scale = 65536.0f / static_cast<float>(calibration.m_irRange.y - calibration.m_irRange.x);
+            if (!prepareStream(2, calibration.m_irDimensions.x, calibration.m_irDimensions.y, AV_PIX_FMT_GRAY16LE,
+                    calibration.m_fps, scale, numThreads, renditions[2])) {
+                cleanupOutput();
+                return false;
             }
-            {
-                unique_lock<mutex> lock(m_lock);
-                ++m_remainingBuffers;
+        }
+        if (m_options.m_compositeImage) {
+            if (!prepareStream(3, m_options.m_compositeWidth, m_options.m_compositeHeight, AV_PIX_FMT_BGRA,
+                    calibration.m_fps, 1.0f, numThreads, renditions[3])) {
+                cleanupOutput();
+                return false;
             }
         }
+    }
+    return true;
+}
 
-        // Notify wakeup
-        if (validData) {
-            m_condition.notify_one();
+bool KinectRecord::prepareStream(const uint32_t stream, const uint32_t width, const uint32_t height,
+    const int32_t format, const uint32_t fps, const float scale, const uint32_t numThreads,
+    const vector<Rendition>& renditions) noexcept
+{
+    auto& encoders = m_encoders[stream];
+    auto& prepared = m_renditions[stream];
+    {
+        // Callbacks only use the encoders while running, but the lock ensures none are still adding a frame
+        unique_lock<shared_mutex> lock(m_encoderLock);
+        encoders.clear();
+    }
+    prepared.clear();
+    for (const auto& i : renditions) {
+        if (i.m_width > width) {
+            logHandler("Skipping rendition larger than input: "s += i.m_name);
+            continue;
         }
+        auto encoder = make_unique<Encoder>();
+        encoder->setPriority(s_streamPriorities[stream]);
+        // Camera images are stored mirrored, but the composite is rendered as displayed so is already mirrored
+        encoder->setMirror(stream != 3);
+        if (encoders.empty()) {
+            if (!encoder->prepare(width, height, fps, format, scale, numThreads, m_options.m_useGPUEncode,
+                    m_options.m_fragmented, i, m_errorCallback)) {
+                return false;
+            }
+        } else {
+            // Smaller renditions are derived from the already converted frames of the previous rendition
+            Encoder* upstream = encoders.back().get();
+            if (!encoder->prepare(upstream->getWidth(), upstream->getHeight(), fps, upstream->getPixelFormat(), 1.0f,
+                    numThreads, m_options.m_useGPUEncode, m_options.m_fragmented, i, m_errorCallback)) {
+                return false;
+            }
+            upstream->setDownstream(encoder.get());
+        }
+        encoders.emplace_back(move(encoder));
+        prepared.emplace_back(i);
     }
+    if (encoders.empty()) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("No valid renditions were requested"s);
+        }
+        return false;
+    }
+    return true;
 }
 
-void KinectRecord::setRecordOptions(const bool depthImage, const bool colourImage, const bool irImage,
-    const bool bodySkeleton, const bool useGPUEncode) noexcept
+bool KinectRecord::isStreamPrepared(const uint32_t stream) const noexcept
 {
-    m_depthImage = depthImage;
-    m_colourImage = colourImage;
-    m_irImage = irImage;
-    m_bodySkeleton = bodySkeleton;
-    m_useGPUEncode = useGPUEncode;
+    const auto& encoders = m_encoders[stream];
+    return !encoders.empty() && all_of(encoders.cbegin(), encoders.cend(), [](const unique_ptr<Encoder>& encoder) {
+        return encoder->isPrepared();
+    });
 }
 
-void KinectRecord::updateCalibration(const KinectCalibration& calibration) noexcept
+bool KinectRecord::startStream(const uint32_t stream, const string& filename) noexcept
 {
-    m_calibration = calibration;
+    // Downstream encoders must be running before the encoders that feed them
+    for (size_t i = m_encoders[stream].size(); i-- > 0;) {
+        string file = filename;
+        if (!m_renditions[stream][i].m_name.empty()) {
+            (file += '_') += m_renditions[stream][i].m_name;
+        }
+        if (!m_encoders[stream][i]->start(file + m_encoders[stream][i]->getFileExtension())) {
+            return false;
+        }
+    }
+    return true;
 }
 
 bool KinectRecord::initOutput() noexcept
 {
-    // Close any existing recordings
-    cleanupOutput();
+    const auto startTime = chrono::steady_clock::now();
+
+    // Prepare the encoders now if they weren't already prepared in the background
+    bool prepared = (!m_options.m_depthImage || isStreamPrepared(0)) &&
+        (!m_options.m_colourImage || isStreamPrepared(1)) && (!m_options.m_irImage || isStreamPrepared(2)) &&
+        (!m_options.m_compositeImage || isStreamPrepared(3));
+    {
+        lock_guard<mutex> lock(m_lock);
+        prepared = prepared && !m_rearm;
+        m_rearm = false;
+    }
+    if (m_skeletonFile.is_open()) {
+        m_skeletonFile.close();
+    }
+    if (!prepared && !prepareOutput()) {
+        return false;
+    }
+    m_dataBuffer.clear();
 
     // Create output directory
     const string pidString = "PID"s + toString(m_pid, 3);
@@ -234,7 +413,7 @@ bool KinectRecord::initOutput() noexcept
     string videoFile = poseFile;
     poseFile += ".csv";
 
-    if (m_bodySkeleton) {
+    if (m_options.m_bodySkeleton) {
         // Create pose file
         m_skeletonFile.open(poseFile, ios::binary);
         if (!m_skeletonFile.is_open()) {
@@ -256,41 +435,26 @@ bool KinectRecord::initOutput() noexcept
     }
 
     // Start recording
-    if (m_depthImage || m_colourImage || m_irImage) {
-        uint32_t numThreads = std::max(static_cast<uint32_t>((std::thread::hardware_concurrency() - 4) /
-                                           (m_depthImage + m_colourImage + m_irImage)),
-            1U);
-        numThreads = std::min(numThreads, 8U);
-
-        if (m_depthImage) {
-            const float scale =
-                65536.0f / static_cast<float>(m_calibration.m_depthRange.y - m_calibration.m_depthRange.x);
-            if (!m_encoders[0].init(videoFile + "_depth.mp4", m_calibration.m_depthDimensions.x,
-                    m_calibration.m_depthDimensions.y, m_calibration.m_fps, AV_PIX_FMT_GRAY16LE, scale, numThreads,
-                    m_useGPUEncode, m_errorCallback)) {
-                cleanupOutput();
-                return false;
-            }
-        }
-        if (m_colourImage) {
-            if (!m_encoders[1].init(videoFile + "_colour.mp4", m_calibration.m_colourDimensions.x,
-                    m_calibration.m_colourDimensions.y, m_calibration.m_fps, AV_PIX_FMT_BGRA, 1.0f, numThreads,
-                    m_useGPUEncode, m_errorCallback)) {
-                cleanupOutput();
-                return false;
-            }
-        }
-        if (m_irImage) {
-            const float scale = 65536.0f / static_cast<float>(m_calibration.m_irRange.y - m_calibration.m_irRange.x);
-            if (!m_encoders[2].init(videoFile + "_ir.mp4", m_calibration.m_irDimensions.x,
-                    m_calibration.m_irDimensions.y, m_calibration.m_fps, AV_PIX_FMT_GRAY16LE, scale, numThreads,
-                    m_useGPUEncode, m_errorCallback)) {
-                cleanupOutput();
-                return false;
-            }
-        }
+    if (m_options.m_depthImage && !startStream(0, videoFile + "_depth")) {
+        cleanupOutput();
+        return false;
+    }
+    if (m_options.m_colourImage && !startStream(1, videoFile + "_colour")) {
+        cleanupOutput();
+        return false;
+    }
+    if (m_options.m_irImage && !startStream(2, videoFile + "_ir")) {
+        cleanupOutput();
+        return false;
+    }
+    if (m_options.m_compositeImage && !startStream(3, videoFile + "_composite")) {
+        cleanupOutput();
+        return false;
     }
 
+    const auto latency = chrono::duration<double, milli>(chrono::steady_clock::now() - startTime).count();
+    logHandler("Recording start latency: "s += to_string(latency) += "ms"s);
+
     return true;
 }
 
@@ -300,8 +464,11 @@ void KinectRecord::cleanupOutput() noexcept
     if (m_skeletonFile.is_open()) {
         m_skeletonFile.close();
     }
+    // Encoders feeding a smaller rendition are shutdown first so that all of their frames are passed on
     for (auto& i : m_encoders) {
-        i.shutdown();
+        for (auto& j : i) {
+            j->shutdown();
+        }
     }
 }
 
@@ -312,11 +479,18 @@ bool KinectRecord::run() noexcept
         {
             unique_lock<mutex> lock(m_lock);
             if (!m_run && !m_shutdown) {
-                m_condition.wait(lock, [this] { return m_run || m_shutdown; });
+                m_condition.wait(lock, [this] { return m_run || m_shutdown || m_rearm; });
             }
             if (m_shutdown) {
                 break;
             }
+            if (!m_run) {
+                // Settings have changed so prepare the encoders in the background
+                m_rearm = false;
+                lock.unlock();
+                (void)prepareOutput();
+                continue;
+            }
         }
         // State is currently set to run, initialise output
         if (!initOutput()) {
@@ -324,55 +498,58 @@ bool KinectRecord::run() noexcept
             m_run = false;
             continue;
         }
-        while (true) {
-            // Wait until we have received valid data
-            {
-                unique_lock<mutex> lock(m_lock);
-                m_run2 = true;
-                if (m_run && !m_shutdown) {
-                    m_condition.wait(lock,
-                        [this] { return (m_run && (m_remainingBuffers > 0)) || m_shutdown || (!m_run && m_run2); });
-                }
-                if (!m_run || m_shutdown) {
-                    break;
-                }
-            }
-            if (m_bodySkeleton) {
-                // Write out to file
-                while (true) {
-                    if (m_remainingBuffers == 0) {
-                        break;
-                    }
-                    --m_remainingBuffers;
-                    m_skeletonFile << "\r\n";
-                    m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_timeStamp << ',';
-                    for (auto& i : s_jointNames) {
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_position.m_position.x
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_position.m_position.y
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_position.m_position.z
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_rotation.m_rotation.x
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_rotation.m_rotation.y
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_rotation.m_rotation.z
-                                       << ',';
-                        m_skeletonFile << m_dataBuffer[m_nextBufferIndex].m_joints[i.first].m_rotation.m_rotation.w
-                                       << ',';
-                    }
-                    ++m_nextBufferIndex;
-                    m_nextBufferIndex = m_nextBufferIndex < m_dataBuffer.size() ? m_nextBufferIndex : 0;
-                    m_skeletonFile.flush();
-                }
-            }
+        m_run2 = true;
+        {
+            // Data is written on the thread pool so just wait until recording stops
+            unique_lock<mutex> lock(m_lock);
+            m_condition.wait(lock, [this] { return !m_run || m_shutdown; });
         }
-        // Cleanup current run
-        m_run2 = false;
+        // Cleanup current run, once the lock is taken no callback can still be adding frames to the encoders
+        {
+            unique_lock<shared_mutex> lock(m_encoderLock);
+            m_run2 = false;
+        }
+        m_skeletonTask.notify();
+        m_skeletonTask.wait();
         cleanupOutput();
+
+        // Re-arm the encoders ready for the next run
+        {
+            lock_guard<mutex> lock(m_lock);
+            m_rearm = false;
+        }
+        if (!m_shutdown) {
+            (void)prepareOutput();
+        }
     }
 
     return true;
 }
+
+void KinectRecord::writeSkeleton() noexcept
+{
+    if (!m_skeletonFile.is_open()) {
+        return;
+    }
+    // Write out to file
+    while (true) {
+        const DataBuffers* buffer = m_dataBuffer.front();
+        if (buffer == nullptr) {
+            break;
+        }
+        m_skeletonFile << "\r\n";
+        m_skeletonFile << buffer->m_timeStamp << ',';
+        for (auto& i : s_jointNames) {
+            m_skeletonFile << buffer->m_joints[i.first].m_position.m_position.x << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_position.m_position.y << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_position.m_position.z << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_rotation.m_rotation.x << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_rotation.m_rotation.y << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_rotation.m_rotation.z << ',';
+            m_skeletonFile << buffer->m_joints[i.first].m_rotation.m_rotation.w << ',';
+        }
+        m_dataBuffer.pop();
+        m_skeletonFile.flush();
+    }
+}
 } // namespace Ak
@@ -0,0 +1,1614 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _USE_MATH_DEFINES
+#include "KinectRenderer.h"
+
+#include <QOpenGLContext>
+#include <QResource>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include <k4abt.h>
+#include <limits>
+using namespace glm;
+using namespace std;
+
+// Persistent mapping requires OpenGL 4.4 or ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#    define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#    define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Timer queries require OpenGL 3.3 or ARB_timer_query
+#ifndef GL_TIME_ELAPSED
+#    define GL_TIME_ELAPSED 0x88BF
+#endif
+
+namespace Ak {
+extern void logHandler(const std::string& message);
+
+#if _DEBUG
+
+static QString s_severity[] = {"High", "Medium", "Low", "Notification"};
+static QString s_type[] = {"Error", "Deprecated", "Undefined", "Portability", "Performance", "Other"};
+static QString s_source[] = {"OpenGL", "OS", "GLSL Compiler", "3rd Party", "Application", "Other"};
+
+void APIENTRY debugCallback(const uint32_t source, const uint32_t type, uint32_t, const uint32_t severity, int32_t,
+    const char* message, void* userParam)
+{
+    // Get the severity
+    uint32_t sevID;
+    switch (severity) {
+        case GL_DEBUG_SEVERITY_HIGH:
+            sevID = 0;
+            break;
+        case GL_DEBUG_SEVERITY_MEDIUM:
+            sevID = 1;
+            break;
+        case GL_DEBUG_SEVERITY_LOW:
+            sevID = 2;
+            break;
+        case GL_DEBUG_SEVERITY_NOTIFICATION:
+        default:
+            sevID = 3;
+            break;
+    }
+
+    // Get the type
+    uint32_t typeID;
+    switch (type) {
+        case GL_DEBUG_TYPE_ERROR:
+            typeID = 0;
+            break;
+        case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR:
+            typeID = 1;
+            break;
+        case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR:
+            typeID = 2;
+            break;
+        case GL_DEBUG_TYPE_PORTABILITY:
+            typeID = 3;
+            break;
+        case GL_DEBUG_TYPE_PERFORMANCE:
+            typeID = 4;
+            break;
+        case GL_DEBUG_TYPE_OTHER:
+        default:
+            typeID = 5;
+            break;
+    }
+
+    // Get the source
+    uint32_t sourceID;
+    switch (source) {
+        case GL_DEBUG_SOURCE_API:
+            sourceID = 0;
+            break;
+        case GL_DEBUG_SOURCE_WINDOW_SYSTEM:
+            sourceID = 1;
+            break;
+        case GL_DEBUG_SOURCE_SHADER_COMPILER:
+            sourceID = 2;
+            break;
+        case GL_DEBUG_SOURCE_THIRD_PARTY:
+            sourceID = 3;
+            break;
+        case GL_DEBUG_SOURCE_APPLICATION:
+            sourceID = 4;
+            break;
+        case GL_DEBUG_SOURCE_OTHER:
+        default:
+            sourceID = 5;
+            break;
+    }
+
+    // Output to message callback
+    const auto mess = QObject::tr("OpenGL Debug: Severity=") + s_severity[sevID] + QObject::tr(", Type=") +
+        s_type[typeID] + QObject::tr(", Source=") + s_source[sourceID] + QObject::tr(" - ") + message;
+    const auto& error = *static_cast<const KinectRenderer::errorCallback*>(userParam);
+    if (severity == GL_DEBUG_SEVERITY_HIGH && error != nullptr) {
+        error(mess.toStdString());
+    } else {
+        logHandler(mess.toStdString());
+    }
+}
+#endif
+
+static array<pair<k4abt_joint_id_t, k4abt_joint_id_t>, 31> s_boneList = {
+    make_pair(K4ABT_JOINT_SPINE_CHEST, K4ABT_JOINT_SPINE_NAVEL), make_pair(K4ABT_JOINT_SPINE_NAVEL, K4ABT_JOINT_PELVIS),
+    make_pair(K4ABT_JOINT_SPINE_CHEST, K4ABT_JOINT_NECK), make_pair(K4ABT_JOINT_NECK, K4ABT_JOINT_HEAD),
+    make_pair(K4ABT_JOINT_HEAD, K4ABT_JOINT_NOSE), make_pair(K4ABT_JOINT_SPINE_CHEST, K4ABT_JOINT_CLAVICLE_LEFT),
+    make_pair(K4ABT_JOINT_CLAVICLE_LEFT, K4ABT_JOINT_SHOULDER_LEFT),
+    make_pair(K4ABT_JOINT_SHOULDER_LEFT, K4ABT_JOINT_ELBOW_LEFT),
+    make_pair(K4ABT_JOINT_ELBOW_LEFT, K4ABT_JOINT_WRIST_LEFT), make_pair(K4ABT_JOINT_WRIST_LEFT, K4ABT_JOINT_HAND_LEFT),
+    make_pair(K4ABT_JOINT_HAND_LEFT, K4ABT_JOINT_HANDTIP_LEFT),
+    make_pair(K4ABT_JOINT_WRIST_LEFT, K4ABT_JOINT_THUMB_LEFT), make_pair(K4ABT_JOINT_PELVIS, K4ABT_JOINT_HIP_LEFT),
+    make_pair(K4ABT_JOINT_HIP_LEFT, K4ABT_JOINT_KNEE_LEFT), make_pair(K4ABT_JOINT_KNEE_LEFT, K4ABT_JOINT_ANKLE_LEFT),
+    make_pair(K4ABT_JOINT_ANKLE_LEFT, K4ABT_JOINT_FOOT_LEFT), make_pair(K4ABT_JOINT_NOSE, K4ABT_JOINT_EYE_LEFT),
+    make_pair(K4ABT_JOINT_EYE_LEFT, K4ABT_JOINT_EAR_LEFT),
+    make_pair(K4ABT_JOINT_SPINE_CHEST, K4ABT_JOINT_CLAVICLE_RIGHT),
+    make_pair(K4ABT_JOINT_CLAVICLE_RIGHT, K4ABT_JOINT_SHOULDER_RIGHT),
+    make_pair(K4ABT_JOINT_SHOULDER_RIGHT, K4ABT_JOINT_ELBOW_RIGHT),
+    make_pair(K4ABT_JOINT_ELBOW_RIGHT, K4ABT_JOINT_WRIST_RIGHT),
+    make_pair(K4ABT_JOINT_WRIST_RIGHT, K4ABT_JOINT_HAND_RIGHT),
+    make_pair(K4ABT_JOINT_HAND_RIGHT, K4ABT_JOINT_HANDTIP_RIGHT),
+    make_pair(K4ABT_JOINT_WRIST_RIGHT, K4ABT_JOINT_THUMB_RIGHT), make_pair(K4ABT_JOINT_PELVIS, K4ABT_JOINT_HIP_RIGHT),
+    make_pair(K4ABT_JOINT_HIP_RIGHT, K4ABT_JOINT_KNEE_RIGHT),
+    make_pair(K4ABT_JOINT_KNEE_RIGHT, K4ABT_JOINT_ANKLE_RIGHT),
+    make_pair(K4ABT_JOINT_ANKLE_RIGHT, K4ABT_JOINT_FOOT_RIGHT), make_pair(K4ABT_JOINT_NOSE, K4ABT_JOINT_EYE_RIGHT),
+    make_pair(K4ABT_JOINT_EYE_RIGHT, K4ABT_JOINT_EAR_RIGHT)};
+
+void KinectRenderer::setRenderOptions(const bool depthImage, const bool colourImage, const bool irImage,
+    const bool pointCloud, const bool bodyShadow, const bool bodySkeleton) noexcept
+{
+    m_depthImage = depthImage;
+    m_colourImage = colourImage;
+    m_irImage = irImage;
+    m_pointCloud = pointCloud;
+    m_bodyShadowImage = bodyShadow;
+    m_bodySkeletonImage = bodySkeleton;
+}
+
+void KinectRenderer::setCalibration(const KinectCalibration& calibration) noexcept
+{
+    m_calibration = calibration;
+}
+
+uint8_t* KinectRenderer::acquirePixelBuffer(const size_t size) noexcept
+{
+    // Start at a different buffer each time so that buffers are used in turn
+    const uint32_t start = m_nextPixelBuffer.fetch_add(1, memory_order_relaxed);
+    for (uint32_t i = 0; i < m_pixelBuffers.size(); ++i) {
+        auto& buffer = m_pixelBuffers[(start + i) % m_pixelBuffers.size()];
+        auto expected = PixelBufferState::Free;
+        if (buffer.m_state.compare_exchange_strong(expected, PixelBufferState::Writing, memory_order_acquire)) {
+            if (buffer.m_size >= size) {
+                return buffer.m_data;
+            }
+            buffer.m_state.store(PixelBufferState::Free, memory_order_release);
+        }
+    }
+    return nullptr;
+}
+
+void KinectRenderer::uploadData(const KinectImage& depthImage, const KinectImage& colourImage,
+    const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept
+{
+    reclaimPixelBuffers();
+    beginTimer(TimerPass::Upload);
+
+    // The view may have changed since the data was copied, in which case the images it needs may be missing
+    if (m_depthImage || m_pointCloud) {
+        // Copy depth image data
+        (void)uploadImage(m_depthTexture, m_calibration.m_depthDimensions, depthImage, GL_DEPTH_COMPONENT,
+            GL_UNSIGNED_SHORT, 2);
+    } else if (m_colourImage) {
+        // Copy colour image data
+        (void)uploadImage(
+            m_colourTexture, m_calibration.m_colourDimensions, colourImage, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+    } else if (m_irImage) {
+        // Copy IR image data
+        (void)uploadImage(
+            m_irTexture, m_calibration.m_irDimensions, irImage, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, 2);
+    }
+
+    if (m_pointCloud) {
+        // Point clouds are coloured from the colour image when there is one
+        m_pointColour = uploadImage(
+            m_colourTexture, m_calibration.m_colourDimensions, colourImage, GL_BGRA, GL_UNSIGNED_BYTE, 4);
+    }
+
+    if (m_bodyShadowImage) {
+        // Copy shadow image data
+        (void)uploadImage(
+            m_shadowTexture, m_calibration.m_depthDimensions, shadowImage, GL_RED, GL_UNSIGNED_BYTE, 1);
+    }
+
+    // The pixel buffer the data was written to can be reused once the GPU has finished the uploads from it
+    for (const auto* image : {depthImage.m_image, colourImage.m_image, irImage.m_image, shadowImage.m_image}) {
+        PixelBuffer* buffer = findPixelBuffer(image);
+        if (buffer != nullptr && buffer->m_state.load(memory_order_relaxed) == PixelBufferState::Writing) {
+            buffer->m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            buffer->m_state.store(PixelBufferState::Uploading, memory_order_release);
+        }
+    }
+
+    if (m_bodySkeletonImage) {
+        // Only the joint positions are uploaded, the sphere and bone transforms are built from them on the GPU
+        m_jointData.resize(0);
+        auto pointer = joints.m_joints;
+        for (uint32_t i = 0; i < joints.m_length; ++i, ++pointer) {
+            m_jointData.emplace_back(pointer->m_position.m_position, pointer->m_confidence);
+        }
+        const auto bodies = static_cast<uint32_t>(m_jointData.size() / K4ABT_JOINT_COUNT);
+        m_skeletonCommands[0].m_instanceCount = static_cast<GLuint>(m_jointData.size());
+        m_skeletonCommands[1].m_instanceCount = bodies * static_cast<GLuint>(s_boneList.size());
+        m_skeletonCommands[1].m_baseInstance = m_skeletonCommands[0].m_instanceCount;
+        if (!m_jointData.empty()) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_jointSSBO);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(sizeof(vec4) * m_jointData.size()),
+                m_jointData.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+
+        // Grow the instance buffer if there are now more bodies
+        const size_t instances = m_skeletonCommands[0].m_instanceCount + m_skeletonCommands[1].m_instanceCount;
+        if (instances > m_skeletonInstances) {
+            glBindBuffer(GL_ARRAY_BUFFER, m_skeletonInstanceBO);
+            glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(sizeof(SkeletonData) * instances), nullptr,
+                GL_DYNAMIC_COPY);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            m_skeletonInstances = instances;
+        }
+    }
+    endTimer();
+}
+
+void KinectRenderer::refreshRender() noexcept
+{
+    // This means that the display image has changed so we must update values
+    updateCamera();
+
+    // Update transform buffer, point clouds use the colour transform to look up each points colour
+    glBindBuffer(GL_UNIFORM_BUFFER, m_transformUBO);
+    if (m_depthImage) {
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(BrownConradyTransform), &m_calibration.m_depthBC, GL_STATIC_DRAW);
+    } else if (m_colourImage || m_pointCloud) {
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(BrownConradyTransform), &m_calibration.m_colourBC, GL_STATIC_DRAW);
+    } else {
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(BrownConradyTransform), &m_calibration.m_irBC, GL_STATIC_DRAW);
+    }
+
+    vec2 inverseRes;
+    if (m_depthImage) {
+        inverseRes = 1.0f / vec2(m_calibration.m_depthDimensions);
+    } else if (m_colourImage || m_pointCloud) {
+        inverseRes = 1.0f / vec2(m_calibration.m_colourDimensions);
+    } else if (m_irImage) {
+        inverseRes = 1.0f / vec2(m_calibration.m_irDimensions);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, m_imageUBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec2), &inverseRes, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Pixel buffers only need to hold the images used by the new view
+    updatePixelBufferSize();
+
+    // Update viewport in case of aspect ratio change
+    resize(m_targetWidth, m_targetHeight);
+}
+
+void KinectRenderer::setOrbitCamera(const float yaw, const float pitch, const float distance) noexcept
+{
+    m_orbitYaw = yaw;
+    m_orbitPitch = pitch;
+    m_orbitDistance = distance;
+    if (m_pointCloud) {
+        updateCamera();
+    }
+}
+
+void KinectRenderer::updateCamera() noexcept
+{
+    // Joints are converted into the space of the displayed image
+    struct CameraBuffer
+    {
+        mat4 m_viewProjection;
+        mat4 m_jointTransform;
+    };
+    CameraBuffer cameraBuffer;
+    if (m_pointCloud) {
+        // Orbit around a point in front of the depth camera (in metres with y down). The default orbit places the
+        // view at the depth camera
+        const vec3 target(0.0f, 0.0f, s_orbitTarget);
+        const float pitchScale = std::cos(m_orbitPitch);
+        const vec3 offset =
+            vec3(std::sin(m_orbitYaw) * pitchScale, -std::sin(m_orbitPitch), -std::cos(m_orbitYaw) * pitchScale) *
+            m_orbitDistance;
+        const mat4 view = lookAt(target + offset, target, vec3(0.0f, -1.0f, 0.0f));
+        const float aspect =
+            m_viewportH > 0 ? static_cast<float>(m_viewportW) / static_cast<float>(m_viewportH) : 1.0f;
+        mat4 projection = perspective(radians(m_calibration.m_depthFOV.y), aspect, 0.05f, 30.0f);
+        projection[0][0] = -projection[0][0]; // Fix for mirroring
+
+        // Points are sized to cover the area of a depth pixel
+        m_pointScale = projection[1][1] * 0.5f * static_cast<float>(m_viewportH) / m_calibration.m_depthBC.m_f.y;
+        cameraBuffer = {projection * view, m_calibration.m_jointToDepth};
+        glBindBuffer(GL_UNIFORM_BUFFER, m_cameraUBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBuffer), &cameraBuffer, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return;
+    }
+
+    // Update the view/projection matrix
+    const mat4 view = lookAt(vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f), vec3(0.0, -1.0, 0.0));
+    mat4 projection;
+    if (m_depthImage) {
+        projection = perspective(
+            radians(m_calibration.m_depthFOV.y), m_calibration.m_depthFOV.x / m_calibration.m_depthFOV.y, 0.01f, 30.0f);
+    } else if (m_colourImage) {
+        projection = perspective(radians(m_calibration.m_colourFOV.y),
+            m_calibration.m_colourFOV.x / m_calibration.m_colourFOV.y, 0.01f, 30.0f);
+    } else {
+        projection = perspective(
+            radians(m_calibration.m_irFOV.y), m_calibration.m_irFOV.x / m_calibration.m_irFOV.y, 0.01f, 30.0f);
+    }
+    projection[0][0] = -projection[0][0]; // Fix for mirroring
+
+    cameraBuffer = {projection * view, m_calibration.m_jointToIR};
+    if (m_depthImage) {
+        cameraBuffer.m_jointTransform = m_calibration.m_jointToDepth;
+    } else if (m_colourImage) {
+        cameraBuffer.m_jointTransform = m_calibration.m_jointToColour;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, m_cameraUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBuffer), &cameraBuffer, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void KinectRenderer::refreshCalibration() noexcept
+{
+    const uint32_t maxSize = glm::max(m_calibration.m_depthDimensions.x * m_calibration.m_depthDimensions.y * 2,
+        m_calibration.m_colourDimensions.x * m_calibration.m_colourDimensions.y * 4);
+
+    // Texture storage is immutable so textures must be recreated when the dimensions change
+    glDeleteTextures(1, &m_depthTexture);
+    glDeleteTextures(1, &m_colourTexture);
+    glDeleteTextures(1, &m_irTexture);
+    glDeleteTextures(1, &m_shadowTexture);
+    createTextures();
+
+    // Resize depth texture
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexStorage2D(
+        GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT16, m_calibration.m_depthDimensions.x, m_calibration.m_depthDimensions.y);
+    std::vector<uint8_t> initialBlank(maxSize, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_calibration.m_depthDimensions.x, m_calibration.m_depthDimensions.y,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(initialBlank.data()));
+
+    // Resize colour texture
+    glBindTexture(GL_TEXTURE_2D, m_colourTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, m_calibration.m_colourDimensions.x, m_calibration.m_colourDimensions.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_calibration.m_colourDimensions.x, m_calibration.m_colourDimensions.y,
+        GL_BGRA, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid*>(initialBlank.data()));
+
+    // Resize IR texture
+    glBindTexture(GL_TEXTURE_2D, m_irTexture);
+    glTexStorage2D(
+        GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT16, m_calibration.m_irDimensions.x, m_calibration.m_irDimensions.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_calibration.m_irDimensions.x, m_calibration.m_irDimensions.y,
+        GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid*>(initialBlank.data()));
+
+    // Resize shadow texture
+    glBindTexture(GL_TEXTURE_2D, m_shadowTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, m_calibration.m_depthDimensions.x, m_calibration.m_depthDimensions.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_calibration.m_depthDimensions.x, m_calibration.m_depthDimensions.y,
+        GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<const GLvoid*>(initialBlank.data()));
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // Create the unprojection table used to build point clouds
+    createXYTable();
+
+    updatePixelBufferSize();
+}
+
+bool KinectRenderer::init(errorCallback error) noexcept
+{
+    m_errorCallback = move(error);
+    initializeOpenGLFunctions();
+
+#if _DEBUG
+    // Allow for synchronous callbacks.
+    glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+
+    // Set up the debug info callback
+    glDebugMessageCallback(reinterpret_cast<GLDEBUGPROC>(&debugCallback), &m_errorCallback);
+
+    // Set up the type of debug information we want to receive
+    uint32_t uiUnusedIDs = 0;
+    glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, &uiUnusedIDs, GL_TRUE); // Enable all
+    /*glDebugMessageControl(
+        GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, nullptr, GL_FALSE); // Disable notifications*/
+#endif
+
+    // Image data is written directly to persistently mapped pixel buffers if they are supported
+    QOpenGLContext* context = QOpenGLContext::currentContext();
+    if (context->format().version() >= qMakePair(4, 4) || context->hasExtension("GL_ARB_buffer_storage")) {
+        m_bufferStorage = reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorage"));
+    }
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f); // Set the cleared back buffer to black
+    glCullFace(GL_BACK);                  // Set back-face culling
+    glEnable(GL_CULL_FACE);               // Enable use of back/front face culling
+    glEnable(GL_DEPTH_TEST);              // Enable use of depth testing
+    glDisable(GL_STENCIL_TEST);           // Disable stencil test for speed
+
+    // Generate the full screen quad
+    glGenVertexArrays(1, &m_quadVAO);
+    glGenBuffers(1, &m_quadVBO);
+    glGenBuffers(1, &m_quadIBO);
+    glBindVertexArray(m_quadVAO);
+
+    // Create VBO data
+    glBindBuffer(GL_ARRAY_BUFFER, m_quadVBO);
+    GLfloat vertexData[] = {-1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f};
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertexData), vertexData, GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), nullptr);
+    glEnableVertexAttribArray(0);
+
+    // Create IBO data
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIBO);
+    GLubyte indexData[] = {0, 1, 3, 1, 2, 3};
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_quadIBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indexData), indexData, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    // Point cloud vertices are generated from the vertex ID so the vertex array has no attributes
+    glGenVertexArrays(1, &m_pointVAO);
+    glEnable(GL_PROGRAM_POINT_SIZE);
+
+    // Create image textures
+    createTextures();
+
+    // Create skeleton objects, the sphere and cylinder share buffers so that all joints and bones are a single draw
+    vector<CustomVertex> vertexBuffer;
+    vector<GLuint> indexBuffer;
+    const GLsizei sphereElements = generateSphere(12, 6, vertexBuffer, indexBuffer);
+    const auto cylinderVertex = static_cast<GLint>(vertexBuffer.size());
+    const GLsizei cylinderElements = generateCylinder(12, vertexBuffer, indexBuffer);
+    m_skeletonCommands[0] = DrawCommand{static_cast<GLuint>(sphereElements), 0, 0, 0, 0};
+    m_skeletonCommands[1] =
+        DrawCommand{static_cast<GLuint>(cylinderElements), 0, static_cast<GLuint>(sphereElements), cylinderVertex, 0};
+    glGenVertexArrays(1, &m_skeletonVAO);
+    glGenBuffers(1, &m_skeletonVBO);
+    glGenBuffers(1, &m_skeletonIBO);
+    glBindVertexArray(m_skeletonVAO);
+
+    // Fill vertex and index buffers
+    glBindBuffer(GL_ARRAY_BUFFER, m_skeletonVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(CustomVertex), vertexBuffer.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_skeletonIBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBuffer.size() * sizeof(GLuint), indexBuffer.data(), GL_STATIC_DRAW);
+
+    // Specify location of data within buffer
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(CustomVertex), nullptr);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(CustomVertex),
+        reinterpret_cast<const GLvoid*>(offsetof(CustomVertex, m_normal)));
+    glEnableVertexAttribArray(1);
+
+    // Create instance buffer, this is written by the skeleton compute shader and allocated once joints are received.
+    // Cylinder instances follow the sphere instances and are offset using the draws base instance.
+    glGenBuffers(1, &m_skeletonInstanceBO);
+    glBindBuffer(GL_ARRAY_BUFFER, m_skeletonInstanceBO);
+    for (uint32_t i = 0; i < 8; i++) {
+        // Set up the vertex attributes for the 2 mat4's
+        glVertexAttribPointer(
+            2 + i, 4, GL_FLOAT, GL_FALSE, sizeof(SkeletonData), reinterpret_cast<void*>(sizeof(vec4) * i));
+        glEnableVertexAttribArray(2 + i);
+        glVertexAttribDivisor(2 + i, 1);
+    }
+    // Set up the vertex attribute for confidence
+    glVertexAttribPointer(10, 1, GL_FLOAT, GL_FALSE, sizeof(SkeletonData), reinterpret_cast<void*>(sizeof(vec4) * 8));
+    glEnableVertexAttribArray(10);
+    glVertexAttribDivisor(10, 1);
+    glBindVertexArray(0);
+    m_jointData.reserve(K4ABT_JOINT_COUNT);
+
+    // Create draw command buffer
+    glGenBuffers(1, &m_skeletonCommandBO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_skeletonCommandBO);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(m_skeletonCommands), nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    m_multiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirectFunction>(
+        context->getProcAddress("glMultiDrawElementsIndirect"));
+
+    // Create joint buffer and the list of joints connected by each bone
+    glGenBuffers(1, &m_jointSSBO);
+    vector<uvec2> bones;
+    for (auto& bone : s_boneList) {
+        bones.emplace_back(static_cast<uint32_t>(bone.first), static_cast<uint32_t>(bone.second));
+    }
+    glGenBuffers(1, &m_boneSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_boneSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, static_cast<GLsizeiptr>(sizeof(uvec2) * bones.size()), bones.data(),
+        GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // Setup inverse resolution
+    glGenBuffers(1, &m_inverseResUBO);
+    vec2 inverseRes = 1.0f / vec2(1280.0f, 720.0f);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_inverseResUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(vec2), &inverseRes, GL_STATIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 2, m_inverseResUBO);
+
+    // Create the viewProjection buffers
+    glGenBuffers(1, &m_cameraUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 1, m_cameraUBO);
+
+    // Create image space transform buffer
+    glGenBuffers(1, &m_transformUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_transformUBO);
+
+    // Create image resolution buffer
+    glGenBuffers(1, &m_imageUBO);
+    glBindBufferBase(GL_UNIFORM_BUFFER, 3, m_imageUBO);
+
+    // Create frame timing queries
+    for (auto& i : m_timerFrames) {
+        glGenQueries(static_cast<GLsizei>(i.m_queries.size()), i.m_queries.data());
+    }
+
+    // Bind defaults to prevent potential contamination
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // Load shaders
+    GLuint vertexShader;
+    if (!loadShader(vertexShader, GL_VERTEX_SHADER, (GLchar*)QResource(":/AzureKinect/FullScreenQuad.vert").data())) {
+        return false;
+    }
+    GLuint fragmentShader;
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/DepthImage.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_depthProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+    glDeleteShader(fragmentShader);
+
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/ColourImage.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_colourProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+    glDeleteShader(fragmentShader);
+
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/IRImage.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_irProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+    glDeleteShader(fragmentShader);
+
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/ShadowImage.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_shadowProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+    glDeleteShader(fragmentShader);
+
+    if (!loadShader(
+            fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/TimingOverlay.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_timingProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+
+    // Clean up unneeded shaders
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    if (!loadShader(vertexShader, GL_VERTEX_SHADER, (GLchar*)QResource(":/AzureKinect/Skeleton.vert").data())) {
+        return false;
+    }
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/Skeleton.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_skeletonProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+
+    // Clean up unneeded shaders
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+
+    GLuint computeShader;
+    if (!loadShader(computeShader, GL_COMPUTE_SHADER, (GLchar*)QResource(":/AzureKinect/Skeleton.comp").data())) {
+        return false;
+    }
+    if (!loadShaders(m_skeletonComputeProgram, computeShader)) {
+        return false;
+    }
+    glDeleteShader(computeShader);
+
+    if (!loadShader(vertexShader, GL_VERTEX_SHADER, (GLchar*)QResource(":/AzureKinect/PointCloud.vert").data())) {
+        return false;
+    }
+    if (!loadShader(fragmentShader, GL_FRAGMENT_SHADER, (GLchar*)QResource(":/AzureKinect/PointCloud.frag").data())) {
+        return false;
+    }
+    if (!loadShaders(m_pointCloudProgram, vertexShader, fragmentShader)) {
+        return false;
+    }
+
+    // Clean up unneeded shaders
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    return true;
+}
+
+void KinectRenderer::resize(const int width, const int height) noexcept
+{
+    m_targetWidth = width;
+    m_targetHeight = height;
+
+    // Keep the viewport at a fixed 16:9 ratio for colour and (10/9 for depth/ir), point clouds fill the target
+    int32_t newWidth = width, newHeight = height;
+    if (!m_pointCloud) {
+        const uint32_t widthRatio = m_colourImage ? 16 : 10;
+        constexpr uint32_t heightRatio = 9;
+        do {
+            const int32_t widthScale = ((newHeight * widthRatio) / heightRatio);
+            const int32_t heightScale = ((newWidth * heightRatio) / widthRatio);
+            const int32_t widthOffset = heightScale >= newHeight ? widthScale : newWidth;
+            const int32_t heightOffset = widthScale >= newWidth ? heightScale : newHeight;
+            newWidth = widthOffset;
+            newHeight = heightOffset;
+        } while (newWidth * heightRatio - newHeight * widthRatio != 0);
+    }
+    m_viewportX = (width - newWidth) / 2;
+    m_viewportY = (height - newHeight) / 2;
+    m_viewportW = newWidth;
+    m_viewportH = newHeight;
+
+    // Update inverse resolution
+    struct ResolutionBuffer
+    {
+        vec2 m_inverseRes;
+        vec2 m_windowsOffset;
+    };
+    ResolutionBuffer resBuffer = {
+        1.0f / vec2(static_cast<float>(m_viewportW), static_cast<float>(m_viewportH)), vec2(m_viewportX, m_viewportY)};
+    glBindBuffer(GL_UNIFORM_BUFFER, m_inverseResUBO);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ResolutionBuffer), &resBuffer, GL_STATIC_DRAW);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    // The point cloud projection depends on the aspect ratio of the target
+    if (m_pointCloud) {
+        updateCamera();
+    }
+}
+
+void KinectRenderer::render() noexcept
+{
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Set correct viewport as it may have been changed by the render target
+    glViewport(m_viewportX, m_viewportY, m_viewportW, m_viewportH);
+
+    glDisable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    beginTimer(TimerPass::Image);
+    if (m_depthImage) {
+        // Render depth image
+        glUseProgram(m_depthProgram);
+        glBindVertexArray(m_quadVAO);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, nullptr);
+    } else if (m_colourImage) {
+        // Render colour image
+        glUseProgram(m_colourProgram);
+        glBindVertexArray(m_quadVAO);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, m_colourTexture);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, nullptr);
+    } else if (m_irImage) {
+        // Render IR image
+        glUseProgram(m_irProgram);
+        glBindVertexArray(m_quadVAO);
+        glActiveTexture(GL_TEXTURE3);
+        glBindTexture(GL_TEXTURE_2D, m_irTexture);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, nullptr);
+    } else if (m_pointCloud) {
+        // Render point cloud, every depth pixel is a vertex that is unprojected in the vertex shader
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+        glUseProgram(m_pointCloudProgram);
+        glUniformMatrix4fv(0, 1, GL_FALSE, &m_calibration.m_jointToColour[0][0]);
+        glUniform2ui(4, m_pointColour, m_bodyShadowImage);
+        glUniform1f(5, m_pointScale);
+        glBindVertexArray(m_pointVAO);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, m_colourTexture);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, m_shadowTexture);
+        glActiveTexture(GL_TEXTURE5);
+        glBindTexture(GL_TEXTURE_2D, m_xyTableTexture);
+        glDrawArrays(GL_POINTS, 0, m_calibration.m_depthDimensions.x * m_calibration.m_depthDimensions.y);
+    }
+    endTimer();
+
+    if (m_bodyShadowImage && !m_colourImage && !m_pointCloud) {
+        // Render body shadow (point clouds are tinted instead)
+        beginTimer(TimerPass::Shadow);
+        glEnable(GL_BLEND); // Enable blending
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(m_shadowProgram);
+        glBindVertexArray(m_quadVAO);
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, m_shadowTexture);
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, nullptr);
+        glDisable(GL_BLEND);
+        endTimer();
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+
+    if (m_bodySkeletonImage) {
+        // Render skeleton joints
+        glEnable(GL_BLEND); // Enable blending
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        const GLuint instances = m_skeletonCommands[0].m_instanceCount + m_skeletonCommands[1].m_instanceCount;
+        if (instances > 0) {
+            // Build the transforms for every joint and bone
+            beginTimer(TimerPass::SkeletonCompute);
+            glUseProgram(m_skeletonComputeProgram);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_jointSSBO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_boneSSBO);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_skeletonInstanceBO);
+            glUniform3ui(0, m_skeletonCommands[0].m_instanceCount, instances, K4ABT_JOINT_COUNT);
+            glDispatchCompute((instances + 63) / 64, 1, 1);
+            glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+            endTimer();
+
+            // Draw the spheres and cylinders together
+            beginTimer(TimerPass::SkeletonDraw);
+            glUseProgram(m_skeletonProgram);
+            glUniform1ui(0, m_pointCloud);
+            glBindVertexArray(m_skeletonVAO);
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_skeletonCommandBO);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, sizeof(m_skeletonCommands), m_skeletonCommands.data());
+            if (m_multiDrawElementsIndirect != nullptr) {
+                m_multiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr,
+                    static_cast<GLsizei>(m_skeletonCommands.size()), 0);
+            } else {
+                for (size_t i = 0; i < m_skeletonCommands.size(); ++i) {
+                    glDrawElementsIndirect(
+                        GL_TRIANGLES, GL_UNSIGNED_INT, reinterpret_cast<const void*>(sizeof(DrawCommand) * i));
+                }
+            }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            endTimer();
+            for (GLuint i = 0; i < 3; ++i) {
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+            }
+        }
+        glDisable(GL_BLEND);
+    }
+
+    if (m_timingOverlay) {
+        renderTimingOverlay();
+
+        // Move on to the next set of queries once this frame's have been issued
+        if (m_timerReady) {
+            m_timerFrame = (m_timerFrame + 1) % static_cast<uint32_t>(m_timerFrames.size());
+            m_timerReady = false;
+        }
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void KinectRenderer::setTimingOverlay(const bool show) noexcept
+{
+    m_timingOverlay = show;
+}
+
+void KinectRenderer::setCPUTimings(const float updateTime, const float paintTime, const float latency) noexcept
+{
+    // Smooth the same as the GPU timings so that the bars are readable
+    const array<float, 3> timings = {updateTime, paintTime, latency};
+    for (size_t i = 0; i < timings.size(); ++i) {
+        m_timings[s_timerPasses + i] += (timings[i] - m_timings[s_timerPasses + i]) * 0.1f;
+    }
+}
+
+void KinectRenderer::beginTimer(const TimerPass pass) noexcept
+{
+    if (!m_timingOverlay) {
+        return;
+    }
+    if (!m_timerReady) {
+        readTimers();
+        if (!m_timerReady) {
+            return;
+        }
+    }
+    TimerFrame& frame = m_timerFrames[m_timerFrame];
+    const auto index = static_cast<size_t>(pass);
+    if (frame.m_issued[index]) {
+        // Only the first upload between renders is timed
+        return;
+    }
+    glBeginQuery(GL_TIME_ELAPSED, frame.m_queries[index]);
+    frame.m_issued[index] = true;
+    m_timerActive = true;
+}
+
+void KinectRenderer::endTimer() noexcept
+{
+    if (m_timerActive) {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_timerActive = false;
+    }
+}
+
+void KinectRenderer::readTimers() noexcept
+{
+    // Queries complete in order so if the last one issued is available then so are all the others. If it isn't then
+    // timing is skipped until it is, rather than waiting on the GPU.
+    TimerFrame& frame = m_timerFrames[m_timerFrame];
+    for (size_t i = frame.m_issued.size(); i-- > 0;) {
+        if (frame.m_issued[i]) {
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(frame.m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available == GL_FALSE) {
+                return;
+            }
+            break;
+        }
+    }
+    for (size_t i = 0; i < frame.m_issued.size(); ++i) {
+        if (frame.m_issued[i]) {
+            GLuint time = 0;
+            glGetQueryObjectuiv(frame.m_queries[i], GL_QUERY_RESULT, &time);
+            m_timings[i] += (static_cast<float>(time) / 1000000.0f - m_timings[i]) * 0.1f;
+            frame.m_issued[i] = false;
+        }
+    }
+    m_timerReady = true;
+}
+
+void KinectRenderer::renderTimingOverlay() noexcept
+{
+    // Draw the overlay using the screen quad restricted to the overlay area
+    constexpr GLint border = 8;
+    constexpr GLsizei overlayWidth = 256;
+    constexpr GLsizei overlayHeight = 8 * 12;
+    const GLint overlayY = std::max(m_targetHeight - border - overlayHeight, 0);
+    glViewport(border, overlayY, overlayWidth, overlayHeight);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(m_timingProgram);
+    glUniform4f(0, static_cast<GLfloat>(border), static_cast<GLfloat>(overlayY), 1.0f / overlayWidth,
+        1.0f / overlayHeight);
+    glUniform4fv(1, 2, m_timings.data());
+    glBindVertexArray(m_quadVAO);
+    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_BYTE, nullptr);
+    glDisable(GL_BLEND);
+    glEnable(GL_DEPTH_TEST);
+    glViewport(m_viewportX, m_viewportY, m_viewportW, m_viewportH);
+}
+
+bool KinectRenderer::initCapture(const uint32_t width, const uint32_t height, captureCallback callback) noexcept
+{
+    cleanupCapture();
+    m_captureWidth = static_cast<GLsizei>(width);
+    m_captureHeight = static_cast<GLsizei>(height);
+    m_captureCallback = move(callback);
+    m_droppedCaptures = 0;
+
+    // The composite is rendered into its own target and then flipped into a second one as OpenGL images are bottom up
+    glGenRenderbuffers(static_cast<GLsizei>(m_captureRenderbuffers.size()), m_captureRenderbuffers.data());
+    glBindRenderbuffer(GL_RENDERBUFFER, m_captureRenderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_captureWidth, m_captureHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_captureRenderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, m_captureWidth, m_captureHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_captureRenderbuffers[2]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, m_captureWidth, m_captureHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    glGenFramebuffers(1, &m_captureFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_captureFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_captureRenderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_captureRenderbuffers[1]);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glGenFramebuffers(1, &m_captureFlipFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_captureFlipFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_captureRenderbuffers[2]);
+    complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+    if (!complete) {
+        cleanupCapture();
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to create capture framebuffer"s);
+        }
+        return false;
+    }
+
+    // Each read back is written once by the GPU and then read once by the CPU
+    const auto size = static_cast<GLsizeiptr>(m_captureWidth) * m_captureHeight * 4;
+    for (auto& i : m_readBuffers) {
+        glGenBuffers(1, &i.m_buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, i.m_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    logHandler("Capture read back buffers: "s +=
+        to_string((static_cast<size_t>(size) * m_readBuffers.size() + 1048575) / 1048576) += " MB"s);
+    return true;
+}
+
+void KinectRenderer::cleanupCapture() noexcept
+{
+    // Pass on anything still being read back so that no captured frames are lost
+    processCaptures(true);
+    for (auto& i : m_readBuffers) {
+        glDeleteBuffers(1, &i.m_buffer);
+        i.m_buffer = 0;
+    }
+    glDeleteFramebuffers(1, &m_captureFramebuffer);
+    glDeleteFramebuffers(1, &m_captureFlipFramebuffer);
+    glDeleteRenderbuffers(static_cast<GLsizei>(m_captureRenderbuffers.size()), m_captureRenderbuffers.data());
+    m_captureFramebuffer = 0;
+    m_captureFlipFramebuffer = 0;
+    m_captureRenderbuffers.fill(0);
+    m_nextReadBuffer = 0;
+    m_captureWidth = 0;
+    m_captureHeight = 0;
+    m_captureCallback = nullptr;
+}
+
+void KinectRenderer::capture(const uint64_t time) noexcept
+{
+    if (m_captureFramebuffer == 0) {
+        return;
+    }
+
+    // Hand over completed captures first so that their buffers can be reused
+    processCaptures(false);
+    ReadBuffer& buffer = m_readBuffers[m_nextReadBuffer];
+    if (buffer.m_fence != nullptr) {
+        // Waiting here would stall the render thread so the frame is dropped instead
+        ++m_droppedCaptures;
+        return;
+    }
+
+    // Render at the capture resolution, this keeps the same aspect ratio handling as the display
+    GLint previousFramebuffer = 0;
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+    const int targetWidth = m_targetWidth;
+    const int targetHeight = m_targetHeight;
+    // The timing overlay is only for the display so is neither drawn nor timed
+    const bool timingOverlay = m_timingOverlay;
+    m_timingOverlay = false;
+    glBindFramebuffer(GL_FRAMEBUFFER, m_captureFramebuffer);
+    resize(m_captureWidth, m_captureHeight);
+    render();
+    resize(targetWidth, targetHeight);
+    m_timingOverlay = timingOverlay;
+
+    // Flip into top down order while copying so the image can be passed straight to an encoder
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_captureFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_captureFlipFramebuffer);
+    glBlitFramebuffer(0, 0, m_captureWidth, m_captureHeight, 0, m_captureHeight, m_captureWidth, 0,
+        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    // Read back into a pixel pack buffer, this returns immediately and the fence signals when the copy has completed
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_captureFlipFramebuffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.m_buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_captureWidth, m_captureHeight, GL_BGRA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    buffer.m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffer.m_time = time;
+    m_nextReadBuffer = (m_nextReadBuffer + 1) % static_cast<uint32_t>(m_readBuffers.size());
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(previousFramebuffer));
+}
+
+bool KinectRenderer::isCapturing() const noexcept
+{
+    return m_captureFramebuffer != 0;
+}
+
+uint64_t KinectRenderer::getDroppedCaptures() const noexcept
+{
+    return m_droppedCaptures;
+}
+
+void KinectRenderer::processCaptures(const bool wait) noexcept
+{
+    // The oldest outstanding read back is the next one in the ring to be reused
+    const auto size = static_cast<GLsizeiptr>(m_captureWidth) * m_captureHeight * 4;
+    for (size_t i = 0; i < m_readBuffers.size(); ++i) {
+        ReadBuffer& buffer = m_readBuffers[(m_nextReadBuffer + i) % m_readBuffers.size()];
+        if (buffer.m_fence == nullptr) {
+            continue;
+        }
+        const GLenum status =
+            glClientWaitSync(buffer.m_fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            // Later read backs can't have completed either, captures must also be passed on in order
+            break;
+        }
+        glDeleteSync(buffer.m_fence);
+        buffer.m_fence = nullptr;
+        if (status == GL_WAIT_FAILED) {
+            continue;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.m_buffer);
+        auto* data = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT));
+        if (data != nullptr) {
+            if (m_captureCallback != nullptr) {
+                m_captureCallback(
+                    buffer.m_time, KinectImage(data, m_captureWidth, m_captureHeight, m_captureWidth * 4));
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+void KinectRenderer::createXYTable() noexcept
+{
+    // Each depth pixel is unprojected once per calibration so the point cloud only needs a multiply by depth per point
+    const BrownConradyTransform& transform = m_calibration.m_depthBC;
+    const auto distort = [&transform](const vec2& point) {
+        const vec2 p2 = point * point;
+        const float xyp = point.x * point.y;
+        const float rs = p2.x + p2.y;
+        const float rss = rs * rs;
+        const float rsc = rss * rs;
+        const vec2 ab = 1.0f + transform.m_k14 * rs + transform.m_k25 * rss + transform.m_k36 * rsc;
+        const float d = ab.x * ((ab.y != 0.0f) ? 1.0f / ab.y : 1.0f);
+        return point * d + (rs + 2.0f * p2) * vec2(transform.m_p.y, transform.m_p.x) + 2.0f * xyp * transform.m_p;
+    };
+
+    const ivec2 dimensions = m_calibration.m_depthDimensions;
+    vector<vec2> table(static_cast<size_t>(dimensions.x) * dimensions.y);
+    auto pointer = table.begin();
+    for (int32_t y = 0; y < dimensions.y; ++y) {
+        for (int32_t x = 0; x < dimensions.x; ++x, ++pointer) {
+            // Invert the distortion by fixed point iteration starting from the distorted position
+            const vec2 distorted = (vec2(x, y) - transform.m_c) / transform.m_f;
+            vec2 point = distorted;
+            for (uint32_t i = 0; i < 20; ++i) {
+                point += distorted - distort(point);
+            }
+
+            // Pixels that don't converge (outside the valid lens area) are not drawn
+            const vec2 error = (distort(point) - distorted) * transform.m_f;
+            *pointer = dot(error, error) < 0.25f ? point : vec2(numeric_limits<float>::quiet_NaN());
+        }
+    }
+
+    glDeleteTextures(1, &m_xyTableTexture);
+    m_xyTableTexture = 0;
+    if (table.empty()) {
+        return;
+    }
+    glGenTextures(1, &m_xyTableTexture);
+    glBindTexture(GL_TEXTURE_2D, m_xyTableTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32F, dimensions.x, dimensions.y);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dimensions.x, dimensions.y, GL_RG, GL_FLOAT, table.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void KinectRenderer::createTextures() noexcept
+{
+    // Create depth texture
+    glGenTextures(1, &m_depthTexture);
+    glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Create colour texture
+    glGenTextures(1, &m_colourTexture);
+    glBindTexture(GL_TEXTURE_2D, m_colourTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+
+    // Create IR texture
+    glGenTextures(1, &m_irTexture);
+    glBindTexture(GL_TEXTURE_2D, m_irTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    // Create shadow texture
+    glGenTextures(1, &m_shadowTexture);
+    glBindTexture(GL_TEXTURE_2D, m_shadowTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void KinectRenderer::cleanup() noexcept
+{
+    // Free all resources
+    cleanupCapture();
+    glDeleteProgram(m_depthProgram);
+    glDeleteProgram(m_colourProgram);
+    glDeleteProgram(m_irProgram);
+    glDeleteProgram(m_shadowProgram);
+    glDeleteProgram(m_skeletonProgram);
+    glDeleteProgram(m_skeletonComputeProgram);
+    glDeleteProgram(m_timingProgram);
+    glDeleteProgram(m_pointCloudProgram);
+
+    glDeleteBuffers(1, &m_quadVBO);
+    glDeleteBuffers(1, &m_quadIBO);
+    glDeleteVertexArrays(1, &m_quadVAO);
+
+    glDeleteTextures(1, &m_depthTexture);
+    glDeleteTextures(1, &m_colourTexture);
+    glDeleteTextures(1, &m_irTexture);
+    glDeleteTextures(1, &m_shadowTexture);
+    glDeleteTextures(1, &m_xyTableTexture);
+    m_xyTableTexture = 0;
+    glDeleteVertexArrays(1, &m_pointVAO);
+
+    glDeleteBuffers(1, &m_skeletonVBO);
+    glDeleteBuffers(1, &m_skeletonIBO);
+    glDeleteVertexArrays(1, &m_skeletonVAO);
+    glDeleteBuffers(1, &m_skeletonInstanceBO);
+    glDeleteBuffers(1, &m_skeletonCommandBO);
+    glDeleteBuffers(1, &m_jointSSBO);
+    glDeleteBuffers(1, &m_boneSSBO);
+    m_skeletonInstances = 0;
+
+    glDeleteBuffers(1, &m_inverseResUBO);
+    glDeleteBuffers(1, &m_cameraUBO);
+    glDeleteBuffers(1, &m_transformUBO);
+    glDeleteBuffers(1, &m_imageUBO);
+
+    if (m_timerActive) {
+        glEndQuery(GL_TIME_ELAPSED);
+        m_timerActive = false;
+    }
+    for (auto& i : m_timerFrames) {
+        glDeleteQueries(static_cast<GLsizei>(i.m_queries.size()), i.m_queries.data());
+        i.m_queries.fill(0);
+        i.m_issued.fill(false);
+    }
+    m_timerReady = false;
+
+    m_pixelBufferSize = 0;
+    for (auto& i : m_pixelBuffers) {
+        if (i.m_fence != nullptr) {
+            glDeleteSync(i.m_fence);
+            i.m_fence = nullptr;
+        }
+        allocatePixelBuffer(i);
+    }
+}
+
+void KinectRenderer::allocatePixelBuffer(PixelBuffer& buffer) noexcept
+{
+    if (buffer.m_buffer != 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.m_buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &buffer.m_buffer);
+        buffer.m_buffer = 0;
+        buffer.m_data = nullptr;
+        buffer.m_size = 0;
+    }
+    if (m_bufferStorage == nullptr || m_pixelBufferSize == 0) {
+        return;
+    }
+
+    // Coherent mapping makes data written by the data thread visible without needing an explicit flush
+    constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &buffer.m_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.m_buffer);
+    m_bufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(m_pixelBufferSize), nullptr, flags);
+    buffer.m_data = static_cast<uint8_t*>(
+        glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, static_cast<GLsizeiptr>(m_pixelBufferSize), flags));
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    if (buffer.m_data != nullptr) {
+        buffer.m_size = m_pixelBufferSize;
+    }
+}
+
+void KinectRenderer::reclaimPixelBuffers() noexcept
+{
+    for (auto& i : m_pixelBuffers) {
+        if (i.m_state.load(memory_order_acquire) != PixelBufferState::Uploading) {
+            continue;
+        }
+        if (i.m_fence != nullptr) {
+            const GLenum status = glClientWaitSync(i.m_fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                continue;
+            }
+            glDeleteSync(i.m_fence);
+            i.m_fence = nullptr;
+        }
+        if (i.m_size != m_pixelBufferSize) {
+            allocatePixelBuffer(i);
+        }
+        i.m_state.store(PixelBufferState::Free, memory_order_release);
+    }
+}
+
+void KinectRenderer::updatePixelBufferSize() noexcept
+{
+    // This must match the layout written by the data thread. Point clouds store the colour image after the depth
+    // image, and the shadow image follows the image(s). The shadow is always allowed for so toggling it doesn't
+    // reallocate.
+    const size_t depthSize = static_cast<size_t>(m_calibration.m_depthDimensions.x) * m_calibration.m_depthDimensions.y;
+    const size_t colourSize =
+        static_cast<size_t>(m_calibration.m_colourDimensions.x) * m_calibration.m_colourDimensions.y * 4;
+    const size_t irSize = static_cast<size_t>(m_calibration.m_irDimensions.x) * m_calibration.m_irDimensions.y * 2;
+    size_t imageSize = 0;
+    if (m_pointCloud) {
+        imageSize = getShadowOffset(depthSize * 2) + colourSize;
+    } else if (m_depthImage) {
+        imageSize = depthSize * 2;
+    } else if (m_colourImage) {
+        imageSize = colourSize;
+    } else if (m_irImage) {
+        imageSize = irSize;
+    }
+    const size_t size = getShadowOffset(imageSize) + depthSize;
+    if (size == m_pixelBufferSize) {
+        return;
+    }
+    m_pixelBufferSize = size;
+    if (m_bufferStorage != nullptr) {
+        logHandler("Display pixel buffers: "s +=
+            to_string((m_pixelBufferSize * m_pixelBuffers.size() + 1048575) / 1048576) += " MB"s);
+    }
+    for (auto& i : m_pixelBuffers) {
+        auto expected = PixelBufferState::Free;
+        (void)i.m_state.compare_exchange_strong(expected, PixelBufferState::Uploading, memory_order_acquire);
+    }
+    reclaimPixelBuffers();
+}
+
+void KinectRenderer::releasePixelBuffer(const uint8_t* data) noexcept
+{
+    if (data == nullptr) {
+        return;
+    }
+    // Only a buffer that is being written to is owned by the data thread, all others may be reallocated at any time
+    for (auto& i : m_pixelBuffers) {
+        if (i.m_state.load(memory_order_acquire) == PixelBufferState::Writing && data >= i.m_data &&
+            data < i.m_data + i.m_size) {
+            i.m_state.store(PixelBufferState::Free, memory_order_release);
+            return;
+        }
+    }
+}
+
+KinectRenderer::PixelBuffer* KinectRenderer::findPixelBuffer(const uint8_t* data) noexcept
+{
+    if (data == nullptr) {
+        return nullptr;
+    }
+    for (auto& i : m_pixelBuffers) {
+        if (i.m_data != nullptr && data >= i.m_data && data < i.m_data + i.m_size) {
+            return &i;
+        }
+    }
+    return nullptr;
+}
+
+bool KinectRenderer::uploadImage(const GLuint texture, const ivec2& dimensions, const KinectImage& image,
+    const GLenum format, const GLenum type, const int32_t pixelSize) noexcept
+{
+    if (image.m_image == nullptr || image.m_width != dimensions.x || image.m_height != dimensions.y ||
+        image.m_stride < image.m_width * pixelSize) {
+        return false;
+    }
+
+    // Data in a pixel buffer is passed as an offset so that the upload is a DMA transfer that doesn't block
+    const PixelBuffer* buffer = findPixelBuffer(image.m_image);
+    if (buffer != nullptr &&
+        static_cast<size_t>(image.m_image - buffer->m_data) + static_cast<size_t>(image.m_height) * image.m_stride >
+            buffer->m_size) {
+        return false;
+    }
+    auto data = reinterpret_cast<const GLvoid*>(image.m_image);
+    if (buffer != nullptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer->m_buffer);
+        data = reinterpret_cast<const GLvoid*>(image.m_image - buffer->m_data);
+    }
+    if (image.m_stride / pixelSize != image.m_width) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, image.m_stride / pixelSize);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.m_width, image.m_height, format, type, data);
+    if (image.m_stride / pixelSize != image.m_width) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (buffer != nullptr) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    return true;
+}
+
+bool KinectRenderer::loadShader(GLuint& shader, const GLenum shaderType, const GLchar* shaderCode) noexcept
+{
+    // Build and link the shader program
+    shader = glCreateShader(shaderType);
+    glShaderSource(shader, 1, &shaderCode, nullptr);
+    glCompileShader(shader);
+
+    // Check for errors
+    GLint testReturn;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &testReturn);
+    if (testReturn == GL_FALSE) {
+        GLchar infolog[1024];
+        int32_t errorLength;
+        glGetShaderInfoLog(shader, 1024, &errorLength, infolog);
+        if (m_errorCallback != nullptr) {
+            m_errorCallback(("Failed to compile shader: "s += infolog) += shaderCode);
+        }
+        glDeleteShader(shader);
+        return false;
+    }
+    return true;
+}
+
+bool KinectRenderer::loadShaders(GLuint& shader, const GLuint vertexShader, const GLuint fragmentShader) noexcept
+{
+    // Link the shaders
+    shader = glCreateProgram();
+    glAttachShader(shader, vertexShader);
+    glAttachShader(shader, fragmentShader);
+    glLinkProgram(shader);
+    return checkProgram(shader);
+}
+
+bool KinectRenderer::loadShaders(GLuint& shader, const GLuint computeShader) noexcept
+{
+    // Link the shader
+    shader = glCreateProgram();
+    glAttachShader(shader, computeShader);
+    glLinkProgram(shader);
+    return checkProgram(shader);
+}
+
+bool KinectRenderer::checkProgram(const GLuint shader) noexcept
+{
+    // Check for error in link
+    GLint testReturn;
+    glGetProgramiv(shader, GL_LINK_STATUS, &testReturn);
+    if (testReturn == GL_FALSE) {
+        GLchar infolog[1024];
+        int32_t errorLength;
+        glGetShaderInfoLog(shader, 1024, &errorLength, infolog);
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to link shaders: "s += infolog);
+        }
+        glDeleteProgram(shader);
+        return false;
+    }
+    return true;
+}
+
+GLsizei KinectRenderer::generateSphere(const uint32_t tessU, const uint32_t tessV, vector<CustomVertex>& vertexBuffer,
+    vector<GLuint>& indexBuffer) noexcept
+{
+    // Init params
+    const float dPhi = static_cast<float>(M_PI) / static_cast<float>(tessV);
+    const float dTheta = static_cast<float>(M_PI + M_PI) / static_cast<float>(tessU);
+
+    // Determine required parameters
+    const uint32_t numVertices = (tessU * (tessV - 1)) + 2;
+    const uint32_t numIndices = (tessU * 6) + (tessU * (tessV - 2) * 6);
+
+    // Append the new primitive
+    vertexBuffer.reserve(vertexBuffer.size() + numVertices);
+    indexBuffer.reserve(indexBuffer.size() + numIndices);
+
+    // Set the top vertex
+    vertexBuffer.emplace_back(vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+    float phi = dPhi;
+    for (uint32_t i = 0; i < tessV - 1; i++) {
+        // Calculate initial value
+        const float rSinPhi = sinf(phi);
+        const float rCosPhi = cosf(phi);
+
+        const float y = rCosPhi;
+
+        float theta = 0.0f;
+        for (uint32_t j = 0; j < tessU; j++) {
+            // Calculate positions
+            const float cosTheta = cosf(theta);
+            const float sinTheta = sinf(theta);
+
+            // Determine position
+            const float x = rSinPhi * cosTheta;
+            const float z = rSinPhi * sinTheta;
+
+            // Create vertex
+            vertexBuffer.emplace_back(vec3(x, y, z), vec3(x, y, z));
+            theta += dTheta;
+        }
+        phi += dPhi;
+    }
+
+    // Set the bottom vertex
+    vertexBuffer.emplace_back(vec3(0.0f, -1.0f, 0.0f), vec3(0.0f, -1.0f, 0.0f));
+
+    // Create top
+    for (GLuint j = 1; j <= tessU; j++) {
+        // Top triangles all share same vertex point at pos 0
+        indexBuffer.emplace_back(0);
+        // Loop back to start if required
+        indexBuffer.emplace_back(((j + 1) > tessU) ? 1 : j + 1);
+        indexBuffer.emplace_back(j);
+    }
+
+    // Create inner triangles
+    for (GLuint i = 0; i < tessV - 2; i++) {
+        for (GLuint j = 1; j <= tessU; j++) {
+            // Create indexes for each quad face (pair of triangles)
+            indexBuffer.emplace_back(j + (i * tessU));
+            // Loop back to start if required
+            const GLuint index = ((j + 1) > tessU) ? 1 : j + 1;
+            indexBuffer.emplace_back(index + (i * tessU));
+            indexBuffer.emplace_back(j + ((i + 1) * tessU));
+
+            indexBuffer.emplace_back(*(indexBuffer.end() - 2));
+            // Loop back to start if required
+            indexBuffer.emplace_back(index + ((i + 1) * tessU));
+            indexBuffer.emplace_back(*(indexBuffer.end() - 3));
+        }
+    }
+
+    // Create bottom
+    for (GLuint j = 1; j <= tessU; j++) {
+        // Bottom triangles all share same vertex point at pos numVertices - 1
+        indexBuffer.emplace_back(j + ((tessV - 2) * tessU));
+        // Loop back to start if required
+        const GLuint index = ((j + 1) > tessU) ? 1 : j + 1;
+        indexBuffer.emplace_back(index + ((tessV - 2) * tessU));
+        indexBuffer.emplace_back(numVertices - 1);
+    }
+
+    return numIndices;
+}
+
+GLsizei KinectRenderer::generateCylinder(
+    const uint32_t tessU, vector<CustomVertex>& vertexBuffer, vector<GLuint>& indexBuffer) noexcept
+{
+    // Init params
+    const float dTheta = static_cast<float>(M_PI + M_PI) / static_cast<float>(tessU);
+
+    // Determine required parameters
+    const uint32_t numVertices = tessU * 4 + 2;
+    const uint32_t numIndices = (tessU * 6) + (tessU * 6);
+
+    // Append the new primitive
+    vertexBuffer.reserve(vertexBuffer.size() + numVertices);
+    indexBuffer.reserve(indexBuffer.size() + numIndices);
+
+    // Set the top vertex
+    vertexBuffer.emplace_back(CustomVertex{vec3(0.0f, 0.0f, -0.5f), vec3(0.0f, 0.0f, -1.0f)});
+
+    // Create top ring
+    float theta = 0.0f;
+    for (uint32_t j = 0; j < tessU; j++) {
+        // Calculate positions
+        const float cosTheta = cosf(theta);
+        const float sinTheta = sinf(theta);
+
+        // Determine position
+        const float x = cosTheta;
+        const float y = sinTheta;
+
+        // Create vertex
+        vertexBuffer.emplace_back(CustomVertex{vec3(x, y, -0.5f), vec3(0.0f, 0.0f, -1.0f)});
+        theta += dTheta;
+    }
+
+    // Create inner rings
+    float z = -0.5f;
+    for (uint32_t i = 0; i < 2; i++) {
+        theta = 0.0f;
+        for (uint32_t j = 0; j < tessU; j++) {
+            // Calculate positions
+            const float cosTheta = cosf(theta);
+            const float sinTheta = sinf(theta);
+
+            // Determine position
+            const float x = cosTheta;
+            const float y = sinTheta;
+
+            // Create vertex
+            vertexBuffer.emplace_back(CustomVertex{vec3(x, y, z), normalize(vec3(x, y, 0.0f))});
+            theta += dTheta;
+        }
+        z = 0.5f;
+    }
+
+    // Create bottom ring
+    theta = 0.0f;
+    for (uint32_t j = 0; j < tessU; j++) {
+        // Calculate positions
+        const float cosTheta = cosf(theta);
+        const float sinTheta = sinf(theta);
+
+        // Determine position
+        const float x = cosTheta;
+        const float y = sinTheta;
+
+        // Create vertex
+        vertexBuffer.emplace_back(CustomVertex{vec3(x, y, 0.5f), vec3(0.0f, 0.0f, 1.0f)});
+        theta += dTheta;
+    }
+
+    // Set the bottom vertex
+    vertexBuffer.emplace_back(CustomVertex{vec3(0.0f, 0.0f, 0.5f), vec3(0.0f, 0.0f, 1.0f)});
+
+    // Create top
+    for (GLuint j = 1; j <= tessU; j++) {
+        // Top triangles all share same vertex point at pos 0
+        indexBuffer.emplace_back(0);
+        // Loop back to start if required
+        indexBuffer.emplace_back(((j + 1) > tessU) ? 1 : j + 1);
+        indexBuffer.emplace_back(j);
+    }
+
+    // Create inner triangles
+    for (GLuint j = 1; j <= tessU; j++) {
+        // Create indexes for each quad face (pair of triangles)
+        indexBuffer.emplace_back(j + (tessU));
+        // Loop back to start if required
+        const GLuint index = ((j + 1) > tessU) ? 1 : j + 1;
+        indexBuffer.emplace_back(index + (tessU));
+        indexBuffer.emplace_back(j + (2 * tessU));
+
+        indexBuffer.emplace_back(*(indexBuffer.end() - 2));
+        // Loop back to start if required
+        indexBuffer.emplace_back(index + (2 * tessU));
+        indexBuffer.emplace_back(*(indexBuffer.end() - 3));
+    }
+
+    // Create bottom
+    for (GLuint j = 1; j <= tessU; j++) {
+        // Bottom triangles all share same vertex point at pos numVertices - 1
+        indexBuffer.emplace_back(j + (3 * tessU));
+        // Loop back to start if required
+        const GLuint index = ((j + 1) > tessU) ? 1 : j + 1;
+        indexBuffer.emplace_back(index + (3 * tessU));
+        indexBuffer.emplace_back(numVertices - 1);
+    }
+
+    return numIndices;
+}
+} // namespace Ak
@@ -0,0 +1,162 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "OffscreenRenderer.h"
+
+#include <QSurfaceFormat>
+#include <chrono>
+
+using namespace std;
+
+namespace Ak {
+OffscreenRenderer::~OffscreenRenderer() noexcept
+{
+    cleanup();
+}
+
+bool OffscreenRenderer::init(const uint32_t width, const uint32_t height, errorCallback error) noexcept
+{
+    cleanup();
+    m_errorCallback = move(error);
+
+    // The renderer requires at least the same context version as the widget
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    if (format.version() < qMakePair(4, 3)) {
+        format.setVersion(4, 3);
+    }
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    m_context = make_unique<QOpenGLContext>();
+    m_context->setFormat(format);
+    if (!m_context->create()) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to create OpenGL context"s);
+        }
+        cleanup();
+        return false;
+    }
+    m_surface = make_unique<QOffscreenSurface>();
+    m_surface->setFormat(m_context->format());
+    m_surface->create();
+    if (!m_surface->isValid() || !m_context->makeCurrent(m_surface.get())) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to create offscreen surface"s);
+        }
+        cleanup();
+        return false;
+    }
+
+    // Render into a framebuffer object as the offscreen surface may not have a default framebuffer
+    m_framebuffer = make_unique<QOpenGLFramebufferObject>(
+        static_cast<int>(width), static_cast<int>(height), QOpenGLFramebufferObject::Depth);
+    if (!m_framebuffer->isValid()) {
+        if (m_errorCallback != nullptr) {
+            m_errorCallback("Failed to create framebuffer object"s);
+        }
+        cleanup();
+        return false;
+    }
+    m_rendererInit = true;
+    if (!m_renderer.init(m_errorCallback)) {
+        cleanup();
+        return false;
+    }
+    m_renderer.resize(static_cast<int>(width), static_cast<int>(height));
+    m_context->doneCurrent();
+    m_renderTime = 0;
+    m_uploadTime = 0;
+    m_renderFrames = 0;
+    return true;
+}
+
+void OffscreenRenderer::setRenderOptions(const bool depthImage, const bool colourImage, const bool irImage,
+    const bool pointCloud, const bool bodyShadow, const bool bodySkeleton) noexcept
+{
+    m_renderer.setRenderOptions(depthImage, colourImage, irImage, pointCloud, bodyShadow, bodySkeleton);
+    if (m_context != nullptr && m_context->makeCurrent(m_surface.get())) {
+        m_renderer.refreshRender();
+        m_context->doneCurrent();
+    }
+}
+
+void OffscreenRenderer::updateCalibration(const KinectCalibration& calibration) noexcept
+{
+    m_renderer.setCalibration(calibration);
+    if (m_context != nullptr && m_context->makeCurrent(m_surface.get())) {
+        m_renderer.refreshCalibration();
+        m_renderer.refreshRender();
+        m_context->doneCurrent();
+    }
+}
+
+QImage OffscreenRenderer::render(const KinectImage& depthImage, const KinectImage& colourImage,
+    const KinectImage& irImage, const KinectImage& shadowImage, const KinectJoints& joints) noexcept
+{
+    if (m_context == nullptr || !m_context->makeCurrent(m_surface.get())) {
+        return QImage();
+    }
+    const auto startTime = chrono::steady_clock::now();
+    m_renderer.uploadData(depthImage, colourImage, irImage, shadowImage, joints);
+    m_uploadTime += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count();
+    m_framebuffer->bind();
+    m_renderer.render();
+    m_framebuffer->release();
+
+    // Reading back waits for rendering to complete so the measured time includes the GPU
+    QImage image = m_framebuffer->toImage();
+    m_context->doneCurrent();
+    m_renderTime += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - startTime).count();
+    ++m_renderFrames;
+    return image;
+}
+
+int64_t OffscreenRenderer::getRenderTime() const noexcept
+{
+    return m_renderFrames > 0 ? m_renderTime / m_renderFrames : 0;
+}
+
+int64_t OffscreenRenderer::getUploadTime() const noexcept
+{
+    return m_renderFrames > 0 ? m_uploadTime / m_renderFrames : 0;
+}
+
+void OffscreenRenderer::resetRenderTime() noexcept
+{
+    m_renderTime = 0;
+    m_uploadTime = 0;
+    m_renderFrames = 0;
+}
+
+uint8_t* OffscreenRenderer::acquirePixelBuffer(const size_t size) noexcept
+{
+    return m_renderer.acquirePixelBuffer(size);
+}
+
+void OffscreenRenderer::cleanup() noexcept
+{
+    // Resources must be freed with the context current
+    if (m_context != nullptr && m_surface != nullptr && m_context->makeCurrent(m_surface.get())) {
+        if (m_rendererInit) {
+            m_renderer.cleanup();
+        }
+        m_framebuffer.reset();
+        m_context->doneCurrent();
+    }
+    m_rendererInit = false;
+    m_framebuffer.reset();
+    m_surface.reset();
+    m_context.reset();
+}
+} // namespace Ak
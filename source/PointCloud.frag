@@ -0,0 +1,10 @@
+﻿#version 430 core
+
+layout(location = 0) in vec3 colourIn;
+
+out vec3 fragOutput;
+
+void main()
+{
+    fragOutput = colourIn;
+}
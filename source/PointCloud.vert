@@ -0,0 +1,83 @@
+﻿#version 430 core
+
+layout(binding = 0) uniform TransformData {
+    vec2 c;
+    vec2 f;
+    vec2 k14;
+    vec2 k25;
+    vec2 k36;
+    vec2 p;
+};
+
+layout(binding = 1) uniform CameraData {
+    mat4 viewProjection;
+    mat4 jointTransform;
+};
+
+layout(binding = 3) uniform ImageResolution {
+    vec2 invResolution;
+};
+
+layout(binding = 1) uniform sampler2D depthTexture;
+layout(binding = 2) uniform sampler2D colourTexture;
+layout(binding = 4) uniform sampler2D shadowTexture;
+layout(binding = 5) uniform sampler2D xyTable;
+
+layout(location = 0) uniform mat4 depthToColour;
+layout(location = 4) uniform uvec2 options; // Colour from the colour image, tint body points
+layout(location = 5) uniform float pointScale;
+
+layout(location = 0) out vec3 colourOut;
+
+void main()
+{
+    // Each vertex is a depth pixel
+    ivec2 size = textureSize(depthTexture, 0);
+    ivec2 pixel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+
+    // Depth is stored in mm as a uint16 which has been converted to 0->1 range
+    float depth = texelFetch(depthTexture, pixel, 0).r * 65.535f;
+    vec2 xy = texelFetch(xyTable, pixel, 0).rg;
+
+    // Invalid pixels are discarded by placing them outside the clip volume
+    if (depth <= 0.0f || isnan(xy.x)) {
+        gl_Position = vec4(0.0f, 0.0f, 2.0f, 1.0f);
+        return;
+    }
+
+    // Unproject into the depth camera space (metres)
+    vec4 position = vec4(xy * depth, depth, 1.0f);
+    gl_Position = viewProjection * position;
+    gl_PointSize = clamp(pointScale * depth / gl_Position.w, 1.0f, 8.0f);
+
+    // Shade by distance unless the colour image can be sampled
+    vec3 colour = vec3(1.0f - clamp((depth - 0.5f) / 4.0f, 0.0f, 0.8f));
+    if (options.x != 0) {
+        // Transform position to colour image space using brown conrady
+        vec4 colourPos = depthToColour * position;
+        if (colourPos.z > 0.0f) {
+            vec2 pxy = colourPos.xy / colourPos.z;
+            vec2 p2 = pxy * pxy;
+            float xyp = pxy.x * pxy.y;
+            float rs = p2.x + p2.y;
+            float rss = rs * rs;
+            float rsc = rss * rs;
+            vec2 ab = 1.0f + k14 * rs + k25 * rss + k36 * rsc;
+            float bi = (ab.y != 0.0f) ? 1.0f / ab.y : 1.0f;
+            float d = ab.x * bi;
+            vec2 p_d = pxy * d;
+            vec2 rs_2p2 = rs + 2.0f * p2;
+            p_d += rs_2p2 * p.yx + 2.0f * xyp * p;
+            vec2 uv = (p_d * f + c + 0.5f) * invResolution;
+            if (all(greaterThanEqual(uv, vec2(0.0f))) && all(lessThan(uv, vec2(1.0f)))) {
+                colour = textureLod(colourTexture, uv, 0.0f).rgb;
+            }
+        }
+    }
+
+    // Tint points that belong to a body
+    if (options.y != 0 && texelFetch(shadowTexture, pixel, 0).r > 0.5f) {
+        colour = mix(colour, vec3(0.0f, 1.0f, 0.0f), 0.3f);
+    }
+    colourOut = colour;
+}
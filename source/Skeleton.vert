@@ -11,12 +11,15 @@ layout(binding = 0) uniform TransformData {
 
 layout(binding = 1) uniform CameraData {
     mat4 viewProjection;
+    mat4 jointTransform;
 };
 
 layout(binding = 3) uniform ImageResolution {
     vec2 invResolution;
 };
 
+layout(location = 0) uniform uint orbitView; // Project in 3D (point cloud view) instead of onto the image
+
 layout(location = 0) in vec3 vertexPos;
 layout(location = 1) in vec3 normal;
 layout(location = 2) in mat4 transform;
@@ -29,9 +32,24 @@ layout(location = 2) out float confidenceOut;
 
 void main()
 {
+    // Bones with an untracked joint are discarded by placing them outside the clip volume
+    if (confidence < 0.0f) {
+        gl_Position = vec4(0.0f, 0.0f, 2.0f, 1.0f);
+        return;
+    }
+
     // Transform to model space
     vec4 position = transform * vec4(vertexPos, 1.0f);
 
+    // Pass through the lighting inputs and confidence
+    normalOut = (transformIT * vec4(normal, 0.0f)).xyz;
+    positionOut = position.xyz;
+    confidenceOut = confidence;
+    if (orbitView != 0) {
+        gl_Position = viewProjection * position;
+        return;
+    }
+
     // Transform position to image space using brown conrady
     vec2 pxy = vec2(position.x, position.y) / position.z;
     vec2 p2 = pxy * pxy;
@@ -55,12 +73,4 @@ void main()
     // Output position just using the approximated z    
     vec4 approx = viewProjection * position;
     gl_Position = vec4(uv, approx.z / approx.w, 1.0f);
-
-    // Transform normal using using the approximated projection
-    vec4 transNormal = transformIT * vec4(normal, 0.0f);
-    normalOut = transNormal.xyz;
-    positionOut = position.xyz;
-
-    // Pass through confidence
-    confidenceOut = confidence;
 }
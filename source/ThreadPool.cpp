@@ -0,0 +1,217 @@
+﻿/**
+ * Copyright Matthew Oliver
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+using namespace std;
+
+namespace Ak {
+// The pool and worker index of the calling thread (nullptr if it is not a pool worker)
+static thread_local ThreadPool* s_pool = nullptr;
+static thread_local uint32_t s_index = 0;
+static thread_local TaskPriority s_priority = TaskPriority::Normal;
+
+ThreadPool::ThreadPool(const uint32_t numThreads) noexcept
+{
+    const uint32_t count = numThreads != 0 ? numThreads : std::max(thread::hardware_concurrency(), 1U);
+    m_queues.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        m_queues.emplace_back(make_unique<Queue>());
+    }
+    m_threads.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        m_threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(m_lock);
+        m_shutdown = true;
+    }
+    // Notify wakeup
+    m_condition.notify_all();
+    // Wait for threads to complete
+    for (auto& i : m_threads) {
+        if (i.joinable()) {
+            i.join();
+        }
+    }
+}
+
+ThreadPool& ThreadPool::get() noexcept
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+TaskPriority ThreadPool::getCurrentPriority() noexcept
+{
+    return s_priority;
+}
+
+uint32_t ThreadPool::size() const noexcept
+{
+    // The queues are all created before any worker starts so unlike the threads they are safe to count
+    return static_cast<uint32_t>(m_queues.size());
+}
+
+void ThreadPool::submit(Task task, const TaskPriority priority) noexcept
+{
+    // Tasks created by a worker stay on its own queue, others are spread across the workers
+    const uint32_t index = s_pool == this ? s_index : m_next.fetch_add(1, memory_order_relaxed) % size();
+    {
+        auto& queue = *m_queues[index];
+        lock_guard<mutex> lock(queue.m_lock);
+        queue.m_tasks[static_cast<uint32_t>(priority)].emplace_back(move(task));
+    }
+    {
+        lock_guard<mutex> lock(m_lock);
+        ++m_pending;
+    }
+    // Notify wakeup
+    m_condition.notify_one();
+}
+
+void ThreadPool::parallelFor(const uint32_t count, const function<void(uint32_t)>& function) noexcept
+{
+    if (count == 0) {
+        return;
+    }
+    struct State
+    {
+        atomic_uint32_t m_next = 0;
+        atomic_uint32_t m_done = 0;
+    };
+    const auto state = make_shared<State>();
+    // Each helper keeps taking indexes until none remain, helpers that start too late do nothing
+    const auto work = [state, count, &function] {
+        uint32_t i;
+        while ((i = state->m_next.fetch_add(1)) < count) {
+            function(i);
+            if (state->m_done.fetch_add(1) + 1 == count) {
+                state->m_done.notify_one();
+            }
+        }
+    };
+    const uint32_t helpers = std::min(count, size()) - 1;
+    for (uint32_t i = 0; i < helpers; ++i) {
+        submit(work, s_priority);
+    }
+    work();
+
+    // Wait for any indexes still being run by other threads
+    uint32_t done;
+    while ((done = state->m_done.load()) != count) {
+        state->m_done.wait(done);
+    }
+}
+
+bool ThreadPool::popTask(const uint32_t index, Task& task, TaskPriority& priority) noexcept
+{
+    const uint32_t count = size();
+    for (uint32_t p = 0; p < 3; ++p) {
+        // Take the newest task from the workers own queue first as its data is most likely to still be in cache
+        {
+            auto& tasks = m_queues[index]->m_tasks[p];
+            lock_guard<mutex> lock(m_queues[index]->m_lock);
+            if (!tasks.empty()) {
+                task = move(tasks.back());
+                tasks.pop_back();
+                priority = static_cast<TaskPriority>(p);
+                return true;
+            }
+        }
+        // Steal the oldest task from another worker
+        for (uint32_t i = 1; i < count; ++i) {
+            auto& queue = *m_queues[(index + i) % count];
+            lock_guard<mutex> lock(queue.m_lock);
+            if (!queue.m_tasks[p].empty()) {
+                task = move(queue.m_tasks[p].front());
+                queue.m_tasks[p].pop_front();
+                priority = static_cast<TaskPriority>(p);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run(const uint32_t index) noexcept
+{
+    s_pool = this;
+    s_index = index;
+    while (true) {
+        Task task;
+        TaskPriority priority;
+        if (popTask(index, task, priority)) {
+            --m_pending;
+            s_priority = priority;
+            task();
+            s_priority = TaskPriority::Normal;
+            continue;
+        }
+        // Wait until there are pending tasks (or shutdown)
+        unique_lock<mutex> lock(m_lock);
+        m_condition.wait(lock, [this] { return m_pending > 0 || m_shutdown; });
+        if (m_shutdown) {
+            break;
+        }
+    }
+}
+
+SerialTask::~SerialTask()
+{
+    wait();
+}
+
+void SerialTask::init(function<void()> function, const TaskPriority priority) noexcept
+{
+    m_function = move(function);
+    m_priority = priority;
+}
+
+void SerialTask::notify() noexcept
+{
+    // Only the first notification schedules a run, later ones are picked up by the run that is already scheduled
+    if (m_pending.fetch_add(1) == 0) {
+        ThreadPool::get().submit([this] { run(); }, m_priority);
+    }
+}
+
+void SerialTask::wait() noexcept
+{
+    unique_lock<mutex> lock(m_lock);
+    m_condition.wait(lock, [this] { return m_pending == 0; });
+}
+
+void SerialTask::run() noexcept
+{
+    uint32_t pending = m_pending.load();
+    while (true) {
+        m_function();
+        // Run again if notified while running
+        lock_guard<mutex> lock(m_lock);
+        pending = m_pending -= pending;
+        if (pending == 0) {
+            m_condition.notify_all();
+            break;
+        }
+    }
+}
+} // namespace Ak
@@ -0,0 +1,42 @@
+﻿#version 430 core
+
+layout(location = 0) uniform vec4 overlayRect; // Offset (pixels) and inverse size of the overlay
+layout(location = 1) uniform vec4 timings[2];  // Pass timings (ms) in display order
+
+out vec4 fragOutput;
+
+const uint timingCount = 8;
+const uint gpuTimings = 5;
+const float fullScale = 33.3f;
+const float frameBudget = 16.7f;
+
+void main()
+{
+    // Get UV coordinates within the overlay, rows are listed from the top
+    vec2 cUV = (gl_FragCoord.xy - overlayRect.xy) * overlayRect.zw;
+    float rowPos = (1.0f - cUV.y) * float(timingCount);
+    uint row = min(uint(rowPos), timingCount - 1);
+    float time = timings[row / 4][row % 4];
+    float position = cUV.x * fullScale;
+
+    // Mark the frame budget with a 1 pixel line
+    float budgetPos = (frameBudget / fullScale) / overlayRect.z;
+    if (abs(gl_FragCoord.x - overlayRect.x - budgetPos) < 0.5f) {
+        fragOutput = vec4(1.0f, 1.0f, 1.0f, 0.8f);
+        return;
+    }
+
+    // Leave a gap between bars
+    if (position > time || fract(rowPos) > 0.75f) {
+        fragOutput = vec4(0.0f, 0.0f, 0.0f, 0.5f);
+        return;
+    }
+
+    // GPU passes are green, CPU timings blue and the latency orange. Anything over budget is red
+    vec3 colour = row < gpuTimings ? vec3(0.2f, 0.8f, 0.2f) :
+        (row < timingCount - 1 ? vec3(0.3f, 0.5f, 1.0f) : vec3(1.0f, 0.6f, 0.1f));
+    if (position > frameBudget) {
+        colour = vec3(1.0f, 0.2f, 0.2f);
+    }
+    fragOutput = vec4(colour, 0.9f);
+}